@@ -8,32 +8,27 @@
 #include "Engine/World.h"
 #include <thread>
 
-FCPathAsyncVolumeGenerator::FCPathAsyncVolumeGenerator(ACPathVolume* Volume, uint32 StartIndex, uint32 EndIndex, uint8 ThreadID, FString ThreadName, bool Obstacles)
-	:
-	FCPathAsyncVolumeGenerator(Volume)
-{
-	bObstacles = Obstacles;
-	FirstIndex = StartIndex;
-	LastIndex = EndIndex;
-	GenThreadID = ThreadID;
-	Name = ThreadName;
-}
-
-// Sets default values
-FCPathAsyncVolumeGenerator::FCPathAsyncVolumeGenerator(ACPathVolume* Volume)
+FCPathAsyncVolumeGenerator::FCPathAsyncVolumeGenerator(ACPathVolume* Volume, uint8 ThreadID, FString ThreadName)
 	:
 	WakeUpCondition([this]() { return WakeUpCondition(); })
 {
 	VolumeRef = Volume;
-	
+	GenThreadID = ThreadID;
+	Name = ThreadName;
+	WorkEvent = FPlatformProcess::GetSynchEventFromPool(false);
 }
 
 FCPathAsyncVolumeGenerator::~FCPathAsyncVolumeGenerator()
 {
 	RequestedKill.store(true);
 	if (ThreadRef)
+	{
 		ThreadRef->Kill(true);
+		delete ThreadRef;
+	}
 	ThreadRef = nullptr;
+	FPlatformProcess::ReturnSynchEventToPool(WorkEvent);
+	WorkEvent = nullptr;
 }
 
 bool FCPathAsyncVolumeGenerator::Init()
@@ -43,50 +38,73 @@ bool FCPathAsyncVolumeGenerator::Init()
 
 uint32 FCPathAsyncVolumeGenerator::Run()
 {
+	while (!RequestedKill.load())
+	{
+		WorkEvent->Wait();
+		if (!RequestedKill.load())
+			Generate();
+	}
+	return 0;
+}
+
+void FCPathAsyncVolumeGenerator::Start(uint32 StartIndex, uint32 EndIndex)
+{
+	FirstIndex = StartIndex;
+	LastIndex = EndIndex;
+
+	// Incremented here rather than by the thread, so the volume sees the round as running right away
 	bIncreasedGenRunning = true;
 	VolumeRef->GeneratorsRunning++;
 
-	// Waiting for pathfinders to finish.
-	// Generators have priority over pathfinders, so we block further pathfinders from starting by incrementing GeneratorsRunning first	
+	if (ThreadRef)
+		WorkEvent->Trigger();
+	else
+		Generate();
+}
+
+void FCPathAsyncVolumeGenerator::ResetWork()
+{
+	bObstacles = false;
+	bFromBake = false;
+	bUpdateGraph = true;
+	bApplyDeltas = false;
+	bChunks = false;
+	for (uint32& Count : OctreeCountAtDepth)
+		Count = 0;
+}
+
+void FCPathAsyncVolumeGenerator::Generate()
+{
+	// Waiting for pathfinders to finish, only until the volume has snapshots - see ACPathVolume::Snapshots.
+	// Generators have priority over pathfinders, GeneratorsRunning was incremented by Start so that further pathfinders don't start
 	while (!ShouldWakeUp())
 		std::this_thread::sleep_for(std::chrono::milliseconds(5));
 	
 		
 	if(RequestedKill.load())
-		return 0;
+		return;
 
 #ifdef LOG_GENERATORS
 	auto GenerationStart = TIMENOW;
+	uint32 ChunkCount = 0;
 #endif
-	
-	if (LastIndex > 0)
-	{
-		if (bObstacles)
-		{
-			auto StartIter = VolumeRef->TreesToRegenerate.begin();
-			for (uint32 i = 0; i < FirstIndex; i++)
-				StartIter++;
-
-			auto EndIter = StartIter;
-			for (uint32 i = FirstIndex; i < LastIndex; i++)
-				EndIter++;
 
-			for (auto Iter = StartIter; Iter != EndIter && !RequestedKill.load(); Iter++)
-			{
-				RefreshTree(*Iter);
-			}
-		}
-		else
+	// Chunks are taken until none are left, so a thread that got empty space takes more of them than one in clutter
+	uint32 ChunkStart;
+	while (!RequestedKill.load() && (ChunkStart = FirstIndex + VolumeRef->NextGenerationItem.fetch_add(CHUNK_SIZE)) < LastIndex)
+	{
+		uint32 ChunkEnd = FMath::Min(ChunkStart + CHUNK_SIZE, LastIndex);
+		for (uint32 Item = ChunkStart; Item < ChunkEnd && !RequestedKill.load(); Item++)
 		{
-			for (uint32 OuterIndex = FirstIndex; OuterIndex < LastIndex && !RequestedKill.load(); OuterIndex++)
-			{
-				RefreshTree(OuterIndex);
-			}
+			GenerateItem(Item);
 		}
+#ifdef LOG_GENERATORS
+		ChunkCount++;
+#endif
 	}
 
 #ifdef LOG_GENERATORS
-	auto GenerationTime = TIMEDIFF(GenerationStart, TIMENOW);
+	GenerationTime = TIMEDIFF(GenerationStart, TIMENOW);
 
 	int NodeCount = 0;
 	for (int i = 0; i <= VolumeRef->OctreeDepth; i++)
@@ -94,18 +112,68 @@ uint32 FCPathAsyncVolumeGenerator::Run()
 		NodeCount += OctreeCountAtDepth[i];
 	}
 
-	UE_LOG(LogTemp, Warning, TEXT("%s generated %d nodes in %lfms"), *Name, NodeCount, GenerationTime);
+	UE_LOG(LogTemp, Warning, TEXT("%s generated %d nodes in %lfms, chunks taken: %d"), *Name, NodeCount, GenerationTime, ChunkCount);
 #endif
 
+	// Last generator to finish updates the graph. During the initial generation GeneratorsRunning is still increased, so pathfinders can't use it yet,
+	// afterwards they keep searching the published snapshot while the other one is updated.
+	if (--VolumeRef->GeneratorsPendingGraphUpdate == 0 && !RequestedKill.load() && bUpdateGraph)
+	{
+#ifdef LOG_GENERATORS
+		auto GraphUpdateStart = TIMENOW;
+#endif
+		if (bObstacles || bChunks)
+		{
+			// Bricks can be shared between generators, so they are collapsed only once all of them are done
+			for (uint32 OuterIndex : VolumeRef->TreesToRegenerate)
+			{
+				uint32 LocalIndex;
+				VolumeRef->Octrees.TryCollapseBrick(VolumeRef->Octrees.GetBrickIndex(OuterIndex, LocalIndex));
+			}
+
+			const std::set<uint32>& Trees = VolumeRef->TreesToRegenerate;
+			VolumeRef->Snapshots.Update([this, &Trees](FCPathSnapshot& Snapshot)
+			{
+				Snapshot.Graph.UpdateOuterTrees(VolumeRef, Trees);
+
+				// Only cached distances of the regenerated cells and their neighbours are recomputed
+				if (VolumeRef->UseHierarchicalSearch)
+					Snapshot.Hierarchy.UpdateOuterTrees(VolumeRef, Trees);
+
+				// Searches of the old snapshot can still add paths until it's updated too, so this runs for both
+				VolumeRef->PathCache.EvictOuterTrees(Trees);
+
+				Snapshot.ChangeLog.emplace_back(Snapshot.Version, std::vector<uint32>(Trees.begin(), Trees.end()));
+				if (Snapshot.ChangeLog.size() > ACPathVolume::GRAPH_CHANGE_LOG_SIZE)
+					Snapshot.ChangeLog.pop_front();
+			});
+		}
+		else
+		{
+			VolumeRef->Snapshots.Update([this](FCPathSnapshot& Snapshot)
+			{
+				Snapshot.Graph.Build(VolumeRef);
+				if (VolumeRef->UseHierarchicalSearch)
+					Snapshot.Hierarchy.Build(VolumeRef);
+				Snapshot.ChangeLog.clear();
+			});
+			VolumeRef->PathCache.Empty();
+			VolumeRef->EnableSnapshots();
+		}
+#ifdef LOG_GENERATORS
+		UE_LOG(LogTemp, Warning, TEXT("%s updated graph in %lfms, leaf count: %d"), *Name, TIMEDIFF(GraphUpdateStart, TIMENOW), VolumeRef->GetGraph().GetLeafCount());
+#endif
+	}
+
 	if (bIncreasedGenRunning)
 		VolumeRef->GeneratorsRunning--;
 	bIncreasedGenRunning = false;
-	return 0;
 }
 
 void FCPathAsyncVolumeGenerator::Stop()
 {
 	RequestedKill.store(true);
+	WorkEvent->Trigger();
 
 	// Preventing a potential deadlock if the process is somehow killed without waiting
 	if (bIncreasedGenRunning)
@@ -120,19 +188,164 @@ void FCPathAsyncVolumeGenerator::Exit()
 	ThreadExited.store(true);
 }
 
+void FCPathAsyncVolumeGenerator::GenerateItem(uint32 Item)
+{
+	if (bObstacles)
+	{
+		uint32 OuterIndex = VolumeRef->TreesToRegenerateList[Item];
+		auto Regions = VolumeRef->RegionsToRegenerate.find(OuterIndex);
+		RefreshTree(OuterIndex, Regions != VolumeRef->RegionsToRegenerate.end() ? &Regions->second : nullptr);
+	}
+	else if (bChunks)
+	{
+		RefreshChunkBrick(VolumeRef->ChunkBricksToRefresh[Item]);
+	}
+	else
+	{
+		uint32 BrickIndex = VolumeRef->BrickOrder[Item];
+
+		// Chunks that aren't streamed in stay uniformly occupied
+		if (!VolumeRef->Chunks.IsBrickResident(VolumeRef->Octrees.GetBrickOrigin(BrickIndex)))
+			return;
+
+		if (bFromBake)
+		{
+			VolumeRef->Octrees.GetOuterIndexesInBrick(BrickIndex, BrickOuterIndexes);
+			for (uint32 OuterIndex : BrickOuterIndexes)
+			{
+				VolumeRef->Occupancy.UpdateOuterTree(VolumeRef, OuterIndex);
+			}
+		}
+		else
+		{
+			RefreshBrick(BrickIndex);
+		}
+	}
+}
+
 bool FCPathAsyncVolumeGenerator::HasFinishedWorking()
 {
 	return ThreadExited.load();
 }
 
-void FCPathAsyncVolumeGenerator::RefreshTree(uint32 OuterIndex)
+void FCPathAsyncVolumeGenerator::RefreshTree(uint32 OuterIndex, const std::vector<FBox>* Regions)
+{
+	if (bApplyDeltas)
+	{
+		if (VolumeRef->DeltaLog.Apply(VolumeRef, OuterIndex))
+			VolumeRef->Occupancy.UpdateOuterTree(VolumeRef, OuterIndex);
+		return;
+	}
+
+	// Unloaded chunks are not regenerated by obstacles
+	if (!VolumeRef->Chunks.IsResident(OuterIndex))
+	{
+		return;
+	}
+
+	const CPathOctree* OctreeRef = VolumeRef->Octrees.Get(OuterIndex);
+
+	// Searches keep walking the old tree while the new one is built, its brick and subtree are released once they can't reach them anymore.
+	// This also leaves subtrees loaded from a bake untouched, they are read only.
+	CPathOctree NewTree;
+	NewTree.Data = OctreeRef->Data;
+	if (Regions)
+	{
+		// Copying is much cheaper than the overlap tests it saves, and keeps the old tree intact for searches
+		NewTree.Children = OctreeRef->Children ? VolumeRef->OctreePool.CloneToWritable(OctreeRef->Children) : 0;
+		RefreshTreeInRegionsRec(&NewTree, 0, VolumeRef->WorldLocationFromTreeID(OuterIndex), *Regions);
+	}
+	else
+	{
+		RefreshTreeRec(&NewTree, 0, VolumeRef->WorldLocationFromTreeID(OuterIndex));
+	}
+
+	uint32 OldChildren = VolumeRef->Octrees.ReplaceTree(OuterIndex, NewTree);
+	if (OldChildren)
+		VolumeRef->OctreePool.Free(OldChildren);
+	VolumeRef->Occupancy.UpdateOuterTree(VolumeRef, OuterIndex);
+
+	if (bObstacles && VolumeRef->RecordObstacleDeltas)
+		VolumeRef->DeltaLog.Record(VolumeRef, OuterIndex);
+}
+
+void FCPathAsyncVolumeGenerator::RefreshBrick(uint32 BrickIndex)
 {
-	CPathOctree* OctreeRef = &VolumeRef->Octrees[OuterIndex];
-	if (!OctreeRef)
+	VolumeRef->Octrees.GetOuterIndexesInBrick(BrickIndex, BrickOuterIndexes);
+
+	// One test for the whole brick, most bricks in open space end here
+	FVector BrickExtent(VolumeRef->GetVoxelSizeByDepth(0) * CPathOuterGrid::BRICK_SIZE / 2.f);
+	if (VolumeRef->RecheckBrickIsFree(VolumeRef->GetBrickWorldLocation(BrickIndex), BrickExtent))
 	{
+		VolumeRef->Octrees.SetBrickUniform(BrickIndex, true);
+		for (uint32 OuterIndex : BrickOuterIndexes)
+		{
+			VolumeRef->Occupancy.UpdateOuterTree(VolumeRef, OuterIndex);
+		}
+		OctreeCountAtDepth[0] += BrickOuterIndexes.size();
 		return;
 	}
-	RefreshTreeRec(OctreeRef, 0, VolumeRef->WorldLocationFromTreeID(OuterIndex));
+
+	// Trees are built aside and the brick is published once, instead of copying it for every tree
+	CPathOctree Trees[CPathOuterGrid::TREES_PER_BRICK];
+	FMemory::Memcpy(Trees, VolumeRef->Octrees.GetBrick(BrickIndex), sizeof(Trees));
+	TArray<uint32, TInlineAllocator<CPathOuterGrid::TREES_PER_BRICK>> OldChildren;
+	for (uint32 OuterIndex : BrickOuterIndexes)
+	{
+		uint32 LocalIndex;
+		VolumeRef->Octrees.GetBrickIndex(OuterIndex, LocalIndex);
+		if (Trees[LocalIndex].Children)
+			OldChildren.Add(Trees[LocalIndex].Children);
+		Trees[LocalIndex].Children = 0;
+		RefreshTreeRec(&Trees[LocalIndex], 0, VolumeRef->WorldLocationFromTreeID(OuterIndex));
+	}
+	VolumeRef->Octrees.LoadBrick(BrickIndex, Trees);
+
+	for (uint32 Children : OldChildren)
+	{
+		VolumeRef->OctreePool.Free(Children);
+	}
+	for (uint32 OuterIndex : BrickOuterIndexes)
+	{
+		VolumeRef->Occupancy.UpdateOuterTree(VolumeRef, OuterIndex);
+	}
+
+	// During initial generation every brick belongs to one generator, so it can be collapsed right away
+	VolumeRef->Octrees.TryCollapseBrick(BrickIndex);
+}
+
+void FCPathAsyncVolumeGenerator::RefreshChunkBrick(uint32 BrickIndex)
+{
+	bool Resident = VolumeRef->Chunks.IsBrickResident(VolumeRef->Octrees.GetBrickOrigin(BrickIndex));
+	if (!Resident)
+	{
+		// Subtrees are released only after the brick stops pointing to them
+		TArray<uint32, TInlineAllocator<CPathOuterGrid::TREES_PER_BRICK>> OldChildren;
+		VolumeRef->Octrees.GetOuterIndexesInBrick(BrickIndex, BrickOuterIndexes);
+		for (uint32 OuterIndex : BrickOuterIndexes)
+		{
+			if (uint32 Children = VolumeRef->Octrees.Get(OuterIndex)->Children)
+				OldChildren.Add(Children);
+		}
+		VolumeRef->Octrees.SetBrickUniform(BrickIndex, false);
+		for (uint32 Children : OldChildren)
+		{
+			VolumeRef->OctreePool.Free(Children);
+		}
+	}
+	else if (!VolumeRef->LoadBrickFromBake(BrickIndex))
+	{
+		RefreshBrick(BrickIndex);
+	}
+
+	// Obstacle changes recorded before the chunk was unloaded are restored too
+	VolumeRef->Octrees.GetOuterIndexesInBrick(BrickIndex, BrickOuterIndexes);
+	for (uint32 OuterIndex : BrickOuterIndexes)
+	{
+		if (Resident)
+			VolumeRef->DeltaLog.Apply(VolumeRef, OuterIndex);
+		VolumeRef->Occupancy.UpdateOuterTree(VolumeRef, OuterIndex);
+	}
 }
 
 FString FCPathAsyncVolumeGenerator::GetNameFromID(uint8 ID)
@@ -149,8 +362,11 @@ bool FCPathAsyncVolumeGenerator::RefreshTreeRec(CPathOctree* OctreeRef, uint32 D
 
 	if (IsFree)
 	{
-		delete[] OctreeRef->Children;
-		OctreeRef->Children = nullptr;
+		if (OctreeRef->Children)
+		{
+			VolumeRef->OctreePool.Free(OctreeRef->Children);
+			OctreeRef->Children = 0;
+		}
 		return true;
 	}
 	else if (++Depth <= (uint32)VolumeRef->OctreeDepth)
@@ -158,13 +374,16 @@ bool FCPathAsyncVolumeGenerator::RefreshTreeRec(CPathOctree* OctreeRef, uint32 D
 		float HalfSize = VolumeRef->GetVoxelSizeByDepth(Depth) / 2.f;
 
 		if (!OctreeRef->Children)
-			OctreeRef->Children = new CPathOctree[8];
+			OctreeRef->Children = VolumeRef->OctreePool.Allocate();
+
+		// Stays valid while deeper levels allocate, see CPathOctreePool::Get
+		CPathOctree* Children = VolumeRef->OctreePool.Get(OctreeRef->Children);
 		uint8 FreeChildren = 0;
 		// Checking children
 		for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
 		{
 			FVector Location = TreeLocation + VolumeRef->LookupTable_ChildPositionOffsetMaskByIndex[ChildIndex] * HalfSize;
-			FreeChildren += RefreshTreeRec(&OctreeRef->Children[ChildIndex], Depth, Location);
+			FreeChildren += RefreshTreeRec(&Children[ChildIndex], Depth, Location);
 		}
 
 		if (FreeChildren)
@@ -173,8 +392,8 @@ bool FCPathAsyncVolumeGenerator::RefreshTreeRec(CPathOctree* OctreeRef, uint32 D
 		}
 		else
 		{
-			delete[] OctreeRef->Children;
-			OctreeRef->Children = nullptr;
+			VolumeRef->OctreePool.Free(OctreeRef->Children);
+			OctreeRef->Children = 0;
 			return false;
 		}
 
@@ -182,9 +401,56 @@ bool FCPathAsyncVolumeGenerator::RefreshTreeRec(CPathOctree* OctreeRef, uint32 D
 	return false;
 }
 
+bool FCPathAsyncVolumeGenerator::RefreshTreeInRegionsRec(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation, const std::vector<FBox>& Regions)
+{
+	float HalfSize = VolumeRef->GetVoxelSizeByDepth(Depth) / 2.f;
+	FBox TreeBox(TreeLocation - FVector(HalfSize), TreeLocation + FVector(HalfSize));
+	bool bInRegion = false;
+	for (const FBox& Region : Regions)
+	{
+		if (Region.Intersect(TreeBox))
+		{
+			bInRegion = true;
+			break;
+		}
+	}
+
+	// Nothing changed here, a tree only has children if some of them are free
+	if (!bInRegion)
+		return OctreeRef->GetIsFree() || OctreeRef->Children;
+
+	// Subtrees of a former leaf were never checked, so they are generated whole
+	if (!OctreeRef->Children)
+		return RefreshTreeRec(OctreeRef, Depth, TreeLocation);
+
+	OctreeCountAtDepth[Depth]++;
+	if (VolumeRef->RecheckOctreeAtDepth(OctreeRef, TreeLocation, Depth))
+	{
+		VolumeRef->OctreePool.Free(OctreeRef->Children);
+		OctreeRef->Children = 0;
+		return true;
+	}
+
+	float ChildHalfSize = VolumeRef->GetVoxelSizeByDepth(Depth + 1) / 2.f;
+	CPathOctree* Children = VolumeRef->OctreePool.Get(OctreeRef->Children);
+	uint8 FreeChildren = 0;
+	for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+	{
+		FVector Location = TreeLocation + VolumeRef->LookupTable_ChildPositionOffsetMaskByIndex[ChildIndex] * ChildHalfSize;
+		FreeChildren += RefreshTreeInRegionsRec(&Children[ChildIndex], Depth + 1, Location, Regions);
+	}
+
+	if (FreeChildren)
+		return true;
+
+	VolumeRef->OctreePool.Free(OctreeRef->Children);
+	OctreeRef->Children = 0;
+	return false;
+}
+
 bool FCPathAsyncVolumeGenerator::ShouldWakeUp()
 {
-	return VolumeRef->PathfindersRunning.load() == 0 || RequestedKill.load();
+	return VolumeRef->Snapshots.IsEnabled() || VolumeRef->PathfindersRunning.load() == 0 || RequestedKill.load();
 }
 
 
@@ -0,0 +1,131 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathCache.h"
+#include "Misc/ScopeLock.h"
+
+
+bool CPathCache::Find(const FKey& Key, FVector Start, FVector End, FCPathResult& Result, TFunctionRef<bool(FVector, FVector)> IsSegmentFree)
+{
+	{
+		FScopeLock Lock(&Mutex);
+		auto Found = EntryByKey.find(Key);
+		if (Found == EntryByKey.end())
+		{
+			Misses++;
+			return false;
+		}
+
+		// Moving to the front keeps iterators valid
+		Entries.splice(Entries.begin(), Entries, Found->second);
+		const FEntry& Entry = *Found->second;
+
+		Result.UserPath = Entry.UserPath;
+		Result.RawPathLength = Entry.RawPathLength;
+		Result.UserPathLength = Entry.UserPathLength;
+	}
+
+	// Segments to the new endpoints may need physics, so they are checked outside of the lock
+	if (!Result.ReplaceEndpoints(Start, End, IsSegmentFree))
+	{
+		Result.Reset();
+		Misses++;
+		return false;
+	}
+
+	Hits++;
+	return true;
+}
+
+void CPathCache::Add(const FKey& Key, const FCPathResult& Result, std::vector<uint32>&& OuterIndexes, uint32 Capacity)
+{
+	if (Capacity == 0)
+		return;
+
+	FScopeLock Lock(&Mutex);
+	auto Found = EntryByKey.find(Key);
+	if (Found != EntryByKey.end())
+	{
+		Remove(Found->second);
+	}
+
+	Entries.emplace_front();
+	FEntry& Entry = Entries.front();
+	Entry.Key = Key;
+	Entry.UserPath = Result.UserPath;
+	Entry.RawPathLength = Result.RawPathLength;
+	Entry.UserPathLength = Result.UserPathLength;
+	Entry.OuterIndexes = MoveTemp(OuterIndexes);
+	EntryByKey[Key] = Entries.begin();
+	for (uint32 OuterIndex : Entry.OuterIndexes)
+	{
+		KeysByOuterIndex[OuterIndex].insert(Key);
+	}
+
+	while (Entries.size() > Capacity)
+	{
+		Remove(std::prev(Entries.end()));
+		Evictions++;
+	}
+}
+
+void CPathCache::EvictOuterTrees(const std::set<uint32>& OuterIndexes)
+{
+	FScopeLock Lock(&Mutex);
+	for (uint32 OuterIndex : OuterIndexes)
+	{
+		auto Found = KeysByOuterIndex.find(OuterIndex);
+		if (Found == KeysByOuterIndex.end())
+			continue;
+
+		// Remove erases keys from this set too, so they are moved out first
+		std::unordered_set<FKey, FKeyHash> Keys = MoveTemp(Found->second);
+		KeysByOuterIndex.erase(Found);
+		for (const FKey& Key : Keys)
+		{
+			auto FoundEntry = EntryByKey.find(Key);
+			if (FoundEntry != EntryByKey.end())
+			{
+				Remove(FoundEntry->second);
+				Invalidations++;
+			}
+		}
+	}
+}
+
+void CPathCache::Empty()
+{
+	FScopeLock Lock(&Mutex);
+	Entries.clear();
+	EntryByKey.clear();
+	KeysByOuterIndex.clear();
+}
+
+uint32 CPathCache::GetEntryCount() const
+{
+	FScopeLock Lock(&Mutex);
+	return (uint32)Entries.size();
+}
+
+void CPathCache::ResetStats()
+{
+	Hits.store(0);
+	Misses.store(0);
+	Evictions.store(0);
+	Invalidations.store(0);
+}
+
+void CPathCache::Remove(std::list<FEntry>::iterator Entry)
+{
+	for (uint32 OuterIndex : Entry->OuterIndexes)
+	{
+		auto Found = KeysByOuterIndex.find(OuterIndex);
+		if (Found != KeysByOuterIndex.end())
+		{
+			Found->second.erase(Entry->Key);
+			if (Found->second.empty())
+				KeysByOuterIndex.erase(Found);
+		}
+	}
+	EntryByKey.erase(Entry->Key);
+	Entries.erase(Entry);
+}
@@ -0,0 +1,108 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathChunks.h"
+
+
+void CPathChunkMap::Init(const uint32 InNodeCount[3], uint32 ChunkSizeInBricks, bool Enabled)
+{
+	Empty();
+
+	for (int i = 0; i < 3; i++)
+	{
+		NodeCount[i] = InNodeCount[i];
+	}
+	NodeCountYZ = NodeCount[1] * NodeCount[2];
+
+	if (!Enabled)
+		return;
+
+	ChunkBits = CPathOuterGrid::BRICK_BITS + FMath::CeilLogTwo(FMath::Max(ChunkSizeInBricks, 1u));
+	for (int i = 0; i < 3; i++)
+	{
+		ChunkCounts[i] = (NodeCount[i] + (1 << ChunkBits) - 1) >> ChunkBits;
+	}
+	ChunkCount = ChunkCounts[0] * ChunkCounts[1] * ChunkCounts[2];
+
+	// Atomics can't be copied, so the vector is created with its final size
+	Resident = std::vector<std::atomic<uint8>>(ChunkCount);
+	for (auto& Flag : Resident)
+	{
+		Flag.store(0);
+	}
+	RefCounts.assign(ChunkCount, 0);
+}
+
+void CPathChunkMap::Empty()
+{
+	Resident = std::vector<std::atomic<uint8>>();
+	RefCounts.clear();
+	ChunkCount = 0;
+	ChunkCounts[0] = ChunkCounts[1] = ChunkCounts[2] = 0;
+}
+
+bool CPathChunkMap::AddRef(uint32 ChunkIndex)
+{
+	if (RefCounts[ChunkIndex]++ > 0)
+		return false;
+
+	Resident[ChunkIndex].store(1);
+	return true;
+}
+
+bool CPathChunkMap::Release(uint32 ChunkIndex)
+{
+	if (RefCounts[ChunkIndex] == 0 || --RefCounts[ChunkIndex] > 0)
+		return false;
+
+	Resident[ChunkIndex].store(0);
+	return true;
+}
+
+void CPathChunkMap::GetChunksInBox(FIntVector Min, FIntVector Max, std::vector<uint32>& OutChunks) const
+{
+	OutChunks.clear();
+	if (!IsEnabled())
+		return;
+
+	for (int i = 0; i < 3; i++)
+	{
+		Min[i] = FMath::Clamp(Min[i], 0, (int32)NodeCount[i] - 1);
+		Max[i] = FMath::Clamp(Max[i], 0, (int32)NodeCount[i] - 1);
+	}
+
+	for (int32 X = Min.X >> ChunkBits; X <= Max.X >> ChunkBits; X++)
+	{
+		for (int32 Y = Min.Y >> ChunkBits; Y <= Max.Y >> ChunkBits; Y++)
+		{
+			for (int32 Z = Min.Z >> ChunkBits; Z <= Max.Z >> ChunkBits; Z++)
+			{
+				OutChunks.push_back((X * ChunkCounts[1] + Y) * ChunkCounts[2] + Z);
+			}
+		}
+	}
+}
+
+void CPathChunkMap::GetBricksInChunk(const CPathOuterGrid& Grid, uint32 ChunkIndex, std::vector<uint32>& OutBricks) const
+{
+	uint32 ChunkCountYZ = ChunkCounts[1] * ChunkCounts[2];
+	uint32 ChunkX = ChunkIndex / ChunkCountYZ;
+	uint32 ChunkY = (ChunkIndex - ChunkX * ChunkCountYZ) / ChunkCounts[2];
+	uint32 ChunkZ = ChunkIndex % ChunkCounts[2];
+
+	uint32 EndX = FMath::Min((ChunkX + 1) << ChunkBits, NodeCount[0]);
+	uint32 EndY = FMath::Min((ChunkY + 1) << ChunkBits, NodeCount[1]);
+	uint32 EndZ = FMath::Min((ChunkZ + 1) << ChunkBits, NodeCount[2]);
+
+	// Going over the first outer tree of every brick
+	for (uint32 X = ChunkX << ChunkBits; X < EndX; X += CPathOuterGrid::BRICK_SIZE)
+	{
+		for (uint32 Y = ChunkY << ChunkBits; Y < EndY; Y += CPathOuterGrid::BRICK_SIZE)
+		{
+			for (uint32 Z = ChunkZ << ChunkBits; Z < EndZ; Z += CPathOuterGrid::BRICK_SIZE)
+			{
+				uint32 LocalIndex;
+				OutBricks.push_back(Grid.GetBrickIndex(X * NodeCountYZ + Y * NodeCount[2] + Z, LocalIndex));
+			}
+		}
+	}
+}
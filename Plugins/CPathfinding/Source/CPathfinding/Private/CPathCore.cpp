@@ -3,7 +3,9 @@
 
 #include "CPathCore.h"
 #include "CPathFindPath.h"
+#include "CPathVolume.h"
 #include "Delegates/Delegate.h"
+#include "Misc/ScopeLock.h"
 
 #include "CPathfindingThread.h"
 
@@ -15,6 +17,7 @@ ACPathCore::ACPathCore()
 
 ACPathCore* ACPathCore::Instance = nullptr;
 bool ACPathCore::WasInstanceCreated = false;
+int ACPathCore::ConfiguredThreadCount = 0;
 
 ACPathCore* ACPathCore::GetInstance(UWorld* World)
 {
@@ -37,12 +40,16 @@ void ACPathCore::EnableNewInstanceCreation()
 	WasInstanceCreated = false;
 }
 
+void ACPathCore::SetThreadCount(int Count)
+{
+	ConfiguredThreadCount = Count;
+}
+
 // Called when the game starts or when spawned
 void ACPathCore::BeginPlay()
 {
 	Super::BeginPlay();
-	ExpectedThreadCount = FPlatformMisc::NumberOfCores() - 1;
-	//ExpectedThreadCount = 1;
+	ExpectedThreadCount = ConfiguredThreadCount > 0 ? ConfiguredThreadCount : FMath::Max(FPlatformMisc::NumberOfCores() - 1, 1);
 	for (int i = 0; i < ExpectedThreadCount; i++)
 	{
 		Threads.push_back(CreateThread(i));
@@ -69,11 +76,21 @@ void ACPathCore::StopAndDeleteThreads()
 	{
 		PrintCoreMessage(FString("Deleting threads"));
 	}
-	while (Threads.size() > 0)
+
+	// Threads can steal from each other, so none is deleted before all of them stopped
+	for (FCPathfindingThread* Thread : Threads)
+	{
+		Thread->Stop();
+	}
+	for (FCPathfindingThread* Thread : Threads)
 	{
-		auto Thread = Threads.back();
 		Thread->EnsureCompletion();
-		delete Thread;
+	}
+
+	FWriteScopeLock Lock(ThreadsLock);
+	while (Threads.size() > 0)
+	{
+		delete Threads.back();
 		Threads.pop_back();
 	}
 
@@ -93,7 +110,11 @@ void ACPathCore::PrintCoreMessage(FString Message)
 void ACPathCore::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
+	ProcessResults();
+}
 
+void ACPathCore::ProcessResults()
+{
 	while (!OutputQueue.IsEmpty())
 	{
 		std::pair<FCPathResult*, PathResultDelegate> Result;
@@ -108,7 +129,7 @@ void ACPathCore::Tick(float DeltaTime)
 		{
 			PrintCoreMessage(FString("Tick - DELEGATE wasn't bound"));
 		}
-		delete Result.first;
+		ReleaseResult(Result.first);
 	}
 }
 
@@ -116,8 +137,77 @@ ACPathCore::~ACPathCore()
 {
 	PrintCoreMessage(FString("Destructor"));
 	StopAndDeleteThreads();
+	for (FCPathResult* Result : ResultPool)
+	{
+		delete Result;
+	}
+	ResultPool.clear();
+}
+
+FCPathResult* ACPathCore::AcquireResult()
+{
+	{
+		FScopeLock Lock(&ResultPoolMutex);
+		if (ResultPool.size())
+		{
+			FCPathResult* Result = ResultPool.back();
+			ResultPool.pop_back();
+			return Result;
+		}
+	}
+	return new FCPathResult();
 }
 
+void ACPathCore::ReleaseResult(FCPathResult* Result)
+{
+	Result->Reset();
+	FScopeLock Lock(&ResultPoolMutex);
+	ResultPool.push_back(Result);
+}
+
+
+bool ACPathCore::TryAssignBidirectional(FCPathRequest& Request)
+{
+	int IdleThreads[2];
+	int IdleCount = 0;
+	for (int i = 0; i < Threads.size() && IdleCount < 2; i++)
+	{
+		if (Threads[i]->IsThreadValid() && Threads[i]->GetTaskCount() == 0)
+			IdleThreads[IdleCount++] = i;
+	}
+	if (IdleCount < 2)
+		return false;
+
+	std::shared_ptr<CPathBidirectionalSearch> Shared;
+	for (const auto& Pooled : BidirectionalPool)
+	{
+		if (Pooled.use_count() == 1)
+		{
+			Shared = Pooled;
+			break;
+		}
+	}
+	if (!Shared)
+	{
+		Shared = std::make_shared<CPathBidirectionalSearch>();
+		BidirectionalPool.push_back(Shared);
+	}
+	Shared->Reset();
+
+	FCPathRequest BackwardRequest = Request;
+	BackwardRequest.OnPathFound.Unbind();
+	BackwardRequest.OnCoarsePathFound.Unbind();
+	BackwardRequest.Bidirectional = Shared;
+	BackwardRequest.bBackwardHalf = true;
+
+	FCPathRequest ForwardRequest = Request;
+	ForwardRequest.Bidirectional = Shared;
+	ForwardRequest.bBackwardHalf = false;
+
+	Threads[IdleThreads[0]]->AssignTask(ForwardRequest);
+	Threads[IdleThreads[1]]->AssignTask(BackwardRequest);
+	return true;
+}
 
 FCPathfindingThread* ACPathCore::CreateThread(int ThreadIndex)
 {
@@ -128,35 +218,112 @@ FCPathfindingThread* ACPathCore::CreateThread(int ThreadIndex)
 
 inline void ACPathCore::AssignAsyncRequest(FCPathRequest& Request)
 {
+	ACPathVolume* Volume = Request.VolumeRef;
+	if (IsValid(Volume) && Volume->BidirectionalSearchMinDistance > 0 && !Request.FlowField && !Request.Batch && !Request.UseJumpPointSearch && !Volume->UseHierarchicalSearch
+		&& FVector::Distance(Request.Start, Request.End) >= Volume->BidirectionalSearchMinDistance && TryAssignBidirectional(Request))
+		return;
+
+	ValidateThreads();
+
+	// Only a first guess, requests the thread doesn't start soon enough are stolen by idle ones
 	int LeastBusyThread = 0;
 	int LeastTaskCount = MAX_int32;
-
 	for (int i = 0; i < Threads.size(); i++)
 	{
-		checkf(Threads[i], TEXT("CPATH - CPathCore AssignAsyncRequest:::Thread was not valid!"));
-
-		if (Threads[i]->IsThreadValid())
+		int TaskCount = Threads[i]->GetTaskCount();
+		if (TaskCount < LeastTaskCount)
 		{
-			int TaskCount = Threads[i]->GetTaskCount();
-			if (TaskCount < LeastTaskCount)
-			{
-				LeastTaskCount = TaskCount;
-				LeastBusyThread = i;
-				if (TaskCount == 0)
-					break;
-			}
+			LeastTaskCount = TaskCount;
+			LeastBusyThread = i;
+			if (TaskCount == 0)
+				break;
 		}
-		else
+	}
+	Threads[LeastBusyThread]->AssignTask(Request);
+}
+
+void ACPathCore::ValidateThreads()
+{
+	for (int i = 0; i < Threads.size(); i++)
+	{
+		checkf(Threads[i], TEXT("CPATH - CPathCore ValidateThreads:::Thread was not valid!"));
+
+		if (!Threads[i]->IsThreadValid())
 		{
+			FWriteScopeLock Lock(ThreadsLock);
 			delete Threads[i];
 			Threads[i] = CreateThread(i);
-			checkf(Threads[i]->IsThreadValid(), TEXT("CPATH - CPathCore AssignAsyncRequest:::Thread died unexpectedly and a new one couldn't be created. (this has never triggered for me)"));
-			LeastBusyThread = i;
-			LeastTaskCount = 0;
-			break;
+			checkf(Threads[i]->IsThreadValid(), TEXT("CPATH - CPathCore ValidateThreads:::Thread died unexpectedly and a new one couldn't be created. (this has never triggered for me)"));
 		}
 	}
-	Threads[LeastBusyThread]->AssignTask(Request);
 }
 
+bool ACPathCore::StealRequest(FCPathfindingThread* Thief, FCPathRequest& OutRequest)
+{
+	FReadScopeLock Lock(ThreadsLock);
+	FCPathfindingThread* Victim = nullptr;
+	int MostPending = 0;
+	for (FCPathfindingThread* Thread : Threads)
+	{
+		int PendingCount = Thread->GetPendingCount();
+		if (Thread != Thief && PendingCount > MostPending)
+		{
+			MostPending = PendingCount;
+			Victim = Thread;
+		}
+	}
+	return Victim && Victim->GiveRequest(OutRequest);
+}
 
+void ACPathCore::WakeIdleThread(FCPathfindingThread* Caller)
+{
+	FReadScopeLock Lock(ThreadsLock);
+	for (FCPathfindingThread* Thread : Threads)
+	{
+		if (Thread != Caller && Thread->WakeUpIfSleeping())
+			return;
+	}
+}
+
+int ACPathCore::GetStolenTaskCount()
+{
+	int Count = 0;
+	for (FCPathfindingThread* Thread : Threads)
+	{
+		Count += Thread->GetStolenCount();
+	}
+	return Count;
+}
+
+void ACPathCore::AssignBatch(std::vector<FCPathRequest>& Requests)
+{
+	// Threads were validated on the game thread when the batch was assigned
+	FReadScopeLock Lock(ThreadsLock);
+	std::vector<int> TaskCounts(Threads.size(), 0);
+	for (int i = 0; i < Threads.size(); i++)
+	{
+		TaskCounts[i] = Threads[i]->GetTaskCount();
+	}
+
+	// Each request goes to the thread with the fewest tasks so far
+	std::vector<int> Assigned(Threads.size(), 0);
+	for (size_t i = 0; i < Requests.size(); i++)
+	{
+		int LeastBusyThread = 0;
+		for (int t = 1; t < Threads.size(); t++)
+		{
+			if (TaskCounts[t] + Assigned[t] < TaskCounts[LeastBusyThread] + Assigned[LeastBusyThread])
+				LeastBusyThread = t;
+		}
+		Assigned[LeastBusyThread]++;
+	}
+
+	int First = 0;
+	for (int t = 0; t < Threads.size(); t++)
+	{
+		if (Assigned[t] == 0)
+			continue;
+		Threads[t]->AssignTasks(Requests.data() + First, Assigned[t]);
+		First += Assigned[t];
+	}
+}
@@ -0,0 +1,208 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathDeltaLog.h"
+#include "CPathVolume.h"
+#include "Misc/ScopeLock.h"
+#include "Serialization/MemoryWriter.h"
+#include "Serialization/MemoryReader.h"
+
+
+void CPathDeltaLog::Record(const ACPathVolume* Volume, uint32 OuterIndex)
+{
+	const CPathOctree* Tree = Volume->Octrees.Get(OuterIndex);
+
+	std::vector<CPathOctree> NewRecord;
+	NewRecord.emplace_back();
+	NewRecord[0].Data = Tree->Data;
+	if (Tree->Children)
+		RecordRec(Volume, Tree, NewRecord, 0);
+
+	FScopeLock Lock(&Mutex);
+	Records[OuterIndex] = std::move(NewRecord);
+}
+
+void CPathDeltaLog::RecordRec(const ACPathVolume* Volume, const CPathOctree* Tree, std::vector<CPathOctree>& Record, uint32 RecordIndex) const
+{
+	uint32 RecordOctet = (uint32)(Record.size() - 1) / 8 + 1;
+	uint32 First = (uint32)Record.size();
+	Record.resize(Record.size() + 8);
+	Record[RecordIndex].Children = RecordOctet;
+
+	// Record can reallocate in the recursive call, so it's indexed every time
+	for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+	{
+		const CPathOctree* Child = Volume->GetChild(Tree, ChildIndex);
+		Record[First + ChildIndex].Data = Child->Data;
+		if (Child->Children)
+			RecordRec(Volume, Child, Record, First + ChildIndex);
+	}
+}
+
+bool CPathDeltaLog::Apply(ACPathVolume* Volume, uint32 OuterIndex) const
+{
+	auto Found = Records.find(OuterIndex);
+	if (Found == Records.end())
+		return false;
+
+	const std::vector<CPathOctree>& Record = Found->second;
+
+	// Searches may be walking the old tree, so the new one is complete before it's published
+	CPathOctree NewTree;
+	NewTree.Children = Record[0].Children ? ApplyRec(Volume, Record, Record[0].Children) : 0;
+	NewTree.Data = Record[0].Data;
+	uint32 OldChildren = Volume->Octrees.ReplaceTree(OuterIndex, NewTree);
+	if (OldChildren)
+		Volume->OctreePool.Free(OldChildren);
+	return true;
+}
+
+uint32 CPathDeltaLog::ApplyRec(ACPathVolume* Volume, const std::vector<CPathOctree>& Record, uint32 RecordOctet) const
+{
+	uint32 OctetIndex = Volume->OctreePool.Allocate();
+
+	// Stays valid while deeper levels allocate, see CPathOctreePool::Get
+	CPathOctree* Children = Volume->OctreePool.Get(OctetIndex);
+	uint32 First = 1 + (RecordOctet - 1) * 8;
+	for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+	{
+		const CPathOctree& Source = Record[First + ChildIndex];
+		Children[ChildIndex].Data = Source.Data;
+		Children[ChildIndex].Children = Source.Children ? ApplyRec(Volume, Record, Source.Children) : 0;
+	}
+	return OctetIndex;
+}
+
+void CPathDeltaLog::GetOuterIndexes(std::set<uint32>& OutIndexes) const
+{
+	FScopeLock Lock(&Mutex);
+	for (const auto& Record : Records)
+	{
+		OutIndexes.insert(Record.first);
+	}
+}
+
+uint32 CPathDeltaLog::Num() const
+{
+	FScopeLock Lock(&Mutex);
+	return (uint32)Records.size();
+}
+
+void CPathDeltaLog::Empty()
+{
+	FScopeLock Lock(&Mutex);
+	Records.clear();
+	StagedRecords.clear();
+	bHasStaged = false;
+}
+
+void CPathDeltaLog::StageEmpty()
+{
+	FScopeLock Lock(&Mutex);
+	StagedRecords.clear();
+	bHasStaged = true;
+}
+
+bool CPathDeltaLog::CommitStaged()
+{
+	FScopeLock Lock(&Mutex);
+	if (!bHasStaged)
+		return false;
+
+	Records = std::move(StagedRecords);
+	StagedRecords.clear();
+	bHasStaged = false;
+	return true;
+}
+
+void CPathDeltaLog::Save(const ACPathVolume* Volume, TArray<uint8>& OutData) const
+{
+	FScopeLock Lock(&Mutex);
+
+	OutData.Reset();
+	FMemoryWriter Writer(OutData);
+
+	uint32 Magic = CPATH_DELTA_LOG_MAGIC;
+	uint32 Version = CPATH_DELTA_LOG_VERSION;
+	uint64 SettingsHash = Volume->ComputeSettingsHash();
+	uint32 RecordCount = (uint32)Records.size();
+	Writer << Magic << Version << SettingsHash << RecordCount;
+
+	for (const auto& Record : Records)
+	{
+		uint32 OuterIndex = Record.first;
+		uint32 NodeCount = (uint32)Record.second.size();
+		Writer << OuterIndex << NodeCount;
+		Writer.Serialize((void*)Record.second.data(), NodeCount * sizeof(CPathOctree));
+	}
+}
+
+bool CPathDeltaLog::Load(const ACPathVolume* Volume, const TArray<uint8>& Data)
+{
+	FMemoryReader Reader(Data);
+
+	uint32 Magic = 0, Version = 0, RecordCount = 0;
+	uint64 SettingsHash = 0;
+	Reader << Magic << Version << SettingsHash << RecordCount;
+	if (Reader.IsError() || Magic != CPATH_DELTA_LOG_MAGIC || Version != CPATH_DELTA_LOG_VERSION || SettingsHash != Volume->ComputeSettingsHash())
+		return false;
+
+	uint32 OuterNodeCount = Volume->NodeCount[0] * Volume->NodeCount[1] * Volume->NodeCount[2];
+	std::unordered_map<uint32, std::vector<CPathOctree>> NewRecords;
+	NewRecords.reserve(RecordCount);
+	for (uint32 i = 0; i < RecordCount; i++)
+	{
+		uint32 OuterIndex = 0, NodeCount = 0;
+		Reader << OuterIndex << NodeCount;
+		if (Reader.IsError() || OuterIndex >= OuterNodeCount || NodeCount == 0
+			|| (uint64)NodeCount * sizeof(CPathOctree) > (uint64)(Reader.TotalSize() - Reader.Tell()))
+			return false;
+
+		std::vector<CPathOctree>& Record = NewRecords[OuterIndex];
+		Record.resize(NodeCount);
+		Reader.Serialize(Record.data(), NodeCount * sizeof(CPathOctree));
+		if (Reader.IsError() || !IsRecordValid(Record, Volume->OctreeDepth))
+			return false;
+	}
+
+	FScopeLock Lock(&Mutex);
+	StagedRecords = std::move(NewRecords);
+	bHasStaged = true;
+	return true;
+}
+
+bool CPathDeltaLog::IsRecordValid(const std::vector<CPathOctree>& Record, uint32 MaxDepth)
+{
+	if ((Record.size() - 1) % 8 != 0)
+		return false;
+
+	// Octets are written depth first, so every octet is referenced exactly once and before it appears
+	uint32 OctetCount = (uint32)(Record.size() - 1) / 8;
+	std::vector<uint8> OctetDepth(OctetCount + 1, 0);
+	OctetDepth[0] = 0;
+	for (uint32 NodeIndex = 0; NodeIndex < Record.size(); NodeIndex++)
+	{
+		uint32 Octet = NodeIndex == 0 ? 0 : (NodeIndex - 1) / 8 + 1;
+		if (Octet > 0 && OctetDepth[Octet] == 0)
+			return false;
+
+		uint32 Children = Record[NodeIndex].Children;
+		if (!Children)
+			continue;
+
+		if (Children > OctetCount || 1 + (Children - 1) * 8 <= NodeIndex || OctetDepth[Children] != 0 || OctetDepth[Octet] + 1u > MaxDepth)
+			return false;
+		OctetDepth[Children] = OctetDepth[Octet] + 1;
+	}
+	return true;
+}
+
+uint64 CPathDeltaLog::GetMemoryUsage() const
+{
+	FScopeLock Lock(&Mutex);
+	uint64 Total = Records.bucket_count() * sizeof(void*);
+	for (const auto& Record : Records)
+	{
+		Total += sizeof(Record) + Record.second.capacity() * sizeof(CPathOctree);
+	}
+	return Total;
+}
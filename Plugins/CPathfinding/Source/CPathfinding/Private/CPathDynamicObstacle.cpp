@@ -2,6 +2,8 @@
 
 #include "CPathDynamicObstacle.h"
 #include "CPathVolume.h"
+#include "Components/PrimitiveComponent.h"
+#include "PhysicsEngine/BodySetup.h"
 
 // Sets default values for this component's properties
 UCPathDynamicObstacle::UCPathDynamicObstacle()
@@ -50,59 +52,65 @@ void UCPathDynamicObstacle::Deactivate()
 		if (IsValid(CastedVolume))
 		{
 			CastedVolume->TrackedDynamicObstacles.erase(this);
+			ReleaseFootprint(CastedVolume);
 		}
 	}
 	OverlappigVolumes.Empty();
+	FootprintByVolume.clear();
 }
 
-void UCPathDynamicObstacle::AddIndexesToUpdate(ACPathVolume* Volume)
+void UCPathDynamicObstacle::AddRegionsToUpdate(ACPathVolume* Volume)
 {
-	FVector Origin, Extent;
-	GetOwner()->GetActorBounds(true, Origin, Extent);
-
-	FVector XYZ = Volume->WorldLocationToLocalCoordsInt3(Origin);
-	if (!Volume->IsInBounds(XYZ))
-	{
-		return;
-	}
-	uint32 Index = Volume->LocalCoordsInt3ToIndex(XYZ);
-	FVector DistanceFromCenter = Origin - Volume->WorldLocationFromTreeID(Index);
-
-	float VoxelSize = Volume->GetVoxelSizeByDepth(0);
-	float VoxelExtent = VoxelSize / 2.f;
-
-	// How many outer trees should we include in given direction
-	int MaxOffsetInDirection[6];
-	MaxOffsetInDirection[Left] = FMath::CeilToInt((Extent.Y - (VoxelExtent + DistanceFromCenter.Y)) / VoxelSize);
-	MaxOffsetInDirection[Front] = FMath::CeilToInt((Extent.X - (VoxelExtent + DistanceFromCenter.X)) / VoxelSize);
-	MaxOffsetInDirection[Right] = FMath::CeilToInt((Extent.Y - (VoxelExtent - DistanceFromCenter.Y)) / VoxelSize);
-	MaxOffsetInDirection[Behind] = FMath::CeilToInt((Extent.X - (VoxelExtent - DistanceFromCenter.X)) / VoxelSize);
-	MaxOffsetInDirection[Below] = FMath::CeilToInt((Extent.Z - (VoxelExtent + DistanceFromCenter.Z)) / VoxelSize);
-	MaxOffsetInDirection[Above] = FMath::CeilToInt((Extent.Z - (VoxelExtent - DistanceFromCenter.Z)) / VoxelSize);
-
-	FVector Offset = FVector::ZeroVector;
-	for (int X = -MaxOffsetInDirection[Front]; X <= MaxOffsetInDirection[Behind]; X++)
+	FTransform Transform = GetOwner()->GetActorTransform();
+	auto Found = FootprintByVolume.find(Volume);
+	if (Found != FootprintByVolume.end())
 	{
-		Offset.X = X;
-		for (int Y = -MaxOffsetInDirection[Left]; Y <= MaxOffsetInDirection[Right]; Y++)
+		const FTransform& Last = Found->second.Transform;
+		if (FVector::Distance(Transform.GetLocation(), Last.GetLocation()) <= LocationTolerance
+			&& FMath::RadiansToDegrees(Transform.GetRotation().AngularDistance(Last.GetRotation())) <= RotationTolerance
+			&& Transform.GetScale3D().Equals(Last.GetScale3D()))
 		{
-			Offset.Y = Y;
-			for (int Z = -MaxOffsetInDirection[Below]; Z <= MaxOffsetInDirection[Above]; Z++)
-			{
-				Offset.Z = Z;
-
-				FVector CurrXYZ = XYZ + Offset;
-				if (Volume->IsInBounds(CurrXYZ))
-				{
-					Index = Volume->LocalCoordsInt3ToIndex(CurrXYZ);
-					Volume->TreesToRegenerate.insert(Index);
-					Volume->TreesToRegeneratePreviousUpdate.insert(Index);
-				}
-			}
+			return;
 		}
+
+		// Space the actor left
+		Volume->ObstacleRegions.insert(Volume->ObstacleRegions.end(), Found->second.Boxes.begin(), Found->second.Boxes.end());
+	}
+
+	FFootprint& Footprint = FootprintByVolume[Volume];
+	Footprint.Transform = Transform;
+	Footprint.Boxes.clear();
+	GetCollisionBoxes(Volume, Footprint.Boxes);
+	Volume->ObstacleRegions.insert(Volume->ObstacleRegions.end(), Footprint.Boxes.begin(), Footprint.Boxes.end());
+}
+
+void UCPathDynamicObstacle::GetCollisionBoxes(const ACPathVolume* Volume, std::vector<FBox>& OutBoxes) const
+{
+	TInlineComponentArray<UPrimitiveComponent*> Primitives(GetOwner());
+	for (UPrimitiveComponent* Primitive : Primitives)
+	{
+		if (!Primitive->IsCollisionEnabled() || Primitive->GetCollisionResponseToChannel(Volume->TraceChannel) == ECR_Ignore)
+			continue;
+
+		// Simple collision is usually much tighter than render bounds, e.g. for skeletal meshes
+		UBodySetup* BodySetup = Primitive->GetBodySetup();
+		if (BodySetup && BodySetup->AggGeom.GetElementCount() > 0)
+			OutBoxes.push_back(BodySetup->AggGeom.CalcAABB(Primitive->GetComponentTransform()));
+		else
+			OutBoxes.push_back(Primitive->Bounds.GetBox());
 	}
 }
 
+void UCPathDynamicObstacle::ReleaseFootprint(ACPathVolume* Volume)
+{
+	auto Found = FootprintByVolume.find(Volume);
+	if (Found == FootprintByVolume.end())
+		return;
+
+	Volume->ObstacleRegions.insert(Volume->ObstacleRegions.end(), Found->second.Boxes.begin(), Found->second.Boxes.end());
+	FootprintByVolume.erase(Found);
+}
+
 void UCPathDynamicObstacle::EndPlay(EEndPlayReason::Type Reason)
 {
 	Deactivate();
@@ -113,7 +121,7 @@ void UCPathDynamicObstacle::BeginPlay()
 {
 	Super::BeginPlay();
 	GetOwner()->OnActorBeginOverlap.AddDynamic(this, &UCPathDynamicObstacle::OnBeginOverlap);
-	GetOwner()->OnActorEndOverlap.AddDynamic(this, &UCPathDynamicObstacle::OnBeginOverlap);
+	GetOwner()->OnActorEndOverlap.AddDynamic(this, &UCPathDynamicObstacle::OnEndOverlap);
 	if (ActivateOnBeginPlay)
 	{
 		Activate();
@@ -144,6 +152,7 @@ void UCPathDynamicObstacle::OnEndOverlap(AActor* Owner, AActor* OtherActor)
 		{
 			Volume->TrackedDynamicObstacles.erase(this);
 			OverlappigVolumes.Remove(Volume);
+			ReleaseFootprint(Volume);
 		}
 	}
 }
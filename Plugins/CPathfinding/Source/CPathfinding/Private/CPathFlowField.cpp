@@ -0,0 +1,340 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathFlowField.h"
+#include "CPathVolume.h"
+#include <algorithm>
+#include <chrono>
+
+
+bool CPathFlowField::Update(ACPathVolume* Volume, FVector Target, PathResultDelegate OnReady)
+{
+	if (!IsValid(Volume))
+		return false;
+
+	// Built right after the current one, older queued targets are dropped
+	if (bBuilding)
+	{
+		bHasQueuedTarget = true;
+		QueuedTarget = Target;
+		QueuedOnReady = OnReady;
+		return true;
+	}
+
+	FCPathRequest Request;
+	Request.VolumeRef = Volume;
+	Request.Start = Target;
+	Request.End = Target;
+	Request.SmoothingPasses = 0;
+	Request.UserData = UserData;
+	Request.TimeLimit = TimeLimit;
+	Request.RequestRawPath = false;
+	Request.RequestUserPath = false;
+	Request.FlowField = shared_from_this();
+
+	std::shared_ptr<CPathFlowField> Self = shared_from_this();
+	Request.OnPathFound.BindLambda([Self, OnReady](FCPathResult& Result)
+	{
+		Self->Publish(Result, OnReady);
+	});
+
+	bBuilding = Volume->FindPathAsync(Request).IsValid();
+	return bBuilding;
+}
+
+bool CPathFlowField::GetNextWaypoint(FVector Location, FVector& OutWaypoint, float& OutDistance) const
+{
+	ACPathVolume* Volume = Fields[Current].VolumeRef;
+	if (!IsValid(Volume))
+		return false;
+
+	// Version is checked and leafs are read on the same snapshot
+	FCPathSnapshotScope Snapshot(Volume->Snapshots);
+	if (!IsReady())
+		return false;
+
+	CPathTreeID TreeID;
+	if (!Volume->FindLeafByWorldLocation(Location, TreeID))
+		return false;
+
+	const CPathGraph& Graph = Volume->GetGraph();
+	uint32 NextLeaf;
+	if (!GetNextLeaf(Graph.FindLeafIndexOrClosest(TreeID, Location), NextLeaf, OutDistance))
+		return false;
+
+	OutWaypoint = NextLeaf == INVALID_INDEX ? Fields[Current].Target : Graph.LeafLocations[NextLeaf];
+	return true;
+}
+
+bool CPathFlowField::GetNextLeaf(uint32 LeafIndex, uint32& OutNextLeaf, float& OutDistance) const
+{
+	const FField& Field = Fields[Current];
+	auto Found = Field.Leafs.find(LeafIndex);
+	if (Found == Field.Leafs.end())
+		return false;
+
+	OutNextLeaf = Found->second.Next;
+	OutDistance = Found->second.Distance;
+	return true;
+}
+
+bool CPathFlowField::IsReady() const
+{
+	const FField& Field = Fields[Current];
+	return Field.bValid && IsValid(Field.VolumeRef) && Field.VolumeRef->CanSearch()
+		&& Field.VolumeRef->GetGraphVersion() == Field.GraphVersion;
+}
+
+bool CPathFlowField::BeginBuild(ACPathVolume* Volume, FVector Target, FCPathResult* Result)
+{
+	BuildVolume = Volume;
+	BuildTarget = Target;
+	BuildResult = Result;
+	BuildElapsedMS = 0;
+	BuildPopped = 0;
+	return StartBuild();
+}
+
+bool CPathFlowField::StartBuild()
+{
+	ACPathVolume* Volume = BuildVolume;
+	FCPathResult* Result = BuildResult;
+	FVector Target = BuildTarget;
+	const FField& Old = Fields[Current];
+	FField& New = Fields[1 - Current];
+	New.Leafs.clear();
+	New.bValid = false;
+	Heap.clear();
+	bBuildActive = false;
+
+	if (!IsValid(Volume))
+	{
+		Result->FailReason = VolumeNotValid;
+		return false;
+	}
+
+	CPathTreeID TargetTreeID;
+	if (!Volume->FindClosestFreeLeaf(Target, TargetTreeID) || !Volume->Chunks.IsResident(Volume->ExtractOuterIndex(TargetTreeID)))
+	{
+		Result->FailReason = WrongEndLocation;
+		return false;
+	}
+
+	const CPathGraph& Graph = Volume->GetGraph();
+	New.VolumeRef = Volume;
+	New.Target = Target;
+	New.TargetLeaf = Graph.FindLeafIndexOrClosest(TargetTreeID, Target);
+	New.GraphVersion = Volume->GetGraphVersion();
+	if (New.TargetLeaf == INVALID_INDEX)
+	{
+		Result->FailReason = WrongEndLocation;
+		return false;
+	}
+
+	// Leaf indexes of the old field are only valid for the same graph
+	if (Old.bValid && Old.VolumeRef == Volume && Old.GraphVersion == New.GraphVersion && Old.Leafs.count(New.TargetLeaf))
+	{
+		KeepSubtree(Old, New);
+	}
+	else
+	{
+		New.Leafs[New.TargetLeaf] = FFlowLeaf();
+		Heap.emplace_back(0.f, New.TargetLeaf);
+	}
+	std::make_heap(Heap.begin(), Heap.end(), &CPathFlowField::IsHeapEntryAfter);
+
+	bBuildActive = true;
+	return true;
+}
+
+bool CPathFlowField::ContinueBuild(float SliceTime)
+{
+	if (!bBuildActive)
+		return true;
+
+	ACPathVolume* Volume = BuildVolume;
+	FCPathResult* Result = BuildResult;
+	FVector Target = BuildTarget;
+	FField& New = Fields[1 - Current];
+	if (!IsValid(Volume))
+	{
+		Result->FailReason = VolumeNotValid;
+		bBuildActive = false;
+		return true;
+	}
+
+	// Leaf indexes in the heap are invalid once the graph was updated, so the build starts over
+	if (Volume->GetGraphVersion() != New.GraphVersion && !StartBuild())
+		return true;
+
+	// Time of previous slices counts towards TimeLimit
+	auto BuildStart = TIMENOW - std::chrono::nanoseconds((int64)(BuildElapsedMS * 1000000.0));
+	double SliceLimitMS = SliceTime > 0 ? BuildElapsedMS + SliceTime * 1000 : MAX_dbl;
+
+	// Reverse Dijkstra, every leaf is reached from the neighbour it flows to
+	const CPathGraph& Graph = Volume->GetGraph();
+	float DistanceLimit = MaxDistance > 0 ? MaxDistance : FLT_MAX;
+	size_t LeafLimit = MaxLeafs > 0 ? MaxLeafs : SIZE_MAX;
+
+	while (!Heap.empty())
+	{
+		std::pop_heap(Heap.begin(), Heap.end(), &CPathFlowField::IsHeapEntryAfter);
+		auto [Distance, Leaf] = Heap.back();
+		Heap.pop_back();
+
+		// Stale entry, the leaf was reached by a shorter way since
+		if (Distance > New.Leafs[Leaf].Distance)
+			continue;
+
+		for (uint32 Neighbour : Graph.GetNeighbours(Leaf))
+		{
+			if (!IsLeafAllowed(Volume, Neighbour))
+				continue;
+
+			float NewDistance = Distance + EdgeCost(Volume, Neighbour, Leaf, Target);
+			if (NewDistance > DistanceLimit)
+				continue;
+
+			auto Found = New.Leafs.find(Neighbour);
+			if (Found == New.Leafs.end())
+			{
+				if (New.Leafs.size() >= LeafLimit)
+					continue;
+				Found = New.Leafs.emplace(Neighbour, FFlowLeaf()).first;
+			}
+			else if (NewDistance >= Found->second.Distance)
+			{
+				continue;
+			}
+
+			Found->second.Next = Leaf;
+			Found->second.Distance = NewDistance;
+			Heap.emplace_back(NewDistance, Neighbour);
+			std::push_heap(Heap.begin(), Heap.end(), &CPathFlowField::IsHeapEntryAfter);
+		}
+
+		if ((++BuildPopped & 255) == 0)
+		{
+			double Elapsed = TIMEDIFF(BuildStart, TIMENOW);
+			if (Elapsed >= TimeLimit * 1000)
+			{
+				Result->FailReason = Timeout;
+				Result->SearchDuration = Elapsed;
+				bBuildActive = false;
+				return true;
+			}
+
+			// Heap and leafs stay as they are until the next slice
+			if (Elapsed >= SliceLimitMS)
+			{
+				BuildElapsedMS = Elapsed;
+				return false;
+			}
+		}
+	}
+
+	New.bValid = true;
+	bBuildActive = false;
+	Result->FailReason = None;
+	Result->SearchDuration = TIMEDIFF(BuildStart, TIMENOW);
+
+#ifdef LOG_PATHFINDERS
+	UE_LOG(LogTemp, Warning, TEXT("FlowField:  time= %lfms  Leafs= %d  Expanded= %d"), Result->SearchDuration, (int)New.Leafs.size(), BuildPopped);
+#endif
+	return true;
+}
+
+void CPathFlowField::KeepSubtree(const FField& Old, FField& New)
+{
+	// A leaf flowing through the new target leaf has the shortest way to it too, it's the part of its old way after that leaf
+	float Offset = Old.Leafs.at(New.TargetLeaf).Distance;
+	New.Leafs[New.TargetLeaf] = FFlowLeaf();
+	Rejected.clear();
+
+	for (const auto& OldLeaf : Old.Leafs)
+	{
+		WalkStack.clear();
+		uint32 Leaf = OldLeaf.first;
+		bool bKeep = false;
+		while (true)
+		{
+			if (New.Leafs.count(Leaf))
+			{
+				bKeep = true;
+				break;
+			}
+			if (Rejected.count(Leaf))
+				break;
+
+			WalkStack.push_back(Leaf);
+			uint32 Next = Old.Leafs.at(Leaf).Next;
+			if (Next == INVALID_INDEX)
+				break;
+			Leaf = Next;
+		}
+
+		for (uint32 Walked : WalkStack)
+		{
+			if (bKeep)
+			{
+				const FFlowLeaf& Kept = Old.Leafs.at(Walked);
+				FFlowLeaf& NewLeaf = New.Leafs[Walked];
+				NewLeaf.Next = Kept.Next;
+				NewLeaf.Distance = Kept.Distance - Offset;
+			}
+			else
+			{
+				Rejected.insert(Walked);
+			}
+		}
+	}
+
+	// Distances of kept leafs are final, only the ones next to dropped or unreached leafs have to be expanded
+	const CPathGraph& Graph = New.VolumeRef->GetGraph();
+	for (const auto& Kept : New.Leafs)
+	{
+		for (uint32 Neighbour : Graph.GetNeighbours(Kept.first))
+		{
+			if (!New.Leafs.count(Neighbour))
+			{
+				Heap.emplace_back(Kept.second.Distance, Kept.first);
+				break;
+			}
+		}
+	}
+}
+
+void CPathFlowField::Publish(FCPathResult& Result, PathResultDelegate OnReady)
+{
+	bBuilding = false;
+	if (Result.FailReason == None)
+		Current = 1 - Current;
+
+	OnReady.ExecuteIfBound(Result);
+
+	if (bHasQueuedTarget && IsValid(Fields[Current].VolumeRef))
+	{
+		bHasQueuedTarget = false;
+		Update(Fields[Current].VolumeRef, QueuedTarget, QueuedOnReady);
+	}
+}
+
+bool CPathFlowField::IsLeafAllowed(const ACPathVolume* Volume, uint32 LeafIndex) const
+{
+	return Volume->Chunks.IsResident(Volume->ExtractOuterIndex(Volume->GetGraph().LeafTreeIDs[LeafIndex]));
+}
+
+float CPathFlowField::EdgeCost(ACPathVolume* Volume, uint32 From, uint32 To, FVector Target) const
+{
+	const CPathGraph& Graph = Volume->GetGraph();
+	CPathAStarNode Previous(Graph.LeafTreeIDs[From], Graph.LeafData[From]);
+	Previous.LeafIndex = From;
+	Previous.WorldLocation = Graph.LeafLocations[From];
+
+	CPathAStarNode Node(Graph.LeafTreeIDs[To], Graph.LeafData[To]);
+	Node.LeafIndex = To;
+	Node.WorldLocation = Graph.LeafLocations[To];
+	Node.PreviousNode = &Previous;
+
+	Volume->CalcFitness(Node, Target, UserData);
+	return Node.DistanceSoFar;
+}
@@ -0,0 +1,198 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathGraph.h"
+#include "CPathVolume.h"
+#include <unordered_set>
+
+void CPathGraph::Build(ACPathVolume* Volume)
+{
+	Empty();
+
+	uint32 OuterNodeCount = Volume->NodeCount[0] * Volume->NodeCount[1] * Volume->NodeCount[2];
+	LeafsByOuterIndex.resize(OuterNodeCount);
+
+	for (uint32 OuterIndex = 0; OuterIndex < OuterNodeCount; OuterIndex++)
+	{
+		AddLeafsRec(Volume, OuterIndex, Volume->CreateTreeID(OuterIndex, 0), Volume->Octrees.Get(OuterIndex), 0);
+	}
+
+	for (uint32 LeafIndex = 0; LeafIndex < GetLeafCapacity(); LeafIndex++)
+	{
+		BuildNeighbourList(Volume, LeafIndex);
+	}
+}
+
+void CPathGraph::UpdateOuterTrees(ACPathVolume* Volume, const std::set<uint32>& OuterIndexes)
+{
+	std::unordered_set<uint32> AffectedOuterIndexes;
+
+	for (uint32 OuterIndex : OuterIndexes)
+	{
+		RemoveOuterTreeLeafs(OuterIndex);
+		AddLeafsRec(Volume, OuterIndex, Volume->CreateTreeID(OuterIndex, 0), Volume->Octrees.Get(OuterIndex), 0);
+
+		// Leafs on the sides of neighbouring outer trees may point to the removed leafs
+		AffectedOuterIndexes.insert(OuterIndex);
+		FVector LocalCoords = Volume->LocalCoordsInt3FromOuterIndex(OuterIndex);
+		for (int Direction = 0; Direction < 6; Direction++)
+		{
+			FVector NeighbourCoords = LocalCoords + ACPathVolume::LookupTable_NeighbourOffsetByDirection[Direction];
+			if (Volume->IsInBounds(NeighbourCoords))
+			{
+				AffectedOuterIndexes.insert(Volume->LocalCoordsInt3ToIndex(NeighbourCoords));
+			}
+		}
+	}
+
+	for (uint32 OuterIndex : AffectedOuterIndexes)
+	{
+		for (uint32 LeafIndex : LeafsByOuterIndex[OuterIndex])
+		{
+			BuildNeighbourList(Volume, LeafIndex);
+		}
+	}
+
+	if (GarbageNeighbours > Neighbours.size() / 2)
+	{
+		Compact();
+	}
+}
+
+uint32 CPathGraph::FindLeafIndexOrClosest(CPathTreeID TreeID, FVector Location) const
+{
+	uint32 LeafIndex = FindLeafIndex(TreeID);
+	uint32 OuterIndex = (uint32)(TreeID & DEPTH_0_MASK);
+	if (LeafIndex != INVALID_INDEX || OuterIndex >= LeafsByOuterIndex.size())
+		return LeafIndex;
+
+	float BestDistance = FLT_MAX;
+	for (uint32 Leaf : LeafsByOuterIndex[OuterIndex])
+	{
+		float Distance = FVector::DistSquared(LeafLocations[Leaf], Location);
+		if (Distance < BestDistance)
+		{
+			BestDistance = Distance;
+			LeafIndex = Leaf;
+		}
+	}
+	return LeafIndex;
+}
+
+void CPathGraph::Empty()
+{
+	LeafTreeIDs.clear();
+	LeafLocations.clear();
+	LeafData.clear();
+	NeighbourOffsets.clear();
+	NeighbourCounts.clear();
+	Neighbours.clear();
+	GarbageNeighbours = 0;
+	LeafsByOuterIndex.clear();
+	FreeLeafIndexes.clear();
+	LeafIndexByTreeID.clear();
+}
+
+uint64 CPathGraph::GetMemoryUsage() const
+{
+	uint64 Memory = LeafTreeIDs.capacity() * sizeof(CPathTreeID) + LeafLocations.capacity() * sizeof(FVector) + LeafData.capacity() * sizeof(uint32);
+	Memory += (NeighbourOffsets.capacity() + NeighbourCounts.capacity() + Neighbours.capacity() + FreeLeafIndexes.capacity()) * sizeof(uint32);
+	for (const auto& Leafs : LeafsByOuterIndex)
+	{
+		Memory += sizeof(Leafs) + Leafs.capacity() * sizeof(uint32);
+	}
+	// Rough estimate of a node in the map
+	Memory += LeafIndexByTreeID.size() * (sizeof(std::pair<CPathTreeID, uint32>) + 2 * sizeof(void*));
+	return Memory;
+}
+
+void CPathGraph::AddLeafsRec(ACPathVolume* Volume, uint32 OuterIndex, CPathTreeID TreeID, CPathOctree* Tree, uint32 Depth)
+{
+	if (Tree->Children)
+	{
+		Depth++;
+		for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+		{
+			CPathTreeID ChildTreeID = TreeID;
+			Volume->ReplaceChildIndexAndDepth(ChildTreeID, Depth, ChildIndex);
+			AddLeafsRec(Volume, OuterIndex, ChildTreeID, Volume->GetChild(Tree, ChildIndex), Depth);
+		}
+		return;
+	}
+
+	if (!Tree->GetIsFree())
+		return;
+
+	uint32 LeafIndex;
+	if (FreeLeafIndexes.size())
+	{
+		LeafIndex = FreeLeafIndexes.back();
+		FreeLeafIndexes.pop_back();
+	}
+	else
+	{
+		LeafIndex = GetLeafCapacity();
+		LeafTreeIDs.push_back(INVALID_TREEID);
+		LeafLocations.emplace_back();
+		LeafData.push_back(0);
+		NeighbourOffsets.push_back(0);
+		NeighbourCounts.push_back(0);
+	}
+
+	LeafTreeIDs[LeafIndex] = TreeID;
+	LeafLocations[LeafIndex] = Volume->WorldLocationFromTreeID(TreeID);
+	LeafData[LeafIndex] = Tree->Data;
+	LeafIndexByTreeID[TreeID] = LeafIndex;
+	LeafsByOuterIndex[OuterIndex].push_back(LeafIndex);
+}
+
+void CPathGraph::RemoveOuterTreeLeafs(uint32 OuterIndex)
+{
+	for (uint32 LeafIndex : LeafsByOuterIndex[OuterIndex])
+	{
+		LeafIndexByTreeID.erase(LeafTreeIDs[LeafIndex]);
+		LeafTreeIDs[LeafIndex] = INVALID_TREEID;
+		GarbageNeighbours += NeighbourCounts[LeafIndex];
+		NeighbourCounts[LeafIndex] = 0;
+		FreeLeafIndexes.push_back(LeafIndex);
+	}
+	LeafsByOuterIndex[OuterIndex].clear();
+}
+
+void CPathGraph::BuildNeighbourList(ACPathVolume* Volume, uint32 LeafIndex)
+{
+	if (LeafTreeIDs[LeafIndex] == INVALID_TREEID)
+		return;
+
+	GarbageNeighbours += NeighbourCounts[LeafIndex];
+	NeighbourOffsets[LeafIndex] = (uint32)Neighbours.size();
+	NeighbourCounts[LeafIndex] = 0;
+
+	for (CPathTreeID NeighbourID : Volume->FindNeighbourLeafs(LeafTreeIDs[LeafIndex], true))
+	{
+		uint32 NeighbourIndex = FindLeafIndex(NeighbourID);
+		if (NeighbourIndex != INVALID_INDEX)
+		{
+			Neighbours.push_back(NeighbourIndex);
+			NeighbourCounts[LeafIndex]++;
+		}
+	}
+}
+
+void CPathGraph::Compact()
+{
+	std::vector<uint32> CompactNeighbours;
+	CompactNeighbours.reserve(Neighbours.size() - GarbageNeighbours);
+
+	for (uint32 LeafIndex = 0; LeafIndex < GetLeafCapacity(); LeafIndex++)
+	{
+		uint32 NewOffset = (uint32)CompactNeighbours.size();
+		for (uint32 NeighbourIndex : GetNeighbours(LeafIndex))
+		{
+			CompactNeighbours.push_back(NeighbourIndex);
+		}
+		NeighbourOffsets[LeafIndex] = NewOffset;
+	}
+
+	Neighbours.swap(CompactNeighbours);
+	GarbageNeighbours = 0;
+}
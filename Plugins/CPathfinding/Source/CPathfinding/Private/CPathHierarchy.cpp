@@ -0,0 +1,384 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathHierarchy.h"
+#include "CPathVolume.h"
+#include <algorithm>
+#include <unordered_set>
+
+
+void CPathHierarchy::Build(const ACPathVolume* Volume)
+{
+	Empty();
+
+	const CPathGraph& Graph = Volume->GetGraph();
+	uint32 OuterNodeCount = Volume->NodeCount[0] * Volume->NodeCount[1] * Volume->NodeCount[2];
+	ComponentByLeaf.assign(Graph.GetLeafCapacity(), INVALID_INDEX);
+
+	for (uint32 Cell = 0; Cell < OuterNodeCount; Cell++)
+	{
+		BuildComponents(Volume, Cell);
+	}
+
+	// Every pair of cells once, from the one with the lower index
+	std::vector<uint32> NeighbourCells;
+	for (uint32 Cell = 0; Cell < OuterNodeCount; Cell++)
+	{
+		if (Graph.GetOuterTreeLeafs(Cell).empty())
+			continue;
+
+		GetNeighbourCells(Volume, Cell, NeighbourCells);
+		for (uint32 NeighbourCell : NeighbourCells)
+		{
+			if (NeighbourCell > Cell)
+				BuildPortalsBetween(Volume, Cell, NeighbourCell);
+		}
+	}
+
+	for (const auto& CellPortals : PortalsByCell)
+	{
+		BuildCellEdges(Volume, CellPortals.first);
+	}
+
+	bBuilt = true;
+}
+
+void CPathHierarchy::UpdateOuterTrees(const ACPathVolume* Volume, const std::set<uint32>& OuterIndexes)
+{
+	if (!bBuilt)
+		return;
+
+	// Graph may have grown, leaf indexes of unchanged cells stay the same
+	if (ComponentByLeaf.size() < Volume->GetGraph().GetLeafCapacity())
+		ComponentByLeaf.resize(Volume->GetGraph().GetLeafCapacity(), INVALID_INDEX);
+
+	for (uint32 OuterIndex : OuterIndexes)
+	{
+		RemoveCellPortals(OuterIndex);
+		BuildComponents(Volume, OuterIndex);
+	}
+
+	// Portals of neighbours to the changed cells were removed too, so their edges are rebuilt as well
+	std::unordered_set<uint32> AffectedCells;
+	std::vector<uint32> NeighbourCells;
+	for (uint32 OuterIndex : OuterIndexes)
+	{
+		AffectedCells.insert(OuterIndex);
+		GetNeighbourCells(Volume, OuterIndex, NeighbourCells);
+		for (uint32 NeighbourCell : NeighbourCells)
+		{
+			AffectedCells.insert(NeighbourCell);
+
+			// Two changed cells next to each other get their portals only once
+			if (!OuterIndexes.count((int32)NeighbourCell) || NeighbourCell > (uint32)OuterIndex)
+				BuildPortalsBetween(Volume, FMath::Min((uint32)OuterIndex, NeighbourCell), FMath::Max((uint32)OuterIndex, NeighbourCell));
+		}
+	}
+
+	for (uint32 Cell : AffectedCells)
+	{
+		BuildCellEdges(Volume, Cell);
+	}
+}
+
+void CPathHierarchy::Empty()
+{
+	bBuilt = false;
+	Portals.clear();
+	FreePortals.clear();
+	Edges.clear();
+	PortalsByCell.clear();
+	ComponentByLeaf.clear();
+}
+
+void CPathHierarchy::FindPortalDistances(const ACPathVolume* Volume, uint32 LeafIndex, std::vector<FEdge>& OutEdges, FCellSearch& Search) const
+{
+	uint32 Cell = Volume->ExtractOuterIndex(Volume->GetGraph().LeafTreeIDs[LeafIndex]);
+	auto CellPortals = PortalsByCell.find(Cell);
+	if (CellPortals == PortalsByCell.end())
+		return;
+
+	CellDijkstra(Volume, Cell, LeafIndex, Search);
+
+	for (uint32 PortalIndex : CellPortals->second)
+	{
+		float Distance = Search.GetDistance(GetPortalLeafInCell(Portals[PortalIndex], Cell));
+		if (Distance < FLT_MAX)
+		{
+			OutEdges.push_back({ PortalIndex, Distance, Cell });
+		}
+	}
+}
+
+uint64 CPathHierarchy::GetMemoryUsage() const
+{
+	uint64 Memory = Portals.capacity() * sizeof(FPortal) + (FreePortals.capacity() + ComponentByLeaf.capacity()) * sizeof(uint32);
+	for (const auto& PortalEdges : Edges)
+	{
+		Memory += sizeof(PortalEdges) + PortalEdges.capacity() * sizeof(FEdge);
+	}
+	for (const auto& CellPortals : PortalsByCell)
+	{
+		Memory += sizeof(CellPortals) + 2 * sizeof(void*) + CellPortals.second.capacity() * sizeof(uint32);
+	}
+	return Memory;
+}
+
+void CPathHierarchy::BuildComponents(const ACPathVolume* Volume, uint32 Cell)
+{
+	const CPathGraph& Graph = Volume->GetGraph();
+	const std::vector<uint32>& Leafs = Graph.GetOuterTreeLeafs(Cell);
+	for (uint32 LeafIndex : Leafs)
+	{
+		ComponentByLeaf[LeafIndex] = INVALID_INDEX;
+	}
+
+	// Flood fill that doesn't leave the cell
+	uint32 Component = 0;
+	std::vector<uint32> Stack;
+	for (uint32 FirstLeaf : Leafs)
+	{
+		if (ComponentByLeaf[FirstLeaf] != INVALID_INDEX)
+			continue;
+
+		ComponentByLeaf[FirstLeaf] = Component;
+		Stack.push_back(FirstLeaf);
+		while (Stack.size())
+		{
+			uint32 LeafIndex = Stack.back();
+			Stack.pop_back();
+			for (uint32 NeighbourIndex : Graph.GetNeighbours(LeafIndex))
+			{
+				if (ComponentByLeaf[NeighbourIndex] == INVALID_INDEX && Volume->ExtractOuterIndex(Graph.LeafTreeIDs[NeighbourIndex]) == Cell)
+				{
+					ComponentByLeaf[NeighbourIndex] = Component;
+					Stack.push_back(NeighbourIndex);
+				}
+			}
+		}
+		Component++;
+	}
+}
+
+void CPathHierarchy::BuildPortalsBetween(const ACPathVolume* Volume, uint32 CellA, uint32 CellB)
+{
+	const CPathGraph& Graph = Volume->GetGraph();
+
+	// All adjacent pairs of leafs between the same two components make one portal,
+	// represented by the pair closest to the middle of the shared face area
+	struct FGroup
+	{
+		uint32 Components[2];
+		FVector Sum = FVector::ZeroVector;
+		uint32 Count = 0;
+		uint32 Leafs[2] = { INVALID_INDEX, INVALID_INDEX };
+		float BestDistance = FLT_MAX;
+	};
+	std::vector<FGroup> Groups;
+
+	auto FindGroup = [&Groups](uint32 ComponentA, uint32 ComponentB) -> FGroup&
+	{
+		for (FGroup& Group : Groups)
+		{
+			if (Group.Components[0] == ComponentA && Group.Components[1] == ComponentB)
+				return Group;
+		}
+		Groups.emplace_back();
+		Groups.back().Components[0] = ComponentA;
+		Groups.back().Components[1] = ComponentB;
+		return Groups.back();
+	};
+
+	const std::vector<uint32>& LeafsA = Graph.GetOuterTreeLeafs(CellA);
+	for (uint32 LeafA : LeafsA)
+	{
+		for (uint32 LeafB : Graph.GetNeighbours(LeafA))
+		{
+			if (Volume->ExtractOuterIndex(Graph.LeafTreeIDs[LeafB]) != CellB)
+				continue;
+
+			FGroup& Group = FindGroup(ComponentByLeaf[LeafA], ComponentByLeaf[LeafB]);
+			Group.Sum += (Graph.LeafLocations[LeafA] + Graph.LeafLocations[LeafB]) * 0.5f;
+			Group.Count++;
+		}
+	}
+
+	if (Groups.empty())
+		return;
+
+	for (uint32 LeafA : LeafsA)
+	{
+		for (uint32 LeafB : Graph.GetNeighbours(LeafA))
+		{
+			if (Volume->ExtractOuterIndex(Graph.LeafTreeIDs[LeafB]) != CellB)
+				continue;
+
+			FGroup& Group = FindGroup(ComponentByLeaf[LeafA], ComponentByLeaf[LeafB]);
+			FVector Middle = (Graph.LeafLocations[LeafA] + Graph.LeafLocations[LeafB]) * 0.5f;
+			float Distance = FVector::DistSquared(Middle, Group.Sum / Group.Count);
+			if (Distance < Group.BestDistance)
+			{
+				Group.BestDistance = Distance;
+				Group.Leafs[0] = LeafA;
+				Group.Leafs[1] = LeafB;
+			}
+		}
+	}
+
+	for (const FGroup& Group : Groups)
+	{
+		uint32 PortalIndex;
+		if (FreePortals.size())
+		{
+			PortalIndex = FreePortals.back();
+			FreePortals.pop_back();
+		}
+		else
+		{
+			PortalIndex = (uint32)Portals.size();
+			Portals.emplace_back();
+			Edges.emplace_back();
+		}
+
+		FPortal& Portal = Portals[PortalIndex];
+		Portal.Cells[0] = CellA;
+		Portal.Cells[1] = CellB;
+		Portal.Leafs[0] = Group.Leafs[0];
+		Portal.Leafs[1] = Group.Leafs[1];
+		Portal.Location = (Graph.LeafLocations[Group.Leafs[0]] + Graph.LeafLocations[Group.Leafs[1]]) * 0.5f;
+		Edges[PortalIndex].clear();
+
+		PortalsByCell[CellA].push_back(PortalIndex);
+		PortalsByCell[CellB].push_back(PortalIndex);
+	}
+}
+
+void CPathHierarchy::RemoveCellPortals(uint32 Cell)
+{
+	auto CellPortals = PortalsByCell.find(Cell);
+	if (CellPortals == PortalsByCell.end())
+		return;
+
+	for (uint32 PortalIndex : CellPortals->second)
+	{
+		FPortal& Portal = Portals[PortalIndex];
+		uint32 OtherCell = Portal.Cells[0] == Cell ? Portal.Cells[1] : Portal.Cells[0];
+
+		auto OtherPortals = PortalsByCell.find(OtherCell);
+		if (OtherPortals != PortalsByCell.end())
+		{
+			std::vector<uint32>& List = OtherPortals->second;
+			List.erase(std::remove(List.begin(), List.end(), PortalIndex), List.end());
+			if (List.empty())
+				PortalsByCell.erase(OtherPortals);
+		}
+
+		Portal = FPortal();
+		Edges[PortalIndex].clear();
+		FreePortals.push_back(PortalIndex);
+	}
+
+	PortalsByCell.erase(Cell);
+}
+
+void CPathHierarchy::BuildCellEdges(const ACPathVolume* Volume, uint32 Cell)
+{
+	auto CellPortals = PortalsByCell.find(Cell);
+	if (CellPortals == PortalsByCell.end())
+		return;
+
+	const std::vector<uint32>& PortalIndexes = CellPortals->second;
+	for (uint32 PortalIndex : PortalIndexes)
+	{
+		std::vector<FEdge>& PortalEdges = Edges[PortalIndex];
+		PortalEdges.erase(std::remove_if(PortalEdges.begin(), PortalEdges.end(), [Cell](const FEdge& Edge) { return Edge.Cell == Cell; }), PortalEdges.end());
+	}
+
+	FCellSearch Search;
+	for (uint32 PortalIndex : PortalIndexes)
+	{
+		uint32 SourceLeaf = GetPortalLeafInCell(Portals[PortalIndex], Cell);
+		uint32 SourceComponent = ComponentByLeaf[SourceLeaf];
+		CellDijkstra(Volume, Cell, SourceLeaf, Search);
+
+		for (uint32 OtherIndex : PortalIndexes)
+		{
+			uint32 OtherLeaf = GetPortalLeafInCell(Portals[OtherIndex], Cell);
+			if (OtherIndex == PortalIndex || ComponentByLeaf[OtherLeaf] != SourceComponent)
+				continue;
+
+			float Distance = Search.GetDistance(OtherLeaf);
+			if (Distance < FLT_MAX)
+			{
+				Edges[PortalIndex].push_back({ OtherIndex, Distance, Cell });
+			}
+		}
+	}
+}
+
+float CPathHierarchy::FCellSearch::GetDistance(uint32 LeafIndex) const
+{
+	auto Found = std::lower_bound(Leafs.begin(), Leafs.end(), LeafIndex);
+	if (Found == Leafs.end() || *Found != LeafIndex)
+		return FLT_MAX;
+	return Distances[Found - Leafs.begin()];
+}
+
+void CPathHierarchy::CellDijkstra(const ACPathVolume* Volume, uint32 Cell, uint32 SourceLeaf, FCellSearch& Search)
+{
+	const CPathGraph& Graph = Volume->GetGraph();
+	const std::vector<uint32>& CellLeafs = Graph.GetOuterTreeLeafs(Cell);
+	Search.Leafs.assign(CellLeafs.begin(), CellLeafs.end());
+	std::sort(Search.Leafs.begin(), Search.Leafs.end());
+	Search.Distances.assign(Search.Leafs.size(), FLT_MAX);
+	Search.Heap.clear();
+
+	// Heap entries hold positions in Search.Leafs
+	auto Position = [&Search](uint32 LeafIndex)
+	{
+		return (uint32)(std::lower_bound(Search.Leafs.begin(), Search.Leafs.end(), LeafIndex) - Search.Leafs.begin());
+	};
+	auto HeapCompare = [](const std::pair<float, uint32>& A, const std::pair<float, uint32>& B) { return A.first > B.first; };
+
+	uint32 SourcePosition = Position(SourceLeaf);
+	Search.Distances[SourcePosition] = 0;
+	Search.Heap.push_back({ 0.f, SourcePosition });
+
+	while (Search.Heap.size())
+	{
+		std::pop_heap(Search.Heap.begin(), Search.Heap.end(), HeapCompare);
+		std::pair<float, uint32> Current = Search.Heap.back();
+		Search.Heap.pop_back();
+		if (Current.first > Search.Distances[Current.second])
+			continue;
+
+		uint32 CurrentLeaf = Search.Leafs[Current.second];
+		for (uint32 NeighbourIndex : Graph.GetNeighbours(CurrentLeaf))
+		{
+			if (Volume->ExtractOuterIndex(Graph.LeafTreeIDs[NeighbourIndex]) != Cell)
+				continue;
+
+			float Distance = Current.first + FVector::Distance(Graph.LeafLocations[CurrentLeaf], Graph.LeafLocations[NeighbourIndex]);
+			uint32 NeighbourPosition = Position(NeighbourIndex);
+			if (Distance < Search.Distances[NeighbourPosition])
+			{
+				Search.Distances[NeighbourPosition] = Distance;
+				Search.Heap.push_back({ Distance, NeighbourPosition });
+				std::push_heap(Search.Heap.begin(), Search.Heap.end(), HeapCompare);
+			}
+		}
+	}
+}
+
+void CPathHierarchy::GetNeighbourCells(const ACPathVolume* Volume, uint32 Cell, std::vector<uint32>& OutCells)
+{
+	OutCells.clear();
+	FVector LocalCoords = Volume->LocalCoordsInt3FromOuterIndex(Cell);
+	for (int Direction = 0; Direction < 6; Direction++)
+	{
+		FVector NeighbourCoords = LocalCoords + ACPathVolume::LookupTable_NeighbourOffsetByDirection[Direction];
+		if (Volume->IsInBounds(NeighbourCoords))
+		{
+			OutCells.push_back(Volume->LocalCoordsInt3ToIndex(NeighbourCoords));
+		}
+	}
+}
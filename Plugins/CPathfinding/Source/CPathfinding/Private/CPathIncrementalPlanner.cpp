@@ -0,0 +1,496 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathIncrementalPlanner.h"
+#include "CPathVolume.h"
+#include <algorithm>
+#include <unordered_set>
+
+
+ECPathfindingFailReason CPathIncrementalPlanner::Replan(ACPathVolume* VolumeRef, FCPathResult* Result, FVector Start, FVector End, uint32 SmoothingPasses, int32 UserData, float TimeLimit, bool RequestRawPath, bool RequestUserPath)
+{
+#if WITH_EDITOR
+	checkf(Result != nullptr, TEXT("CPATH - Replan:::The result struct was nullptr"));
+#endif
+
+	auto SearchStart = TIMENOW;
+	if (!IsValid(VolumeRef))
+	{
+		Result->FailReason = VolumeNotValid;
+		return Result->FailReason;
+	}
+	if (!VolumeRef->CanSearch())
+	{
+		Result->FailReason = VolumeNotGenerated;
+		return Result->FailReason;
+	}
+
+	// Leaf indexes kept between calls are checked against the graph version of the pinned snapshot
+	FCPathSnapshotScope Snapshot(VolumeRef->Snapshots);
+
+	const CPathGraph& Graph = VolumeRef->GetGraph();
+	uint32 NewStartLeaf = FindLeaf(VolumeRef, Start);
+	if (NewStartLeaf == INVALID_INDEX)
+	{
+		Result->FailReason = WrongStartLocation;
+		return Result->FailReason;
+	}
+	uint32 NewGoalLeaf = FindLeaf(VolumeRef, End);
+	if (NewGoalLeaf == INVALID_INDEX)
+	{
+		Result->FailReason = WrongEndLocation;
+		return Result->FailReason;
+	}
+
+	// Graph may have grown since the last call, new leafs are untouched
+	if (States.size() < Graph.GetLeafCapacity())
+	{
+		States.resize(Graph.GetLeafCapacity());
+		InSubtree.resize(Graph.GetLeafCapacity(), 0);
+	}
+
+	bool bReuse = StartLeaf != INVALID_INDEX && VolumeRef == CurrentVolumeRef && UserData == CurrentUserData;
+	bool bKeysChanged = NewStartLeaf != StartLeaf || NewGoalLeaf != GoalLeaf || VolumeRef->GetGraphVersion() != GraphVersion;
+	CurrentVolumeRef = VolumeRef;
+	CurrentUserData = UserData;
+	GoalLeaf = NewGoalLeaf;
+	GoalLocation = Graph.LeafLocations[GoalLeaf];
+
+	bReuse = bReuse && ApplyGraphChanges() && MoveStart(NewStartLeaf);
+	if (!bReuse)
+	{
+		StartLeaf = NewStartLeaf;
+		Initialize();
+	}
+	else if (bKeysChanged)
+	{
+		RebuildOpenHeap();
+	}
+
+	LastExpansionCount = 0;
+	if (!ComputeShortestPath(TimeLimit * 1000, SearchStart))
+	{
+		Result->FailReason = Timeout;
+		Result->SearchDuration = TIMEDIFF(SearchStart, TIMENOW);
+		return Result->FailReason;
+	}
+
+	if (!IsTouched(GoalLeaf) || States[GoalLeaf].G == FLT_MAX)
+	{
+		Result->FailReason = EndLocationUnreachable;
+		Result->SearchDuration = TIMEDIFF(SearchStart, TIMENOW);
+		return Result->FailReason;
+	}
+
+	// Parent chain from the target to the start, plus one node at the exact End location
+	uint32 LeafCount = 1;
+	for (uint32 Leaf = GoalLeaf; Leaf != StartLeaf; Leaf = States[Leaf].Parent)
+	{
+		// Broken chain, only possible if CalcFitness gives different costs for the same two leafs
+		if (States[Leaf].Parent == INVALID_INDEX || LeafCount > TouchedLeafs.size())
+		{
+			Reset();
+			Result->FailReason = Unknown;
+			return Result->FailReason;
+		}
+		LeafCount++;
+	}
+	PathNodes.SetNum(LeafCount + 1, false);
+
+	uint32 Leaf = GoalLeaf;
+	for (int32 i = LeafCount - 1; i >= 0; i--)
+	{
+		CPathAStarNode& Node = PathNodes[i];
+		Node.TreeID = Graph.LeafTreeIDs[Leaf];
+		Node.TreeUserData = Graph.LeafData[Leaf];
+		Node.LeafIndex = Leaf;
+		Node.WorldLocation = Graph.LeafLocations[Leaf];
+		Node.DistanceSoFar = States[Leaf].G;
+		Node.PreviousNode = i > 0 ? &PathNodes[i - 1] : nullptr;
+		Leaf = States[Leaf].Parent;
+	}
+	PathNodes[0].WorldLocation = Start;
+
+	CPathAStarNode* PathEnd = &PathNodes[LeafCount];
+	CPathTreeID LastTreeID;
+	PathEnd->TreeID = VolumeRef->FindLeafByWorldLocation(End, LastTreeID, false) ? LastTreeID : Graph.LeafTreeIDs[GoalLeaf];
+	PathEnd->LeafIndex = INVALID_INDEX;
+	PathEnd->WorldLocation = End;
+	PathEnd->PreviousNode = &PathNodes[LeafCount - 1];
+	VolumeRef->CalcFitness(*PathEnd, GoalLocation, UserData);
+
+	if (RequestRawPath)
+	{
+		for (CPathAStarNode* CurrNode = PathEnd; CurrNode; CurrNode = CurrNode->PreviousNode)
+		{
+			Result->RawPathNodes.Add(*CurrNode);
+		}
+	}
+	Result->RawPathLength = PathEnd->DistanceSoFar;
+
+	PostProcess.CurrentVolumeRef = VolumeRef;
+	PostProcess.bStop = false;
+	for (uint32 i = 0; i < SmoothingPasses; i++)
+	{
+		PostProcess.SmoothenPath(PathEnd);
+	}
+
+	if (RequestUserPath)
+	{
+		PostProcess.TransformToUserPath(PathEnd, Result->UserPath);
+	}
+	Result->SearchDuration = TIMEDIFF(SearchStart, TIMENOW);
+	Result->FailReason = None;
+
+#ifdef LOG_PATHFINDERS
+	UE_LOG(LogTemp, Warning, TEXT("Replan:  time= %lfms  LeafsExpanded= %d  Reused= %d"), Result->SearchDuration, LastExpansionCount, (int)bReuse);
+#endif
+
+	return Result->FailReason;
+}
+
+void CPathIncrementalPlanner::Reset()
+{
+	CurrentVolumeRef = nullptr;
+	StartLeaf = INVALID_INDEX;
+	GoalLeaf = INVALID_INDEX;
+	TouchedLeafs.clear();
+	OpenHeap.clear();
+	Iteration++;
+}
+
+void CPathIncrementalPlanner::Initialize()
+{
+	Iteration++;
+	TouchedLeafs.clear();
+	OpenHeap.clear();
+	GraphVersion = CurrentVolumeRef->GetGraphVersion();
+
+	FLeafState& StartState = Touch(StartLeaf);
+	StartState.Rhs = 0;
+	PushOpen(StartLeaf);
+}
+
+bool CPathIncrementalPlanner::ApplyGraphChanges()
+{
+	uint32 CurrentVersion = CurrentVolumeRef->GetGraphVersion();
+	if (CurrentVersion == GraphVersion)
+		return true;
+
+	// Every update since the last call must still be in the log
+	const auto& ChangeLog = CurrentVolumeRef->GetGraphChangeLog();
+	if (ChangeLog.empty() || ChangeLog.front().first > GraphVersion + 1 || ChangeLog.back().first != CurrentVersion)
+		return false;
+
+	std::unordered_set<uint32> ChangedOuterIndexes;
+	for (const auto& Change : ChangeLog)
+	{
+		if (Change.first > GraphVersion)
+			ChangedOuterIndexes.insert(Change.second.begin(), Change.second.end());
+	}
+	GraphVersion = CurrentVersion;
+
+	// Leafs in changed outer trees and leafs reached from them. Leafs next to a changed outer tree that weren't reached
+	// from it only have more options now, they are updated when the new leafs are expanded.
+	Affected.clear();
+	for (uint32 Leaf : TouchedLeafs)
+	{
+		const FLeafState& State = States[Leaf];
+		if (ChangedOuterIndexes.count(CurrentVolumeRef->ExtractOuterIndex(State.TreeID))
+			|| (State.Parent != INVALID_INDEX && ChangedOuterIndexes.count(CurrentVolumeRef->ExtractOuterIndex(States[State.Parent].TreeID))))
+		{
+			Affected.push_back(Leaf);
+		}
+	}
+
+	// Removed leafs and reused indexes are forgotten
+	const CPathGraph& Graph = CurrentVolumeRef->GetGraph();
+	for (uint32 Leaf : Affected)
+	{
+		if (States[Leaf].TreeID != Graph.LeafTreeIDs[Leaf])
+		{
+			RemoveOpen(Leaf);
+			States[Leaf].Stamp = 0;
+		}
+	}
+	if (!IsTouched(StartLeaf))
+		return false;
+
+	TouchedLeafs.erase(std::remove_if(TouchedLeafs.begin(), TouchedLeafs.end(), [this](uint32 Leaf) { return !IsTouched(Leaf); }), TouchedLeafs.end());
+
+	for (uint32 OuterIndex : ChangedOuterIndexes)
+	{
+		const std::vector<uint32>& OuterLeafs = Graph.GetOuterTreeLeafs(OuterIndex);
+		Affected.insert(Affected.end(), OuterLeafs.begin(), OuterLeafs.end());
+	}
+
+	for (uint32 Leaf : Affected)
+	{
+		if (Graph.LeafTreeIDs[Leaf] != INVALID_TREEID)
+			UpdateLeaf(Leaf);
+	}
+	return true;
+}
+
+bool CPathIncrementalPlanner::MoveStart(uint32 NewStartLeaf)
+{
+	if (NewStartLeaf == StartLeaf)
+		return true;
+
+	if (!IsTouched(NewStartLeaf))
+		return false;
+
+	FLeafState& NewStartState = States[NewStartLeaf];
+	if (NewStartState.G == FLT_MAX || NewStartState.G != NewStartState.Rhs)
+		return false;
+
+	// Marks every touched leaf by whether its parent chain leads to the new start: 1 - yes, 2 - no
+	InSubtree[NewStartLeaf] = 1;
+	for (uint32 Leaf : TouchedLeafs)
+	{
+		WalkStack.clear();
+		uint32 Current = Leaf;
+		uint8 Mark = 2;
+		while (true)
+		{
+			if (InSubtree[Current])
+			{
+				Mark = InSubtree[Current];
+				break;
+			}
+			WalkStack.push_back(Current);
+
+			uint32 Parent = States[Current].Parent;
+			if (Parent == INVALID_INDEX || !IsTouched(Parent) || WalkStack.size() > TouchedLeafs.size())
+				break;
+			Current = Parent;
+		}
+
+		for (uint32 Walked : WalkStack)
+		{
+			InSubtree[Walked] = Mark;
+		}
+	}
+
+	// Costs in the subtree become relative to the new start, everything else is dropped
+	float Offset = NewStartState.G;
+	Affected.clear();
+	uint32 KeptCount = 0;
+	for (uint32 Leaf : TouchedLeafs)
+	{
+		FLeafState& State = States[Leaf];
+		if (InSubtree[Leaf] == 1)
+		{
+			if (State.G != FLT_MAX)
+				State.G -= Offset;
+			if (State.Rhs != FLT_MAX)
+				State.Rhs -= Offset;
+			TouchedLeafs[KeptCount++] = Leaf;
+		}
+		else
+		{
+			State.Stamp = 0;
+			State.bOpen = false;
+			Affected.push_back(Leaf);
+		}
+		InSubtree[Leaf] = 0;
+	}
+	TouchedLeafs.resize(KeptCount);
+
+	StartLeaf = NewStartLeaf;
+	NewStartState.G = 0;
+	NewStartState.Rhs = 0;
+	NewStartState.Parent = INVALID_INDEX;
+
+	// Dropped leafs next to the subtree become its frontier
+	const CPathGraph& Graph = CurrentVolumeRef->GetGraph();
+	for (uint32 Leaf : Affected)
+	{
+		if (Graph.LeafTreeIDs[Leaf] != INVALID_TREEID)
+			UpdateLeaf(Leaf);
+	}
+	return true;
+}
+
+void CPathIncrementalPlanner::RebuildOpenHeap()
+{
+	OpenHeap.clear();
+	for (uint32 Leaf : TouchedLeafs)
+	{
+		FLeafState& State = States[Leaf];
+		State.bOpen = State.G != State.Rhs;
+		if (State.bOpen)
+		{
+			State.OpenVersion++;
+			OpenHeap.push_back({ CalcKey(Leaf), Leaf, State.OpenVersion });
+		}
+	}
+	std::make_heap(OpenHeap.begin(), OpenHeap.end(), OpenEntryGreater);
+}
+
+bool CPathIncrementalPlanner::ComputeShortestPath(double TimeLimitMS, decltype(TIMENOW) SearchStart)
+{
+	const CPathGraph& Graph = CurrentVolumeRef->GetGraph();
+	FOpenEntry Top;
+	while (PeekOpen(Top))
+	{
+		bool bGoalTouched = IsTouched(GoalLeaf);
+		bool bGoalConsistent = !bGoalTouched || States[GoalLeaf].G == States[GoalLeaf].Rhs;
+		if (bGoalTouched && bGoalConsistent && !(Top.Key < CalcKey(GoalLeaf)))
+			break;
+
+		std::pop_heap(OpenHeap.begin(), OpenHeap.end(), OpenEntryGreater);
+		OpenHeap.pop_back();
+
+		uint32 Leaf = Top.Leaf;
+		FLeafState& State = States[Leaf];
+		FKey NewKey = CalcKey(Leaf);
+		if (Top.Key < NewKey)
+		{
+			PushOpen(Leaf);
+			continue;
+		}
+
+		LastExpansionCount++;
+		if (State.G > State.Rhs)
+		{
+			State.G = State.Rhs;
+			State.bOpen = false;
+			for (uint32 Neighbour : Graph.GetNeighbours(Leaf))
+			{
+				UpdateLeaf(Neighbour);
+			}
+		}
+		else
+		{
+			State.G = FLT_MAX;
+			UpdateLeaf(Leaf);
+			for (uint32 Neighbour : Graph.GetNeighbours(Leaf))
+			{
+				UpdateLeaf(Neighbour);
+			}
+		}
+
+		if (TIMEDIFF(SearchStart, TIMENOW) >= TimeLimitMS)
+			return false;
+	}
+	return true;
+}
+
+void CPathIncrementalPlanner::UpdateLeaf(uint32 Leaf)
+{
+	if (Leaf == StartLeaf)
+		return;
+
+	float BestRhs = FLT_MAX;
+	uint32 BestParent = INVALID_INDEX;
+	for (uint32 Neighbour : CurrentVolumeRef->GetGraph().GetNeighbours(Leaf))
+	{
+		if (!IsTouched(Neighbour) || States[Neighbour].G == FLT_MAX)
+			continue;
+
+		float Rhs = States[Neighbour].G + EdgeCost(Neighbour, Leaf);
+		if (Rhs < BestRhs)
+		{
+			BestRhs = Rhs;
+			BestParent = Neighbour;
+		}
+	}
+
+	// Untouched leafs are unreached already
+	if (BestRhs == FLT_MAX && !IsTouched(Leaf))
+		return;
+
+	FLeafState& State = Touch(Leaf);
+	State.Rhs = BestRhs;
+	State.Parent = BestParent;
+	if (State.G != State.Rhs)
+		PushOpen(Leaf);
+	else
+		RemoveOpen(Leaf);
+}
+
+float CPathIncrementalPlanner::EdgeCost(uint32 From, uint32 To) const
+{
+	const CPathGraph& Graph = CurrentVolumeRef->GetGraph();
+	CPathAStarNode Previous(Graph.LeafTreeIDs[From], Graph.LeafData[From]);
+	Previous.LeafIndex = From;
+	Previous.WorldLocation = Graph.LeafLocations[From];
+
+	CPathAStarNode Node(Graph.LeafTreeIDs[To], Graph.LeafData[To]);
+	Node.LeafIndex = To;
+	Node.WorldLocation = Graph.LeafLocations[To];
+	Node.PreviousNode = &Previous;
+
+	CurrentVolumeRef->CalcFitness(Node, GoalLocation, CurrentUserData);
+	return Node.DistanceSoFar;
+}
+
+CPathIncrementalPlanner::FKey CPathIncrementalPlanner::CalcKey(uint32 Leaf) const
+{
+	FKey Key;
+	if (!IsTouched(Leaf))
+		return Key;
+
+	float MinCost = FMath::Min(States[Leaf].G, States[Leaf].Rhs);
+	if (MinCost == FLT_MAX)
+		return Key;
+
+	Key.First = MinCost + HeuristicWeight * FVector::Distance(CurrentVolumeRef->GetGraph().LeafLocations[Leaf], GoalLocation);
+	Key.Second = MinCost;
+	return Key;
+}
+
+CPathIncrementalPlanner::FLeafState& CPathIncrementalPlanner::Touch(uint32 Leaf)
+{
+	FLeafState& State = States[Leaf];
+	if (State.Stamp != Iteration)
+	{
+		State.G = FLT_MAX;
+		State.Rhs = FLT_MAX;
+		State.Parent = INVALID_INDEX;
+		State.bOpen = false;
+		State.Stamp = Iteration;
+		State.TreeID = CurrentVolumeRef->GetGraph().LeafTreeIDs[Leaf];
+		TouchedLeafs.push_back(Leaf);
+	}
+	return State;
+}
+
+void CPathIncrementalPlanner::PushOpen(uint32 Leaf)
+{
+	FLeafState& State = States[Leaf];
+	State.bOpen = true;
+	State.OpenVersion++;
+	OpenHeap.push_back({ CalcKey(Leaf), Leaf, State.OpenVersion });
+	std::push_heap(OpenHeap.begin(), OpenHeap.end(), OpenEntryGreater);
+}
+
+bool CPathIncrementalPlanner::PeekOpen(FOpenEntry& OutEntry)
+{
+	while (!OpenHeap.empty())
+	{
+		const FOpenEntry& Top = OpenHeap.front();
+		const FLeafState& State = States[Top.Leaf];
+		if (IsTouched(Top.Leaf) && State.bOpen && State.OpenVersion == Top.Version)
+		{
+			OutEntry = Top;
+			return true;
+		}
+		std::pop_heap(OpenHeap.begin(), OpenHeap.end(), OpenEntryGreater);
+		OpenHeap.pop_back();
+	}
+	return false;
+}
+
+uint32 CPathIncrementalPlanner::FindLeaf(ACPathVolume* VolumeRef, FVector Location)
+{
+	CPathTreeID TreeID;
+	if (!VolumeRef->FindClosestFreeLeaf(Location, TreeID))
+		return INVALID_INDEX;
+
+	// Same as FindPath, start and end are only valid in streamed in chunks
+	if (!VolumeRef->Chunks.IsResident(VolumeRef->ExtractOuterIndex(TreeID)))
+		return INVALID_INDEX;
+
+	return VolumeRef->GetGraph().FindLeafIndexOrClosest(TreeID, Location);
+}
@@ -0,0 +1,366 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathOccupancy.h"
+#include "CPathVolume.h"
+#include "CPathOctree.h"
+#include "Misc/ScopeLock.h"
+
+#if PLATFORM_ENABLE_VECTORINTRINSICS_NEON
+#include <arm_neon.h>
+#define CPATH_OCCUPANCY_NEON 1
+#elif PLATFORM_ENABLE_VECTORINTRINSICS
+#if defined(PLATFORM_ALWAYS_HAS_AVX_2) && PLATFORM_ALWAYS_HAS_AVX_2
+#include <immintrin.h>
+#define CPATH_OCCUPANCY_AVX2 1
+#else
+#include <emmintrin.h>
+#define CPATH_OCCUPANCY_SSE 1
+#endif
+#endif
+
+
+// ------- Word wide mask operations ---------------------------------------
+
+// Returns true if A & B has any bit set
+static inline bool AnyAnd(const uint64* A, const uint64* B, uint32 Words)
+{
+	uint32 i = 0;
+#if CPATH_OCCUPANCY_AVX2
+	for (; i + 4 <= Words; i += 4)
+	{
+		__m256i VA = _mm256_loadu_si256((const __m256i*)(A + i));
+		__m256i VB = _mm256_loadu_si256((const __m256i*)(B + i));
+		if (!_mm256_testz_si256(VA, VB))
+			return true;
+	}
+#elif CPATH_OCCUPANCY_SSE
+	for (; i + 2 <= Words; i += 2)
+	{
+		__m128i V = _mm_and_si128(_mm_loadu_si128((const __m128i*)(A + i)), _mm_loadu_si128((const __m128i*)(B + i)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(V, _mm_setzero_si128())) != 0xFFFF)
+			return true;
+	}
+#elif CPATH_OCCUPANCY_NEON
+	for (; i + 2 <= Words; i += 2)
+	{
+		uint64x2_t V = vandq_u64(vld1q_u64(A + i), vld1q_u64(B + i));
+		if (vgetq_lane_u64(V, 0) | vgetq_lane_u64(V, 1))
+			return true;
+	}
+#endif
+	for (; i < Words; i++)
+	{
+		if (A[i] & B[i])
+			return true;
+	}
+	return false;
+}
+
+// Returns true if all bits of A are set
+static inline bool AllSet(const uint64* A, uint32 Words)
+{
+	uint32 i = 0;
+#if CPATH_OCCUPANCY_AVX2
+	const __m256i Ones = _mm256_set1_epi64x(-1);
+	for (; i + 4 <= Words; i += 4)
+	{
+		if (!_mm256_testc_si256(_mm256_loadu_si256((const __m256i*)(A + i)), Ones))
+			return false;
+	}
+#elif CPATH_OCCUPANCY_SSE
+	const __m128i Ones = _mm_set1_epi32(-1);
+	for (; i + 2 <= Words; i += 2)
+	{
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(A + i)), Ones)) != 0xFFFF)
+			return false;
+	}
+#elif CPATH_OCCUPANCY_NEON
+	for (; i + 2 <= Words; i += 2)
+	{
+		uint64x2_t V = vld1q_u64(A + i);
+		if ((vgetq_lane_u64(V, 0) & vgetq_lane_u64(V, 1)) != MAX_uint64)
+			return false;
+	}
+#endif
+	for (; i < Words; i++)
+	{
+		if (A[i] != MAX_uint64)
+			return false;
+	}
+	return true;
+}
+
+
+// ------- CPathOccupancy ---------------------------------------
+
+CPathOccupancy::CPathOccupancy()
+{
+}
+
+CPathOccupancy::~CPathOccupancy()
+{
+	Empty();
+}
+
+void CPathOccupancy::Init(const ACPathVolume* Volume)
+{
+	Empty();
+
+	OctreeDepth = Volume->OctreeDepth;
+	if (OctreeDepth > MAX_OCCUPANCY_DEPTH)
+	{
+		WordsPerTree = 0;
+		return;
+	}
+
+	WordsPerTree = FMath::Max((uint32)1, ((uint32)1 << (3 * OctreeDepth)) / 64);
+	for (int i = 0; i < 3; i++)
+	{
+		NodeCount[i] = Volume->NodeCount[i];
+	}
+	VolumeMin = Volume->StartPosition - Volume->GetVoxelSizeByDepth(0) / 2.f;
+	FinestVoxelSize = Volume->GetVoxelSizeByDepth(OctreeDepth);
+
+	uint32 OuterNodeCount = NodeCount[0] * NodeCount[1] * NodeCount[2];
+	SlotByOuterIndex.assign(OuterNodeCount, 0);
+	// +1 for the reserved slot 0. Masks replaced by regeneration can be kept until searches are done with them, so twice as many.
+	Blocks.resize((2 * (uint64)OuterNodeCount + 1) / SLOTS_PER_BLOCK + 1, nullptr);
+
+	// Child index is X << 2 | Z << 1 | Y, see LookupTable_ChildPositionOffsetMaskByIndex
+	for (uint32 Coord = 0; Coord < (1u << MAX_OCCUPANCY_DEPTH); Coord++)
+	{
+		uint32 Spread = 0;
+		for (uint32 Bit = 0; Bit < MAX_OCCUPANCY_DEPTH; Bit++)
+		{
+			Spread |= ((Coord >> Bit) & 1) << (3 * Bit);
+		}
+		MortonByAxis[0][Coord] = Spread << 2;
+		MortonByAxis[1][Coord] = Spread;
+		MortonByAxis[2][Coord] = Spread << 1;
+	}
+
+	FMemory::Memzero(FaceMasks, sizeof(FaceMasks));
+	for (uint32 Height = 0; Height <= MAX_OCCUPANCY_DEPTH; Height++)
+	{
+		uint32 Max = (1 << Height) - 1;
+		for (uint32 X = 0; X <= Max; X++)
+		{
+			for (uint32 Y = 0; Y <= Max; Y++)
+			{
+				for (uint32 Z = 0; Z <= Max; Z++)
+				{
+					uint32 Code = MortonByAxis[0][X] | MortonByAxis[1][Y] | MortonByAxis[2][Z];
+					uint64 Bit = (uint64)1 << (Code & 63);
+					if (Y == 0)		FaceMasks[Height][Left][Code >> 6] |= Bit;
+					if (X == 0)		FaceMasks[Height][Front][Code >> 6] |= Bit;
+					if (Y == Max)	FaceMasks[Height][Right][Code >> 6] |= Bit;
+					if (X == Max)	FaceMasks[Height][Behind][Code >> 6] |= Bit;
+					if (Z == 0)		FaceMasks[Height][Below][Code >> 6] |= Bit;
+					if (Z == Max)	FaceMasks[Height][Above][Code >> 6] |= Bit;
+				}
+			}
+		}
+	}
+}
+
+void CPathOccupancy::Empty()
+{
+	for (uint64* Block : Blocks)
+	{
+		delete[] Block;
+	}
+	Blocks.clear();
+	BlocksCreated = 0;
+	NextFreshSlot = 1;
+	FreeSlots.clear();
+	SlotByOuterIndex.clear();
+}
+
+void CPathOccupancy::UpdateOuterTree(const ACPathVolume* Volume, uint32 OuterIndex)
+{
+	if (!IsEnabled())
+		return;
+
+	const CPathOctree* Tree = Volume->Octrees.Get(OuterIndex);
+	uint32 OldSlot = SlotByOuterIndex[OuterIndex];
+	uint32 NewSlot = 0;
+	if (Tree->Children)
+	{
+		NewSlot = OldSlot && !DeferRelease ? OldSlot : AllocateSlot();
+		uint64* Mask = GetSlot(NewSlot);
+		FMemory::Memzero(Mask, WordsPerTree * sizeof(uint64));
+		RasterizeRec(Volume, Tree, Mask, 0, 0);
+	}
+
+	SlotByOuterIndex[OuterIndex] = NewSlot;
+	if (OldSlot && OldSlot != NewSlot)
+		ReleaseSlot(OldSlot);
+}
+
+uint32 CPathOccupancy::GetSubtreeStart(const ACPathVolume* Volume, CPathTreeID TreeID) const
+{
+	uint32 Depth = Volume->ExtractDepth(TreeID);
+	uint32 Prefix = 0;
+	for (uint32 CurrDepth = 1; CurrDepth <= Depth; CurrDepth++)
+	{
+		Prefix = (Prefix << 3) | Volume->ExtractChildIndex(TreeID, CurrDepth);
+	}
+	return Prefix << (3 * (OctreeDepth - Depth));
+}
+
+bool CPathOccupancy::AnyFreeOnSide(uint32 OuterIndex, uint32 Start, uint32 Depth, ENeighbourDirection Side) const
+{
+	// Not rasterized yet, so we can't tell
+	const uint64* Mask = GetMask(OuterIndex);
+	if (!Mask)
+		return true;
+
+	uint32 Height = OctreeDepth - Depth;
+	uint32 BitCount = 1 << (3 * Height);
+	if (BitCount >= 64)
+		return AnyAnd(Mask + (Start >> 6), FaceMasks[Height][Side], BitCount >> 6);
+
+	return (Mask[Start >> 6] >> (Start & 63)) & FaceMasks[Height][Side][0];
+}
+
+bool CPathOccupancy::IsBoxFree(const ACPathVolume* Volume, FVector WorldMin, FVector WorldMax) const
+{
+	if (!IsEnabled())
+		return false;
+
+	FVector LocalMin = (WorldMin - VolumeMin) / FinestVoxelSize;
+	FVector LocalMax = (WorldMax - VolumeMin) / FinestVoxelSize;
+	FIntVector Min(FMath::FloorToInt(LocalMin.X), FMath::FloorToInt(LocalMin.Y), FMath::FloorToInt(LocalMin.Z));
+	FIntVector Max(FMath::FloorToInt(LocalMax.X), FMath::FloorToInt(LocalMax.Y), FMath::FloorToInt(LocalMax.Z));
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (Min[i] < 0 || Max[i] >= (int32)(NodeCount[i] << OctreeDepth))
+			return false;
+	}
+
+	int32 LocalMask = (1 << OctreeDepth) - 1;
+	for (int32 X = Min.X >> OctreeDepth; X <= Max.X >> OctreeDepth; X++)
+	{
+		for (int32 Y = Min.Y >> OctreeDepth; Y <= Max.Y >> OctreeDepth; Y++)
+		{
+			for (int32 Z = Min.Z >> OctreeDepth; Z <= Max.Z >> OctreeDepth; Z++)
+			{
+				FIntVector TreeOrigin(X << OctreeDepth, Y << OctreeDepth, Z << OctreeDepth);
+				FIntVector TreeMin(FMath::Max(Min.X - TreeOrigin.X, 0), FMath::Max(Min.Y - TreeOrigin.Y, 0), FMath::Max(Min.Z - TreeOrigin.Z, 0));
+				FIntVector TreeMax(FMath::Min(Max.X - TreeOrigin.X, LocalMask), FMath::Min(Max.Y - TreeOrigin.Y, LocalMask), FMath::Min(Max.Z - TreeOrigin.Z, LocalMask));
+
+				uint32 OuterIndex = X * NodeCount[1] * NodeCount[2] + Y * NodeCount[2] + Z;
+				if (!IsLocalBoxFree(Volume, OuterIndex, TreeMin, TreeMax))
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+uint64 CPathOccupancy::GetMemoryUsage() const
+{
+	uint64 Memory = (uint64)BlocksCreated * SLOTS_PER_BLOCK * WordsPerTree * sizeof(uint64);
+	Memory += SlotByOuterIndex.capacity() * sizeof(uint32) + Blocks.capacity() * sizeof(uint64*) + FreeSlots.capacity() * sizeof(uint32);
+	return Memory;
+}
+
+uint32 CPathOccupancy::AllocateSlot()
+{
+	FScopeLock Lock(&Mutex);
+
+	if (FreeSlots.size())
+	{
+		uint32 Slot = FreeSlots.back();
+		FreeSlots.pop_back();
+		return Slot;
+	}
+
+	uint32 Slot = NextFreshSlot++;
+	uint32 BlockIndex = Slot >> SLOTS_PER_BLOCK_BITS;
+	checkf(BlockIndex < Blocks.size(), TEXT("CPATH - Occupancy:::Occupancy was not initialized or ran out of blocks."));
+	if (!Blocks[BlockIndex])
+	{
+		Blocks[BlockIndex] = new uint64[SLOTS_PER_BLOCK * WordsPerTree];
+		BlocksCreated++;
+	}
+	return Slot;
+}
+
+void CPathOccupancy::FreeSlot(uint32 Slot)
+{
+	FScopeLock Lock(&Mutex);
+	FreeSlots.push_back(Slot);
+}
+
+void CPathOccupancy::ReleaseSlot(uint32 Slot)
+{
+	if (DeferRelease)
+		DeferRelease([this, Slot]() { FreeSlot(Slot); });
+	else
+		FreeSlot(Slot);
+}
+
+void CPathOccupancy::RasterizeRec(const ACPathVolume* Volume, const CPathOctree* Tree, uint64* Mask, uint32 Prefix, uint32 Depth)
+{
+	if (!Tree->Children)
+	{
+		if (Tree->GetIsFree())
+		{
+			uint32 Height = OctreeDepth - Depth;
+			SetBits(Mask, Prefix << (3 * Height), 1 << (3 * Height));
+		}
+		return;
+	}
+
+	for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+	{
+		RasterizeRec(Volume, Volume->GetChild(Tree, ChildIndex), Mask, (Prefix << 3) | ChildIndex, Depth + 1);
+	}
+}
+
+void CPathOccupancy::SetBits(uint64* Mask, uint32 Start, uint32 Count)
+{
+	if (Count >= 64)
+	{
+		for (uint32 Word = Start >> 6; Word < (Start + Count) >> 6; Word++)
+		{
+			Mask[Word] = MAX_uint64;
+		}
+		return;
+	}
+
+	Mask[Start >> 6] |= (((uint64)1 << Count) - 1) << (Start & 63);
+}
+
+bool CPathOccupancy::IsLocalBoxFree(const ACPathVolume* Volume, uint32 OuterIndex, const FIntVector& Min, const FIntVector& Max) const
+{
+	const uint64* Mask = GetMask(OuterIndex);
+	if (!Mask)
+		return Volume->Octrees.Get(OuterIndex)->GetIsFree();
+
+	int32 LocalMax = (1 << OctreeDepth) - 1;
+	if (Min == FIntVector(0) && Max == FIntVector(LocalMax))
+	{
+		uint32 BitCount = 1 << (3 * OctreeDepth);
+		if (BitCount < 64)
+			return Mask[0] == (((uint64)1 << BitCount) - 1);
+		return AllSet(Mask, WordsPerTree);
+	}
+
+	for (int32 X = Min.X; X <= Max.X; X++)
+	{
+		for (int32 Y = Min.Y; Y <= Max.Y; Y++)
+		{
+			uint32 CodeXY = MortonByAxis[0][X] | MortonByAxis[1][Y];
+			for (int32 Z = Min.Z; Z <= Max.Z; Z++)
+			{
+				uint32 Code = CodeXY | MortonByAxis[2][Z];
+				if (!((Mask[Code >> 6] >> (Code & 63)) & 1))
+					return false;
+			}
+		}
+	}
+	return true;
+}
@@ -1,9 +1,323 @@
 // Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
 
 #include "CPathOctree.h"
+#include "Misc/ScopeLock.h"
 
 CPathOctree::CPathOctree()
 {
 }
 
 
+CPathOctreePool::CPathOctreePool()
+{
+}
+
+CPathOctreePool::~CPathOctreePool()
+{
+	Empty();
+}
+
+void CPathOctreePool::Init(uint64 MaxOctets, const CPathOctree* MappedOctets, uint32 MappedOctetCount)
+{
+	Empty();
+
+	MappedBlockCount = (MappedOctetCount + OCTET_MASK) >> OCTETS_PER_BLOCK_BITS;
+
+	// +1 for the reserved octet at index 0. MaxOctets is a worst case that deep octrees never come close to,
+	// so the table is capped to what 32 bit indexes can address and only actually used octets have to fit in it.
+	uint64 BlockCount = MappedBlockCount + (MaxOctets + 1) / OCTETS_PER_BLOCK + 1;
+	BlockCount = FMath::Min(BlockCount, MAX_BLOCK_COUNT);
+	Blocks.resize(BlockCount, nullptr);
+
+	if (MappedBlockCount)
+	{
+		// Pool never writes to these blocks, the last one may be only partially backed by MappedOctets
+		for (uint32 BlockIndex = 0; BlockIndex < MappedBlockCount; BlockIndex++)
+		{
+			Blocks[BlockIndex] = const_cast<CPathOctree*>(MappedOctets) + (uint64)BlockIndex * OCTETS_PER_BLOCK * 8;
+		}
+		NextFreshOctet = MappedBlockCount << OCTETS_PER_BLOCK_BITS;
+		AllocatedOctets = MappedOctetCount - 1;
+	}
+}
+
+uint32 CPathOctreePool::Allocate()
+{
+	FScopeLock Lock(&Mutex);
+
+	uint32 OctetIndex;
+	if (FreeListHead)
+	{
+		OctetIndex = FreeListHead;
+		FreeListHead = Get(OctetIndex)->Children;
+	}
+	else
+	{
+		checkf(NextFreshOctet != 0, TEXT("CPATH - Octree Pool:::Too many nodes to address with 32 bits, increase voxel size or decrease volume area."));
+		OctetIndex = NextFreshOctet++;
+		uint32 BlockIndex = OctetIndex >> OCTETS_PER_BLOCK_BITS;
+		checkf(BlockIndex < Blocks.size(), TEXT("CPATH - Octree Pool:::Pool was not initialized or ran out of blocks."));
+		if (!Blocks[BlockIndex])
+		{
+			Blocks[BlockIndex] = new CPathOctree[OCTETS_PER_BLOCK * 8];
+			BlocksCreated++;
+		}
+	}
+
+	CPathOctree* Octet = Get(OctetIndex);
+	for (int i = 0; i < 8; i++)
+	{
+		Octet[i].Children = 0;
+		Octet[i].Data = 0;
+	}
+	AllocatedOctets++;
+	return OctetIndex;
+}
+
+void CPathOctreePool::Free(uint32 OctetIndex)
+{
+	// Mapped subtrees are only ever replaced by writable copies as a whole, so there is nothing to free
+	if (IsMapped(OctetIndex))
+		return;
+
+	if (DeferRelease)
+	{
+		DeferRelease([this, OctetIndex]()
+		{
+			FScopeLock Lock(&Mutex);
+			FreeRec(OctetIndex);
+		});
+		return;
+	}
+
+	FScopeLock Lock(&Mutex);
+	FreeRec(OctetIndex);
+}
+
+uint32 CPathOctreePool::CloneToWritable(uint32 OctetIndex)
+{
+	uint32 NewIndex = Allocate();
+	const CPathOctree* Source = Get(OctetIndex);
+	CPathOctree* Target = Get(NewIndex);
+	for (int i = 0; i < 8; i++)
+	{
+		Target[i].Data = Source[i].Data;
+		Target[i].Children = Source[i].Children ? CloneToWritable(Source[i].Children) : 0;
+	}
+	return NewIndex;
+}
+
+void CPathOctreePool::FreeRec(uint32 OctetIndex)
+{
+	CPathOctree* Octet = Get(OctetIndex);
+	for (int i = 0; i < 8; i++)
+	{
+		if (Octet[i].Children)
+			FreeRec(Octet[i].Children);
+	}
+
+	Octet->Children = FreeListHead;
+	FreeListHead = OctetIndex;
+	AllocatedOctets--;
+}
+
+void CPathOctreePool::Empty()
+{
+	for (uint64 BlockIndex = MappedBlockCount; BlockIndex < Blocks.size(); BlockIndex++)
+	{
+		delete[] Blocks[BlockIndex];
+	}
+	Blocks.clear();
+	BlocksCreated = 0;
+	MappedBlockCount = 0;
+	NextFreshOctet = 1;
+	FreeListHead = 0;
+	AllocatedOctets = 0;
+}
+
+uint64 CPathOctreePool::GetMemoryUsage() const
+{
+	return (uint64)BlocksCreated * OCTETS_PER_BLOCK * 8 * sizeof(CPathOctree) + Blocks.capacity() * sizeof(CPathOctree*);
+}
+
+
+CPathOuterGrid::CPathOuterGrid()
+{
+	for (uint32 IsFree = 0; IsFree < 2; IsFree++)
+	{
+		UniformBricks[IsFree] = new CPathOctree[TREES_PER_BRICK];
+		for (uint32 i = 0; i < TREES_PER_BRICK; i++)
+		{
+			UniformBricks[IsFree][i].SetIsFree(IsFree);
+		}
+	}
+}
+
+CPathOuterGrid::~CPathOuterGrid()
+{
+	Empty();
+	delete[] UniformBricks[0];
+	delete[] UniformBricks[1];
+}
+
+void CPathOuterGrid::Init(const uint32 InNodeCount[3])
+{
+	Empty();
+
+	for (int i = 0; i < 3; i++)
+	{
+		NodeCount[i] = InNodeCount[i];
+		BrickCount[i] = (NodeCount[i] + BRICK_MASK) >> BRICK_BITS;
+	}
+	NodeCountYZ = NodeCount[1] * NodeCount[2];
+
+	// Atomics can't be moved, so the vector is created at its size instead of resized
+	Bricks = std::vector<std::atomic<CPathOctree*>>((uint64)BrickCount[0] * BrickCount[1] * BrickCount[2]);
+	for (std::atomic<CPathOctree*>& Brick : Bricks)
+	{
+		Brick.store(UniformBricks[0], std::memory_order_relaxed);
+	}
+}
+
+uint32 CPathOuterGrid::ReplaceTree(uint32 OuterIndex, const CPathOctree& Tree)
+{
+	uint32 LocalIndex;
+	uint32 BrickIndex = GetBrickIndex(OuterIndex, LocalIndex);
+	CPathOctree* Brick = new CPathOctree[TREES_PER_BRICK];
+
+	// Other trees of the brick can be replaced by other generators, so the copy is made under the lock
+	FScopeLock Lock(&Mutex);
+	FMemory::Memcpy(Brick, Bricks[BrickIndex].load(std::memory_order_relaxed), TREES_PER_BRICK * sizeof(CPathOctree));
+	uint32 OldChildren = Brick[LocalIndex].Children;
+	Brick[LocalIndex] = Tree;
+	PublishBrick(BrickIndex, Brick);
+	return OldChildren;
+}
+
+void CPathOuterGrid::LoadBrick(uint32 BrickIndex, const CPathOctree* Trees)
+{
+	// Filled before it's visible, searches only see the old or the new brick
+	CPathOctree* Brick = new CPathOctree[TREES_PER_BRICK];
+	FMemory::Memcpy(Brick, Trees, TREES_PER_BRICK * sizeof(CPathOctree));
+
+	FScopeLock Lock(&Mutex);
+	PublishBrick(BrickIndex, Brick);
+}
+
+void CPathOuterGrid::PublishBrick(uint32 BrickIndex, CPathOctree* Brick)
+{
+	CPathOctree* OldBrick = Bricks[BrickIndex].load(std::memory_order_relaxed);
+	Bricks[BrickIndex].store(Brick, std::memory_order_release);
+
+	MaterializedBricks += (int32)IsMaterialized(Brick) - (int32)IsMaterialized(OldBrick);
+	if (IsMaterialized(OldBrick))
+		ReleaseBrick(OldBrick);
+}
+
+FIntVector CPathOuterGrid::GetBrickOrigin(uint32 BrickIndex) const
+{
+	uint32 BrickCountYZ = BrickCount[1] * BrickCount[2];
+	uint32 X = BrickIndex / BrickCountYZ;
+	BrickIndex -= X * BrickCountYZ;
+	return FIntVector(X, BrickIndex / BrickCount[2], BrickIndex % BrickCount[2]) * BRICK_SIZE;
+}
+
+// Moves the lowest 21 bits to every third bit
+static uint64 SpreadBits3(uint64 Value)
+{
+	Value &= 0x1FFFFF;
+	Value = (Value | Value << 32) & 0x1F00000000FFFF;
+	Value = (Value | Value << 16) & 0x1F0000FF0000FF;
+	Value = (Value | Value << 8) & 0x100F00F00F00F00F;
+	Value = (Value | Value << 4) & 0x10C30C30C30C30C3;
+	Value = (Value | Value << 2) & 0x1249249249249249;
+	return Value;
+}
+
+uint64 CPathOuterGrid::GetBrickMortonCode(uint32 BrickIndex) const
+{
+	FIntVector Brick = GetBrickOrigin(BrickIndex) / BRICK_SIZE;
+	return (SpreadBits3(Brick.X) << 2) | (SpreadBits3(Brick.Y) << 1) | SpreadBits3(Brick.Z);
+}
+
+void CPathOuterGrid::GetOuterIndexesInBrick(uint32 BrickIndex, std::vector<uint32>& OutIndexes) const
+{
+	OutIndexes.clear();
+	FIntVector Origin = GetBrickOrigin(BrickIndex);
+	uint32 EndX = FMath::Min((uint32)Origin.X + BRICK_SIZE, NodeCount[0]);
+	uint32 EndY = FMath::Min((uint32)Origin.Y + BRICK_SIZE, NodeCount[1]);
+	uint32 EndZ = FMath::Min((uint32)Origin.Z + BRICK_SIZE, NodeCount[2]);
+
+	for (uint32 X = Origin.X; X < EndX; X++)
+	{
+		for (uint32 Y = Origin.Y; Y < EndY; Y++)
+		{
+			for (uint32 Z = Origin.Z; Z < EndZ; Z++)
+			{
+				OutIndexes.push_back(X * NodeCountYZ + Y * NodeCount[2] + Z);
+			}
+		}
+	}
+}
+
+void CPathOuterGrid::SetBrickUniform(uint32 BrickIndex, bool IsFree)
+{
+	FScopeLock Lock(&Mutex);
+	PublishBrick(BrickIndex, UniformBricks[IsFree]);
+}
+
+bool CPathOuterGrid::TryCollapseBrick(uint32 BrickIndex)
+{
+	const CPathOctree* Brick = GetBrick(BrickIndex);
+	if (!IsMaterialized(Brick))
+		return true;
+
+	FIntVector Origin = GetBrickOrigin(BrickIndex);
+	int32 UniformData = -1;
+
+	// Trees outside of the volume are never written to, so they are skipped
+	for (uint32 LocalX = 0; LocalX < BRICK_SIZE && Origin.X + LocalX < NodeCount[0]; LocalX++)
+	{
+		for (uint32 LocalY = 0; LocalY < BRICK_SIZE && Origin.Y + LocalY < NodeCount[1]; LocalY++)
+		{
+			for (uint32 LocalZ = 0; LocalZ < BRICK_SIZE && Origin.Z + LocalZ < NodeCount[2]; LocalZ++)
+			{
+				const CPathOctree& Tree = Brick[(LocalX << (2 * BRICK_BITS)) | (LocalY << BRICK_BITS) | LocalZ];
+				if (Tree.Children || Tree.Data > 1)
+					return false;
+
+				if (UniformData < 0)
+					UniformData = Tree.Data;
+				else if (UniformData != (int32)Tree.Data)
+					return false;
+			}
+		}
+	}
+
+	SetBrickUniform(BrickIndex, UniformData == 1);
+	return true;
+}
+
+void CPathOuterGrid::Empty()
+{
+	for (std::atomic<CPathOctree*>& Brick : Bricks)
+	{
+		if (IsMaterialized(Brick.load(std::memory_order_relaxed)))
+			delete[] Brick.load(std::memory_order_relaxed);
+	}
+	Bricks.clear();
+	MaterializedBricks = 0;
+}
+
+void CPathOuterGrid::ReleaseBrick(CPathOctree* Brick)
+{
+	if (DeferRelease)
+		DeferRelease([Brick]() { delete[] Brick; });
+	else
+		delete[] Brick;
+}
+
+uint64 CPathOuterGrid::GetMemoryUsage() const
+{
+	return ((uint64)MaterializedBricks + 2) * TREES_PER_BRICK * sizeof(CPathOctree) + Bricks.capacity() * sizeof(std::atomic<CPathOctree*>);
+}
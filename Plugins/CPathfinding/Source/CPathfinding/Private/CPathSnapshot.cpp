@@ -0,0 +1,145 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathSnapshot.h"
+#include "Misc/ScopeLock.h"
+#include "HAL/PlatformProcess.h"
+
+// Snapshot pinned on this thread. Kept out of the class, exported thread local members don't work across modules.
+static thread_local const CPathSnapshots* PinnedSnapshots = nullptr;
+static thread_local uint32 PinnedIndex = 0;
+
+
+const FCPathSnapshot& CPathSnapshots::GetCurrent() const
+{
+	if (PinnedSnapshots == this)
+		return Snapshots[PinnedIndex];
+	return Snapshots[Published.load()];
+}
+
+void CPathSnapshots::Enable()
+{
+	uint32 Other = 1 - Published.load();
+	Snapshots[Other] = Snapshots[Published.load()];
+	bEnabled = true;
+}
+
+void CPathSnapshots::Update(TFunctionRef<void(FCPathSnapshot& Snapshot)> Apply)
+{
+	const CPathSnapshots* PreviousSnapshots = PinnedSnapshots;
+	uint32 PreviousIndex = PinnedIndex;
+	uint32 NewVersion = ++LastVersion;
+
+	// The first pass updates the copy nobody reads and publishes it, the second one the copy searches just left
+	for (uint32 Pass = 0; Pass < (bEnabled ? 2u : 1u); Pass++)
+	{
+		uint32 Index = bEnabled ? 1 - Published.load() : Published.load();
+		if (bEnabled)
+			WaitForReaders(Index);
+
+		PinnedSnapshots = this;
+		PinnedIndex = Index;
+		Snapshots[Index].Version = NewVersion;
+		Apply(Snapshots[Index]);
+
+		if (bEnabled && Pass == 0)
+			Published.store(Index);
+	}
+
+	PinnedSnapshots = PreviousSnapshots;
+	PinnedIndex = PreviousIndex;
+}
+
+void CPathSnapshots::Retire(TFunction<void()>&& Release)
+{
+	if (!bEnabled)
+	{
+		Release();
+		return;
+	}
+
+	FScopeLock Lock(&RetiredMutex);
+	Retired.push_back(MoveTemp(Release));
+}
+
+void CPathSnapshots::Reclaim()
+{
+	std::vector<TFunction<void()>> Releases;
+	{
+		FScopeLock Lock(&RetiredMutex);
+		Releases.swap(Retired);
+	}
+
+	for (auto& Release : Releases)
+	{
+		Release();
+	}
+}
+
+void CPathSnapshots::Empty()
+{
+	Reclaim();
+	LastVersion++;
+	for (FCPathSnapshot& Snapshot : Snapshots)
+	{
+		Snapshot.Graph.Empty();
+		Snapshot.Hierarchy.Empty();
+		Snapshot.ChangeLog.clear();
+		Snapshot.Version = LastVersion;
+	}
+	Published.store(0);
+	bEnabled = false;
+}
+
+uint32 CPathSnapshots::Pin() const
+{
+	// The update may publish the other copy between reading Published and incrementing Readers,
+	// it only waits for readers it can see, so the pin is checked again after it's visible
+	while (true)
+	{
+		uint32 Index = Published.load();
+		Readers[Index]++;
+		if (Published.load() == Index)
+			return Index;
+		Readers[Index]--;
+	}
+}
+
+void CPathSnapshots::Unpin(uint32 Index) const
+{
+	Readers[Index]--;
+}
+
+void CPathSnapshots::WaitForReaders(uint32 Index) const
+{
+	// Searches pin for one slice at most, so this is short
+	while (Readers[Index].load() > 0)
+	{
+		FPlatformProcess::YieldThread();
+	}
+}
+
+
+FCPathSnapshotScope::FCPathSnapshotScope(const CPathSnapshots& InSnapshots)
+	:
+	Snapshots(InSnapshots)
+{
+	if (PinnedSnapshots == &Snapshots)
+		return;
+
+	// Pin of another volume is restored afterwards
+	PreviousSnapshots = PinnedSnapshots;
+	PreviousIndex = PinnedIndex;
+	Index = (int32)Snapshots.Pin();
+	PinnedSnapshots = &Snapshots;
+	PinnedIndex = (uint32)Index;
+}
+
+FCPathSnapshotScope::~FCPathSnapshotScope()
+{
+	if (Index < 0)
+		return;
+
+	PinnedSnapshots = PreviousSnapshots;
+	PinnedIndex = PreviousIndex;
+	Snapshots.Unpin((uint32)Index);
+}
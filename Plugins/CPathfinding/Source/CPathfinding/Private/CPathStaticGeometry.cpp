@@ -0,0 +1,591 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathStaticGeometry.h"
+#include "CPathVolume.h"
+#include "EngineUtils.h"
+#include "Engine/World.h"
+#include "Engine/StaticMesh.h"
+#include "Components/PrimitiveComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "StaticMeshResources.h"
+#include "Math/VectorRegister.h"
+
+
+// ------- Triangle/box test ---------------------------------------
+
+// Separating axis test of 4 triangles against a box (Akenine-Moller), all relative to the box center.
+// Returns a mask of lanes that overlap the box, touching counts as overlapping.
+static inline int32 OverlappingLanes(const float (&Coords)[9][4], const VectorRegister4Float (&Center)[3], const VectorRegister4Float (&Extent)[3])
+{
+	VectorRegister4Float V[3][3];
+	for (int Vertex = 0; Vertex < 3; Vertex++)
+	{
+		for (int Axis = 0; Axis < 3; Axis++)
+		{
+			V[Vertex][Axis] = VectorSubtract(VectorLoadAligned(Coords[Vertex * 3 + Axis]), Center[Axis]);
+		}
+	}
+
+	VectorRegister4Float Separated = VectorZero();
+	auto TestAxis = [&Separated](VectorRegister4Float P0, VectorRegister4Float P1, VectorRegister4Float P2, VectorRegister4Float Radius)
+	{
+		VectorRegister4Float Min = VectorMin(VectorMin(P0, P1), P2);
+		VectorRegister4Float Max = VectorMax(VectorMax(P0, P1), P2);
+		Separated = VectorBitwiseOr(Separated, VectorBitwiseOr(VectorCompareGT(Min, Radius), VectorCompareGT(VectorNegate(Radius), Max)));
+	};
+
+	// Box faces, same as comparing bounding boxes
+	for (int Axis = 0; Axis < 3; Axis++)
+	{
+		TestAxis(V[0][Axis], V[1][Axis], V[2][Axis], Extent[Axis]);
+	}
+
+	VectorRegister4Float Edges[3][3];
+	for (int Axis = 0; Axis < 3; Axis++)
+	{
+		Edges[0][Axis] = VectorSubtract(V[1][Axis], V[0][Axis]);
+		Edges[1][Axis] = VectorSubtract(V[2][Axis], V[1][Axis]);
+		Edges[2][Axis] = VectorSubtract(V[0][Axis], V[2][Axis]);
+	}
+
+	// Cross products of box axes and edges. For box axis A, the separating axis is (0, -Edge[A2], Edge[A1]) rotated so A is first.
+	for (int Edge = 0; Edge < 3; Edge++)
+	{
+		for (int Axis = 0; Axis < 3; Axis++)
+		{
+			const int A1 = (Axis + 1) % 3;
+			const int A2 = (Axis + 2) % 3;
+			const VectorRegister4Float& E1 = Edges[Edge][A1];
+			const VectorRegister4Float& E2 = Edges[Edge][A2];
+			auto Project = [&](const VectorRegister4Float (&Vertex)[3])
+			{
+				return VectorSubtract(VectorMultiply(E1, Vertex[A2]), VectorMultiply(E2, Vertex[A1]));
+			};
+			VectorRegister4Float Radius = VectorMultiplyAdd(Extent[A1], VectorAbs(E2), VectorMultiply(Extent[A2], VectorAbs(E1)));
+			TestAxis(Project(V[0]), Project(V[1]), Project(V[2]), Radius);
+		}
+	}
+
+	// Triangle plane
+	VectorRegister4Float Normal[3];
+	for (int Axis = 0; Axis < 3; Axis++)
+	{
+		const int A1 = (Axis + 1) % 3;
+		const int A2 = (Axis + 2) % 3;
+		Normal[Axis] = VectorSubtract(VectorMultiply(Edges[0][A1], Edges[1][A2]), VectorMultiply(Edges[0][A2], Edges[1][A1]));
+	}
+	VectorRegister4Float Distance = VectorMultiplyAdd(Normal[0], V[0][0], VectorMultiplyAdd(Normal[1], V[0][1], VectorMultiply(Normal[2], V[0][2])));
+	VectorRegister4Float Radius = VectorMultiplyAdd(Extent[0], VectorAbs(Normal[0]),
+		VectorMultiplyAdd(Extent[1], VectorAbs(Normal[1]), VectorMultiply(Extent[2], VectorAbs(Normal[2]))));
+	TestAxis(Distance, Distance, Distance, Radius);
+
+	return ~VectorMaskBits(Separated) & 0xF;
+}
+
+
+// ------- CPathStaticGeometry ---------------------------------------
+
+bool CPathStaticGeometry::Gather(const ACPathVolume* Volume)
+{
+	Empty();
+
+	CellSize = Volume->GetVoxelSizeByDepth(0);
+	GridMin = Volume->StartPosition - FVector(CellSize / 2.f);
+	for (int Axis = 0; Axis < 3; Axis++)
+	{
+		CellCount[Axis] = Volume->NodeCount[Axis];
+	}
+
+	// Trace shapes reach outside of the volume by the agent's size, and bricks on its edge by up to a brick
+	FVector Reach(CellSize * CPathOuterGrid::BRICK_SIZE + FMath::Max(Volume->AgentRadius, Volume->AgentHalfHeight));
+	Bounds = FBox(GridMin - Reach, GridMin + FVector(CellCount[0], CellCount[1], CellCount[2]) * CellSize + Reach);
+
+	for (TActorIterator<AActor> Actor(Volume->GetWorld()); Actor; ++Actor)
+	{
+		TInlineComponentArray<UPrimitiveComponent*> Primitives(*Actor);
+		for (UPrimitiveComponent* Primitive : Primitives)
+		{
+			// Overlap tests find blocking and overlapping components of any mobility, movable ones where they are right now
+			if (!Primitive->IsQueryCollisionEnabled()
+				|| Primitive->GetCollisionResponseToChannel(Volume->TraceChannel) == ECR_Ignore
+				|| !Bounds.Intersect(Primitive->Bounds.GetBox()))
+				continue;
+
+			if (!AddPrimitive(Primitive))
+			{
+#ifdef LOG_GENERATORS
+				UE_LOG(LogTemp, Warning, TEXT("%s: collision of %s can't be gathered, generating with physics"), *Volume->GetName(), *Primitive->GetReadableName());
+#endif
+				Empty();
+				return false;
+			}
+		}
+	}
+
+	Build();
+	bGathered = true;
+
+#ifdef LOG_GENERATORS
+	UE_LOG(LogTemp, Warning, TEXT("%s: gathered %u static triangles in %u batches, %u solids"), *Volume->GetName(), TriangleCount, (uint32)Batches.size(), (uint32)Solids.size());
+#endif
+	return true;
+}
+
+void CPathStaticGeometry::Empty()
+{
+	Batches.clear();
+	Batches.shrink_to_fit();
+	CellFirstBatch.clear();
+	CellFirstBatch.shrink_to_fit();
+	Vertices.clear();
+	Vertices.shrink_to_fit();
+	Solids.clear();
+	Solids.shrink_to_fit();
+	SolidPlanes.clear();
+	SolidPlanes.shrink_to_fit();
+	CellSolids.clear();
+	CellSolids.shrink_to_fit();
+	CellFirstSolid.clear();
+	CellFirstSolid.shrink_to_fit();
+	TriangleCount = 0;
+	bGathered = false;
+}
+
+bool CPathStaticGeometry::IsBoxFree(FVector Center, FVector Extent) const
+{
+	FIntVector Min, Max;
+	GetCellRange(Center - Extent, Center + Extent, Min, Max);
+
+	const VectorRegister4Float CenterRegister[3] = { VectorSetFloat1((float)Center.X), VectorSetFloat1((float)Center.Y), VectorSetFloat1((float)Center.Z) };
+	const VectorRegister4Float ExtentRegister[3] = { VectorSetFloat1((float)Extent.X), VectorSetFloat1((float)Extent.Y), VectorSetFloat1((float)Extent.Z) };
+
+	// Triangles spanning several cells may be tested more than once, which is cheaper than deduplicating them
+	for (int32 X = Min.X; X <= Max.X; X++)
+	{
+		for (int32 Y = Min.Y; Y <= Max.Y; Y++)
+		{
+			for (int32 Z = Min.Z; Z <= Max.Z; Z++)
+			{
+				uint32 Cell = GetCellIndex(X, Y, Z);
+				for (uint32 Batch = CellFirstBatch[Cell]; Batch < CellFirstBatch[Cell + 1]; Batch++)
+				{
+					if (OverlappingLanes(Batches[Batch].Coords, CenterRegister, ExtentRegister))
+						return false;
+				}
+			}
+		}
+	}
+	return !IsInsideSolid(Center);
+}
+
+bool CPathStaticGeometry::IsSphereFree(FVector Center, float Radius) const
+{
+	FIntVector Min, Max;
+	GetCellRange(Center - FVector(Radius), Center + FVector(Radius), Min, Max);
+	const double RadiusSquared = (double)Radius * Radius;
+
+	const VectorRegister4Float CenterRegister[3] = { VectorSetFloat1((float)Center.X), VectorSetFloat1((float)Center.Y), VectorSetFloat1((float)Center.Z) };
+	const VectorRegister4Float ExtentRegister[3] = { VectorSetFloat1(Radius), VectorSetFloat1(Radius), VectorSetFloat1(Radius) };
+
+	for (int32 X = Min.X; X <= Max.X; X++)
+	{
+		for (int32 Y = Min.Y; Y <= Max.Y; Y++)
+		{
+			for (int32 Z = Min.Z; Z <= Max.Z; Z++)
+			{
+				uint32 Cell = GetCellIndex(X, Y, Z);
+				for (uint32 Batch = CellFirstBatch[Cell]; Batch < CellFirstBatch[Cell + 1]; Batch++)
+				{
+					const float (&Coords)[9][4] = Batches[Batch].Coords;
+
+					// Only lanes touching the bounding box of the sphere need the exact distance
+					int32 Lanes = OverlappingLanes(Coords, CenterRegister, ExtentRegister);
+					for (int32 Lane = 0; Lanes; Lane++, Lanes >>= 1)
+					{
+						if (!(Lanes & 1))
+							continue;
+
+						FVector A(Coords[0][Lane], Coords[1][Lane], Coords[2][Lane]);
+						FVector B(Coords[3][Lane], Coords[4][Lane], Coords[5][Lane]);
+						FVector C(Coords[6][Lane], Coords[7][Lane], Coords[8][Lane]);
+						if (FVector::DistSquared(FMath::ClosestPointOnTriangleToPoint(Center, A, B, C), Center) <= RadiusSquared)
+							return false;
+					}
+				}
+			}
+		}
+	}
+	return !IsInsideSolid(Center);
+}
+
+bool CPathStaticGeometry::IsInsideSolid(FVector Location) const
+{
+	FIntVector Cell, Unused;
+	GetCellRange(Location, Location, Cell, Unused);
+	uint32 CellIndex = GetCellIndex(Cell.X, Cell.Y, Cell.Z);
+
+	for (uint32 Index = CellFirstSolid[CellIndex]; Index < CellFirstSolid[CellIndex + 1]; Index++)
+	{
+		const FSolid& Solid = Solids[CellSolids[Index]];
+		if (!Solid.Box.IsInsideOrOn(Location))
+			continue;
+
+		bool bInside = true;
+		for (uint32 Plane = Solid.FirstPlane; Plane < Solid.FirstPlane + Solid.PlaneCount && bInside; Plane++)
+		{
+			bInside = SolidPlanes[Plane].PlaneDot(Location) <= 0;
+		}
+		if (bInside)
+			return true;
+	}
+	return false;
+}
+
+bool CPathStaticGeometry::AddPrimitive(UPrimitiveComponent* Primitive)
+{
+	UBodySetup* BodySetup = Primitive->GetBodySetup();
+	if (!BodySetup)
+		return false;
+
+	TArray<FTransform, TInlineAllocator<1>> Transforms;
+	if (UInstancedStaticMeshComponent* Instanced = Cast<UInstancedStaticMeshComponent>(Primitive))
+	{
+		for (int32 Instance = 0; Instance < Instanced->GetInstanceCount(); Instance++)
+		{
+			Instanced->GetInstanceTransform(Instance, Transforms.AddDefaulted_GetRef(), true);
+		}
+	}
+	else
+	{
+		Transforms.Add(Primitive->GetComponentTransform());
+	}
+
+	// Overlap tests only see complex collision if it's used as simple
+	if (BodySetup->CollisionTraceFlag != CTF_UseComplexAsSimple)
+	{
+		for (const FTransform& Transform : Transforms)
+			AddAggregateGeometry(BodySetup->AggGeom, Transform);
+		return true;
+	}
+
+	UStaticMeshComponent* MeshComponent = Cast<UStaticMeshComponent>(Primitive);
+	if (!MeshComponent)
+		return false;
+
+	for (const FTransform& Transform : Transforms)
+	{
+		if (!AddStaticMesh(MeshComponent->GetStaticMesh(), Transform))
+			return false;
+	}
+	return true;
+}
+
+bool CPathStaticGeometry::AddStaticMesh(const UStaticMesh* Mesh, const FTransform& Transform)
+{
+	if (!Mesh || !Mesh->GetRenderData() || Mesh->GetRenderData()->LODResources.Num() == 0)
+		return false;
+
+	const auto& LODResources = Mesh->GetRenderData()->LODResources;
+	const FStaticMeshLODResources& LOD = LODResources[FMath::Clamp(Mesh->LODForCollision, 0, LODResources.Num() - 1)];
+	const FPositionVertexBuffer& Positions = LOD.VertexBuffers.PositionVertexBuffer;
+
+	// Without CPU access the vertex data only lives on the GPU
+	if (!Positions.GetVertexData() || Positions.GetNumVertices() == 0)
+		return false;
+
+	TArray<uint32> Indices;
+	LOD.IndexBuffer.GetCopy(Indices);
+	if (Indices.Num() == 0)
+		return false;
+
+	for (const FStaticMeshSection& Section : LOD.Sections)
+	{
+		if (!Section.bEnableCollision)
+			continue;
+
+		uint32 LastIndex = FMath::Min(Section.FirstIndex + Section.NumTriangles * 3, (uint32)Indices.Num());
+		for (uint32 Index = Section.FirstIndex; Index + 2 < LastIndex; Index += 3)
+		{
+			AddTriangle(Transform.TransformPosition(FVector(Positions.VertexPosition(Indices[Index]))),
+				Transform.TransformPosition(FVector(Positions.VertexPosition(Indices[Index + 1]))),
+				Transform.TransformPosition(FVector(Positions.VertexPosition(Indices[Index + 2]))));
+		}
+	}
+	return true;
+}
+
+void CPathStaticGeometry::AddAggregateGeometry(const FKAggregateGeom& Geometry, const FTransform& Transform)
+{
+	for (const FKBoxElem& Box : Geometry.BoxElems)
+	{
+		AddBox(Box.GetTransform() * Transform, FVector(Box.X, Box.Y, Box.Z) / 2.f);
+	}
+
+	for (const FKSphereElem& Sphere : Geometry.SphereElems)
+	{
+		AddBox(Sphere.GetTransform() * Transform, FVector(Sphere.Radius));
+	}
+
+	for (const FKSphylElem& Sphyl : Geometry.SphylElems)
+	{
+		AddBox(Sphyl.GetTransform() * Transform, FVector(Sphyl.Radius, Sphyl.Radius, Sphyl.Length / 2.f + Sphyl.Radius));
+	}
+
+	for (const FKTaperedCapsuleElem& Capsule : Geometry.TaperedCapsuleElems)
+	{
+		float Radius = FMath::Max(Capsule.Radius0, Capsule.Radius1);
+		AddBox(Capsule.GetTransform() * Transform, FVector(Radius, Radius, Capsule.Length / 2.f + Radius));
+	}
+
+	for (const FKConvexElem& Convex : Geometry.ConvexElems)
+	{
+		FTransform ConvexTransform = Convex.GetTransform() * Transform;
+
+		// Hull triangles aren't always cooked, its bounding box is the closest safe shape then
+		if (Convex.IndexData.Num() < 3)
+		{
+			FBox Box = Convex.ElemBox.IsValid ? Convex.ElemBox : FBox(Convex.VertexData);
+			AddBox(FTransform(Box.GetCenter()) * ConvexTransform, Box.GetExtent());
+			continue;
+		}
+
+		TArray<FVector> Points;
+		Points.Reserve(Convex.VertexData.Num());
+		for (const FVector& Vertex : Convex.VertexData)
+		{
+			Points.Add(ConvexTransform.TransformPosition(Vertex));
+		}
+
+		const int32 IndexCount = Convex.IndexData.Num() / 3 * 3;
+		for (int32 Index = 0; Index < IndexCount; Index += 3)
+		{
+			AddTriangle(Points[Convex.IndexData[Index]], Points[Convex.IndexData[Index + 1]], Points[Convex.IndexData[Index + 2]]);
+		}
+		AddSolid(Points, Convex.IndexData.GetData(), IndexCount);
+	}
+}
+
+void CPathStaticGeometry::AddBox(const FTransform& Transform, FVector Extent)
+{
+	FVector Corners[8];
+	for (int Corner = 0; Corner < 8; Corner++)
+	{
+		FVector Sign(Corner & 1 ? 1 : -1, Corner & 2 ? 1 : -1, Corner & 4 ? 1 : -1);
+		Corners[Corner] = Transform.TransformPosition(Sign * Extent);
+	}
+
+	// 2 triangles per face, winding doesn't matter for overlap tests
+	static const int Faces[6][4] = {
+		{0, 2, 6, 4}, {1, 3, 7, 5},
+		{0, 1, 5, 4}, {2, 3, 7, 6},
+		{0, 1, 3, 2}, {4, 5, 7, 6}
+	};
+	int32 PlaneIndices[6 * 3];
+	for (int Face = 0; Face < 6; Face++)
+	{
+		AddTriangle(Corners[Faces[Face][0]], Corners[Faces[Face][1]], Corners[Faces[Face][2]]);
+		AddTriangle(Corners[Faces[Face][0]], Corners[Faces[Face][2]], Corners[Faces[Face][3]]);
+		for (int Vertex = 0; Vertex < 3; Vertex++)
+		{
+			PlaneIndices[Face * 3 + Vertex] = Faces[Face][Vertex];
+		}
+	}
+	AddSolid(TArray<FVector>(Corners, 8), PlaneIndices, 6 * 3);
+}
+
+void CPathStaticGeometry::AddTriangle(FVector A, FVector B, FVector C)
+{
+	FBox TriangleBox(ForceInit);
+	TriangleBox += A;
+	TriangleBox += B;
+	TriangleBox += C;
+	if (!Bounds.Intersect(TriangleBox))
+		return;
+
+	Vertices.push_back(FVector3f(A));
+	Vertices.push_back(FVector3f(B));
+	Vertices.push_back(FVector3f(C));
+}
+
+void CPathStaticGeometry::AddSolid(const TArray<FVector>& Points, const int32* Indices, int32 IndexCount)
+{
+	FBox Box(Points);
+	if (IndexCount < 12 || !Box.IsValid || !Bounds.Intersect(Box))
+		return;
+
+	// Average of hull points is inside of it
+	FVector Inside = FVector::ZeroVector;
+	for (const FVector& Point : Points)
+	{
+		Inside += Point;
+	}
+	Inside /= Points.Num();
+
+	FSolid Solid{ Box, (uint32)SolidPlanes.size(), 0 };
+	for (int32 Index = 0; Index + 2 < IndexCount; Index += 3)
+	{
+		const FVector& A = Points[Indices[Index]];
+		FVector Normal = FVector::CrossProduct(Points[Indices[Index + 1]] - A, Points[Indices[Index + 2]] - A);
+		if (!Normal.Normalize())
+			continue;
+
+		FPlane Plane(A, Normal);
+		SolidPlanes.push_back(Plane.PlaneDot(Inside) > 0 ? Plane.Flip() : Plane);
+		Solid.PlaneCount++;
+	}
+
+	// Flat hulls have no inside
+	if (Solid.PlaneCount < 4)
+	{
+		SolidPlanes.resize(Solid.FirstPlane);
+		return;
+	}
+	Solids.push_back(Solid);
+}
+
+void CPathStaticGeometry::Build()
+{
+	TriangleCount = (uint32)Vertices.size() / 3;
+	uint32 CellTotal = CellCount[0] * CellCount[1] * CellCount[2];
+
+	// Big triangles, like slopes and walls placed diagonally, touch only a few of the cells their bounding box overlaps
+	auto ForEachCell = [this](uint32 Triangle, auto&& Function)
+	{
+		const FVector3f* Triangle3 = &Vertices[Triangle * 3];
+		FVector Min(FVector3f::Min(FVector3f::Min(Triangle3[0], Triangle3[1]), Triangle3[2]));
+		FVector Max(FVector3f::Max(FVector3f::Max(Triangle3[0], Triangle3[1]), Triangle3[2]));
+		FIntVector CellMin, CellMax;
+		GetCellRange(Min, Max, CellMin, CellMax);
+		if (CellMin == CellMax)
+		{
+			Function(GetCellIndex(CellMin.X, CellMin.Y, CellMin.Z));
+			return;
+		}
+
+		// Same triangle in every lane
+		FTriangleBatch Single;
+		for (int Vertex = 0; Vertex < 3; Vertex++)
+		{
+			for (int Lane = 0; Lane < 4; Lane++)
+			{
+				Single.Coords[Vertex * 3][Lane] = Triangle3[Vertex].X;
+				Single.Coords[Vertex * 3 + 1][Lane] = Triangle3[Vertex].Y;
+				Single.Coords[Vertex * 3 + 2][Lane] = Triangle3[Vertex].Z;
+			}
+		}
+
+		for (int32 X = CellMin.X; X <= CellMax.X; X++)
+			for (int32 Y = CellMin.Y; Y <= CellMax.Y; Y++)
+				for (int32 Z = CellMin.Z; Z <= CellMax.Z; Z++)
+				{
+					// Slightly larger, so rounding doesn't drop triangles that only touch the cell's side
+					FBox CellBox = GetCellBox(X, Y, Z).ExpandBy(CellSize * 0.01f);
+					FVector Center = CellBox.GetCenter();
+					FVector Extent = CellBox.GetExtent();
+					const VectorRegister4Float CenterRegister[3] = { VectorSetFloat1((float)Center.X), VectorSetFloat1((float)Center.Y), VectorSetFloat1((float)Center.Z) };
+					const VectorRegister4Float ExtentRegister[3] = { VectorSetFloat1((float)Extent.X), VectorSetFloat1((float)Extent.Y), VectorSetFloat1((float)Extent.Z) };
+					if (OverlappingLanes(Single.Coords, CenterRegister, ExtentRegister))
+						Function(GetCellIndex(X, Y, Z));
+				}
+	};
+
+	// Triangles of every cell, counted first so they fit in one array
+	std::vector<uint32> CellFirstTriangle(CellTotal + 1, 0);
+	for (uint32 Triangle = 0; Triangle < TriangleCount; Triangle++)
+	{
+		ForEachCell(Triangle, [&](uint32 Cell) { CellFirstTriangle[Cell + 1]++; });
+	}
+	for (uint32 Cell = 0; Cell < CellTotal; Cell++)
+	{
+		CellFirstTriangle[Cell + 1] += CellFirstTriangle[Cell];
+	}
+
+	std::vector<uint32> CellTriangles(CellFirstTriangle.back());
+	std::vector<uint32> CellFill(CellFirstTriangle.begin(), CellFirstTriangle.end() - 1);
+	for (uint32 Triangle = 0; Triangle < TriangleCount; Triangle++)
+	{
+		ForEachCell(Triangle, [&](uint32 Cell) { CellTriangles[CellFill[Cell]++] = Triangle; });
+	}
+
+	CellFirstBatch.assign(CellTotal + 1, 0);
+	for (uint32 Cell = 0; Cell < CellTotal; Cell++)
+	{
+		CellFirstBatch[Cell + 1] = CellFirstBatch[Cell] + (CellFirstTriangle[Cell + 1] - CellFirstTriangle[Cell] + 3) / 4;
+	}
+
+	Batches.resize(CellFirstBatch.back());
+	for (uint32 Cell = 0; Cell < CellTotal; Cell++)
+	{
+		uint32 First = CellFirstTriangle[Cell];
+		uint32 Count = CellFirstTriangle[Cell + 1] - First;
+		for (uint32 Batch = 0; Batch * 4 < Count; Batch++)
+		{
+			FTriangleBatch& Target = Batches[CellFirstBatch[Cell] + Batch];
+			for (uint32 Lane = 0; Lane < 4; Lane++)
+			{
+				uint32 Slot = Batch * 4 + Lane < Count ? Batch * 4 + Lane : Batch * 4;
+				const FVector3f* Triangle3 = &Vertices[CellTriangles[First + Slot] * 3];
+				for (int Vertex = 0; Vertex < 3; Vertex++)
+				{
+					Target.Coords[Vertex * 3][Lane] = Triangle3[Vertex].X;
+					Target.Coords[Vertex * 3 + 1][Lane] = Triangle3[Vertex].Y;
+					Target.Coords[Vertex * 3 + 2][Lane] = Triangle3[Vertex].Z;
+				}
+			}
+		}
+	}
+
+	Vertices.clear();
+	Vertices.shrink_to_fit();
+
+	// Solids are only looked up by the cell of a location, so their bounding box is exact enough
+	CellFirstSolid.assign(CellTotal + 1, 0);
+	auto ForEachSolidCell = [this](const FSolid& Solid, auto&& Function)
+	{
+		FIntVector CellMin, CellMax;
+		GetCellRange(Solid.Box.Min, Solid.Box.Max, CellMin, CellMax);
+		for (int32 X = CellMin.X; X <= CellMax.X; X++)
+			for (int32 Y = CellMin.Y; Y <= CellMax.Y; Y++)
+				for (int32 Z = CellMin.Z; Z <= CellMax.Z; Z++)
+					Function(GetCellIndex(X, Y, Z));
+	};
+	for (const FSolid& Solid : Solids)
+	{
+		ForEachSolidCell(Solid, [&](uint32 Cell) { CellFirstSolid[Cell + 1]++; });
+	}
+	for (uint32 Cell = 0; Cell < CellTotal; Cell++)
+	{
+		CellFirstSolid[Cell + 1] += CellFirstSolid[Cell];
+	}
+
+	CellSolids.resize(CellFirstSolid.back());
+	std::vector<uint32> SolidFill(CellFirstSolid.begin(), CellFirstSolid.end() - 1);
+	for (uint32 Solid = 0; Solid < Solids.size(); Solid++)
+	{
+		ForEachSolidCell(Solids[Solid], [&](uint32 Cell) { CellSolids[SolidFill[Cell]++] = Solid; });
+	}
+}
+
+void CPathStaticGeometry::GetCellRange(FVector Min, FVector Max, FIntVector& OutMin, FIntVector& OutMax) const
+{
+	for (int Axis = 0; Axis < 3; Axis++)
+	{
+		OutMin[Axis] = FMath::Clamp(FMath::FloorToInt((Min[Axis] - GridMin[Axis]) / CellSize), 0, CellCount[Axis] - 1);
+		OutMax[Axis] = FMath::Clamp(FMath::FloorToInt((Max[Axis] - GridMin[Axis]) / CellSize), 0, CellCount[Axis] - 1);
+	}
+}
+
+FBox CPathStaticGeometry::GetCellBox(int32 X, int32 Y, int32 Z) const
+{
+	const int32 Cell[3] = { X, Y, Z };
+	FBox Box(ForceInit);
+	for (int Axis = 0; Axis < 3; Axis++)
+	{
+		Box.Min[Axis] = Cell[Axis] == 0 ? Bounds.Min[Axis] : GridMin[Axis] + Cell[Axis] * CellSize;
+		Box.Max[Axis] = Cell[Axis] == CellCount[Axis] - 1 ? Bounds.Max[Axis] : GridMin[Axis] + (Cell[Axis] + 1) * CellSize;
+	}
+	Box.IsValid = true;
+	return Box;
+}
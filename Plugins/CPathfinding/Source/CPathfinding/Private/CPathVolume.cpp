@@ -8,6 +8,7 @@
 #include <deque>
 #include <list>
 #include <unordered_set>
+#include <algorithm>
 #include "Misc/FileHelper.h"
 #include "Misc/Paths.h"
 #include "CPathDynamicObstacle.h"
@@ -16,7 +17,12 @@
 #include "CPathFindPath.h"
 #include "CPathCore.h"
 #include "Engine/Selection.h"
+#include "EngineUtils.h"
+#include "GameFramework/PlayerStart.h"
 #include "GenericPlatform/GenericPlatformAtomics.h"
+#include "Engine/World.h"
+#include "Engine/LevelBounds.h"
+#include "Engine/Level.h"
 
 
 
@@ -34,7 +40,8 @@ ACPathVolume::ACPathVolume()
 
 
 #endif
-	DepthsToDraw = { true, true, true, true };
+	DepthsToDraw.Init(true, MAX_DEPTH + 1);
+	OctreeCountAtDepth.Init(0, MAX_DEPTH + 1);
 
 
 	FVector Location = GetActorLocation() - VolumeBox->GetScaledBoxExtent() + VoxelSize;
@@ -44,7 +51,7 @@ ACPathVolume::ACPathVolume()
 
 void ACPathVolume::DebugDrawNeighbours(FVector WorldLocation)
 {
-	uint32 LeafID;
+	CPathTreeID LeafID;
 	if (FindLeafByWorldLocation(WorldLocation, LeafID))
 	{
 		DrawDebugBox(GetWorld(), WorldLocationFromTreeID(LeafID), FVector(GetVoxelSizeByDepth(ExtractDepth(LeafID)) / 2.f), FColor::Emerald, false, 5, 10, DebugBoxesThickness*1.3);
@@ -57,7 +64,7 @@ void ACPathVolume::DebugDrawNeighbours(FVector WorldLocation)
 	}
 }
 
-bool ACPathVolume::DrawDebugVoxel(uint32 TreeID, bool DrawIfNotLeaf, float Duration, FColor Color, CPathVoxelDrawData* OutDrawData)
+bool ACPathVolume::DrawDebugVoxel(CPathTreeID TreeID, bool DrawIfNotLeaf, float Duration, FColor Color, CPathVoxelDrawData* OutDrawData)
 {
 
 	uint32 Depth;
@@ -135,13 +142,13 @@ void ACPathVolume::DrawDebugNodesAroundLocation(FVector WorldLocation, int Voxel
 	}
 	PreviousDrawAroundLocationData.clear();
 
-	uint32 OriginTreeID = 0xFFFFFFFF;
+	CPathTreeID OriginTreeID = INVALID_TREEID;
 	CPathOctree* OriginTree = FindLeafByWorldLocation(WorldLocation, OriginTreeID, false);
 	if (!OriginTree)
 		return;
 
-	std::list<uint32> IndexList;
-	std::unordered_set<uint32> VisitedIndexes;
+	std::list<CPathTreeID> IndexList;
+	std::unordered_set<CPathTreeID> VisitedIndexes;
 
 	CPathAStarNode StartNode(OriginTreeID);
 	StartNode.FitnessResult = 0;
@@ -154,7 +161,7 @@ void ACPathVolume::DrawDebugNodesAroundLocation(FVector WorldLocation, int Voxel
 
 	while (!IndexList.empty() && VoxelLimit > 0)
 	{
-		uint32 CurrID = IndexList.front();
+		CPathTreeID CurrID = IndexList.front();
 		IndexList.pop_front();
 		CPathVoxelDrawData DrawData;
 		if (DrawDebugVoxel(CurrID, true, Duration, FColor::Green, &DrawData))
@@ -164,8 +171,8 @@ void ACPathVolume::DrawDebugNodesAroundLocation(FVector WorldLocation, int Voxel
 		}
 
 
-		std::vector<uint32> Neighbours = FindNeighbourLeafs(CurrID, !DrawOccupied);
-		for (uint32 NewTreeID : Neighbours)
+		std::vector<CPathTreeID> Neighbours = FindNeighbourLeafs(CurrID, !DrawOccupied);
+		for (CPathTreeID NewTreeID : Neighbours)
 		{
 
 			// We dont want to redraw nodes
@@ -194,38 +201,53 @@ void ACPathVolume::BeginPlay()
 {
 	Super::BeginPlay();
 
+	// Values set before CPATH_64BIT_TREEID was undefined, or from blueprints
+	OctreeDepth = FMath::Clamp(OctreeDepth, 0, MAX_DEPTH);
+
 	VolumeBox->SetCollisionResponseToChannel(TraceChannel, ECR_Ignore);
 	GenerationFinishedSemaphore = FGenericPlatformProcess::GetSynchEventFromPool();
 
 	if (!ACPathCore::DoesInstanceExist()) 
 	{
 		ACPathCore::EnableNewInstanceCreation();
+		ACPathCore::SetThreadCount(PathfindingThreadCount);
 	}
 	CoreInstance = ACPathCore::GetInstance(GetWorld());
 
+	if (StreamChunks)
+	{
+		LevelAddedHandle = FWorldDelegates::LevelAddedToWorld.AddUObject(this, &ACPathVolume::OnLevelAddedToWorld);
+		LevelRemovedHandle = FWorldDelegates::LevelRemovedFromWorld.AddUObject(this, &ACPathVolume::OnLevelRemovedFromWorld);
+	}
+
 	if (GenerateOnBeginPlay)
 		GenerateGraph();
 }
 
-bool ACPathVolume::GenerateGraph()
+#if WITH_EDITOR
+void ACPathVolume::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
 {
-	GenerationStarted = true;
-	PrintGenerationTime = true;
+	// UPROPERTY meta can't depend on CPATH_64BIT_TREEID, so the limit of the build is applied here
+	if (PropertyChangedEvent.GetPropertyName() == GET_MEMBER_NAME_CHECKED(ACPathVolume, OctreeDepth))
+		OctreeDepth = FMath::Clamp(OctreeDepth, 0, MAX_DEPTH);
 
-	UBoxComponent* tempBox = Cast<UBoxComponent>(GetRootComponent());
-	tempBox->UpdateOverlaps();
-	
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+}
+#endif
 
+void ACPathVolume::InitGenerationData()
+{
 	float Divider = VoxelSize * FMath::Pow(2.f, OctreeDepth);
 
 	NodeCount[0] = FMath::CeilToInt(VolumeBox->GetScaledBoxExtent().X * 2.0 / Divider);
 	NodeCount[1] = FMath::CeilToInt(VolumeBox->GetScaledBoxExtent().Y * 2.0 / Divider);
 	NodeCount[2] = FMath::CeilToInt(VolumeBox->GetScaledBoxExtent().Z * 2.0 / Divider);
 
-	checkf(OctreeDepth <= MAX_DEPTH && OctreeDepth >= 0, TEXT("CPATH - Graph Generation:::OctreeDepth must be within 0 and MAX_DEPTH"));
+	checkf(OctreeDepth <= MAX_DEPTH && OctreeDepth >= 0, TEXT("CPATH - Graph Generation:::OctreeDepth must be within 0 and MAX_DEPTH, define CPATH_64BIT_TREEID for deeper octrees"));
 	//checkf(AgentShape == ECollisionShapeType::Capsule || AgentShape == ECollisionShapeType::Sphere || AgentShape == ECollisionShapeType::Box, TEXT("CPATH - Graph Generation:::Agent shape must be Capsule, Sphere or Box"));
 
 
+	TraceShapesByDepth.clear();
 	for (int i = 0; i <= OctreeDepth; i++)
 	{
 
@@ -252,9 +274,85 @@ bool ACPathVolume::GenerateGraph()
 
 	StartPosition = GetActorLocation() - VolumeBox->GetScaledBoxExtent() + GetVoxelSizeByDepth(0) / 2;
 
-	uint32 OuterNodeCount = NodeCount[0] * NodeCount[1] * NodeCount[2];
-	checkf(OuterNodeCount < DEPTH_0_LIMIT, TEXT("CPATH - Graph Generation:::Depth 0 is too dense, increase OctreeDepth and/or voxel size, or decrease volume area."));
-	Octrees = new CPathOctree[OuterNodeCount];
+	uint64 OuterNodeCount64 = (uint64)NodeCount[0] * NodeCount[1] * NodeCount[2];
+	checkf(OuterNodeCount64 < DEPTH_0_LIMIT, TEXT("CPATH - Graph Generation:::Depth 0 is too dense, increase OctreeDepth and/or voxel size, decrease volume area, or define CPATH_64BIT_TREEID."));
+	Octrees.Init(NodeCount);
+	BrickOrder.resize(Octrees.GetBrickCount());
+	for (uint32 BrickIndex = 0; BrickIndex < BrickOrder.size(); BrickIndex++)
+		BrickOrder[BrickIndex] = BrickIndex;
+	SortByBrickMortonCode(BrickOrder);
+	Chunks.Init(NodeCount, ChunkSizeInBricks, StreamChunks);
+	Occupancy.Init(this);
+	OctreePool.Init(GetMaxOctetCount());
+}
+
+void ACPathVolume::EnableSnapshots()
+{
+	Snapshots.Enable();
+
+	// Searches don't wait for generators from now on, so memory they may be reading is released once the update is over
+	auto Retire = [this](TFunction<void()>&& Release) { Snapshots.Retire(MoveTemp(Release)); };
+	OctreePool.DeferRelease = Retire;
+	Octrees.DeferRelease = Retire;
+	Occupancy.DeferRelease = Retire;
+}
+
+uint64 ACPathVolume::GetMaxOctetCount() const
+{
+	// Every outer tree can have at most 1 + 8 + ... + 8^(OctreeDepth-1) octets
+	uint64 MaxOctetsPerTree = 0;
+	for (int Depth = 0; Depth < OctreeDepth; Depth++)
+	{
+		MaxOctetsPerTree += (uint64)1 << (3 * Depth);
+	}
+	// Regenerated subtrees are built next to the old ones, which are freed only once searches are done with them
+	return 2 * MaxOctetsPerTree * NodeCount[0] * NodeCount[1] * NodeCount[2];
+}
+
+void ACPathVolume::ReleaseGenerationData()
+{
+	// Retired memory belongs to the containers below, so it's released first
+	Snapshots.Empty();
+	OctreePool.DeferRelease = nullptr;
+	Octrees.DeferRelease = nullptr;
+	Occupancy.DeferRelease = nullptr;
+
+	Octrees.Empty();
+	OctreePool.Empty();
+	PathCache.Empty();
+	Occupancy.Empty();
+	Chunks.Empty();
+	BrickOrder.clear();
+	TraceShapesByDepth.clear();
+	StaticGeometry.Empty();
+
+	// After the pool, which may point into the mapped file
+	ReleaseBake();
+}
+
+bool ACPathVolume::GenerateGraph()
+{
+	GenerationStarted = true;
+	PrintGenerationTime = true;
+
+	UBoxComponent* tempBox = Cast<UBoxComponent>(GetRootComponent());
+	tempBox->UpdateOverlaps();
+	
+
+	InitGenerationData();
+
+	// Sublevels that are already visible make their chunks resident, the rest is skipped by generators
+	if (StreamChunks)
+	{
+		for (ULevel* Level : GetWorld()->GetLevels())
+		{
+			if (Level && Level != GetWorld()->PersistentLevel && Level->bIsVisible)
+				OnLevelAddedToWorld(Level, GetWorld());
+		}
+		ChunksPendingRefresh.clear();
+	}
+
+	bool LoadedFromBake = LoadBakedOctree && LoadBake(GetBakeFilePath());
 
 	// If we use all logical threads in the system, the rest of the game
 	// will have no computing power to work with. From my small test sample
@@ -266,38 +364,37 @@ bool ACPathVolume::GenerateGraph()
 	if (MaxGenerationThreads <= 0)
 		MaxGenerationThreads = FPlatformMisc::NumberOfCores() - 1;
 	
-	MaxGenerationThreads = FMath::Min(MaxGenerationThreads, 31);
-
-	uint32 NodesPerThread = OuterNodeCount / MaxGenerationThreads;
-
-	for (int i = 0; i < 64; i++)
-	{
-		ThreadIDs[1] = false;
-	}
+	MaxGenerationThreads = FMath::Clamp(MaxGenerationThreads, 1, 31);
+	CreateGenerators();
 
+	if (VoxelizeStaticGeometry && !LoadedFromBake)
+		StaticGeometry.Gather(this);
 
-	for (int CurrentThread = 0; CurrentThread < MaxGenerationThreads; CurrentThread++)
+	// The first round only covers bricks around points of interest, the rest is generated by InitialGenerationUpdate in waves
+	uint32 FirstRoundBricks = (uint32)BrickOrder.size();
+	if (ProgressiveGeneration && !LoadedFromBake)
 	{
-		uint32 LastIndex = NodesPerThread * (CurrentThread + 1);
-		if (CurrentThread == MaxGenerationThreads - 1)
-			LastIndex += OuterNodeCount % MaxGenerationThreads;
-
-		int ThreadID = GetFreeThreadID();
-		FString ThreadName = FCPathAsyncVolumeGenerator::GetNameFromID(ThreadID);
-		ThreadName.AppendInt(ThreadID);
-		GeneratorThreads.push_back(std::make_unique<FCPathAsyncVolumeGenerator>(this, NodesPerThread * CurrentThread, LastIndex, ThreadID, ThreadName));
-		GeneratorThreads.back()->ThreadRef = FRunnableThread::Create(GeneratorThreads.back().get(), *ThreadName);
-		if (GeneratorThreads.back()->ThreadRef)
+		for (TActorIterator<APlayerStart> PlayerStart(GetWorld()); PlayerStart; ++PlayerStart)
 		{
-			ThreadIDs[ThreadID] = true;
+			PointsOfInterest.Add(PlayerStart->GetActorLocation());
 		}
-		else
+
+		if (PointsOfInterest.Num())
 		{
-			GeneratorThreads.pop_back();
+			SortByDistanceToPointsOfInterest(BrickOrder);
+			FirstRoundBricks = FMath::Min(FirstRoundBricks, (uint32)ProgressiveBricksPerWave);
 		}
-
 	}
-	OuterIndexesPerThread = 5 * (5 + OctreeDepth) * FMath::Pow(8.f, MAX_DEPTH - OctreeDepth);
+	NextProgressiveBrick = FirstRoundBricks;
+
+	// Initial generation is split by bricks of outer trees, so that uniform bricks can be skipped with one test
+	StartGenerators(FirstRoundBricks, MaxGenerationThreads, [LoadedFromBake](FCPathAsyncVolumeGenerator& Generator)
+	{
+		Generator.bFromBake = LoadedFromBake;
+	});
+
+	// Tuned for depths up to 3, deeper trees are more expensive to regenerate so there are fewer of them per thread
+	OuterIndexesPerThread = FMath::Max(1, FMath::RoundToInt(5 * (5 + OctreeDepth) * FMath::Pow(8.f, 3 - OctreeDepth)));
 	// Setting timer for dynamic generation and garbage collection
 	GetWorld()->GetTimerManager().SetTimer(GenerationTimerHandle, this, &ACPathVolume::InitialGenerationUpdate, 1.f / 60.f, true);
 	return true;
@@ -313,10 +410,17 @@ void ACPathVolume::Tick(float DeltaTime)
 
 	if (GeneratorsRunning.load() == 0)
 	{
-		if (GenerationFinishedSemaphore && PathfindersWaiting.load() > 0 && InitialGenerationFinished)
+		if (GenerationFinishedSemaphore && PathfindersWaiting.load() > 0 && InitialGenerationCompleteAtom.load())
 		{
 			GenerationFinishedSemaphore->Trigger();
 		}
+
+		// Searches that could still see memory replaced by the last update were waited for by it
+		if (GeneratorsPendingGraphUpdate.load() == 0)
+			Snapshots.Reclaim();
+
+		// Loaded or cleared while generators were applying records
+		DeltaLog.CommitStaged();
 	}
 
 }
@@ -341,7 +445,7 @@ bool ACPathVolume::IsReadyForFinishDestroy()
 void ACPathVolume::FinishDestroy()
 {
 	// Deleting the graph
-	delete[] Octrees;
+	ReleaseGenerationData();
 
 	Super::FinishDestroy();
 }
@@ -358,7 +462,10 @@ void ACPathVolume::EndPlay(EEndPlayReason::Type EndPlayReason)
 	// If you're not destroying this manyally, before unloading the level, then the 5ms thread hang won't really matter anyway
 	// So only worry about this if you're destroying volumes during the game
 
-	GeneratorThreads.clear();
+	FWorldDelegates::LevelAddedToWorld.Remove(LevelAddedHandle);
+	FWorldDelegates::LevelRemovedFromWorld.Remove(LevelRemovedHandle);
+
+	Generators.clear();
 	GeneratorsRunning.store(0);
 	if (GenerationFinishedSemaphore)
 	{
@@ -368,7 +475,7 @@ void ACPathVolume::EndPlay(EEndPlayReason::Type EndPlayReason)
 	}
 }
 
-bool ACPathVolume::FindPathAsync(UObject* CallingObject, const FName& InFunctionName, FVector Start, FVector End, uint32 SmoothingPasses, int32 UserData, float TimeLimit, bool RequestRawPath, bool RequestUserPath)
+FCPathRequestHandle ACPathVolume::FindPathAsync(UObject* CallingObject, const FName& InFunctionName, FVector Start, FVector End, uint32 SmoothingPasses, int32 UserData, float TimeLimit, bool RequestRawPath, bool RequestUserPath, bool UseJumpPointSearch)
 {
 	FCPathRequest Request;
 	Request.OnPathFound.BindUFunction(CallingObject, InFunctionName);
@@ -376,6 +483,7 @@ bool ACPathVolume::FindPathAsync(UObject* CallingObject, const FName& InFunction
 	Request.Start = Start;
 	Request.End = End;
 	Request.SmoothingPasses = SmoothingPasses;
+	Request.UseJumpPointSearch = UseJumpPointSearch;
 	Request.UserData = UserData;
 	Request.TimeLimit = TimeLimit;
 	Request.RequestRawPath = RequestRawPath;
@@ -384,33 +492,165 @@ bool ACPathVolume::FindPathAsync(UObject* CallingObject, const FName& InFunction
 	return FindPathAsync(Request);
 }
 
-bool ACPathVolume::FindPathAsync(FCPathRequest& Request)
+FCPathRequestHandle ACPathVolume::FindPathAsync(FCPathRequest& Request)
 {
 	if (!CoreInstance)
-		return false;
+		return FCPathRequestHandle();
 
+	Request.State = std::make_shared<FCPathRequestState>();
+	Request.DeadlineTime = Request.Deadline > 0 ? FPlatformTime::Seconds() + Request.Deadline : 0;
 	CoreInstance->AssignAsyncRequest(Request);
 
+	return FCPathRequestHandle(Request.State);
+}
+
+bool ACPathVolume::FindPathBatchAsync(TArray<FCPathRequest>& Requests, PathBatchDelegate OnBatchFinished)
+{
+	if (!CoreInstance)
+		return false;
+
+	auto Batch = std::make_shared<FCPathBatch>();
+	Batch->OnBatchFinished = OnBatchFinished;
+	Batch->Results.SetNum(Requests.Num());
+	Batch->SearchIndexes.SetNum(Requests.Num());
+	Batch->SharedRequests.Reserve(Requests.Num());
+
+	if (Requests.Num() == 0)
+	{
+		Batch->Finish();
+		return true;
+	}
+
+	// Looking up leafs of every request takes too long for the game thread with large batches,
+	// so one pathfinding thread does it and merges the requests before the searches are spread over threads
+	FCPathRequest Prepare;
+	Prepare.VolumeRef = this;
+	Prepare.Start = Prepare.End = FVector::ZeroVector;
+	Prepare.Priority = MIN_int32;
+	Prepare.Batch = Batch;
+	Prepare.BatchIndex = INDEX_NONE;
+	for (int32 i = 0; i < Requests.Num(); i++)
+	{
+		FCPathRequest& Request = Requests[i];
+		Request.VolumeRef = this;
+		Request.OnPathFound.Unbind();
+		Request.FlowField.reset();
+		Request.State.reset();
+		Request.DeadlineTime = Request.Deadline > 0 ? FPlatformTime::Seconds() + Request.Deadline : 0;
+		Request.BatchIndex = i;
+		Prepare.Priority = FMath::Max(Prepare.Priority, Request.Priority);
+		Batch->SharedRequests.Add(MoveTemp(Request));
+	}
+
+	CoreInstance->AssignAsyncRequest(Prepare);
 	return true;
 }
 
-FCPathResult ACPathVolume::FindPathSynchronous(FVector Start, FVector End, uint32 SmoothingPasses, int32 UserData, float TimeLimit, bool RequestRawPath, bool RequestUserPath)
+void ACPathVolume::PrepareBatch(const std::shared_ptr<FCPathBatch>& Batch, std::vector<FCPathRequest>& OutSearches)
+{
+	// Requests share a search only if they resolve to the same leafs and their search runs under the same limits
+	struct FBatchKey
+	{
+		CPathCache::FKey PathKey;
+		int32 Priority;
+		float Deadline;
+		float TimeLimit;
+
+		inline bool operator==(const FBatchKey& Other) const
+		{
+			return PathKey == Other.PathKey && Priority == Other.Priority && Deadline == Other.Deadline && TimeLimit == Other.TimeLimit;
+		}
+	};
+	struct FBatchKeyHash
+	{
+		size_t operator()(const FBatchKey& Key) const
+		{
+			uint32 Hash = HashCombine(GetTypeHash(Key.Priority), HashCombine(GetTypeHash(Key.Deadline), GetTypeHash(Key.TimeLimit)));
+			return CPathCache::FKeyHash()(Key.PathKey) ^ ((size_t)Hash * 0x9E3779B9u);
+		}
+	};
+
+	FCPathSnapshotScope Snapshot(Snapshots);
+	std::unordered_map<FBatchKey, int32, FBatchKeyHash> SearchByKey;
+
+	// Same lookup as CPathAStar::StartSearch, so requests are merged by the leafs their search actually starts and ends in
+	auto FindSearchLeaf = [this](FVector Location, CPathTreeID& OutTreeID)
+	{
+		CPathTreeID TreeID;
+		if (!FindClosestFreeLeaf(Location, TreeID))
+			return false;
+		uint32 LeafIndex = GetGraph().FindLeafIndexOrClosest(TreeID, Location);
+		if (LeafIndex == CPathGraph::INVALID_INDEX)
+			return false;
+		OutTreeID = GetGraph().LeafTreeIDs[LeafIndex];
+		return true;
+	};
+
+	OutSearches.reserve(Batch->SharedRequests.Num());
+	for (int32 i = 0; i < Batch->SharedRequests.Num(); i++)
+	{
+		FCPathRequest& Request = Batch->SharedRequests[i];
+		Batch->SearchIndexes[i] = i;
+
+		// Same condition as for the path cache, only user paths are the same for every location in the start and end leaf
+		CPathTreeID StartTreeID, EndTreeID;
+		if (Request.RequestUserPath && !Request.RequestRawPath && !Request.UseJumpPointSearch
+			&& FindSearchLeaf(Request.Start, StartTreeID) && FindSearchLeaf(Request.End, EndTreeID))
+		{
+			FBatchKey Key{ { StartTreeID, EndTreeID, Request.UserData, Request.SmoothingPasses }, Request.Priority, Request.Deadline, Request.TimeLimit };
+			auto Found = SearchByKey.find(Key);
+			if (Found != SearchByKey.end())
+			{
+				Batch->SearchIndexes[i] = Found->second;
+				continue;
+			}
+			SearchByKey[Key] = i;
+		}
+
+		Request.Batch = Batch;
+		OutSearches.push_back(MoveTemp(Request));
+	}
+}
+
+FCPathResult ACPathVolume::FindPathSynchronous(FVector Start, FVector End, uint32 SmoothingPasses, int32 UserData, float TimeLimit, bool RequestRawPath, bool RequestUserPath, bool UseJumpPointSearch)
 {
 	FCPathResult Result;
-	if (GeneratorsRunning.load() > 0)
+	if (!CanSearch())
 	{
 		Result.FailReason = VolumeNotGenerated;
 	}
 	else
 	{
-		CPathAStar::GetInstance(GetWorld())->FindPath(this, &Result, Start, End, SmoothingPasses, UserData, TimeLimit, RequestRawPath, RequestUserPath);
+		FCPathSnapshotScope Snapshot(Snapshots);
+		CPathAStar::GetInstance(GetWorld())->FindPath(this, &Result, Start, End, SmoothingPasses, UserData, TimeLimit, RequestRawPath, RequestUserPath, UseJumpPointSearch);
 	}
 	return Result;
 }
 
-void ACPathVolume::FindPathSynchronous(TEnumAsByte<BranchFailSuccessEnum>& Branches, TArray<FCPathNode>& Path, TEnumAsByte<ECPathfindingFailReason>& FailReason, FVector Start, FVector End, int SmoothingPasses, int UserData, float TimeLimit)
+bool ACPathVolume::BeginSynchronousSearch(CPathAStar& Search, FCPathResult& Result, FVector Start, FVector End, uint32 SmoothingPasses, int32 UserData, float TimeLimit, bool RequestRawPath, bool RequestUserPath, bool UseJumpPointSearch)
+{
+	if (!CanSearch())
+	{
+		Result.FailReason = VolumeNotGenerated;
+		return false;
+	}
+	FCPathSnapshotScope Snapshot(Snapshots);
+	return Search.BeginFindPath(this, &Result, Start, End, SmoothingPasses, UserData, TimeLimit, RequestRawPath, RequestUserPath, UseJumpPointSearch);
+}
+
+bool ACPathVolume::ContinueSynchronousSearch(CPathAStar& Search, float SliceTime)
+{
+	// Graph can't be read right now, the search waits for the next frame
+	if (!CanSearch())
+		return !Search.IsSearchActive();
+
+	FCPathSnapshotScope Snapshot(Snapshots);
+	return Search.ContinueFindPath(SliceTime);
+}
+
+void ACPathVolume::FindPathSynchronous(TEnumAsByte<BranchFailSuccessEnum>& Branches, TArray<FCPathNode>& Path, TEnumAsByte<ECPathfindingFailReason>& FailReason, FVector Start, FVector End, int SmoothingPasses, int UserData, float TimeLimit, bool UseJumpPointSearch)
 {
-	FCPathResult Result = FindPathSynchronous(Start, End, SmoothingPasses, UserData, TimeLimit);
+	FCPathResult Result = FindPathSynchronous(Start, End, SmoothingPasses, UserData, TimeLimit, false, true, UseJumpPointSearch);
 	FailReason = Result.FailReason;
 	Path = Result.UserPath;
 	if (FailReason == None)
@@ -429,7 +669,7 @@ inline FVector ACPathVolume::WorldLocationToLocalCoordsInt3(FVector WorldLocatio
 
 }
 
-inline int ACPathVolume::WorldLocationToIndex(FVector WorldLocation) const
+inline uint32 ACPathVolume::WorldLocationToIndex(FVector WorldLocation) const
 {
 	FVector XYZ = WorldLocationToLocalCoordsInt3(WorldLocation);
 	return LocalCoordsInt3ToIndex(XYZ);
@@ -449,9 +689,9 @@ inline bool ACPathVolume::IsInBounds(FVector XYZ) const
 	return true;
 }
 
-inline float ACPathVolume::LocalCoordsInt3ToIndex(FVector V) const
+inline uint32 ACPathVolume::LocalCoordsInt3ToIndex(FVector V) const
 {
-	return (V.X * (NodeCount[1] * NodeCount[2])) + (V.Y * NodeCount[2]) + V.Z;
+	return ((uint32)V.X * NodeCount[1] + (uint32)V.Y) * NodeCount[2] + (uint32)V.Z;
 }
 
 inline float ACPathVolume::GetVoxelSizeByDepth(int Depth) const
@@ -463,60 +703,60 @@ inline float ACPathVolume::GetVoxelSizeByDepth(int Depth) const
 	return LookupTable_VoxelSizeByDepth[Depth];
 }
 
-inline uint32 ACPathVolume::CreateTreeID(uint32 Index, uint32 Depth) const
+uint64 ACPathVolume::GetOctreeMemoryUsage() const
+{
+	return Octrees.GetMemoryUsage() + OctreePool.GetMemoryUsage() + Occupancy.GetMemoryUsage();
+}
+
+inline CPathTreeID ACPathVolume::CreateTreeID(uint32 Index, uint32 Depth) const
 {
 #if WITH_EDITOR
 	checkf(Depth <= MAX_DEPTH, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
 #endif		
-	Index |= Depth << DEPTH_0_BITS;
-
-	return Index;
+	return (CPathTreeID)Index | ((CPathTreeID)Depth << DEPTH_0_BITS);
 }
 
-inline uint32 ACPathVolume::ExtractOuterIndex(uint32 TreeID) const
+inline uint32 ACPathVolume::ExtractOuterIndex(CPathTreeID TreeID) const
 {
-	return TreeID & DEPTH_0_MASK;
+	return (uint32)(TreeID & DEPTH_0_MASK);
 }
 
-inline void ACPathVolume::ReplaceDepth(uint32& TreeID, uint32 NewDepth)
+inline void ACPathVolume::ReplaceDepth(CPathTreeID& TreeID, uint32 NewDepth)
 {
 #if WITH_EDITOR
 	checkf(NewDepth <= MAX_DEPTH, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
 #endif
 
 	TreeID &= ~DEPTH_MASK;
-	TreeID |= NewDepth << DEPTH_0_BITS;
+	TreeID |= (CPathTreeID)NewDepth << DEPTH_0_BITS;
 }
 
-inline uint32 ACPathVolume::ExtractDepth(uint32 TreeID) const
+inline uint32 ACPathVolume::ExtractDepth(CPathTreeID TreeID) const
 {
-	return (TreeID & DEPTH_MASK) >> DEPTH_0_BITS;
+	return (uint32)((TreeID & DEPTH_MASK) >> DEPTH_0_BITS);
 }
 
-inline uint32 ACPathVolume::ExtractChildIndex(uint32 TreeID, uint32 Depth) const
+inline uint32 ACPathVolume::ExtractChildIndex(CPathTreeID TreeID, uint32 Depth) const
 {
 #if WITH_EDITOR
 	checkf(Depth <= MAX_DEPTH && Depth > 0, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
 #endif
-	uint32 DepthOffset = (Depth - 1) * 3 + DEPTH_0_BITS + 2;
-	uint32 Mask = 0x00000007 << DepthOffset;
+	uint32 DepthOffset = (Depth - 1) * 3 + CHILD_INDEX_OFFSET;
 
-	return (TreeID & Mask) >> DepthOffset;
+	return (uint32)(TreeID >> DepthOffset) & 7;
 }
 
-inline void ACPathVolume::AddChildIndex(uint32& TreeID, uint32 Depth, uint32 ChildIndex)
+inline void ACPathVolume::AddChildIndex(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex)
 {
 #if WITH_EDITOR
 	checkf(Depth <= MAX_DEPTH && Depth > 0, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
 	checkf(ChildIndex < 8, TEXT("CPATH - Graph Generation:::Child Index can be up to 7"));
 #endif
 
-	ChildIndex <<= (Depth - 1) * 3 + DEPTH_0_BITS + 2;
-
-	TreeID |= ChildIndex;
+	TreeID |= (CPathTreeID)ChildIndex << ((Depth - 1) * 3 + CHILD_INDEX_OFFSET);
 }
 
-inline FVector ACPathVolume::WorldLocationFromTreeID(uint32 TreeID) const
+inline FVector ACPathVolume::WorldLocationFromTreeID(CPathTreeID TreeID) const
 {
 	uint32 OuterIndex = ExtractOuterIndex(TreeID);
 	uint32 Depth = ExtractDepth(TreeID);
@@ -538,65 +778,63 @@ inline FVector ACPathVolume::LocalCoordsInt3FromOuterIndex(uint32 OuterIndex) co
 	return FVector(X, OuterIndex / NodeCount[2], OuterIndex % NodeCount[2]);
 }
 
-inline void ACPathVolume::ReplaceChildIndex(uint32& TreeID, uint32 Depth, uint32 ChildIndex)
+inline void ACPathVolume::ReplaceChildIndex(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex)
 {
 #if WITH_EDITOR
 	checkf(Depth <= MAX_DEPTH && Depth > 0, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
 	checkf(ChildIndex < 8, TEXT("CPATH - Graph Generation:::Child Index can be up to 7"));
 #endif
 
-	uint32 DepthOffset = (Depth - 1) * 3 + DEPTH_0_BITS + 2;
+	uint32 DepthOffset = (Depth - 1) * 3 + CHILD_INDEX_OFFSET;
 
 	// Clearing previous child index
-	TreeID &= ~(0x00000007 << DepthOffset);
+	TreeID &= ~((CPathTreeID)7 << DepthOffset);
 
-	ChildIndex <<= DepthOffset;
-	TreeID |= ChildIndex;
+	TreeID |= (CPathTreeID)ChildIndex << DepthOffset;
 }
 
-inline void ACPathVolume::ReplaceChildIndexAndDepth(uint32& TreeID, uint32 Depth, uint32 ChildIndex)
+inline void ACPathVolume::ReplaceChildIndexAndDepth(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex)
 {
 #if WITH_EDITOR
 	checkf(Depth <= MAX_DEPTH && Depth > 0, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
 	checkf(ChildIndex < 8, TEXT("CPATH - Graph Generation:::Child Index can be up to 7"));
 #endif
 
-	uint32 DepthOffset = (Depth - 1) * 3 + DEPTH_0_BITS + 2;
+	uint32 DepthOffset = (Depth - 1) * 3 + CHILD_INDEX_OFFSET;
 
 	// Clearing previous child index
-	TreeID &= ~(0x00000007 << DepthOffset);
+	TreeID &= ~((CPathTreeID)7 << DepthOffset);
 
-	ChildIndex <<= DepthOffset;
-	TreeID |= ChildIndex;
+	TreeID |= (CPathTreeID)ChildIndex << DepthOffset;
 	ReplaceDepth(TreeID, Depth);
 }
 
-inline void ACPathVolume::GetAllSubtrees(uint32 TreeID, std::vector<uint32>& Container)
+inline void ACPathVolume::GetAllSubtrees(CPathTreeID TreeID, std::vector<CPathTreeID>& Container)
 {
 	uint32 Depth = 0;
 	CPathOctree* Tree = FindTreeByID(TreeID, Depth);
 	GetAllSubtreesRec(TreeID, Tree, Container, Depth);
 }
 
-void ACPathVolume::GetAllSubtreesRec(uint32 TreeID, CPathOctree* Tree, std::vector<uint32>& Container, uint32 Depth)
+void ACPathVolume::GetAllSubtreesRec(CPathTreeID TreeID, CPathOctree* Tree, std::vector<CPathTreeID>& Container, uint32 Depth)
 {
 	if (Tree->Children)
 	{
 		Depth++;
 		for (uint32 ChildID = 0; ChildID < 8; ChildID++)
 		{
-			uint32 ID = TreeID;
+			CPathTreeID ID = TreeID;
 			ReplaceChildIndexAndDepth(ID, Depth, ChildID);
-			GetAllSubtreesRec(ID, &Tree->Children[ChildID], Container, Depth);
+			GetAllSubtreesRec(ID, GetChild(Tree, ChildID), Container, Depth);
 			Container.push_back(ID);
 		}
 	}
 }
 
-inline CPathOctree* ACPathVolume::FindTreeByID(uint32 TreeID)
+inline CPathOctree* ACPathVolume::FindTreeByID(CPathTreeID TreeID)
 {
 	uint32 Depth = ExtractDepth(TreeID);
-	CPathOctree* CurrTree = &Octrees[ExtractOuterIndex(TreeID)];
+	CPathOctree* CurrTree = Octrees.Get(ExtractOuterIndex(TreeID));
 
 
 	for (uint32 CurrDepth = 1; CurrDepth <= Depth; CurrDepth++)
@@ -607,15 +845,15 @@ inline CPathOctree* ACPathVolume::FindTreeByID(uint32 TreeID)
 			break;
 		}
 
-		CurrTree = &CurrTree->Children[ExtractChildIndex(TreeID, CurrDepth)];
+		CurrTree = GetChild(CurrTree, ExtractChildIndex(TreeID, CurrDepth));
 	}
 	return CurrTree;
 }
 
-CPathOctree* ACPathVolume::FindTreeByID(uint32 TreeID, uint32& DepthReached)
+CPathOctree* ACPathVolume::FindTreeByID(CPathTreeID TreeID, uint32& DepthReached)
 {
 	uint32 Depth = ExtractDepth(TreeID);
-	CPathOctree* CurrTree = &Octrees[ExtractOuterIndex(TreeID)];
+	CPathOctree* CurrTree = Octrees.Get(ExtractOuterIndex(TreeID));
 	DepthReached = 0;
 
 	for (uint32 CurrDepth = 1; CurrDepth <= Depth; CurrDepth++)
@@ -626,23 +864,23 @@ CPathOctree* ACPathVolume::FindTreeByID(uint32 TreeID, uint32& DepthReached)
 			break;
 		}
 
-		CurrTree = &CurrTree->Children[ExtractChildIndex(TreeID, CurrDepth)];
+		CurrTree = GetChild(CurrTree, ExtractChildIndex(TreeID, CurrDepth));
 		DepthReached = CurrDepth;
 	}
 	return CurrTree;
 }
 
-CPathOctree* ACPathVolume::FindTreeByWorldLocation(FVector WorldLocation, uint32& TreeID)
+CPathOctree* ACPathVolume::FindTreeByWorldLocation(FVector WorldLocation, CPathTreeID& TreeID)
 {
 	FVector LocalCoords = WorldLocationToLocalCoordsInt3(WorldLocation);
 	if (!IsInBounds(LocalCoords))
 		return nullptr;
 
 	TreeID = LocalCoordsInt3ToIndex(LocalCoords);
-	return &Octrees[TreeID];
+	return Octrees.Get(TreeID);
 }
 
-inline CPathOctree* ACPathVolume::FindLeafByWorldLocation(FVector WorldLocation, uint32& TreeID, bool MustBeFree)
+inline CPathOctree* ACPathVolume::FindLeafByWorldLocation(FVector WorldLocation, CPathTreeID& TreeID, bool MustBeFree)
 {
 	CPathOctree* CurrentTree = FindTreeByWorldLocation(WorldLocation, TreeID);
 	CPathOctree* FoundLeaf = nullptr;
@@ -664,8 +902,8 @@ inline CPathOctree* ACPathVolume::FindLeafByWorldLocation(FVector WorldLocation,
 		{
 			for (int i = 0; i < 8; i++)
 			{
-				if (CurrentTree->Children[i].GetIsFree())
-					FoundLeaf = &CurrentTree->Children[i];
+				if (GetChild(CurrentTree, i)->GetIsFree())
+					FoundLeaf = GetChild(CurrentTree, i);
 			}
 		}
 
@@ -676,9 +914,9 @@ inline CPathOctree* ACPathVolume::FindLeafByWorldLocation(FVector WorldLocation,
 	return FoundLeaf;
 }
 
-CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, uint32& TreeID, float SearchRange)
+CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, CPathTreeID& TreeID, float SearchRange)
 {
-	uint32 OriginTreeID = 0xFFFFFFFF;
+	CPathTreeID OriginTreeID = INVALID_TREEID;
 	CPathOctree* OriginTree = FindLeafByWorldLocation(WorldLocation, OriginTreeID, false);
 	if (!OriginTree)
 		return nullptr;
@@ -800,7 +1038,7 @@ CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, uint32& Tr
 	return nullptr;
 }
 
-CPathOctree* ACPathVolume::FindLeafRecursive(FVector RelativeLocation, uint32& TreeID, uint32 CurrentDepth, CPathOctree* CurrentTree)
+CPathOctree* ACPathVolume::FindLeafRecursive(FVector RelativeLocation, CPathTreeID& TreeID, uint32 CurrentDepth, CPathOctree* CurrentTree)
 {
 	CurrentDepth += 1;
 
@@ -816,7 +1054,7 @@ CPathOctree* ACPathVolume::FindLeafRecursive(FVector RelativeLocation, uint32& T
 
 	ReplaceChildIndex(TreeID, CurrentDepth, ChildIndex);
 
-	CPathOctree* ChildTree = &CurrentTree->Children[ChildIndex];
+	CPathOctree* ChildTree = GetChild(CurrentTree, ChildIndex);
 	if (ChildTree->Children)
 	{
 		RelativeLocation = RelativeLocation - (LookupTable_ChildPositionOffsetMaskByIndex[ChildIndex] * (GetVoxelSizeByDepth(CurrentDepth) / 2.f));
@@ -831,14 +1069,14 @@ CPathOctree* ACPathVolume::FindLeafRecursive(FVector RelativeLocation, uint32& T
 	return nullptr;
 }
 
-FVector ACPathVolume::GetOuterTreeWorldLocation(uint32 TreeID) const
+FVector ACPathVolume::GetOuterTreeWorldLocation(CPathTreeID TreeID) const
 {
 	FVector LocalCoords = LocalCoordsInt3FromOuterIndex(ExtractOuterIndex(TreeID));
 	LocalCoords *= GetVoxelSizeByDepth(0);
 	return StartPosition + LocalCoords;
 }
 
-inline CPathOctree* ACPathVolume::GetParentTree(uint32 TreeId)
+inline CPathOctree* ACPathVolume::GetParentTree(CPathTreeID TreeId)
 {
 	uint32 Depth = ExtractDepth(TreeId);
 	if (Depth)
@@ -851,21 +1089,21 @@ inline CPathOctree* ACPathVolume::GetParentTree(uint32 TreeId)
 
 
 
-CPathOctree* ACPathVolume::FindNeighbourByID(uint32 TreeID, ENeighbourDirection Direction, uint32& NeighbourID)
+CPathOctree* ACPathVolume::FindNeighbourByID(CPathTreeID TreeID, ENeighbourDirection Direction, CPathTreeID& NeighbourID)
 {
 
 	// Depth 0, getting neighbour from Octrees
 	uint32 Depth = ExtractDepth(TreeID);
 	if (Depth == 0)
 	{
-		int OuterIndex = ExtractOuterIndex(TreeID);
+		uint32 OuterIndex = ExtractOuterIndex(TreeID);
 		FVector NeighbourLocalCoords = LocalCoordsInt3FromOuterIndex(OuterIndex) + LookupTable_NeighbourOffsetByDirection[Direction];
 
 		if (!IsInBounds(NeighbourLocalCoords))
 			return nullptr;
 
 		NeighbourID = LocalCoordsInt3ToIndex(NeighbourLocalCoords);
-		return &Octrees[NeighbourID];
+		return Octrees.Get(NeighbourID);
 	}
 
 	uint8 ChildIndex = ExtractChildIndex(TreeID, Depth);
@@ -892,7 +1130,7 @@ CPathOctree* ACPathVolume::FindNeighbourByID(uint32 TreeID, ENeighbourDirection
 				NeighbourChildIndex = -1 * NeighbourChildIndex - 1;
 				ReplaceDepth(NeighbourID, Depth);
 				ReplaceChildIndex(NeighbourID, Depth, NeighbourChildIndex);
-				return &NeighbourOfParent->Children[NeighbourChildIndex];
+				return GetChild(NeighbourOfParent, NeighbourChildIndex);
 			}
 			else
 			{
@@ -905,13 +1143,13 @@ CPathOctree* ACPathVolume::FindNeighbourByID(uint32 TreeID, ENeighbourDirection
 	return nullptr;
 }
 
-std::vector<uint32> ACPathVolume::FindNeighbourLeafs(uint32 TreeID, bool MustBeFree)
+std::vector<CPathTreeID> ACPathVolume::FindNeighbourLeafs(CPathTreeID TreeID, bool MustBeFree)
 {
-	std::vector<uint32> FreeNeighbours;
+	std::vector<CPathTreeID> FreeNeighbours;
 
 	for (int Direction = 0; Direction < 6; Direction++)
 	{
-		uint32 NeighbourID = 0;
+		CPathTreeID NeighbourID = 0;
 		CPathOctree* Neighbour = FindNeighbourByID(TreeID, (ENeighbourDirection)Direction, NeighbourID);
 		if (Neighbour)
 		{
@@ -935,7 +1173,7 @@ std::vector<CPathAStarNode> ACPathVolume::FindFreeNeighbourLeafs(CPathAStarNode&
 
 	for (int Direction = 0; Direction < 6; Direction++)
 	{
-		uint32 NeighbourID = 0;
+		CPathTreeID NeighbourID = 0;
 		CPathOctree* Neighbour = FindNeighbourByID(Node.TreeID, (ENeighbourDirection)Direction, NeighbourID);
 		if (Neighbour)
 		{
@@ -953,26 +1191,29 @@ std::vector<CPathAStarNode> ACPathVolume::FindFreeNeighbourLeafs(CPathAStarNode&
 }
 
 
-void ACPathVolume::FindLeafsOnSide(uint32 TreeID, ENeighbourDirection Side, std::vector<uint32>* Vector, bool MustBeFree)
+void ACPathVolume::FindLeafsOnSide(CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathTreeID>* Vector, bool MustBeFree)
 {
 	uint32 TempDepthReached;
 	FindLeafsOnSide(FindTreeByID(TreeID, TempDepthReached), TreeID, Side, Vector, MustBeFree);
 }
 
-void ACPathVolume::FindLeafsOnSide(CPathOctree* Tree, uint32 TreeID, ENeighbourDirection Side, std::vector<uint32>* Vector, bool MustBeFree)
+void ACPathVolume::FindLeafsOnSide(CPathOctree* Tree, CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathTreeID>* Vector, bool MustBeFree)
 {
 #if WITH_EDITOR
 	checkf(Tree->Children, TEXT("CPATH - FindAllLeafsOnSide, requested tree has no children"));
 #endif
+	if (MustBeFree && !MayHaveFreeLeafsOnSide(TreeID, Side))
+		return;
+
 	uint8 NewDepth = ExtractDepth(TreeID) + 1;
 	for (uint8 i = 0; i < 4; i++)
 	{
 		uint8 ChildIndex = LookupTable_ChildrenOnSide[Side][i];
-		CPathOctree* Child = &Tree->Children[ChildIndex];
-		uint32 ChildTreeID = TreeID;
+		CPathOctree* Child = GetChild(Tree, ChildIndex);
+		CPathTreeID ChildTreeID = TreeID;
 		ReplaceChildIndexAndDepth(ChildTreeID, NewDepth, ChildIndex);
 		if (Child->Children)
-			FindLeafsOnSide(Child, ChildTreeID, Side, Vector);
+			FindLeafsOnSide(Child, ChildTreeID, Side, Vector, MustBeFree);
 		else
 		{
 			if (Child->GetIsFree() || !MustBeFree)
@@ -981,20 +1222,23 @@ void ACPathVolume::FindLeafsOnSide(CPathOctree* Tree, uint32 TreeID, ENeighbourD
 	}
 }
 
-void ACPathVolume::FindLeafsOnSide(CPathOctree* Tree, uint32 TreeID, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector, bool MustBeFree)
+void ACPathVolume::FindLeafsOnSide(CPathOctree* Tree, CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector, bool MustBeFree)
 {
 #if WITH_EDITOR
 	checkf(Tree->Children, TEXT("CPATH - FindAllLeafsOnSide, requested tree has no children"));
 #endif
+	if (MustBeFree && !MayHaveFreeLeafsOnSide(TreeID, Side))
+		return;
+
 	uint8 NewDepth = ExtractDepth(TreeID) + 1;
 	for (uint8 i = 0; i < 4; i++)
 	{
 		uint8 ChildIndex = LookupTable_ChildrenOnSide[Side][i];
-		CPathOctree* Child = &Tree->Children[ChildIndex];
-		uint32 ChildTreeID = TreeID;
+		CPathOctree* Child = GetChild(Tree, ChildIndex);
+		CPathTreeID ChildTreeID = TreeID;
 		ReplaceChildIndexAndDepth(ChildTreeID, NewDepth, ChildIndex);
 		if (Child->Children)
-			FindLeafsOnSide(Child, ChildTreeID, Side, Vector);
+			FindLeafsOnSide(Child, ChildTreeID, Side, Vector, MustBeFree);
 		else
 		{
 			if (Child->GetIsFree() || !MustBeFree)
@@ -1006,16 +1250,112 @@ void ACPathVolume::FindLeafsOnSide(CPathOctree* Tree, uint32 TreeID, ENeighbourD
 
 
 
-void ACPathVolume::PerformRandomBenchmark(uint32 FindPathUserData, float FindPathTimeLimit)
+inline bool ACPathVolume::MayHaveFreeLeafsOnSide(CPathTreeID TreeID, ENeighbourDirection Side) const
 {
-	if (IsAsyncBenchmark)
+	if (!Occupancy.IsEnabled())
+		return true;
+
+	return Occupancy.AnyFreeOnSide(ExtractOuterIndex(TreeID), Occupancy.GetSubtreeStart(this, TreeID), ExtractDepth(TreeID), Side);
+}
+
+bool ACPathVolume::IsSweepFreeInOccupancy(FVector Start, FVector End) const
+{
+	if (!Occupancy.IsEnabled())
+		return false;
+
+	// Every point of the segment is at most half a step from a sample, so boxes around samples cover the whole sweep
+	float Step = GetVoxelSizeByDepth(OctreeDepth);
+	FVector Extent = TraceShapesByDepth.back().back().GetExtent() + FVector(Step / 2.f);
+	int32 StepCount = FMath::Max(1, FMath::CeilToInt(FVector::Distance(Start, End) / Step));
+
+	for (int32 i = 0; i <= StepCount; i++)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Async Benchmark started, duration: %f seconds."), BenchmarkDurationSeconds);
+		FVector Sample = FMath::Lerp(Start, End, (float)i / StepCount);
+		if (!Occupancy.IsBoxFree(this, Sample - Extent, Sample + Extent))
+			return false;
 	}
-	else
+	return true;
+}
+
+bool ACPathVolume::IsSegmentFree(FVector Start, FVector End) const
+{
+	// Most segments in open space are answered by the occupancy layer without touching physics
+	if (IsSweepFreeInOccupancy(Start, End))
+		return true;
+
+	FHitResult HitResult;
+	GetWorld()->SweepSingleByChannel(HitResult, Start, End, FQuat(FRotator(0, 0, 0)), TraceChannel, TraceShapesByDepth.back().back());
+
+	return !HitResult.bBlockingHit;
+}
+
+void ACPathVolume::GetOuterTreesAlongSegment(FVector Start, FVector End, std::vector<uint32>& OutOuterIndexes) const
+{
+	// Same sampling as IsSweepFreeInOccupancy, in outer tree sized steps
+	float Step = GetVoxelSizeByDepth(0);
+	FVector Extent = TraceShapesByDepth.back().back().GetExtent() + FVector(Step / 2.f);
+	int32 StepCount = FMath::Max(1, FMath::CeilToInt(FVector::Distance(Start, End) / Step));
+
+	for (int32 i = 0; i <= StepCount; i++)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Benchmark started, duration: %f seconds. This window will be frozen until completion..."), BenchmarkDurationSeconds);
+		FVector Sample = FMath::Lerp(Start, End, (float)i / StepCount);
+		FVector Min = WorldLocationToLocalCoordsInt3(Sample - Extent);
+		FVector Max = WorldLocationToLocalCoordsInt3(Sample + Extent);
+		for (int32 X = FMath::Max(0, (int32)Min.X); X <= FMath::Min((int32)NodeCount[0] - 1, (int32)Max.X); X++)
+		{
+			for (int32 Y = FMath::Max(0, (int32)Min.Y); Y <= FMath::Min((int32)NodeCount[1] - 1, (int32)Max.Y); Y++)
+			{
+				for (int32 Z = FMath::Max(0, (int32)Min.Z); Z <= FMath::Min((int32)NodeCount[2] - 1, (int32)Max.Z); Z++)
+				{
+					OutOuterIndexes.push_back(LocalCoordsInt3ToIndex(FVector(X, Y, Z)));
+				}
+			}
+		}
+	}
+}
+
+void ACPathVolume::GetPathCacheStats(int64& Hits, int64& Misses, int64& Evictions, int64& Invalidations, int& EntryCount, bool Reset)
+{
+	Hits = PathCache.GetHitCount();
+	Misses = PathCache.GetMissCount();
+	Evictions = PathCache.GetEvictionCount();
+	Invalidations = PathCache.GetInvalidationCount();
+	EntryCount = PathCache.GetEntryCount();
+	if (Reset)
+		PathCache.ResetStats();
+}
+
+// Returns the first BaseName.csv, BaseName_2.csv... in Saved that has this header, creating it if needed.
+// Rows are only appended under a matching header, files written by older versions keep their own columns.
+static FString GetBenchmarkFilePath(const FString& BaseName, const FString& Header)
+{
+	FString Directory = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir());
+	for (int Index = 1; ; Index++)
+	{
+		FString FilePath = Directory + TEXT("/") + BaseName + (Index > 1 ? FString::Printf(TEXT("_%d"), Index) : FString()) + TEXT(".csv");
+		if (!FPaths::FileExists(FilePath))
+		{
+			FFileHelper::SaveStringToFile(Header, *FilePath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), EFileWrite::FILEWRITE_Append);
+			return FilePath;
+		}
+
+		FString Existing;
+		if (FFileHelper::LoadFileToString(Existing, *FilePath) && Existing.StartsWith(Header, ESearchCase::CaseSensitive)
+			&& (Existing.Len() == Header.Len() || Existing[Header.Len()] == TEXT('\n') || Existing[Header.Len()] == TEXT('\r')))
+		{
+			return FilePath;
+		}
+	}
+}
+
+void ACPathVolume::PerformRandomBenchmark(uint32 FindPathUserData, float FindPathTimeLimit)
+{
+	if (IsAsyncBenchmark)
+	{
+		PerformAsyncBenchmark(FindPathUserData, FindPathTimeLimit);
+		return;
 	}
+	UE_LOG(LogTemp, Warning, TEXT("Benchmark started, duration: %f seconds. This window will be frozen until completion..."), BenchmarkDurationSeconds);
 
 	// Box for random start and end points
 	FBox Box = FBox::BuildAABB(GetActorLocation(), VolumeBox->GetScaledBoxExtent());
@@ -1049,6 +1389,7 @@ void ACPathVolume::PerformRandomBenchmark(uint32 FindPathUserData, float FindPat
 	int VolumeInvalid = ResultCounter[VolumeNotValid] + ResultCounter[VolumeNotGenerated];
 	int WrongLocation = ResultCounter[WrongStartLocation] + ResultCounter[WrongEndLocation];
 	int RecommendedSampleSize = NodeCount[0] * NodeCount[1] * NodeCount[2] / 2 * FMath::Pow(8.0f, (float)FMath::Max(OctreeDepth - 2, -1));
+	float OctreeMemoryMB = GetOctreeMemoryUsage() / (1024.f * 1024.f);
 
 
 	UE_LOG(LogTemp, Warning, TEXT("Benchmark finished."));
@@ -1057,75 +1398,236 @@ void ACPathVolume::PerformRandomBenchmark(uint32 FindPathUserData, float FindPat
 
 
 	// Logging result to the editor
-	UE_LOG(LogTemp, Warning, TEXT("SCORE = %f, Successes = %d, Overtimes = %d, WrongLocation = %d, distance = %f, SuccessTime = %f, FailedTime = %f, Unreachable = %d, UnknownError = %d, VolumeInvalid = %d"),
+	UE_LOG(LogTemp, Warning, TEXT("SCORE = %f, Successes = %d, Overtimes = %d, WrongLocation = %d, distance = %f, SuccessTime = %f, FailedTime = %f, Unreachable = %d, UnknownError = %d, VolumeInvalid = %d, OctreeMemory = %fMB"),
 		(float)(TotalPathLength / TotalSuccesfulSearchDuration / (double)VoxelSize), ResultCounter[0], ResultCounter[Timeout], WrongLocation, TotalPathLength, TotalSuccesfulSearchDuration / 1000.f, FailedRequestsDuration / 1000.f,
-		ResultCounter[EndLocationUnreachable], ResultCounter[Unknown], VolumeInvalid);
+		ResultCounter[EndLocationUnreachable], ResultCounter[Unknown], VolumeInvalid, OctreeMemoryMB);
 
 
 	//Saving result to a file
-	FString FilePath = FPaths::ConvertRelativePathToFull(FPaths::ProjectSavedDir()) + TEXT("/BenchmarkResults.csv");
-	FString BenchmarkResult = FString::Printf(TEXT("\n%s,%s,%f,%d,%d,%d,%d,%d,%d,%f,%f,%f,%f,%f,%d,%f,%f,%d,%d,%d,%f,%d,%d"),
+	FString BenchmarkResult = FString::Printf(TEXT("\n%s,%s,%f,%d,%d,%d,%d,%d,%d,%f,%f,%f,%f,%f,%d,%f,%f,%d,%d,%d,%f,%d,%d,%f"),
 		*BenchmarkName, *GetWorld()->GetMapName(), (float)(TotalPathLength / TotalSuccesfulSearchDuration / (double)VoxelSize), ResultCounter[0], VolumeInvalid, ResultCounter[Timeout], WrongLocation, ResultCounter[EndLocationUnreachable],
-		ResultCounter[Unknown], BenchmarkDurationSeconds, TotalSuccesfulSearchDuration / 1000.f, FailedRequestsDuration / 1000.f, TotalPathLength, VoxelSize, OctreeDepth, AgentRadius, AgentHalfHeight, BenchmarkFindPathUserData, TotalNodeCount, IsAsyncBenchmark, DynamicObstaclesUpdateRate, MaxGenerationThreads, RecommendedSampleSize);
+		ResultCounter[Unknown], BenchmarkDurationSeconds, TotalSuccesfulSearchDuration / 1000.f, FailedRequestsDuration / 1000.f, TotalPathLength, VoxelSize, OctreeDepth, AgentRadius, AgentHalfHeight, BenchmarkFindPathUserData, TotalNodeCount, IsAsyncBenchmark, DynamicObstaclesUpdateRate, MaxGenerationThreads, RecommendedSampleSize, OctreeMemoryMB);
 
 
-	if (!FPaths::FileExists(FilePath))
+	FString BenchmarkFileStart = TEXT("benchmark_name,map_name,score,success,invalid_volume,timeout,wrong_location,unreachable,unknown_error,benchmark_duration,success_duration,failed_duration,success_paths_distance,voxel_size,octree_depth,agent_radius,agent_half_height,find_path_user_data,graph_node_count,is_async,dynamic_update_rate,worker_threads,min_recommended_success,octree_memory_mb");
+	FString FilePath = GetBenchmarkFilePath(TEXT("BenchmarkResults"), BenchmarkFileStart);
+
+	if (RecommendedSampleSize < ResultCounter[0] || SaveBenchmarksWithUnreliableResults)
+		FFileHelper::SaveStringToFile(BenchmarkResult, *FilePath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), EFileWrite::FILEWRITE_Append);
+}
+
+void ACPathVolume::PerformAsyncBenchmark(uint32 FindPathUserData, float FindPathTimeLimit)
+{
+	if (!CoreInstance)
+		return;
+
+	UE_LOG(LogTemp, Warning, TEXT("Async Benchmark started, duration: %f seconds, burst size: %d, pathfinding threads: %d. This window will be frozen until completion..."),
+		BenchmarkDurationSeconds, BenchmarkBurstSize, CoreInstance->GetThreadCount());
+
+	FBox Box = FBox::BuildAABB(GetActorLocation(), VolumeBox->GetScaledBoxExtent());
+	int BurstSize = FMath::Max(BenchmarkBurstSize, 1);
+
+	// Filled by delegates, which are called on this thread by ProcessResults
+	struct FBenchmarkState
+	{
+		std::vector<double> Latencies;
+		int ResultCounter[9] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+		int Delivered = 0;
+	};
+	auto State = std::make_shared<FBenchmarkState>();
+	int StolenBefore = CoreInstance->GetStolenTaskCount();
+	int Sent = 0;
+
+	auto StartTime = TIMENOW;
+	while (TIMEDIFF(StartTime, TIMENOW) < BenchmarkDurationSeconds * 1000)
 	{
-		FString BenchmarkFileStart = TEXT("benchmark_name,map_name,score,success,invalid_volume,timeout,wrong_location,unreachable,unknown_error,benchmark_duration,success_duration,failed_duration,success_paths_distance,voxel_size,octree_depth,agent_radius,agent_half_height,find_path_user_data,graph_node_count,is_async,dynamic_update_rate,worker_threads,min_recommended_success");
-		FFileHelper::SaveStringToFile(BenchmarkFileStart, *FilePath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), EFileWrite::FILEWRITE_Append);
+		for (int i = 0; i < BurstSize; i++)
+		{
+			FCPathRequest Request;
+			Request.VolumeRef = this;
+			Request.Start = FMath::RandPointInBox(Box);
+			Request.End = FMath::RandPointInBox(Box);
+			Request.SmoothingPasses = 0;
+			Request.UserData = FindPathUserData;
+			Request.TimeLimit = FindPathTimeLimit;
+			Request.RequestRawPath = false;
+			Request.RequestUserPath = true;
+			auto SentTime = TIMENOW;
+			Request.OnPathFound.BindLambda([State, SentTime](FCPathResult& Result)
+			{
+				State->Latencies.push_back(TIMEDIFF(SentTime, TIMENOW));
+				State->ResultCounter[Result.FailReason]++;
+				State->Delivered++;
+			});
+			FindPathAsync(Request);
+		}
+		Sent += BurstSize;
+
+		// Every request ends within its TimeLimit, the margin is for the queue
+		auto BurstStart = TIMENOW;
+		while (State->Delivered < Sent && TIMEDIFF(BurstStart, TIMENOW) < (FindPathTimeLimit * BurstSize + 10.f) * 1000)
+		{
+			CoreInstance->ProcessResults();
+			FPlatformProcess::YieldThread();
+		}
+		if (State->Delivered < Sent)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Async Benchmark stopped, a burst didn't finish in time"));
+			break;
+		}
 	}
+	double Duration = TIMEDIFF(StartTime, TIMENOW);
 
-	if (RecommendedSampleSize < ResultCounter[0] || SaveBenchmarksWithUnreliableResults)
+	std::vector<double>& Latencies = State->Latencies;
+	std::sort(Latencies.begin(), Latencies.end());
+	auto Percentile = [&Latencies](double P)
+	{
+		return Latencies.size() ? Latencies[FMath::Min((size_t)(P * Latencies.size()), Latencies.size() - 1)] : 0.0;
+	};
+	double Throughput = Latencies.size() / (Duration / 1000.0);
+	int Stolen = CoreInstance->GetStolenTaskCount() - StolenBefore;
+
+	UE_LOG(LogTemp, Warning, TEXT("Async Benchmark finished. Throughput = %f paths/s, Requests = %d, Successes = %d, Overtimes = %d, Latency p50 = %fms, p95 = %fms, p99 = %fms, max = %fms, Stolen = %d"),
+		Throughput, (int)Latencies.size(), State->ResultCounter[None], State->ResultCounter[Timeout], Percentile(0.5), Percentile(0.95), Percentile(0.99), Percentile(1.0), Stolen);
+
+	FString BenchmarkResult = FString::Printf(TEXT("\n%s,%s,%f,%d,%d,%d,%f,%f,%f,%f,%d,%d,%d,%f,%d,%f"),
+		*BenchmarkName, *GetWorld()->GetMapName(), Throughput, (int)Latencies.size(), State->ResultCounter[None], State->ResultCounter[Timeout],
+		Percentile(0.5), Percentile(0.95), Percentile(0.99), Percentile(1.0), Stolen, BurstSize, CoreInstance->GetThreadCount(), Duration / 1000.0, FindPathUserData, FindPathTimeLimit);
+	if (SaveBenchmarkResultToFile)
+	{
+		FString BenchmarkFileStart = TEXT("benchmark_name,map_name,throughput,requests,success,timeout,latency_p50,latency_p95,latency_p99,latency_max,stolen,burst_size,pathfinding_threads,benchmark_duration,find_path_user_data,find_path_time_limit");
+		FString FilePath = GetBenchmarkFilePath(TEXT("AsyncBenchmarkResults"), BenchmarkFileStart);
 		FFileHelper::SaveStringToFile(BenchmarkResult, *FilePath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), EFileWrite::FILEWRITE_Append);
+	}
 }
 
-inline uint32 ACPathVolume::GetFreeThreadID() const
+void ACPathVolume::CreateGenerators()
 {
-	for (int ID = 0; ID < 64; ID++)
+	if (Generators.size())
+		return;
+
+	for (int ID = 0; ID < MaxGenerationThreads; ID++)
+	{
+		Generators.push_back(std::make_unique<FCPathAsyncVolumeGenerator>(this, ID, FCPathAsyncVolumeGenerator::GetNameFromID(ID)));
+
+		// Without a thread, the generator does its work on the game thread in Start
+		Generators.back()->ThreadRef = FRunnableThread::Create(Generators.back().get(), *Generators.back()->Name);
+	}
+}
+
+void ACPathVolume::StartGenerators(uint32 WorkCount, uint32 ThreadCount, TFunctionRef<void(FCPathAsyncVolumeGenerator& Generator)> SetWork)
+{
+	ThreadCount = FMath::Clamp(ThreadCount, (uint32)1, (uint32)Generators.size());
+
+	// Set before any of them starts, the last one to finish updates the graph
+	GeneratorsPendingGraphUpdate.store(ThreadCount);
+	NextGenerationItem.store(0);
+
+	// Counters of generators left idle don't carry over to this round
+	for (const auto& Generator : Generators)
+	{
+		Generator->ResetWork();
+	}
+
+	for (uint32 CurrentThread = 0; CurrentThread < ThreadCount; CurrentThread++)
 	{
-		if (!ThreadIDs[ID])
-			return ID;
+		FCPathAsyncVolumeGenerator& Generator = *Generators[CurrentThread];
+		SetWork(Generator);
+		Generator.Start(0, WorkCount);
 	}
+}
 
-	// This will never return as max number of generation threads is always less than 64
-	return 0;
+void ACPathVolume::SortByBrickMortonCode(std::vector<uint32>& Bricks) const
+{
+	std::vector<std::pair<uint64, uint32>> Keys;
+	Keys.reserve(Bricks.size());
+	for (uint32 BrickIndex : Bricks)
+		Keys.emplace_back(Octrees.GetBrickMortonCode(BrickIndex), BrickIndex);
+	std::sort(Keys.begin(), Keys.end());
+
+	for (size_t i = 0; i < Keys.size(); i++)
+		Bricks[i] = Keys[i].second;
 }
 
-void ACPathVolume::CleanFinishedGenerators()
+void ACPathVolume::SortByDistanceToPointsOfInterest(std::vector<uint32>& Bricks) const
 {
-	for (auto Generator = GeneratorThreads.begin(); Generator != GeneratorThreads.end(); Generator++)
+	std::vector<std::pair<float, uint32>> Keys;
+	Keys.reserve(Bricks.size());
+	for (uint32 BrickIndex : Bricks)
 	{
-		if ((*Generator)->HasFinishedWorking())
+		FVector BrickLocation = GetBrickWorldLocation(BrickIndex);
+		float MinDistanceSquared = FLT_MAX;
+		for (const FVector& Point : PointsOfInterest)
 		{
-			ThreadIDs[(*Generator)->GenThreadID] = false;
-			Generator = GeneratorThreads.erase(Generator);
+			MinDistanceSquared = FMath::Min(MinDistanceSquared, (float)FVector::DistSquared(BrickLocation, Point));
 		}
+		Keys.emplace_back(MinDistanceSquared, BrickIndex);
 	}
+	std::sort(Keys.begin(), Keys.end());
 
+	for (size_t i = 0; i < Keys.size(); i++)
+		Bricks[i] = Keys[i].second;
 }
 
-void ACPathVolume::InitialGenerationUpdate()
+void ACPathVolume::SortOuterIndexesByBrickMortonCode(std::vector<uint32>& OuterIndexes) const
 {
-	if (GeneratorsRunning.load() <= 0)
+	std::vector<std::pair<uint64, uint32>> Keys;
+	Keys.reserve(OuterIndexes.size());
+	for (uint32 OuterIndex : OuterIndexes)
 	{
-		InitialGenerationCompleteAtom.store(true);
-		InitialGenerationFinished = true;
+		uint32 LocalIndex;
+		Keys.emplace_back(Octrees.GetBrickMortonCode(Octrees.GetBrickIndex(OuterIndex, LocalIndex)), OuterIndex);
+	}
+	std::sort(Keys.begin(), Keys.end());
 
-		for (auto Generator = GeneratorThreads.begin(); Generator != GeneratorThreads.end(); Generator++)
+	for (size_t i = 0; i < Keys.size(); i++)
+		OuterIndexes[i] = Keys[i].second;
+}
+
+void ACPathVolume::InitialGenerationUpdate()
+{
+	if (GeneratorsRunning.load() <= 0 && GeneratorsPendingGraphUpdate.load() <= 0)
+	{
+		for (const auto& Generator : Generators)
 		{
 			for (int Depth = 0; Depth <= OctreeDepth; Depth++)
 			{
-				OctreeCountAtDepth[Depth] += Generator->get()->OctreeCountAtDepth[Depth];
+				OctreeCountAtDepth[Depth] += Generator->OctreeCountAtDepth[Depth];
 
 			}
 		}
+
+		if (!InitialGenerationCompleteAtom.load())
+		{
+			InitialGenerationCompleteAtom.store(true);
+
+#ifdef LOG_GENERATORS
+			// Generation takes as long as the slowest thread, the closer the fastest one is to it the better the work was split
+			double SlowestThread = 0, FastestThread = DBL_MAX;
+			for (const auto& Generator : Generators)
+			{
+				SlowestThread = FMath::Max(SlowestThread, Generator->GenerationTime);
+				FastestThread = FMath::Min(FastestThread, Generator->GenerationTime);
+			}
+			UE_LOG(LogTemp, Warning, TEXT("%s initial generation: slowest thread %lfms, fastest thread %lfms, %d threads"), *GetName(), SlowestThread, FastestThread, (int)Generators.size());
+#endif
+		}
+
+		// Searches already run on generated bricks, the rest is generated one wave at a time
+		if (NextProgressiveBrick < BrickOrder.size())
+		{
+			StartNextProgressiveWave();
+			return;
+		}
+
+		InitialGenerationFinished = true;
+		// Geometry may change from now on
+		StaticGeometry.Empty();
 		for (int Depth = 0; Depth <= OctreeDepth; Depth++)
 		{
 			TotalNodeCount += OctreeCountAtDepth[Depth];
 		}
 
-
-		CleanFinishedGenerators();
 		GetWorld()->GetTimerManager().ClearTimer(GenerationTimerHandle);
 
 		// Run benchmark before modifying the graph
@@ -1135,32 +1637,201 @@ void ACPathVolume::InitialGenerationUpdate()
 		}
 
 
-		if (DynamicObstaclesUpdateRate > 0)
-			GetWorld()->GetTimerManager().SetTimer(GenerationTimerHandle, this, &ACPathVolume::GenerationUpdate, 1.f / DynamicObstaclesUpdateRate, true);
+		if (DeltasPendingApply)
+			StartApplyingDeltas();
+		else if (ChunksPendingRefresh.size())
+			StartRefreshingChunks();
+
+		// Streaming needs the update for chunks that change while generators are running
+		float UpdateRate = DynamicObstaclesUpdateRate > 0 ? DynamicObstaclesUpdateRate : (StreamChunks ? 3.f : 0.f);
+		if (UpdateRate > 0)
+			GetWorld()->GetTimerManager().SetTimer(GenerationTimerHandle, this, &ACPathVolume::GenerationUpdate, 1.f / UpdateRate, true);
 	}
 
 }
 
+void ACPathVolume::SaveObstacleDeltas(TArray<uint8>& OutData) const
+{
+	DeltaLog.Save(this, OutData);
+}
+
+bool ACPathVolume::LoadObstacleDeltas(const TArray<uint8>& Data)
+{
+	if (!GenerationStarted || !DeltaLog.Load(this, Data))
+		return false;
+
+	// Generators may be reading the current records, they are replaced once none runs
+	DeltasPendingApply = true;
+	if (GeneratorsRunning.load() == 0)
+	{
+		DeltaLog.CommitStaged();
+		if (InitialGenerationFinished)
+			StartApplyingDeltas();
+	}
+	return true;
+}
+
+void ACPathVolume::ClearObstacleDeltas()
+{
+	DeltaLog.StageEmpty();
+	if (GeneratorsRunning.load() == 0)
+		DeltaLog.CommitStaged();
+}
+
+void ACPathVolume::StartApplyingDeltas()
+{
+	DeltasPendingApply = false;
+	DeltaLog.CommitStaged();
+
+	TreesToRegenerate.clear();
+	RegionsToRegenerate.clear();
+	DeltaLog.GetOuterIndexes(TreesToRegenerate);
+	if (TreesToRegenerate.empty())
+		return;
+
+	// No physics involved, so one generator is enough
+	TreesToRegenerateList.assign(TreesToRegenerate.begin(), TreesToRegenerate.end());
+	StartGenerators((uint32)TreesToRegenerateList.size(), 1, [](FCPathAsyncVolumeGenerator& Generator)
+	{
+		Generator.bObstacles = true;
+		Generator.bApplyDeltas = true;
+	});
+}
+
+void ACPathVolume::AddPointOfInterest(FVector WorldLocation)
+{
+	PointsOfInterest.Add(WorldLocation);
+}
+
+void ACPathVolume::LoadChunksInBox(FBox WorldBox)
+{
+	ChangeChunkRefsInBox(WorldBox, true);
+}
+
+void ACPathVolume::UnloadChunksInBox(FBox WorldBox)
+{
+	ChangeChunkRefsInBox(WorldBox, false);
+}
+
+bool ACPathVolume::IsLocationResident(FVector WorldLocation) const
+{
+	if (!Chunks.IsEnabled())
+		return true;
+
+	FVector LocalCoords = WorldLocationToLocalCoordsInt3(WorldLocation);
+	return IsInBounds(LocalCoords) && Chunks.IsChunkResident(Chunks.GetChunkIndex(LocalCoords.X, LocalCoords.Y, LocalCoords.Z));
+}
+
+void ACPathVolume::OnLevelAddedToWorld(ULevel* Level, UWorld* World)
+{
+	if (World != GetWorld() || !Level || !GenerationStarted || StreamedLevelBounds.Contains(Level))
+		return;
+
+	FBox Bounds = ALevelBounds::CalculateLevelBounds(Level);
+	StreamedLevelBounds.Add(Level, Bounds);
+	ChangeChunkRefsInBox(Bounds, true);
+}
+
+void ACPathVolume::OnLevelRemovedFromWorld(ULevel* Level, UWorld* World)
+{
+	if (World != GetWorld() || !Level)
+		return;
+
+	FBox Bounds;
+	if (StreamedLevelBounds.RemoveAndCopyValue(Level, Bounds))
+		ChangeChunkRefsInBox(Bounds, false);
+}
+
+void ACPathVolume::ChangeChunkRefsInBox(const FBox& WorldBox, bool Add)
+{
+	if (!Chunks.IsEnabled() || !WorldBox.IsValid)
+		return;
+
+	std::vector<uint32> BoxChunks;
+	Chunks.GetChunksInBox(FIntVector(WorldLocationToLocalCoordsInt3(WorldBox.Min)), FIntVector(WorldLocationToLocalCoordsInt3(WorldBox.Max)), BoxChunks);
+	for (uint32 ChunkIndex : BoxChunks)
+	{
+		// Unloaded chunks are impassable for pathfinders right away, generators only release their memory
+		if (Add ? Chunks.AddRef(ChunkIndex) : Chunks.Release(ChunkIndex))
+			ChunksPendingRefresh.insert(ChunkIndex);
+	}
+
+	if (ChunksPendingRefresh.size() && InitialGenerationFinished && GeneratorsRunning.load() == 0)
+		StartRefreshingChunks();
+}
+
+void ACPathVolume::StartRefreshingChunks()
+{
+	ChunkBricksToRefresh.clear();
+	for (uint32 ChunkIndex : ChunksPendingRefresh)
+	{
+		Chunks.GetBricksInChunk(Octrees, ChunkIndex, ChunkBricksToRefresh);
+	}
+	ChunksPendingRefresh.clear();
+	StartRefreshingBricks();
+}
+
+void ACPathVolume::StartNextProgressiveWave()
+{
+	uint32 WaveEnd = FMath::Min((uint32)BrickOrder.size(), NextProgressiveBrick + (uint32)ProgressiveBricksPerWave);
+	ChunkBricksToRefresh.assign(BrickOrder.begin() + NextProgressiveBrick, BrickOrder.begin() + WaveEnd);
+	NextProgressiveBrick = WaveEnd;
+	StartRefreshingBricks();
+}
+
+void ACPathVolume::StartRefreshingBricks()
+{
+	// The graph is updated for every tree of the refreshed bricks
+	TreesToRegenerate.clear();
+	RegionsToRegenerate.clear();
+	std::vector<uint32> BrickOuterIndexes;
+	for (uint32 BrickIndex : ChunkBricksToRefresh)
+	{
+		Octrees.GetOuterIndexesInBrick(BrickIndex, BrickOuterIndexes);
+		TreesToRegenerate.insert(BrickOuterIndexes.begin(), BrickOuterIndexes.end());
+	}
+	if (ChunkBricksToRefresh.empty())
+		return;
+
+	// Every brick belongs to one generator, like in the initial generation
+	SortByBrickMortonCode(ChunkBricksToRefresh);
+	uint32 BrickCount = (uint32)ChunkBricksToRefresh.size();
+	StartGenerators(BrickCount, BrickCount / 8, [](FCPathAsyncVolumeGenerator& Generator)
+	{
+		Generator.bChunks = true;
+	});
+}
+
 void ACPathVolume::GenerationUpdate()
 {
 #if WITH_EDITOR
 	checkf(GeneratorsRunning.load() >= 0, TEXT("CPATH - Graph Generation:::GenerationUpdate - GeneratorsRunning was negative!!!!!"));
 #endif
-	// Garbage collecting generators that finished their job
-	CleanFinishedGenerators();
 
+	// Loaded deltas go first, obstacles are regenerated on top of them next update
+	if (GeneratorsRunning.load() == 0 && DeltasPendingApply)
+	{
+		StartApplyingDeltas();
+		return;
+	}
 
+	// Same for chunks that streamed in or out
+	if (GeneratorsRunning.load() == 0 && ChunksPendingRefresh.size())
+	{
+		StartRefreshingChunks();
+		return;
+	}
 
 	// We skip this update if generation from previous update is still running
 	// This can be the cause if we set DynamicObstaclesUpdateRate too high, or when it's initial generation, 
 	// or if there were a lot of pathfinding requests and generators are waiting for them to finish.
-	if (GeneratorsRunning.load() == 0 && TrackedDynamicObstacles.size())
+	if (GeneratorsRunning.load() == 0 && (TrackedDynamicObstacles.size() || ObstacleRegions.size()))
 	{
 
 		//Drawing previously updated trees
 		/*for (auto TreeID : TreesToRegenerate)
 		{
-			std::vector<uint32> Subtrees;
+			std::vector<CPathTreeID> Subtrees;
 			Subtrees.push_back(TreeID);
 			GetAllSubtrees(TreeID, Subtrees);
 			for (auto SubID : Subtrees)
@@ -1169,51 +1840,58 @@ void ACPathVolume::GenerationUpdate()
 			}
 		}*/
 
-		// Adding indexes from previous update
-		TreesToRegenerate = TreesToRegeneratePreviousUpdate;
-		TreesToRegeneratePreviousUpdate.clear();
-
-		// Adding new indexes
+		// Obstacles that didn't move add nothing, moved ones add where they were and where they are now
 		for (auto Obstacle : TrackedDynamicObstacles)
 		{
 			if (IsValid(Obstacle))
 			{
-				Obstacle->AddIndexesToUpdate(this);
+				Obstacle->AddRegionsToUpdate(this);
 			}
 		}
+		AddObstacleRegionsToRegenerate();
 
-		// Creating threads
-		// In case there is a lot of trees to update, we split the work into multiple threads to make it faster
+		// Splitting the work between generators
+		// In case there is a lot of trees to update, more of them are used to make it faster
 		if (TreesToRegenerate.size())
 		{
+			TreesToRegenerateList.assign(TreesToRegenerate.begin(), TreesToRegenerate.end());
+			SortOuterIndexesByBrickMortonCode(TreesToRegenerateList);
+			uint32 ThreadCount = FMath::Min(FPlatformMisc::NumberOfCores(), (int)TreesToRegenerateList.size() / OuterIndexesPerThread);
+			StartGenerators((uint32)TreesToRegenerateList.size(), ThreadCount, [](FCPathAsyncVolumeGenerator& Generator)
+			{
+				Generator.bObstacles = true;
+			});
+			//UE_LOG(LogTemp, Warning, TEXT("GENERATION UPDATE Tracked - %d, Indexes - %d, Threads - %d"), TrackedDynamicObstacles.size(), TreesToRegenerate.size(), ThreadCount);
+		}
+	}
+}
 
-			uint32 ThreadCount = FMath::Min(FMath::Min(FPlatformMisc::NumberOfCores(), (int)TreesToRegenerate.size() / OuterIndexesPerThread), MaxGenerationThreads);
-			ThreadCount = FMath::Max(ThreadCount, (uint32)1);
-			uint32 NodesPerThread = (uint32)TreesToRegenerate.size() / ThreadCount;
+void ACPathVolume::AddObstacleRegionsToRegenerate()
+{
+	TreesToRegenerate.clear();
+	RegionsToRegenerate.clear();
 
-			// Starting generation
-			for (uint32 CurrentThread = 0; CurrentThread < ThreadCount; CurrentThread++)
+	// Agent shapes are centered on trees, so trees up to the agent's size away from an obstacle are affected by it
+	FVector AgentExtent(FMath::Max(AgentRadius, AgentHalfHeight));
+	for (const FBox& ObstacleRegion : ObstacleRegions)
+	{
+		FBox Region = ObstacleRegion.ExpandBy(AgentExtent);
+		FVector Min = WorldLocationToLocalCoordsInt3(Region.Min);
+		FVector Max = WorldLocationToLocalCoordsInt3(Region.Max);
+		for (int32 X = FMath::Max(0, (int32)Min.X); X <= FMath::Min((int32)NodeCount[0] - 1, (int32)Max.X); X++)
+		{
+			for (int32 Y = FMath::Max(0, (int32)Min.Y); Y <= FMath::Min((int32)NodeCount[1] - 1, (int32)Max.Y); Y++)
 			{
-				uint32 LastIndex = NodesPerThread * (CurrentThread + 1);
-				if (CurrentThread == ThreadCount - 1)
-					LastIndex += TreesToRegenerate.size() % ThreadCount;
-
-				int ThreadID = GetFreeThreadID();
-				FString ThreadName = FCPathAsyncVolumeGenerator::GetNameFromID(ThreadID);
-				GeneratorThreads.push_back(std::make_unique<FCPathAsyncVolumeGenerator>(this, NodesPerThread * CurrentThread, LastIndex, ThreadID, ThreadName, true));
-				GeneratorThreads.back()->ThreadRef = FRunnableThread::Create(GeneratorThreads.back().get(), *ThreadName);
-				if (GeneratorThreads.back()->ThreadRef)
-				{
-					ThreadIDs[ThreadID] = true;
-				}
-				else
+				for (int32 Z = FMath::Max(0, (int32)Min.Z); Z <= FMath::Min((int32)NodeCount[2] - 1, (int32)Max.Z); Z++)
 				{
-					GeneratorThreads.pop_back();
+					uint32 OuterIndex = LocalCoordsInt3ToIndex(FVector(X, Y, Z));
+					TreesToRegenerate.insert(OuterIndex);
+					RegionsToRegenerate[OuterIndex].push_back(Region);
 				}
 			}
-			//UE_LOG(LogTemp, Warning, TEXT("GENERATION UPDATE Tracked - %d, Indexes - %d, Threads - %d"), TrackedDynamicObstacles.size(), TreesToRegenerate.size(), ThreadCount);
 		}
 	}
+	ObstacleRegions.clear();
 }
 
 void ACPathVolume::CalcFitness(CPathAStarNode& Node, FVector TargetLocation, int32 UserData)
@@ -1226,12 +1904,29 @@ void ACPathVolume::CalcFitness(CPathAStarNode& Node, FVector TargetLocation, int
 	Node.FitnessResult = Node.DistanceSoFar + 3.5f * FVector::Distance(Node.WorldLocation, TargetLocation);
 }
 
+bool ACPathVolume::RecheckBrickIsFree(FVector BrickLocation, FVector BrickExtent)
+{
+	// Agent shapes are centered on outer trees, so they can reach outside of the brick
+	BrickExtent += FVector(FMath::Max(AgentRadius, AgentHalfHeight));
+	if (StaticGeometry.IsGathered())
+		return StaticGeometry.IsBoxFree(BrickLocation, BrickExtent);
+
+	return !GetWorld()->OverlapAnyTestByChannel(BrickLocation, FQuat(FRotator(0)), TraceChannel, FCollisionShape::MakeBox(BrickExtent));
+}
+
+FVector ACPathVolume::GetBrickWorldLocation(uint32 BrickIndex) const
+{
+	FVector Origin(Octrees.GetBrickOrigin(BrickIndex));
+	return StartPosition + GetVoxelSizeByDepth(0) * (Origin + FVector((CPathOuterGrid::BRICK_SIZE - 1) / 2.f));
+}
+
 bool ACPathVolume::RecheckOctreeAtDepth(CPathOctree* OctreeRef, FVector TreeLocation, uint32 Depth)
 {
 	bool IsFree = true;
 	for (auto Shape : TraceShapesByDepth[Depth])
 	{
-		if (GetWorld()->OverlapAnyTestByChannel(TreeLocation, FQuat(FRotator(0)), TraceChannel, Shape))
+		if (StaticGeometry.IsGathered() ? !IsShapeFreeInStaticGeometry(TreeLocation, Shape)
+			: GetWorld()->OverlapAnyTestByChannel(TreeLocation, FQuat(FRotator(0)), TraceChannel, Shape))
 		{
 			IsFree = false;
 			break;
@@ -1243,6 +1938,14 @@ bool ACPathVolume::RecheckOctreeAtDepth(CPathOctree* OctreeRef, FVector TreeLoca
 	return IsFree;
 }
 
+bool ACPathVolume::IsShapeFreeInStaticGeometry(FVector Location, const FCollisionShape& Shape) const
+{
+	if (Shape.IsSphere())
+		return StaticGeometry.IsSphereFree(Location, Shape.GetSphereRadius());
+
+	return StaticGeometry.IsBoxFree(Location, Shape.GetExtent());
+}
+
 const FVector ACPathVolume::LookupTable_ChildPositionOffsetMaskByIndex[8] = {
 	{-1, -1, -1},
 	{-1,  1, -1},
@@ -0,0 +1,312 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathVolume.h"
+#include "CPathBake.h"
+#include "CPathAsyncVolumeGeneration.h"
+#include "Components/BoxComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/World.h"
+#include "Engine/Level.h"
+#include "HAL/PlatformFileManager.h"
+#include "HAL/FileManager.h"
+#include "Hash/CityHash.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/PackageName.h"
+
+
+
+static inline uint64 AlignBakeOffset(uint64 Offset)
+{
+	return (Offset + CPATH_BAKE_ALIGNMENT - 1) & ~(uint64)(CPATH_BAKE_ALIGNMENT - 1);
+}
+
+static inline uint64 HashBakeString(const FString& String)
+{
+	FTCHARToUTF8 Utf8(*String);
+	return CityHash64(Utf8.Get(), Utf8.Length());
+}
+
+
+FString ACPathVolume::GetBakeFilePath() const
+{
+	FString MapName = TEXT("NoLevel");
+	if (GetLevel())
+	{
+		MapName = FPackageName::GetShortName(UWorld::RemovePIEPrefix(GetLevel()->GetPackage()->GetName()));
+	}
+	return FPaths::ProjectContentDir() / CPATH_BAKE_DIRECTORY / FString::Printf(TEXT("%s_%s.cpathbake"), *MapName, *GetName());
+}
+
+uint64 ACPathVolume::ComputeSettingsHash() const
+{
+	FString Settings = FString::Printf(TEXT("%d|%u|%.4f|%d|%d|%.4f|%.4f|%d|%s|%s|%s"),
+		CPATH_BAKE_VERSION, (uint32)sizeof(CPathTreeID),
+		VoxelSize, OctreeDepth, (int)AgentShape.GetValue(), AgentRadius, AgentHalfHeight, (int)TraceChannel.GetValue(),
+		*GetActorLocation().ToString(), *VolumeBox->GetScaledBoxExtent().ToString(), *GetClass()->GetPathName());
+	return HashBakeString(Settings);
+}
+
+uint64 ACPathVolume::ComputeCollisionHash() const
+{
+	UWorld* World = GetWorld();
+	if (!World)
+		return 0;
+
+	// Agent shapes are up to one voxel larger than the volume, so collision right outside of it matters too
+	FVector Extent = VolumeBox->GetScaledBoxExtent() + FVector(VoxelSize + FMath::Max(AgentRadius, AgentHalfHeight));
+
+	FCollisionQueryParams Params;
+	Params.AddIgnoredActor(this);
+	TArray<FOverlapResult> Overlaps;
+	World->OverlapMultiByChannel(Overlaps, GetActorLocation(), FQuat::Identity, TraceChannel, FCollisionShape::MakeBox(Extent), Params);
+
+	// Overlap order is not deterministic
+	TArray<uint64> ComponentHashes;
+	for (const FOverlapResult& Overlap : Overlaps)
+	{
+		const UPrimitiveComponent* Component = Overlap.GetComponent();
+		if (!Component)
+			continue;
+
+		// Dynamic obstacles are regenerated at runtime anyway
+		if (Component->Mobility == EComponentMobility::Movable)
+			continue;
+
+		// Streamed levels may not be loaded yet, so only the persistent level can be compared
+		if (StreamChunks && Component->GetComponentLevel() != World->PersistentLevel)
+			continue;
+
+		FString Description = Component->GetName();
+		if (Component->GetOwner())
+			Description += Component->GetOwner()->GetName();
+
+		if (const UStaticMeshComponent* MeshComponent = Cast<UStaticMeshComponent>(Component))
+			if (MeshComponent->GetStaticMesh())
+				Description += MeshComponent->GetStaticMesh()->GetPathName();
+
+		Description += Component->GetComponentTransform().ToString();
+		Description += Component->Bounds.GetBox().ToString();
+		ComponentHashes.Add(HashBakeString(Description));
+	}
+	ComponentHashes.Sort();
+
+	return CityHash64((const char*)ComponentHashes.GetData(), ComponentHashes.Num() * sizeof(uint64));
+}
+
+uint32 ACPathVolume::BakeOctetRec(uint32 OctetIndex, TArray<CPathOctree>& Octets) const
+{
+	uint32 NewIndex = Octets.Num() / 8;
+	Octets.AddDefaulted(8);
+
+	const CPathOctree* Source = OctreePool.Get(OctetIndex);
+	for (int i = 0; i < 8; i++)
+	{
+		// Octets can reallocate in the recursive call, so it has to be indexed every time
+		uint32 Children = Source[i].Children ? BakeOctetRec(Source[i].Children, Octets) : 0;
+		Octets[NewIndex * 8 + i].Data = Source[i].Data;
+		Octets[NewIndex * 8 + i].Children = Children;
+	}
+	return NewIndex;
+}
+
+bool ACPathVolume::SaveBake(const FString& Path, const uint32* CountAtDepth)
+{
+	FCPathBakeHeader Header;
+	Header.OctreeDepth = OctreeDepth;
+	Header.NodeCount[0] = NodeCount[0];
+	Header.NodeCount[1] = NodeCount[1];
+	Header.NodeCount[2] = NodeCount[2];
+	Header.BrickCount = Octrees.GetBrickCount();
+	Header.SettingsHash = ComputeSettingsHash();
+	Header.CollisionHash = ComputeCollisionHash();
+	for (int Depth = 0; Depth <= OctreeDepth; Depth++)
+	{
+		Header.OctreeCountAtDepth[Depth] = CountAtDepth[Depth];
+	}
+
+	// Compacting the pool depth first, so that a subtree is close together in the file. Octet 0 stays reserved.
+	TArray<uint32> BrickStates;
+	TArray<CPathOctree> Bricks;
+	TArray<CPathOctree> Octets;
+	Octets.AddDefaulted(8);
+	BrickStates.SetNumUninitialized(Header.BrickCount);
+
+	for (uint32 BrickIndex = 0; BrickIndex < Header.BrickCount; BrickIndex++)
+	{
+		const CPathOctree* Brick = Octrees.GetBrick(BrickIndex);
+		if (!Octrees.IsBrickMaterialized(BrickIndex))
+		{
+			BrickStates[BrickIndex] = Brick[0].GetIsFree() ? 1 : 0;
+			continue;
+		}
+
+		BrickStates[BrickIndex] = 2 + Header.MaterializedBrickCount++;
+		int32 First = Bricks.AddDefaulted(CPathOuterGrid::TREES_PER_BRICK);
+		for (uint32 LocalIndex = 0; LocalIndex < CPathOuterGrid::TREES_PER_BRICK; LocalIndex++)
+		{
+			Bricks[First + LocalIndex].Data = Brick[LocalIndex].Data;
+			Bricks[First + LocalIndex].Children = Brick[LocalIndex].Children ? BakeOctetRec(Brick[LocalIndex].Children, Octets) : 0;
+		}
+	}
+	Header.OctetCount = Octets.Num() / 8;
+
+	Header.BrickStatesOffset = AlignBakeOffset(sizeof(FCPathBakeHeader));
+	Header.BricksOffset = AlignBakeOffset(Header.BrickStatesOffset + BrickStates.Num() * sizeof(uint32));
+	Header.OctetsOffset = AlignBakeOffset(Header.BricksOffset + Bricks.Num() * sizeof(CPathOctree));
+	Header.FileSize = Header.OctetsOffset + Octets.Num() * sizeof(CPathOctree);
+
+	TArray64<uint8> FileData;
+	FileData.SetNumZeroed(Header.FileSize);
+	FMemory::Memcpy(FileData.GetData(), &Header, sizeof(FCPathBakeHeader));
+	FMemory::Memcpy(FileData.GetData() + Header.BrickStatesOffset, BrickStates.GetData(), BrickStates.Num() * sizeof(uint32));
+	FMemory::Memcpy(FileData.GetData() + Header.BricksOffset, Bricks.GetData(), Bricks.Num() * sizeof(CPathOctree));
+	FMemory::Memcpy(FileData.GetData() + Header.OctetsOffset, Octets.GetData(), Octets.Num() * sizeof(CPathOctree));
+
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(Path), true);
+	return FFileHelper::SaveArrayToFile(FileData, *Path);
+}
+
+bool ACPathVolume::LoadBake(const FString& Path)
+{
+	if (!FPaths::FileExists(Path))
+		return false;
+
+	const uint8* FileData = nullptr;
+	int64 FileSize = 0;
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	BakeFileHandle.Reset(PlatformFile.OpenMapped(*Path));
+	if (BakeFileHandle)
+	{
+		BakeFileRegion.Reset(BakeFileHandle->MapRegion(0, BakeFileHandle->GetFileSize()));
+	}
+	if (BakeFileRegion)
+	{
+		FileData = BakeFileRegion->GetMappedPtr();
+		FileSize = BakeFileRegion->GetMappedSize();
+	}
+	else if (FFileHelper::LoadFileToArray(BakeFileData, *Path))
+	{
+		FileData = BakeFileData.GetData();
+		FileSize = BakeFileData.Num();
+	}
+	else
+	{
+		ReleaseBake();
+		return false;
+	}
+
+	FString Error;
+	const FCPathBakeHeader* Header = (const FCPathBakeHeader*)FileData;
+	if (FileSize < (int64)sizeof(FCPathBakeHeader) || Header->Magic != CPATH_BAKE_MAGIC)
+		Error = TEXT("not a bake file");
+	else if (Header->Version != CPATH_BAKE_VERSION || Header->TreeIDSize != sizeof(CPathTreeID))
+		Error = TEXT("made with a different version of CPathfinding");
+	else if (Header->FileSize != (uint64)FileSize
+		|| Header->BrickStatesOffset + (uint64)Header->BrickCount * sizeof(uint32) > Header->BricksOffset
+		|| Header->BricksOffset + (uint64)Header->MaterializedBrickCount * CPathOuterGrid::TREES_PER_BRICK * sizeof(CPathOctree) > Header->OctetsOffset
+		|| Header->OctetsOffset + (uint64)Header->OctetCount * 8 * sizeof(CPathOctree) > Header->FileSize
+		|| Header->OctetsOffset % CPATH_BAKE_ALIGNMENT != 0 || Header->OctetCount == 0)
+		Error = TEXT("file is corrupted");
+	else if (Header->OctreeDepth != OctreeDepth || Header->NodeCount[0] != NodeCount[0] || Header->NodeCount[1] != NodeCount[1]
+		|| Header->NodeCount[2] != NodeCount[2] || Header->BrickCount != Octrees.GetBrickCount() || Header->SettingsHash != ComputeSettingsHash())
+		Error = TEXT("volume settings changed");
+	else if (Header->CollisionHash != ComputeCollisionHash())
+		Error = TEXT("level collision changed");
+
+	const uint32* BrickStates = (const uint32*)(FileData + Header->BrickStatesOffset);
+	for (uint32 BrickIndex = 0; BrickIndex < Header->BrickCount && Error.IsEmpty(); BrickIndex++)
+	{
+		if (BrickStates[BrickIndex] >= 2 && BrickStates[BrickIndex] - 2 >= Header->MaterializedBrickCount)
+			Error = TEXT("file is corrupted");
+	}
+
+	if (!Error.IsEmpty())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPath - Volume '%s' ignored its bake (%s), generating instead. Rebake the volume to fix it."), *GetName(), *Error);
+		ReleaseBake();
+		return false;
+	}
+
+	// Octets are used in place, bricks are small so they are copied into the grid
+	BakeBrickStates = BrickStates;
+	BakeBricks = (const CPathOctree*)(FileData + Header->BricksOffset);
+	const CPathOctree* Octets = (const CPathOctree*)(FileData + Header->OctetsOffset);
+
+	OctreePool.Init(GetMaxOctetCount(), Octets, Header->OctetCount);
+	for (uint32 BrickIndex = 0; BrickIndex < Header->BrickCount; BrickIndex++)
+	{
+		// The rest is loaded when its chunk streams in
+		if (Chunks.IsBrickResident(Octrees.GetBrickOrigin(BrickIndex)))
+			LoadBrickFromBake(BrickIndex);
+	}
+
+	for (int Depth = 0; Depth <= OctreeDepth; Depth++)
+	{
+		OctreeCountAtDepth[Depth] = Header->OctreeCountAtDepth[Depth];
+	}
+	return true;
+}
+
+bool ACPathVolume::LoadBrickFromBake(uint32 BrickIndex)
+{
+	if (!BakeBrickStates)
+		return false;
+
+	uint32 State = BakeBrickStates[BrickIndex];
+	if (State < 2)
+		Octrees.SetBrickUniform(BrickIndex, State == 1);
+	else
+		Octrees.LoadBrick(BrickIndex, BakeBricks + (uint64)(State - 2) * CPathOuterGrid::TREES_PER_BRICK);
+	return true;
+}
+
+void ACPathVolume::ReleaseBake()
+{
+	BakeBrickStates = nullptr;
+	BakeBricks = nullptr;
+	BakeFileRegion.Reset();
+	BakeFileHandle.Reset();
+	BakeFileData.Empty();
+}
+
+#if WITH_EDITOR
+void ACPathVolume::BakeOctree()
+{
+	if (GenerationStarted || !GetWorld())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPath - Volume '%s' can't be baked after its generation started."), *GetName());
+		return;
+	}
+
+	double BakeStart = FPlatformTime::Seconds();
+
+	// Same generation as on begin play, just on this thread and without the graph
+	VolumeBox->UpdateOverlaps();
+	InitGenerationData();
+
+	// The whole volume is baked, all streamed levels should be loaded in the editor
+	Chunks.Init(NodeCount, ChunkSizeInBricks, false);
+	if (VoxelizeStaticGeometry)
+		StaticGeometry.Gather(this);
+	GeneratorsPendingGraphUpdate.store(1);
+	NextGenerationItem.store(0);
+	FCPathAsyncVolumeGenerator Generator(this, 0, TEXT("CPathBakeGenerator"));
+	Generator.bUpdateGraph = false;
+	Generator.Start(0, Octrees.GetBrickCount());
+
+	FString Path = GetBakeFilePath();
+	if (SaveBake(Path, Generator.OctreeCountAtDepth))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPath - Volume '%s' baked to %s in %lfs, octree memory: %fMB"), *GetName(), *Path, FPlatformTime::Seconds() - BakeStart, GetOctreeMemoryUsage() / (1024.f * 1024.f));
+	}
+	else
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPath - Volume '%s' failed to save its bake to %s"), *GetName(), *Path);
+	}
+
+	ReleaseGenerationData();
+}
+#endif
@@ -44,3 +44,10 @@ bool ACPathVolumeGroundPrio::RecheckOctreeAtDepth(CPathOctree* OctreeRef, FVecto
 	return IsFree;
 	
 }
+
+bool ACPathVolumeGroundPrio::RecheckBrickIsFree(FVector BrickLocation, FVector BrickExtent)
+{
+	// A brick can only be uniform if none of its trees is a ground node, so the ground trace has to fit in the test
+	BrickExtent.Z += VoxelSize * 1.49;
+	return Super::RecheckBrickIsFree(BrickLocation, BrickExtent);
+}
@@ -4,9 +4,11 @@
 #include "CPathfindingThread.h"
 #include "CPathVolume.h"
 #include "CPathFindPath.h"
+#include "CPathFlowField.h"
 #include "Engine/World.h"
 #include "GenericPlatform/GenericPlatformProcess.h"
 #include "CPathCore.h"
+#include <algorithm>
 
 
 FCPathfindingThread::FCPathfindingThread(ACPathCore* Producer, int Index)
@@ -15,8 +17,13 @@ FCPathfindingThread::FCPathfindingThread(ACPathCore* Producer, int Index)
 	ThreadIndex = Index;
 	Semaphore = FGenericPlatformProcess::GetSynchEventFromPool();
 	ThreadName = FString::Printf(TEXT("CPathfindingThread %d"), Index);
+	ActiveSearches.reserve(MAX_ACTIVE_SEARCHES);
+	for (int i = 0; i < MAX_ACTIVE_SEARCHES; i++)
+	{
+		AStarPool.push_back(new CPathAStar());
+	}
+	FreeAStars = AStarPool;
 	Thread = FRunnableThread::Create(this, *ThreadName);
-	AStar = new CPathAStar();
 }
 
 FCPathfindingThread::~FCPathfindingThread()
@@ -32,16 +39,23 @@ FCPathfindingThread::~FCPathfindingThread()
 		delete Thread;
 		Thread = nullptr;
 	}	
-	if (AStar)
+	for (FActiveSearch& Search : ActiveSearches)
+	{
+		if (!Search.Request.Batch)
+			delete Search.Result;
+	}
+	ActiveSearches.clear();
+	Pending.clear();
+	for (CPathAStar* AStar : AStarPool)
 	{
 		delete AStar;
-		AStar = nullptr;
 	}
+	AStarPool.clear();
+	FreeAStars.clear();
 }
 
 bool FCPathfindingThread::Init()
 {
-	InputQueue.Empty();
 	return true;
 }
 
@@ -50,69 +64,362 @@ uint32 FCPathfindingThread::Run()
 	PrintThreadMessage(FString("Working"));
 	while (!KillRequested.load())
 	{
-		// Getting/waiting for new request
-		if (InputQueue.IsEmpty())
+		// A new request gets its first slice right away, then one of the paused searches continues.
+		// Short requests finish in their first slice, so they don't wait behind long ones.
+		// Requests of lower priority than a running search wait, they would get no slices anyway.
+		int32 RunningPriority = MIN_int32;
+		for (const FActiveSearch& Active : ActiveSearches)
+		{
+			RunningPriority = FMath::Max(RunningPriority, Active.Request.Priority);
+		}
+
+		FCPathRequest Request;
+		bool bHasRequest = false;
+		if (ActiveSearches.size() < MAX_ACTIVE_SEARCHES)
+		{
+			bHasRequest = TakeRequest(Request, RunningPriority);
+
+			// An idle thread helps the busiest one, whose pending requests would wait behind its running searches
+			if (!bHasRequest && ActiveSearches.empty() && CoreRef->StealRequest(this, Request))
+			{
+				bHasRequest = true;
+				CurrentTaskCount++;
+				TasksAssigned++;
+				StolenCount++;
+			}
+		}
+
+		// Left over requests, or ones waiting behind higher priority, can be taken by a sleeping thread
+		if (PendingCount.load() > 0)
+			CoreRef->WakeIdleThread(this);
+
+		// Waiting for new request
+		if (!bHasRequest && ActiveSearches.empty())
 		{
 			IsDoingWork = false;
 			PrintThreadMessage(FString::Printf(TEXT("WaitingForTask. CurrentTaskCount= %d, TasksSubmited= %d, TasksAssigned= %d"), CurrentTaskCount.load(), TasksSubmited, TasksAssigned));
-			Semaphore->Wait();
+
+			// A request assigned after this sees bSleeping and triggers the event, one assigned before is in PendingCount
+			bSleeping.store(true);
+			if (PendingCount.load() == 0 && !KillRequested)
+				Semaphore->Wait();
+			bSleeping.store(false);
 			if (KillRequested)
 				return 0;
 			IsDoingWork = true;
-		}
-		FCPathRequest Request;
-		if (!InputQueue.Dequeue(Request))
 			continue;
+		}
 
-		// After volume is generated and valid, performing FindPath call
-		if (WaitForVolume(Request.VolumeRef))
+		if (bHasRequest)
 		{
-			Request.VolumeRef->PathfindersRunning++;
+			FActiveSearch Search;
+			Search.Request = MoveTemp(Request);
+			Search.AStar = FreeAStars.back();
+			FreeAStars.pop_back();
+			ActiveSearches.push_back(MoveTemp(Search));
 
-			// State of the volume could have changed during incrementing the atomic variable
-			// So it's necessary to check it again before doing any pathfinding
-			if (WaitForVolume(Request.VolumeRef))
-			{
-				// This is deleted in CPathCore::Tick
-				FCPathResult* Result = new FCPathResult();
-
-				Result->FailReason = AStar->FindPath(Request.VolumeRef, Result, Request.Start, Request.End,
-					Request.SmoothingPasses, Request.UserData, Request.TimeLimit,
-					Request.RequestRawPath, Request.RequestUserPath);
-					
-				Request.VolumeRef->PathfindersRunning--;
-
-				// Thread could be stopped during pathfinding
-				// In this case we dont have a proper result
-				if (KillRequested)
-				{
-					delete Result;
-					return 0;
-				}
+			bool bFinished = RunSlice(ActiveSearches.back(), true);
+			if (KillRequested)
+				return 0;
+			if (bFinished)
+				RemoveActiveSearch(ActiveSearches.size() - 1);
+		}
+
+		if (!ActiveSearches.empty())
+		{
+			NextActiveSearch = PickActiveSearch();
+
+			bool bFinished = RunSlice(ActiveSearches[NextActiveSearch], false);
+			if (KillRequested)
+				return 0;
+			if (bFinished)
+				RemoveActiveSearch(NextActiveSearch);
+			else
+				NextActiveSearch++;
+		}
+	}
+	return 0;
+}
+
+bool FCPathfindingThread::RunSlice(FActiveSearch& Search, bool bFirstSlice)
+{
+	FCPathRequest& Request = Search.Request;
+	ACPathVolume* Volume = Request.VolumeRef;
+
+	// Cancelled requests end without a callback
+	if (Request.State && Request.State->bCancelled.load())
+	{
+		Search.AStar->AbortSearch();
+		DropSearch(Search);
+		return true;
+	}
+
+	// Past the deadline, the search ends with Timeout without running further
+	if (Request.DeadlineTime > 0 && FPlatformTime::Seconds() >= Request.DeadlineTime)
+	{
+		Search.AStar->AbortSearch();
+		if (!Search.Result)
+			Search.Result = Request.Batch ? &Request.Batch->Results[Request.BatchIndex] : CoreRef->AcquireResult();
+		Search.Result->FailReason = Timeout;
+		FinishSearch(Search);
+		return true;
+	}
 
-				SubmitResult(Result, Request.OnPathFound);
+	// After volume is generated and valid, performing FindPath call
+	if (!WaitForVolume(Volume))
+	{
+		DropSearch(Search);
+		return true;
+	}
+	Volume->PathfindersRunning++;
+
+	// State of the volume could have changed during incrementing the atomic variable
+	// So it's necessary to check it again before doing any pathfinding
+	if (!WaitForVolume(Volume))
+	{
+		Volume->PathfindersRunning--;
+		DropSearch(Search);
+		return true;
+	}
+
+	// Leafs of batch requests are looked up here instead of on the game thread, then the searches are spread over threads
+	if (Request.Batch && Request.BatchIndex == INDEX_NONE)
+	{
+		std::vector<FCPathRequest> Searches;
+		Volume->PrepareBatch(Request.Batch, Searches);
+		Volume->PathfindersRunning--;
+
+		// Counted before the searches are assigned, so the batch can't be submitted before all of them finished
+		Request.Batch->Remaining = (int)Searches.size();
+		CurrentTaskCount--;
+		if (Searches.empty())
+			SubmitBatch(Request.Batch);
+		else
+			CoreRef->AssignBatch(Searches);
+		return true;
+	}
+
+	CPathAStar* AStar = Search.AStar;
+	AStar->CancelFlag = Request.State ? &Request.State->bCancelled : nullptr;
+	if (Request.OnCoarsePathFound.IsBound())
+	{
+		AStar->OnCoarsePathFound = [this, &Request](const TArray<FCPathNode>& CoarsePath)
+		{
+			if (!Request.State || !Request.State->bCancelled.load())
+				SubmitCoarseResult(CoarsePath, GuardCancelled(Request, Request.OnCoarsePathFound));
+		};
+	}
+	else
+	{
+		AStar->OnCoarsePathFound = nullptr;
+	}
+
+	RunningAStar.store(AStar);
+	bool bFinished;
+
+	// Regeneration publishes a new snapshot instead of waiting for this slice
+	{
+		FCPathSnapshotScope Snapshot(Volume->Snapshots);
+		if (Request.FlowField)
+		{
+			// Sliced like searches. This is returned to the pool in CPathCore::Tick
+			if (bFirstSlice)
+			{
+				Search.Result = CoreRef->AcquireResult();
+				bFinished = !Request.FlowField->BeginBuild(Volume, Request.End, Search.Result)
+					|| Request.FlowField->ContinueBuild(Volume->AsyncSearchSliceTime);
 			}
 			else
 			{
-				Request.VolumeRef->PathfindersRunning--;
-				CurrentTaskCount--;
+				bFinished = Request.FlowField->ContinueBuild(Volume->AsyncSearchSliceTime);
 			}
 		}
+		else if (bFirstSlice)
+		{
+			// This is returned to the pool in CPathCore::Tick, batches have their own results
+			Search.Result = Request.Batch ? &Request.Batch->Results[Request.BatchIndex] : CoreRef->AcquireResult();
+			float TimeLimit = Request.TimeLimit;
+			if (Request.DeadlineTime > 0)
+				TimeLimit = FMath::Min(TimeLimit, (float)(Request.DeadlineTime - FPlatformTime::Seconds()));
+			bFinished = !AStar->BeginFindPath(Volume, Search.Result, Request.Start, Request.End,
+				Request.SmoothingPasses, Request.UserData, TimeLimit,
+				Request.RequestRawPath, Request.RequestUserPath, Request.UseJumpPointSearch,
+				Request.Bidirectional.get(), Request.bBackwardHalf)
+				|| AStar->ContinueFindPath(Volume->AsyncSearchSliceTime);
+		}
 		else
 		{
-			CurrentTaskCount--;
+			bFinished = AStar->ContinueFindPath(Volume->AsyncSearchSliceTime);
 		}
-	
+	}
+	RunningAStar.store(nullptr);
+	Volume->PathfindersRunning--;
+
+	// Thread could be stopped during pathfinding
+	// In this case we dont have a proper result
+	if (KillRequested)
+	{
+		if (!Request.Batch)
+			delete Search.Result;
+		Search.Result = nullptr;
+		return true;
+	}
+
+	if (!bFinished)
+		return false;
+
+	if (Request.State && Request.State->bCancelled.load())
+		DropSearch(Search);
+	else
+		FinishSearch(Search);
+	return true;
+}
+
+void FCPathfindingThread::FinishSearch(FActiveSearch& Search)
+{
+	FCPathRequest& Request = Search.Request;
+	EndBidirectionalHalf(Request);
+	if (Request.Batch)
+	{
+		SubmitBatchResult(Request);
+	}
+	else if (Request.bBackwardHalf)
+	{
+		CoreRef->ReleaseResult(Search.Result);
+		CurrentTaskCount--;
+	}
+	else
+	{
+		SubmitResult(Search.Result, GuardCancelled(Request, Request.OnPathFound));
+	}
+	Search.Result = nullptr;
+}
+
+PathResultDelegate FCPathfindingThread::GuardCancelled(const FCPathRequest& Request, const PathResultDelegate& Delegate)
+{
+	if (!Request.State)
+		return Delegate;
+
+	// The request can still be cancelled before the game thread gets to the result
+	PathResultDelegate Guarded;
+	Guarded.BindLambda([State = Request.State, Delegate](FCPathResult& Result)
+	{
+		if (!State->bCancelled.load())
+			Delegate.ExecuteIfBound(Result);
+	});
+	return Guarded;
+}
+
+size_t FCPathfindingThread::PickActiveSearch()
+{
+	int32 HighestPriority = MIN_int32;
+	for (const FActiveSearch& Active : ActiveSearches)
+	{
+		HighestPriority = FMath::Max(HighestPriority, Active.Request.Priority);
+	}
+	for (size_t i = 0; i < ActiveSearches.size(); i++)
+	{
+		size_t Index = (NextActiveSearch + i) % ActiveSearches.size();
+		if (ActiveSearches[Index].Request.Priority == HighestPriority)
+			return Index;
 	}
 	return 0;
 }
 
+bool FCPathfindingThread::IsServedAfter(const FPendingRequest& A, const FPendingRequest& B)
+{
+	if (A.Request.Priority != B.Request.Priority)
+		return A.Request.Priority < B.Request.Priority;
+
+	// No deadline goes last
+	if (A.Request.DeadlineTime != B.Request.DeadlineTime)
+		return A.Request.DeadlineTime == 0 || (B.Request.DeadlineTime > 0 && A.Request.DeadlineTime > B.Request.DeadlineTime);
+
+	return A.Order > B.Order;
+}
+
+void FCPathfindingThread::PushPending(FCPathRequest&& Request)
+{
+	Pending.push_back(FPendingRequest{ MoveTemp(Request), NextPendingOrder++ });
+	std::push_heap(Pending.begin(), Pending.end(), &FCPathfindingThread::IsServedAfter);
+	PendingCount++;
+}
+
+bool FCPathfindingThread::TakeRequest(FCPathRequest& OutRequest, int32 MinPriority)
+{
+	if (PendingCount.load() == 0)
+		return false;
+
+	FScopeLock Lock(&Mutex);
+	if (Pending.empty() || Pending.front().Request.Priority < MinPriority)
+		return false;
+
+	std::pop_heap(Pending.begin(), Pending.end(), &FCPathfindingThread::IsServedAfter);
+	OutRequest = MoveTemp(Pending.back().Request);
+	Pending.pop_back();
+	PendingCount--;
+	return true;
+}
+
+void FCPathfindingThread::DropSearch(FActiveSearch& Search)
+{
+	EndBidirectionalHalf(Search.Request);
+	if (Search.Request.Batch && Search.Request.BatchIndex == INDEX_NONE)
+	{
+		// Batch that wasn't prepared has no searches yet, it fails as a whole
+		for (FCPathResult& Result : Search.Request.Batch->Results)
+		{
+			Result.FailReason = VolumeNotValid;
+		}
+		CurrentTaskCount--;
+		SubmitBatch(Search.Request.Batch);
+		return;
+	}
+	if (Search.Request.Batch)
+	{
+		// Rest of the batch still gets its results
+		Search.Request.Batch->Results[Search.Request.BatchIndex].FailReason = VolumeNotValid;
+		Search.Result = nullptr;
+		SubmitBatchResult(Search.Request);
+		return;
+	}
+	if (Search.Request.FlowField)
+	{
+		// The field counts as building until its delegate runs, so it gets a failed result instead of nothing
+		if (!Search.Result)
+			Search.Result = CoreRef->AcquireResult();
+		Search.Result->FailReason = VolumeNotValid;
+		SubmitResult(Search.Result, Search.Request.OnPathFound);
+		Search.Result = nullptr;
+		return;
+	}
+	if (Search.Result)
+	{
+		CoreRef->ReleaseResult(Search.Result);
+		Search.Result = nullptr;
+	}
+	CurrentTaskCount--;
+}
+
+void FCPathfindingThread::RemoveActiveSearch(size_t Index)
+{
+	FreeAStars.push_back(ActiveSearches[Index].AStar);
+	if (Index != ActiveSearches.size() - 1)
+		ActiveSearches[Index] = MoveTemp(ActiveSearches.back());
+	ActiveSearches.pop_back();
+}
+
 void FCPathfindingThread::Stop()
 {
 	PrintThreadMessage(FString("Stop"));
 	KillRequested.store(true);
-	AStar->bStop.store(true);
-	InputQueue.Empty();
+	if (CPathAStar* AStar = RunningAStar.load())
+		AStar->bStop.store(true);
+	{
+		FScopeLock Lock(&Mutex);
+		Pending.clear();
+		PendingCount = 0;
+	}
 	WakeUp();
 }
 
@@ -155,10 +462,45 @@ int FCPathfindingThread::GetTaskCount()
 
 void FCPathfindingThread::AssignTask(FCPathRequest& FindPathRequest)
 {
-	InputQueue.Enqueue(FindPathRequest);
+	{
+		FScopeLock Lock(&Mutex);
+		PushPending(FCPathRequest(FindPathRequest));
+	}
 	CurrentTaskCount++;
 	TasksAssigned++;
+	WakeUpIfSleeping();
+}
+
+bool FCPathfindingThread::WakeUpIfSleeping()
+{
+	if (!bSleeping.exchange(false))
+		return false;
 	WakeUp();
+	return true;
+}
+
+bool FCPathfindingThread::GiveRequest(FCPathRequest& OutRequest)
+{
+	FScopeLock Lock(&Mutex);
+
+	// Halves of a bidirectional search stay on the threads ACPathCore picked, a stolen one could end up next to the other half
+	size_t Best = Pending.size();
+	for (size_t i = 0; i < Pending.size(); i++)
+	{
+		if (!Pending[i].Request.Bidirectional && (Best == Pending.size() || IsServedAfter(Pending[Best], Pending[i])))
+			Best = i;
+	}
+	if (Best == Pending.size())
+		return false;
+
+	OutRequest = MoveTemp(Pending[Best].Request);
+	if (Best != Pending.size() - 1)
+		Pending[Best] = MoveTemp(Pending.back());
+	Pending.pop_back();
+	std::make_heap(Pending.begin(), Pending.end(), &FCPathfindingThread::IsServedAfter);
+	PendingCount--;
+	CurrentTaskCount--;
+	return true;
 }
 
 void FCPathfindingThread::PrintThreadMessage(FString Message)
@@ -176,11 +518,105 @@ void FCPathfindingThread::SubmitResult(FCPathResult* Result, PathResultDelegate
 	TasksSubmited++;
 }
 
+void FCPathfindingThread::SubmitBatchResult(FCPathRequest& Request)
+{
+	checkf(IsValid(CoreRef), TEXT("CPATH - PathfindingThread SubmitBatchResult:::CoreRef not valid!"));
+	std::shared_ptr<FCPathBatch> Batch = Request.Batch;
+	ShareBatchResult(Request);
+
+	CurrentTaskCount--;
+	TasksSubmited++;
+	if (--Batch->Remaining > 0)
+		return;
+	SubmitBatch(Batch);
+}
+
+void FCPathfindingThread::SubmitBatch(const std::shared_ptr<FCPathBatch>& Batch)
+{
+	// The whole batch goes to the game thread as one output
+	PathResultDelegate Delegate;
+	Delegate.BindLambda([Batch](FCPathResult&)
+	{
+		Batch->Finish();
+	});
+	CoreRef->OutputQueue.Enqueue(std::pair<FCPathResult*, PathResultDelegate>(CoreRef->AcquireResult(), Delegate));
+}
+
+void FCPathfindingThread::ShareBatchResult(FCPathRequest& Request)
+{
+	FCPathBatch& Batch = *Request.Batch;
+	const FCPathResult& Searched = Batch.Results[Request.BatchIndex];
+	ACPathVolume* Volume = Request.VolumeRef;
+
+	for (int32 i = 0; i < Batch.Results.Num(); i++)
+	{
+		if (i == Request.BatchIndex || Batch.SearchIndexes[i] != Request.BatchIndex)
+			continue;
+
+		FCPathResult& Result = Batch.Results[i];
+		Result = Searched;
+		if (Searched.FailReason != None)
+			continue;
+
+		FCPathRequest& Shared = Batch.SharedRequests[i];
+		if (Result.ReplaceEndpoints(Shared.Start, Shared.End, [Volume](FVector A, FVector B) { return Volume->IsSegmentFree(A, B); }))
+			continue;
+
+		// Counted before this search is, so the batch can't be submitted in between
+		Result.Reset();
+		Shared.Batch = Request.Batch;
+		Batch.Remaining++;
+		AssignTasks(&Shared, 1);
+	}
+}
+
+void FCPathfindingThread::AssignTasks(FCPathRequest* Requests, int Count)
+{
+	{
+		FScopeLock Lock(&Mutex);
+		for (int i = 0; i < Count; i++)
+		{
+			PushPending(MoveTemp(Requests[i]));
+		}
+	}
+	CurrentTaskCount += Count;
+	TasksAssigned += Count;
+	WakeUpIfSleeping();
+}
+
+void FCPathfindingThread::SubmitCoarseResult(const TArray<FCPathNode>& CoarsePath, PathResultDelegate Delegate)
+{
+	checkf(IsValid(CoreRef), TEXT("CPATH - PathfindingThread SubmitCoarseResult:::CoreRef not valid!"));
+	FCPathResult* Result = CoreRef->AcquireResult();
+	Result->FailReason = None;
+	Result->bCoarsePath = true;
+	Result->UserPath = CoarsePath;
+	CoreRef->OutputQueue.Enqueue(std::pair<FCPathResult*, PathResultDelegate>(Result, Delegate));
+}
+
+void FCPathfindingThread::EndBidirectionalHalf(FCPathRequest& Request)
+{
+	if (!Request.Bidirectional)
+		return;
+
+	// FindPath does this too, unless it failed before searching. The other half must not wait for this one in that case.
+	if (Request.bBackwardHalf)
+	{
+		Request.Bidirectional->StopSearching(CPathBidirectionalSearch::BACKWARD);
+		Request.Bidirectional->PublishBackwardHalf(nullptr);
+	}
+	else
+	{
+		Request.Bidirectional->StopSearching(CPathBidirectionalSearch::FORWARD);
+	}
+	Request.Bidirectional.reset();
+}
+
 bool FCPathfindingThread::WaitForVolume(ACPathVolume* Volume)
 {
 	if (IsValid(Volume))
 	{
-		if (Volume->GeneratorsRunning.load() > 0 || !Volume->InitialGenerationCompleteAtom.load())
+		if (!Volume->CanSearch())
 		{
 			if (Volume->GenerationFinishedSemaphore)
 			{
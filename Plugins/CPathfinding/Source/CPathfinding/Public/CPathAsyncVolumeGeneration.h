@@ -3,8 +3,11 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "CPathDefines.h"
 #include "Core/Public/HAL/Runnable.h"
 #include "Core/Public/HAL/RunnableThread.h"
+#include "HAL/Event.h"
+#include <vector>
 
 class ACPathVolume;
 class CPathOctree;
@@ -12,16 +15,14 @@ class CPathOctree;
 
 
 
+// One generation thread of a volume. Generators live as long as the volume's generation data,
+// and sleep between rounds until the volume gives them work with Start.
 class CPATHFINDING_API FCPathAsyncVolumeGenerator : public FRunnable
 {
 
 
 public:
-	// Geneated trees in range Start(inclusive) - End(not inclusive). If Obstacles = true, it takes from Volume->TreesToRegenerate, if not, it takes from Volume->Octrees (default)
-	FCPathAsyncVolumeGenerator(ACPathVolume* Volume, uint32 StartIndex, uint32 EndIndex, uint8 ThreadID, FString ThreadName, bool Obstacles = false);
-
-	// Not used for now
-	FCPathAsyncVolumeGenerator(ACPathVolume* Volume);
+	FCPathAsyncVolumeGenerator(ACPathVolume* Volume, uint8 ThreadID, FString ThreadName);
 
 	~FCPathAsyncVolumeGenerator();
 
@@ -35,11 +36,48 @@ public:
 
 	bool HasFinishedWorking();
 
-	// The main generating function, generated/regenerates the whole octree at given index
-	void RefreshTree(uint32 OuterIndex);
+	// Generates items in range Start(inclusive) - End(not inclusive), in chunks taken from Volume->NextGenerationItem,
+	// which is shared by generators of the round. If bObstacles is set, items are trees in Volume->TreesToRegenerateList,
+	// if not, they are bricks of Volume->Octrees in Volume->BrickOrder (default).
+	// Wakes the thread up, or does the work right away if there is no thread. The previous round must have finished.
+	void Start(uint32 StartIndex, uint32 EndIndex);
+
+	// Items taken from Volume->NextGenerationItem at once, big enough to keep contention low and small enough to balance the load
+	static constexpr uint32 CHUNK_SIZE = 8;
+
+	// Sets the flags below back to the initial generation and clears OctreeCountAtDepth
+	void ResetWork();
+
+	// Work of one round, called by Start
+	void Generate();
+
+	// Generates one item of the range as described above
+	void GenerateItem(uint32 Item);
+
+	// The main generating function, generated/regenerates the whole octree at given index.
+	// With Regions, only subtrees that overlap one of the boxes are rechecked.
+	void RefreshTree(uint32 OuterIndex, const std::vector<FBox>* Regions = nullptr);
+
+	// Generates all outer trees in a brick, or sets it as uniformly free if RecheckBrickIsFree allows it
+	void RefreshBrick(uint32 BrickIndex);
+
+	// Generates or loads the brick from the bake if its chunk is resident, releases it otherwise
+	void RefreshChunkBrick(uint32 BrickIndex);
 
 	bool bObstacles = false;
 
+	// Trees were loaded from a bake, so only occupancy and the graph are built for the bricks in range
+	bool bFromBake = false;
+
+	// Set to false if nothing is going to search the volume, e.g. when baking
+	bool bUpdateGraph = true;
+
+	// Trees are restored from Volume->DeltaLog instead of being regenerated, only used with bObstacles
+	bool bApplyDeltas = false;
+
+	// The range is in Volume->ChunkBricksToRefresh instead
+	bool bChunks = false;
+
 	FRunnableThread* ThreadRef = nullptr;
 
 	uint8 GenThreadID;
@@ -48,7 +86,12 @@ public:
 
 	FString Name = "";
 
-	uint32 OctreeCountAtDepth[4] = { 0, 0, 0, 0 };
+	uint32 OctreeCountAtDepth[MAX_DEPTH + 1] = {};
+
+#ifdef LOG_GENERATORS
+	// Time the last round took on this thread, in ms
+	double GenerationTime = 0;
+#endif
 
 
 protected:
@@ -60,11 +103,20 @@ protected:
 	std::atomic_bool RequestedKill = false;
 	std::atomic_bool ThreadExited = false;
 
+	// Triggered by Start and Stop
+	FEvent* WorkEvent = nullptr;
+
 	bool bIncreasedGenRunning = false;
 
+	// Reused by RefreshBrick
+	std::vector<uint32> BrickOuterIndexes;
+
 	// Gets called by RefreshTree. Returns true if ANY child is free
 	bool RefreshTreeRec(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation);
 
+	// Same as above, but subtrees outside of Regions are kept as they are
+	bool RefreshTreeInRegionsRec(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation, const std::vector<FBox>& Regions);
+
 	bool ShouldWakeUp();
 
 	TFunctionRef< bool()> WakeUpCondition;
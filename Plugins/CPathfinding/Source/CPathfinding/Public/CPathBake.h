@@ -0,0 +1,56 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CPathDefines.h"
+#include "CPathOctree.h"
+
+// "CPBK"
+#define CPATH_BAKE_MAGIC 0x4B425043
+
+// Increase whenever the layout of the file or of CPathOctree changes
+#define CPATH_BAKE_VERSION 1
+
+// Sections are aligned to this, so that they can be used directly from a memory mapped file
+#define CPATH_BAKE_ALIGNMENT 64
+
+// Bake files are stored in ProjectContentDir/CPATH_BAKE_DIRECTORY
+#define CPATH_BAKE_DIRECTORY TEXT("CPathBakes")
+
+static_assert(sizeof(CPathOctree) == 8, "CPATH - Bake:::CPathOctree layout changed, update CPATH_BAKE_VERSION");
+
+
+// Header at the start of a baked octree file, followed by the sections it points to:
+// - BrickStates: uint32 per brick of the outer grid. 0 - uniformly occupied, 1 - uniformly free, 2+ - index of a materialized brick + 2
+// - Bricks: 64 CPathOctree per materialized brick, Children are indexes to Octets
+// - Octets: 8 CPathOctree per octet, in the same layout as CPathOctreePool. Octet 0 is reserved.
+struct FCPathBakeHeader
+{
+	uint32 Magic = CPATH_BAKE_MAGIC;
+	uint32 Version = CPATH_BAKE_VERSION;
+	uint32 TreeIDSize = sizeof(CPathTreeID);
+	uint32 OctreeDepth = 0;
+
+	uint32 NodeCount[3] = { 0, 0, 0 };
+	uint32 BrickCount = 0;
+
+	uint32 MaterializedBrickCount = 0;
+	uint32 OctetCount = 0;
+
+	// Volume settings that affect generation, see ACPathVolume::ComputeSettingsHash
+	uint64 SettingsHash = 0;
+
+	// Collision inside the volume at the time of baking, see ACPathVolume::ComputeCollisionHash
+	uint64 CollisionHash = 0;
+
+	// Generation stats, shown in the volume's details panel
+	uint32 OctreeCountAtDepth[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	uint64 BrickStatesOffset = 0;
+	uint64 BricksOffset = 0;
+	uint64 OctetsOffset = 0;
+	uint64 FileSize = 0;
+};
+
+static_assert(MAX_DEPTH < 8, "CPATH - Bake:::FCPathBakeHeader::OctreeCountAtDepth is too small");
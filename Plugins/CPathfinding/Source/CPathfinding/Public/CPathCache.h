@@ -0,0 +1,112 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CPathNode.h"
+#include "HAL/CriticalSection.h"
+#include <atomic>
+#include <list>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+
+// LRU cache of found paths in front of CPathAStar::FindPath, for requests that repeat the same pairs of leafs.
+// Every entry knows the outer trees its path crosses, including the space swept around smoothed segments,
+// so regenerating some outer trees only evicts paths going through them. Thread safe.
+class CPATHFINDING_API CPathCache
+{
+public:
+	struct FKey
+	{
+		CPathTreeID StartTreeID;
+		CPathTreeID EndTreeID;
+		int32 UserData;
+		uint32 SmoothingPasses;
+
+		inline bool operator==(const FKey& Other) const
+		{
+			return StartTreeID == Other.StartTreeID && EndTreeID == Other.EndTreeID && UserData == Other.UserData && SmoothingPasses == Other.SmoothingPasses;
+		}
+	};
+
+	struct FKeyHash
+	{
+		size_t operator()(const FKey& Key) const
+		{
+			uint64 Hash = (uint64)Key.StartTreeID * 0x9E3779B97F4A7C15ull;
+			Hash ^= ((uint64)Key.EndTreeID + (Hash << 6) + (Hash >> 2)) * 0xff51afd7ed558ccdull;
+			Hash ^= (uint64)(uint32)Key.UserData * 31 + Key.SmoothingPasses;
+			return (size_t)(Hash ^ (Hash >> 33));
+		}
+	};
+
+	// Copies the cached path to Result and moves the entry to the front. First and last node are moved to Start and End,
+	// which resolve to the same leafs as the ones the path was found for, see FCPathResult::ReplaceEndpoints.
+	// If they can't be connected to the path it's a miss and Result is left reset.
+	bool Find(const FKey& Key, FVector Start, FVector End, FCPathResult& Result, TFunctionRef<bool(FVector, FVector)> IsSegmentFree);
+
+	// Adds or replaces the entry, evicts least recently used ones above Capacity
+	void Add(const FKey& Key, const FCPathResult& Result, std::vector<uint32>&& OuterIndexes, uint32 Capacity);
+
+	// Evicts every path crossing one of the outer trees
+	void EvictOuterTrees(const std::set<uint32>& OuterIndexes);
+
+	void Empty();
+
+	inline uint64 GetHitCount() const
+	{
+		return Hits.load();
+	}
+
+	inline uint64 GetMissCount() const
+	{
+		return Misses.load();
+	}
+
+	// Entries evicted because the cache was full
+	inline uint64 GetEvictionCount() const
+	{
+		return Evictions.load();
+	}
+
+	// Entries evicted because outer trees they cross were regenerated
+	inline uint64 GetInvalidationCount() const
+	{
+		return Invalidations.load();
+	}
+
+	uint32 GetEntryCount() const;
+
+	// Resets hit, miss and eviction counters
+	void ResetStats();
+
+private:
+	struct FEntry
+	{
+		FKey Key;
+		TArray<FCPathNode> UserPath;
+		float RawPathLength = 0;
+		float UserPathLength = 0;
+
+		// Sorted, no duplicates
+		std::vector<uint32> OuterIndexes;
+	};
+
+	// Most recently used first
+	std::list<FEntry> Entries;
+	std::unordered_map<FKey, std::list<FEntry>::iterator, FKeyHash> EntryByKey;
+	std::unordered_map<uint32, std::unordered_set<FKey, FKeyHash>> KeysByOuterIndex;
+
+	mutable FCriticalSection Mutex;
+
+	std::atomic<uint64> Hits = 0;
+	std::atomic<uint64> Misses = 0;
+	std::atomic<uint64> Evictions = 0;
+	std::atomic<uint64> Invalidations = 0;
+
+	// Removes the entry from all containers, mutex must be locked
+	void Remove(std::list<FEntry>::iterator Entry);
+};
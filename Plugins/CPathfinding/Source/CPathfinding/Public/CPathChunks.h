@@ -0,0 +1,86 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CPathOctree.h"
+#include <atomic>
+#include <vector>
+
+
+// Splits the outer grid into cubic chunks of bricks that can be loaded and unloaded independently, e.g. with streamed levels.
+// Unloaded chunks are kept as uniformly occupied bricks, so they cost no memory and have no leafs in the graph.
+// Residency flags are read by pathfinders while the game thread changes them, so A* sees an unloaded chunk as impassable
+// right away, before generators get to release it.
+class CPATHFINDING_API CPathChunkMap
+{
+public:
+	// ChunkSizeInBricks is rounded up to a power of 2. If Enabled is false, every outer tree is always resident.
+	void Init(const uint32 InNodeCount[3], uint32 ChunkSizeInBricks, bool Enabled);
+
+	void Empty();
+
+	inline bool IsEnabled() const
+	{
+		return ChunkCount > 0;
+	}
+
+	inline uint32 GetChunkCount() const
+	{
+		return ChunkCount;
+	}
+
+	// Chunk of an outer tree given by its local integer coordinates
+	inline uint32 GetChunkIndex(uint32 X, uint32 Y, uint32 Z) const
+	{
+		return ((X >> ChunkBits) * ChunkCounts[1] + (Y >> ChunkBits)) * ChunkCounts[2] + (Z >> ChunkBits);
+	}
+
+	inline uint32 GetChunkIndex(uint32 OuterIndex) const
+	{
+		uint32 X = OuterIndex / NodeCountYZ;
+		uint32 YZ = OuterIndex - X * NodeCountYZ;
+		uint32 Y = YZ / NodeCount[2];
+		return GetChunkIndex(X, Y, YZ - Y * NodeCount[2]);
+	}
+
+	// True if chunks are disabled
+	inline bool IsResident(uint32 OuterIndex) const
+	{
+		return !IsEnabled() || Resident[GetChunkIndex(OuterIndex)].load(std::memory_order_relaxed);
+	}
+
+	// True if chunks are disabled. BrickOrigin as in CPathOuterGrid::GetBrickOrigin.
+	inline bool IsBrickResident(const FIntVector& BrickOrigin) const
+	{
+		return !IsEnabled() || Resident[GetChunkIndex(BrickOrigin.X, BrickOrigin.Y, BrickOrigin.Z)].load(std::memory_order_relaxed);
+	}
+
+	inline bool IsChunkResident(uint32 ChunkIndex) const
+	{
+		return Resident[ChunkIndex].load(std::memory_order_relaxed);
+	}
+
+	// Chunk is resident as long as anything holds a reference to it.
+	// Both return true if residency changed, the chunk's bricks have to be refreshed then. Game thread only.
+	bool AddRef(uint32 ChunkIndex);
+	bool Release(uint32 ChunkIndex);
+
+	// Chunks overlapping the box of outer trees, Min and Max are inclusive local integer coordinates
+	void GetChunksInBox(FIntVector Min, FIntVector Max, std::vector<uint32>& OutChunks) const;
+
+	// Appends indexes of bricks in the chunk, as used by Grid
+	void GetBricksInChunk(const CPathOuterGrid& Grid, uint32 ChunkIndex, std::vector<uint32>& OutBricks) const;
+
+private:
+	uint32 NodeCount[3] = { 0, 0, 0 };
+	uint32 NodeCountYZ = 1;
+	uint32 ChunkCounts[3] = { 0, 0, 0 };
+	uint32 ChunkCount = 0;
+
+	// Chunk size in outer trees is 1 << ChunkBits
+	uint32 ChunkBits = 0;
+
+	std::vector<std::atomic<uint8>> Resident;
+	std::vector<uint16> RefCounts;
+};
@@ -5,7 +5,10 @@
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
 #include <vector>
+#include <memory>
 #include "Containers/Queue.h"
+#include "HAL/CriticalSection.h"
+#include "Misc/ScopeRWLock.h"
 #include "CPathfindingThread.h"
 #include "CPathCore.generated.h"
 
@@ -31,6 +34,10 @@ public:
 	static bool DoesInstanceExist();
 	static void EnableNewInstanceCreation();
 
+	// Size of the pathfinding thread pool, <= 0 is system's Physical Core count - 1.
+	// Takes effect when the instance is spawned, so it has to be called before GetInstance.
+	static void SetThreadCount(int Count);
+
 	virtual void Tick(float DeltaSeconds) override;
 	virtual void BeginPlay() override;
 	virtual void BeginDestroy() override;
@@ -44,6 +51,32 @@ public:
 	// Using this directly is unsafe, please use the FindPathAsync function in ACPathVolume class.
 	void AssignAsyncRequest(FCPathRequest& Request);
 
+	// Spreads requests over threads so their task counts even out, each thread gets a contiguous part with one wake up.
+	// Requests are moved from the vector. Called by the pathfinding thread that prepared a batch of FindPathBatchAsync.
+	void AssignBatch(std::vector<FCPathRequest>& Requests);
+
+	// Results of async requests are recycled after their delegate was called, so steady state pathfinding doesn't allocate them.
+	// Thread safe.
+	FCPathResult* AcquireResult();
+	void ReleaseResult(FCPathResult* Result);
+
+	// Calls delegates of finished requests, this happens every Tick
+	void ProcessResults();
+
+	inline int GetThreadCount() const
+	{
+		return (int)Threads.size();
+	}
+
+	// Requests taken by idle threads from busy ones since the threads were created
+	int GetStolenTaskCount();
+
+	// Called by pathfinding threads with nothing to do. Takes the next pending request of the thread with the most of them.
+	bool StealRequest(FCPathfindingThread* Thief, FCPathRequest& OutRequest);
+
+	// Called by pathfinding threads with pending requests they can't start yet, wakes one thread waiting for work to steal them
+	void WakeIdleThread(FCPathfindingThread* Caller);
+
 	
 
 protected:
@@ -54,8 +87,25 @@ private:
 	int ExpectedThreadCount;
 	std::vector<FCPathfindingThread*> Threads;
 
+	// Pathfinding threads read Threads when stealing, the game thread locks this for writing when replacing or deleting them
+	FRWLock ThreadsLock;
+
+	static int ConfiguredThreadCount;
+
+	// Replaces threads that died, so requests can be assigned to all of them
+	void ValidateThreads();
+
 	TQueue<std::pair<FCPathResult*, PathResultDelegate>, EQueueMode::Mpsc> OutputQueue;
 
+	std::vector<FCPathResult*> ResultPool;
+	FCriticalSection ResultPoolMutex;
+
+	// Shared states of bidirectional searches, one is free when nothing but this holds it
+	std::vector<std::shared_ptr<class CPathBidirectionalSearch>> BidirectionalPool;
+
+	// Splits the request between two idle threads, returns false if there aren't two
+	bool TryAssignBidirectional(FCPathRequest& Request);
+
 
 	FCPathfindingThread* CreateThread(int ThreadIndex);
 
@@ -5,18 +5,41 @@
 #include "CoreMinimal.h"
 
 // TreeID settings
-// If you change these, you will also need to change some masks in functions like ReplaceDepth, ExtractDepth, etc
+// TreeID layout, starting from the least significant bit: outer index (DEPTH_0_BITS), depth (DEPTH_BITS),
+// and then 3 bits of child index for every depth from 1 to MAX_DEPTH.
+// Uncomment this or define somewhere else for 64 bit TreeIDs. They allow much bigger outer index and octree depth,
+// so one volume can cover a large map with small voxels, but they make the graph and path nodes a bit bigger.
+//#define CPATH_64BIT_TREEID 1
+
+#ifdef CPATH_64BIT_TREEID
+typedef uint64 CPathTreeID;
+#define DEPTH_0_BITS 32
+#define DEPTH_BITS 3
+#define MAX_DEPTH 7
+#else
+typedef uint32 CPathTreeID;
 #define DEPTH_0_BITS 21
-#define DEPTH_0_LIMIT (uint32)1<<DEPTH_0_BITS
-#define DEPTH_0_MASK 0x001FFFFF
-#define DEPTH_MASK 0x00600000
+#define DEPTH_BITS 2
 #define MAX_DEPTH 3
+#endif
+
+#define DEPTH_0_LIMIT ((uint64)1 << DEPTH_0_BITS)
+#define DEPTH_0_MASK (((CPathTreeID)1 << DEPTH_0_BITS) - 1)
+#define DEPTH_MASK ((((CPathTreeID)1 << DEPTH_BITS) - 1) << DEPTH_0_BITS)
+#define CHILD_INDEX_OFFSET (DEPTH_0_BITS + DEPTH_BITS)
+#define INVALID_TREEID ((CPathTreeID)-1)
+
+static_assert(DEPTH_0_BITS + DEPTH_BITS + 3 * MAX_DEPTH <= sizeof(CPathTreeID) * 8, "CPATH - TreeID layout doesn't fit in CPathTreeID");
+static_assert(MAX_DEPTH < (1 << DEPTH_BITS), "CPATH - MAX_DEPTH doesn't fit in DEPTH_BITS");
 
 // Time measurement macros
 #define TIMENOW std::chrono::steady_clock::now()
 // this is in ms
 #define TIMEDIFF(BEGIN, END) ((double)std::chrono::duration_cast<std::chrono::nanoseconds>(END - BEGIN).count())/1000000.0 
 
+// Hands over releasing memory that searches may still be reading, see CPathSnapshots::Retire
+typedef TFunction<void(TFunction<void()>&&)> FCPathDeferRelease;
+
 // Uncomment these or define somwhere else to see performance logs
 //#define LOG_GENERATORS 1
 //#define LOG_PATHFINDERS 1 // set it to 2 for more async logs
@@ -50,7 +73,8 @@ enum ECPathfindingFailReason
 	WrongStartLocation,
 	WrongEndLocation,
 	EndLocationUnreachable,
-	Unknown
+	Unknown,
+	Cancelled
 };
 
 
@@ -0,0 +1,72 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CPathDefines.h"
+#include "CPathOctree.h"
+#include "HAL/CriticalSection.h"
+#include <unordered_map>
+#include <vector>
+#include <set>
+
+class ACPathVolume;
+
+// "CPDL"
+#define CPATH_DELTA_LOG_MAGIC 0x4C445043
+
+// Increase whenever the serialized layout changes
+#define CPATH_DELTA_LOG_VERSION 1
+
+
+// Last state of every outer tree regenerated because of dynamic obstacles.
+// Every record is the outer tree followed by its octets in depth first order, Children being 1-based indexes of these octets,
+// so it can be applied again without any physics queries, e.g. after loading a save game.
+class CPATHFINDING_API CPathDeltaLog
+{
+public:
+	// Replaces the record of the outer tree with its current state. Thread safe.
+	void Record(const ACPathVolume* Volume, uint32 OuterIndex);
+
+	// Replaces the outer tree with its record, returns false if there is none.
+	// Thread safe as long as every thread applies different outer trees and nothing records at the same time.
+	bool Apply(ACPathVolume* Volume, uint32 OuterIndex) const;
+
+	// Adds outer indexes of all records to the set
+	void GetOuterIndexes(std::set<uint32>& OutIndexes) const;
+
+	uint32 Num() const;
+
+	// Not thread safe with Apply, use StageEmpty while generators may run
+	void Empty();
+
+	// Writes all records to a byte array that can be stored in a save game
+	void Save(const ACPathVolume* Volume, TArray<uint8>& OutData) const;
+
+	// Stages records from Data to replace all current ones, see CommitStaged.
+	// Returns false and leaves the log unchanged if Data was saved for a different volume or with different settings.
+	bool Load(const ACPathVolume* Volume, const TArray<uint8>& Data);
+
+	// Stages an empty log, see CommitStaged
+	void StageEmpty();
+
+	// Replaces the records with the ones staged by Load or StageEmpty, returns false if nothing was staged.
+	// Generators apply records without the lock, so this must only be called while none of them runs.
+	bool CommitStaged();
+
+	// In bytes
+	uint64 GetMemoryUsage() const;
+
+private:
+	std::unordered_map<uint32, std::vector<CPathOctree>> Records;
+	mutable FCriticalSection Mutex;
+
+	std::unordered_map<uint32, std::vector<CPathOctree>> StagedRecords;
+	bool bHasStaged = false;
+
+	void RecordRec(const ACPathVolume* Volume, const CPathOctree* Tree, std::vector<CPathOctree>& Record, uint32 RecordIndex) const;
+	uint32 ApplyRec(ACPathVolume* Volume, const std::vector<CPathOctree>& Record, uint32 RecordOctet) const;
+
+	// Checks that all Children indexes of a loaded record are in range, point forward and don't go deeper than MaxDepth
+	static bool IsRecordValid(const std::vector<CPathOctree>& Record, uint32 MaxDepth);
+};
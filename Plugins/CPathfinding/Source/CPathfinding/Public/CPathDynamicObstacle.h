@@ -3,10 +3,13 @@
 
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
+#include <unordered_map>
+#include <vector>
 #include "CPathDynamicObstacle.generated.h"
 
 // Make sure this actor's collision has Generate Overlaps turned on.
 // Owning actor must be movable.
+// Only the space under the actor's colliding primitives is regenerated, and only after the actor moved, rotated or scaled beyond the tolerances.
 // For better performance, call Deactivate() on this component once you dont need it to be updated anymore.
 // bAutoActivate should be left unckecked for this component.
 UCLASS(ClassGroup = (Custom), meta = (BlueprintSpawnableComponent))
@@ -35,11 +38,20 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CPath)
 		bool ActivateOnBeginPlay = true;
 
+	// Movement in cm below which the volume is not regenerated
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CPath, meta = (ClampMin = "0", UIMin = "0"))
+		float LocationTolerance = 1.f;
+
+	// Rotation in degrees below which the volume is not regenerated
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CPath, meta = (ClampMin = "0", UIMin = "0"))
+		float RotationTolerance = 1.f;
+
 	virtual void Activate(bool bReset = false) override;
 
 	virtual void Deactivate() override;
 
-	void AddIndexesToUpdate(class ACPathVolume* Volume);
+	// If the actor moved since the volume last regenerated it, adds both its old and new footprint to the volume's regions to regenerate
+	void AddRegionsToUpdate(class ACPathVolume* Volume);
 
 	virtual void EndPlay(EEndPlayReason::Type Reason) override;
 protected:
@@ -47,6 +59,23 @@ protected:
 	virtual void BeginPlay() override;
 	//TArray<class ACPathVolume*> OverlappingVolumes;
 
+	// What a volume regenerated last time
+	struct FFootprint
+	{
+		FTransform Transform;
+
+		// World bounds of colliding primitives
+		std::vector<FBox> Boxes;
+	};
+
+	std::unordered_map<const class ACPathVolume*, FFootprint> FootprintByVolume;
+
+	// Bounds of the primitives the volume's trace channel doesn't ignore, from their collision geometry if they have simple one
+	void GetCollisionBoxes(const class ACPathVolume* Volume, std::vector<FBox>& OutBoxes) const;
+
+	// The volume regenerates the last footprint once more, so that the space the actor left becomes free
+	void ReleaseFootprint(class ACPathVolume* Volume);
+
 public:
 
 
@@ -5,9 +5,12 @@
 
 #include "CoreMinimal.h"
 #include "CPathNode.h"
+#include "CPathHierarchy.h"
+#include "CPathCache.h"
 #include "Core/Public/HAL/Runnable.h"
 #include "Core/Public/HAL/RunnableThread.h"
 #include "Kismet/BlueprintAsyncActionBase.h"
+#include "HAL/CriticalSection.h"
 #include <atomic>
 #include <vector>
 #include <memory>
@@ -17,6 +20,203 @@
 
 class ACPathVolume;
 
+/**
+Memory reused by every search of one CPathAStar, so that a search doesn't allocate once the buffers grew big enough.
+- Nodes live in fixed size blocks, so pointers to them (PreviousNode) stay valid as the arena grows
+- Open list is a binary heap of node pointers keyed by fitness
+- Closed set is an open addressing table of visited leafs with generation stamps, starting a search only increments the generation.
+  It's sized by how many leafs searches visit rather than by the graph, since every pathfinding thread keeps MAX_ACTIVE_SEARCHES workspaces.
+*/
+class CPathSearchWorkspace
+{
+public:
+	CPathSearchWorkspace();
+	~CPathSearchWorkspace();
+
+	// Invalidates all nodes from the previous search. TrackNodes enables SetVisitedNode / FindVisitedNode.
+	void Begin(bool TrackNodes);
+
+	// Starts another search with an empty heap and no visited leafs, but keeps the nodes, so a path can be refined in parts
+	void Restart();
+
+	// Returns a default initialized node that lives until the next Begin
+	CPathAStarNode* NewNode();
+
+	// Marks the leaf as visited, returns false if it already was during this search
+	inline bool TryVisit(uint32 LeafIndex)
+	{
+		// At most half full, so probe sequences stay short
+		if ((VisitCount + 1) * 2 > VisitSlots.size())
+			GrowVisitSlots();
+
+		uint32 Slot = FindVisitSlot(LeafIndex);
+		if (VisitSlots[Slot].Stamp == Generation)
+			return false;
+		VisitSlots[Slot] = { LeafIndex, Generation };
+		VisitCount++;
+		return true;
+	}
+
+	// Only kept by searches that look nodes up by leaf afterwards, see CPathBidirectionalSearch
+	// The leaf must be visited already.
+	inline void SetVisitedNode(uint32 LeafIndex, CPathAStarNode* Node)
+	{
+		check(bTrackNodes);
+		VisitedNodes[FindVisitSlot(LeafIndex)] = Node;
+	}
+
+	// Node set for the leaf during this search, nullptr if the leaf wasn't visited
+	inline CPathAStarNode* FindVisitedNode(uint32 LeafIndex) const
+	{
+		if (!bTrackNodes || VisitSlots.empty())
+			return nullptr;
+		uint32 Slot = FindVisitSlot(LeafIndex);
+		return VisitSlots[Slot].Stamp == Generation ? VisitedNodes[Slot] : nullptr;
+	}
+
+	void Push(CPathAStarNode* Node);
+
+	// Returns the node with the lowest FitnessResult. Heap must not be empty.
+	CPathAStarNode* Pop();
+
+	inline bool IsHeapEmpty() const
+	{
+		return Heap.empty();
+	}
+
+	inline uint32 GetNodeCount() const
+	{
+		return NodeCount;
+	}
+
+	inline uint32 GetPoppedCount() const
+	{
+		return PoppedCount;
+	}
+
+private:
+	static constexpr uint32 NODES_PER_BLOCK_BITS = 12;
+	static constexpr uint32 NODES_PER_BLOCK = 1 << NODES_PER_BLOCK_BITS;
+
+	std::vector<CPathAStarNode*> NodeBlocks;
+	uint32 NodeCount = 0;
+	uint32 PoppedCount = 0;
+
+	struct FHeapEntry
+	{
+		float Fitness;
+		CPathAStarNode* Node;
+	};
+	std::vector<FHeapEntry> Heap;
+
+	static constexpr uint32 MIN_VISIT_SLOTS = 1 << 10;
+
+	struct FVisitSlot
+	{
+		uint32 LeafIndex;
+		uint32 Stamp;
+	};
+	// Power of 2 size, a slot is empty if its Stamp isn't the current Generation
+	std::vector<FVisitSlot> VisitSlots;
+	// Parallel to VisitSlots, only allocated while bTrackNodes
+	std::vector<CPathAStarNode*> VisitedNodes;
+	uint32 VisitCount = 0;
+	uint32 Generation = 0;
+	bool bTrackNodes = false;
+
+	// Slot holding the leaf, or the empty slot it would be put in
+	inline uint32 FindVisitSlot(uint32 LeafIndex) const
+	{
+		const uint32 Mask = (uint32)VisitSlots.size() - 1;
+		uint32 Slot = (LeafIndex * 2654435769u) & Mask;
+		while (VisitSlots[Slot].Stamp == Generation && VisitSlots[Slot].LeafIndex != LeafIndex)
+			Slot = (Slot + 1) & Mask;
+		return Slot;
+	}
+
+	// Doubles the table and reinserts the leafs visited in this generation
+	void GrowVisitSlots();
+};
+
+/**
+State shared by the two halves of a bidirectional search, each running on its own pathfinding thread.
+- Both halves publish the cost of every leaf they reach, a leaf reached by both is a candidate meeting point
+- A half stops once the lowest fitness in its open list is not below the best meeting cost, or when the other one stopped.
+  Fitness is weighted (g + 3.5h, see ACPathVolume::CalcFitness), so it is not compared with costs of the same kind:
+  every path not found yet crosses the open list of the half that stopped, and fitness there is at most 3.5 times
+  the cost of the shortest path through the node. The path found costs at most 3.5 times the shortest one,
+  the same bound a single weighted search has, but it's not the shortest.
+- The backward half copies its part of the path, the forward half joins it to its own and submits the result
+Recycled by ACPathCore, so the per leaf arrays are only reallocated when the graph grows.
+*/
+class CPathBidirectionalSearch
+{
+public:
+	static constexpr uint32 FORWARD = 0;
+	static constexpr uint32 BACKWARD = 1;
+
+	// Prepares for a new request. Game thread, only while no half uses it.
+	void Reset();
+
+	// Called by both halves before searching, only the first call has effect.
+	// Returns false if the first call was for another graph version, the halves can't meet on leaf indexes then.
+	bool Init(uint32 LeafCapacity, uint32 GraphVersion);
+
+	// Publishes that the half reached the leaf with Cost, updates the best meeting point if the other half reached it too
+	void Reach(uint32 Side, uint32 LeafIndex, float Cost);
+
+	inline float GetBestCost() const
+	{
+		return BestCost.load();
+	}
+
+	// INVALID_INDEX if the halves haven't met. Final once IsSearchFinished returns true.
+	uint32 GetMeetingLeaf() const;
+
+	// Tells both halves to stop, the half stopped searching. Can be called more than once.
+	void StopSearching(uint32 Side);
+
+	// True if any half asked to stop
+	inline bool ShouldStop() const
+	{
+		return bStopRequested.load();
+	}
+
+	// True when neither half is searching anymore
+	inline bool IsSearchFinished() const
+	{
+		return HalvesSearching.load() == 0;
+	}
+
+	// Backward half copies its nodes from the meeting leaf to its start, or nullptr if it has none. Only the first call has effect.
+	void PublishBackwardHalf(const CPathAStarNode* MeetingNode);
+
+	// 0 while the backward half hasn't published, 1 if it published a path, 2 if it has none
+	inline int32 GetBackwardHalfState() const
+	{
+		return BackwardHalfState.load();
+	}
+
+	// From the meeting leaf to End, valid when GetBackwardHalfState returns 1
+	TArray<CPathAStarNode> BackwardHalf;
+
+private:
+	// Generation in the upper 32 bits, cost in the lower ones
+	std::vector<std::atomic<uint64>> Reached[2];
+	uint32 Generation = 0;
+	bool bInitialized = false;
+	uint32 InitGraphVersion = 0;
+
+	std::atomic<float> BestCost = FLT_MAX;
+	uint32 MeetingLeaf = 0xFFFFFFFF;
+	mutable FCriticalSection Mutex;
+
+	std::atomic_bool bStopRequested = false;
+	std::atomic_bool bHalfStopped[2] = { false, false };
+	std::atomic_int HalvesSearching = 2;
+	std::atomic_int BackwardHalfState = 0;
+};
+
 /**
 The class for pathfinding, used in UCPathAsyncFindPath. Can also be used on game thread to get the path instantly.
 */
@@ -32,18 +232,58 @@ public:
 
 
 	// Can be called from main thread, but can freeze the game if you increase TimeLimit.
-	ECPathfindingFailReason FindPath(ACPathVolume* VolumeRef, FCPathResult* Result, FVector Start, FVector End, uint32 SmoothingPasses = 2, int32 UserData = 0, float TimeLimit = 0.15f, bool RequestRawPath = false, bool RequestUserPath = true);
+	// UseJumpPointSearch skips over symmetric runs of same depth leafs, so open spaces cost nodes per corner instead of per leaf.
+	// It ignores CalcFitness between jump points, so leave it off if your CalcFitness prefers some leafs over others.
+	// InBidirectional is set by pathfinding threads for requests split by ACPathCore, it disables jump point and hierarchical search.
+	ECPathfindingFailReason FindPath(ACPathVolume* VolumeRef, FCPathResult* Result, FVector Start, FVector End, uint32 SmoothingPasses = 2, int32 UserData = 0, float TimeLimit = 0.15f, bool RequestRawPath = false, bool RequestUserPath = true, bool UseJumpPointSearch = false,
+		CPathBidirectionalSearch* InBidirectional = nullptr, bool bBackwardHalf = false);
+
+	// FindPath split in two, so a search can be spread over several frames or shared with other searches on a thread.
+	// BeginFindPath returns false if the search is over right away, because it failed or the path was in ACPathVolume::PathCache.
+	// Result->FailReason says which.
+	// ContinueFindPath runs the search for at most SliceTime seconds (0 - no limit) and returns true once Result is final.
+	// TimeLimit counts only the time spent inside slices. Open list, visited leafs and nodes are kept between slices,
+	// the search starts over if the graph was updated in between. Volume must not be regenerated during a slice.
+	// Hierarchical searches find their route over portals in the first slice, refining it can take more.
+	// Bidirectional halves search in their first slice, then return false from ContinueFindPath until the other half is done, even with SliceTime 0.
+	bool BeginFindPath(ACPathVolume* VolumeRef, FCPathResult* Result, FVector Start, FVector End, uint32 SmoothingPasses = 2, int32 UserData = 0, float TimeLimit = 0.15f, bool RequestRawPath = false, bool RequestUserPath = true, bool UseJumpPointSearch = false,
+		CPathBidirectionalSearch* InBidirectional = nullptr, bool bBackwardHalf = false);
+	bool ContinueFindPath(float SliceTime);
+
+	// True between BeginFindPath and the ContinueFindPath call that finished the search
+	inline bool IsSearchActive() const
+	{
+		return bSearchActive;
+	}
 
 	// Set this to true to interrupt pathfinding. FindPath returns an empty array.
 	// This is set to false at the beginning of each FindPath call!
 	std::atomic_bool bStop = false;
 
+	// Stop flag of the current request only, set by pathfinding threads. The search ends with Cancelled once it's true.
+	const std::atomic_bool* CancelFlag = nullptr;
+
+	// Ends the current search without running it further, Result keeps its FailReason
+	inline void AbortSearch()
+	{
+		bSearchActive = false;
+	}
+
+	// Hierarchical search only, see ACPathVolume::UseHierarchicalSearch. Called on the thread of FindPath as soon as the route
+	// over portals is known, with the locations of start, portals and end, before the route is refined.
+	TFunction<void(const TArray<FCPathNode>&)> OnCoarsePathFound;
+
 
 		// Used in removing nodes that lay on the same line. The biger the number, the more nodes will be removed, but the path potentially loses data.
 	float LineAngleToleranceDegrees = 3;
 
 protected:
 
+	inline bool IsStopped() const
+	{
+		return bStop || (CancelFlag && CancelFlag->load());
+	}
+
 	inline float EucDistance(CPathAStarNode& Node, FVector TargetWorldLocation) const;
 
 	inline void CalcFitness(CPathAStarNode& Node);
@@ -56,14 +296,147 @@ private:
 	// Sweeps from Start to End using the tracing shape from volume. Returns true if no obstacles
 	inline bool CanSkip(FVector Start, FVector End);
 
+	// Set by SearchLeafs when TimeLimit runs out
+	bool bTimedOut = false;
+	decltype(TIMENOW) SearchStart;
+	double TimeLimitMS = 0;
+
+	// Set by SearchLeafs when the slice runs out, the search continues in the next ContinueFindPath call
+	bool bPaused = false;
+	double SliceLimitMS = 0;
+
+	// Time spent in previous slices
+	double ElapsedMS = 0;
+
+	// Request of the current search, kept between slices
+	bool bSearchActive = false;
+	FCPathResult* ActiveResult = nullptr;
+	FVector PathStart;
+	FVector PathEnd;
+	uint32 PathSmoothingPasses = 0;
+	int32 PathUserData = 0;
+	bool bRequestRawPath = false;
+	bool bRequestUserPath = true;
+	bool bHierarchicalSearch = false;
+	CPathAStarNode* PathStartNode = nullptr;
+	uint32 PathTargetLeaf = 0;
+
+	// ACPathVolume::GetGraphVersion when the search started
+	uint32 SearchGraphVersion = 0;
+
+	// Set if the path goes to ACPathVolume::PathCache once found
+	bool bUseCache = false;
+	CPathCache::FKey CacheKey;
+
+	// Finds start and target leafs and prepares the search, returns false on failure
+	bool StartSearch();
+
+	// Smoothing and conversion to the result
+	void FinishFindPath(CPathAStarNode* FoundPathEnd);
+
+	// A* over graph leafs from StartNode until the target leaf is reached, returns the node of the target leaf or nullptr.
+	// If CorridorCell is not INVALID_INDEX, the search doesn't leave that outer tree.
+	CPathAStarNode* SearchLeafs(CPathAStarNode* StartNode, uint32 TargetLeafIndex, uint32 CorridorCell, int32 UserData);
+
+	// SearchLeafs in two steps, ContinueLeafSearch can return with bPaused set and be called again
+	void BeginLeafSearch(CPathAStarNode* StartNode, uint32 TargetLeafIndex, uint32 CorridorCell);
+	CPathAStarNode* ContinueLeafSearch(int32 UserData);
+
+	// Target and corridor of the current SearchLeafs call
+	FVector SegmentTarget;
+	uint32 SearchTargetLeaf = 0;
+	uint32 SearchCorridorCell = 0;
+	CPathAStarNode* SearchStartNode = nullptr;
+
+	// False for leafs outside of the corridor or in unloaded chunks
+	bool IsLeafAllowed(uint32 LeafIndex) const;
+
+	// UseJumpPointSearch of the current FindPath call
+	bool bJumpPointSearch = false;
+
+	// Neighbour of the leaf in given ENeighbourDirection if it has the same depth and is allowed, INVALID_INDEX otherwise
+	uint32 StepSameDepth(uint32 LeafIndex, uint32 Direction) const;
+
+	// True if all free neighbours have the same depth as the leaf
+	bool IsLeafRegular(uint32 LeafIndex) const;
+
+	// True if a side of higher priority than Direction is free at the leaf but was blocked at BehindLeaf
+	bool HasForcedNeighbour(uint32 LeafIndex, uint32 BehindLeaf, uint32 Direction) const;
+
+	// Moves from the leaf in Direction until a jump point, returns INVALID_INDEX if it hits a dead end.
+	// Also returns INVALID_INDEX once TimeLimit runs out, with bTimedOut set.
+	uint32 Jump(uint32 LeafIndex, uint32 Direction);
+
+	// Steps taken by Jump and its side probes, the time is checked every JUMP_STEPS_PER_TIME_CHECK of them
+	uint32 JumpSteps = 0;
+	static constexpr uint32 JUMP_STEPS_PER_TIME_CHECK = 256;
+
+	// Pushes jump points reachable from the node instead of its neighbours
+	void ExpandJumpPoints(CPathAStarNode* Node, bool bFullExpansion, int32 UserData);
+
+	// Searches over portals of the volume's hierarchy, then refines the route with a leaf search one outer tree at a time.
+	// StartNode and the target leaf must be in different outer trees. Can return with bPaused set during the refinement,
+	// the next call continues it. If a leg can't be refined, the rest of the search is a plain one from StartNode.
+	CPathAStarNode* FindPathHierarchical(CPathAStarNode* StartNode, uint32 TargetLeafIndex, FVector End, int32 UserData);
+
+	// Refinement of CoarseRoute kept between slices. Leg n ends at portal n, the last one at the target leaf.
+	bool bRouteFound = false;
+	uint32 RefineLegIndex = 0;
+	CPathAStarNode* RefineNode = nullptr;
+
+	// Appends a node for a leaf next to PreviousNode
+	CPathAStarNode* AddLeafNode(CPathAStarNode* PreviousNode, uint32 LeafIndex, int32 UserData);
+
+	// Shared state if this is one half of a bidirectional search, nullptr otherwise
+	CPathBidirectionalSearch* Bidirectional = nullptr;
+	uint32 BidirectionalSide = 0;
+
+	// Joins the path for the forward half or publishes it for the backward one, once the other half finished.
+	// Returns the end node of the whole path on the forward half, nullptr otherwise.
+	// Sets bPaused while the other half isn't done, ContinueFindPath calls it again in the next slice.
+	CPathAStarNode* JoinBidirectionalHalves(int32 UserData);
+
+	// Set while the half waits for the other one to join, JoinStart is when its own search started
+	bool bJoiningHalves = false;
+	decltype(TIMENOW) JoinStart;
+
+	// State of the search over portals, indexed by portal. Stamped with PortalGeneration like leafs in the workspace.
+	struct FPortalState
+	{
+		float Cost = 0;
+		float GoalCost = 0;
+
+		// Previous portal, INVALID_INDEX if reached from start
+		uint32 Parent = CPathHierarchy::INVALID_INDEX;
+
+		// Outer tree the route from Parent goes through
+		uint32 Cell = CPathHierarchy::INVALID_INDEX;
+
+		uint32 Stamp = 0;
+		uint32 GoalStamp = 0;
+		bool bClosed = false;
+	};
+	std::vector<FPortalState> PortalStates;
+	uint32 PortalGeneration = 0;
+	std::vector<std::pair<float, uint32>> PortalHeap;
+	std::vector<CPathHierarchy::FEdge> EndpointEdges;
+	CPathHierarchy::FCellSearch CellSearch;
+
+	// Portals of the found route with the outer tree leading to each of them
+	std::vector<std::pair<uint32, uint32>> CoarseRoute;
+
 	// Iterates over the path from end to start, removing every other node if CanSkip returns true
 	inline void SmoothenPath(CPathAStarNode* PathEndNode);
 
 	// Removes nodes in (nearly)straight sections, transforms to Blueprint exposed struct, optionally reverses it so that the path is from start to end and returns raw nodes.
 	void TransformToUserPath(CPathAStarNode* PathEndNode, TArray<FCPathNode>& UserPath, bool bReverse = true);
 
+	// Every thread has its own CPathAStar, so this is never shared
+	CPathSearchWorkspace Workspace;
+
 	friend class UCPathAsyncFindPath;
 	friend class FCPathRunnableFindPath;
+	friend class CPathIncrementalPlanner;
 
 	static CPathAStar* GlobalInstance;
 
@@ -94,8 +467,9 @@ public:
 	// SmoothingPasses - During a smoothing pass, every other node is potentially removed, as long as there is an empty space to the next one.
 	// With SmoothingPasses=0, the path will be very jagged since the graph is Discrete.
 	// With SmoothingPasses > 2 there is a potential loss of data, especially if the CalcFitness method has been overriden
+	// UseJumpPointSearch - Faster in large open spaces, see CPathAStar::FindPath
 	UFUNCTION(BlueprintCallable, Category = CPath, meta = (BlueprintInternalUseOnly = "true"))
-		static UCPathAsyncFindPath* FindPathAsync(class ACPathVolume* Volume, FVector StartLocation, FVector EndLocation, int SmoothingPasses = 2, int32 UserData = 0, float TimeLimit = 0.2f);
+		static UCPathAsyncFindPath* FindPathAsync(class ACPathVolume* Volume, FVector StartLocation, FVector EndLocation, int SmoothingPasses = 2, int32 UserData = 0, float TimeLimit = 0.2f, bool UseJumpPointSearch = false);
 
 	UFUNCTION()
 		void OnPathFound(FCPathResult& PathResult);
@@ -0,0 +1,134 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CPathNode.h"
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+class ACPathVolume;
+
+
+/**
+Distances and next leafs toward one target, shared by any number of agents converging on it.
+Built with a reverse Dijkstra from the target leaf on a pathfinding thread, bounded by MaxDistance and MaxLeafs.
+Agents read their next waypoint from any location in the field without searching.
+When the target moves and the graph didn't change, the part of the field already leading through the new target leaf is kept
+and only the rest is searched again.
+Create it with std::make_shared, the pathfinding thread keeps it alive while building. Everything but BeginBuild and ContinueBuild is game thread only.
+*/
+class CPATHFINDING_API CPathFlowField : public std::enable_shared_from_this<CPathFlowField>
+{
+public:
+	static constexpr uint32 INVALID_INDEX = 0xFFFFFFFF;
+
+	// Leafs further than this from the target, measured along the flow, are not in the field. 0 - no limit.
+	float MaxDistance = 0;
+
+	// Most leafs in the field, 0 - no limit. Leafs on the edge of a field cut by this may not take the shortest way.
+	uint32 MaxLeafs = 100000;
+
+	// Passed to CalcFitness, which gives the cost between two leafs
+	int32 UserData = 0;
+
+	// Of one build, on timeout the previous field stays in use
+	float TimeLimit = 0.1f;
+
+	// Builds the field toward Target on a pathfinding thread. OnReady is called on the game thread once the new field is in use,
+	// FailReason of its result says if the build failed. If a build is running, only the last target given meanwhile is built after it.
+	// Returns false if the request couldn't be made.
+	bool Update(ACPathVolume* Volume, FVector Target, PathResultDelegate OnReady = PathResultDelegate());
+
+	// Next location toward the target and the distance left, from a location in the field.
+	// False if the location is outside of the field, or the field is out of date because the graph changed - call Update again then.
+	bool GetNextWaypoint(FVector Location, FVector& OutWaypoint, float& OutDistance) const;
+
+	// Same as above for a leaf of the graph. OutNextLeaf is INVALID_INDEX for the target leaf.
+	bool GetNextLeaf(uint32 LeafIndex, uint32& OutNextLeaf, float& OutDistance) const;
+
+	// True if the field in use is valid for the current graph
+	bool IsReady() const;
+
+	inline FVector GetTarget() const
+	{
+		return Fields[Current].Target;
+	}
+
+	inline uint32 GetLeafCount() const
+	{
+		return (uint32)Fields[Current].Leafs.size();
+	}
+
+	inline bool IsBuilding() const
+	{
+		return bBuilding;
+	}
+
+	// Called by pathfinding threads, fills the field that isn't in use. Split like CPathAStar::BeginFindPath and ContinueFindPath,
+	// so a large field doesn't hold a thread for its whole build. BeginBuild returns false if the build is over right away,
+	// ContinueBuild builds for at most SliceTime seconds (0 - no limit) and returns true once Result is final.
+	// TimeLimit counts only the time spent inside slices, the build starts over if the graph was updated in between.
+	bool BeginBuild(ACPathVolume* Volume, FVector Target, FCPathResult* Result);
+	bool ContinueBuild(float SliceTime);
+
+private:
+	struct FFlowLeaf
+	{
+		uint32 Next = INVALID_INDEX;
+		float Distance = 0;
+	};
+
+	struct FField
+	{
+		// By leaf index of the graph
+		std::unordered_map<uint32, FFlowLeaf> Leafs;
+		ACPathVolume* VolumeRef = nullptr;
+		uint32 TargetLeaf = INVALID_INDEX;
+		FVector Target;
+		uint32 GraphVersion = 0;
+		bool bValid = false;
+	};
+
+	// Fields[Current] is read by agents, the other one is written by Build. Swapped on the game thread.
+	FField Fields[2];
+	int32 Current = 0;
+
+	bool bBuilding = false;
+	bool bHasQueuedTarget = false;
+	FVector QueuedTarget;
+	PathResultDelegate QueuedOnReady;
+
+	// Used by the build, kept between slices
+	std::vector<std::pair<float, uint32>> Heap;
+	std::unordered_set<uint32> Rejected;
+	std::vector<uint32> WalkStack;
+	bool bBuildActive = false;
+	ACPathVolume* BuildVolume = nullptr;
+	FVector BuildTarget;
+	FCPathResult* BuildResult = nullptr;
+	double BuildElapsedMS = 0;
+	uint32 BuildPopped = 0;
+
+	// Min heap on distance
+	static inline bool IsHeapEntryAfter(const std::pair<float, uint32>& A, const std::pair<float, uint32>& B)
+	{
+		return A.first > B.first;
+	}
+
+	// Finds the target leaf and fills the heap, on failure sets FailReason of BuildResult and returns false
+	bool StartBuild();
+
+	// Game thread, after Build finished
+	void Publish(FCPathResult& Result, PathResultDelegate OnReady);
+
+	// Keeps leafs of the old field whose flow goes through the new target leaf, and queues the ones at the edge of them
+	void KeepSubtree(const FField& Old, FField& New);
+
+	bool IsLeafAllowed(const ACPathVolume* Volume, uint32 LeafIndex) const;
+
+	// Cost of moving From a leaf To its neighbour
+	float EdgeCost(ACPathVolume* Volume, uint32 From, uint32 To, FVector Target) const;
+};
@@ -0,0 +1,112 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <vector>
+#include <set>
+#include <unordered_map>
+
+class ACPathVolume;
+class CPathOctree;
+
+// Neighbours of one leaf in CPathGraph, as leaf indexes
+struct CPathNeighbourSpan
+{
+	const uint32* First = nullptr;
+	uint32 Num = 0;
+
+	inline const uint32* begin() const
+	{
+		return First;
+	}
+
+	inline const uint32* end() const
+	{
+		return First + Num;
+	}
+};
+
+// Adjacency of free leafs in compressed sparse row form, so that A* doesn't have to walk the octree.
+// Built after initial generation, then patched for outer trees that were regenerated by dynamic obstacles.
+// Leafs are addressed by a dense leaf index. Indexes of removed leafs are reused.
+class CPATHFINDING_API CPathGraph
+{
+public:
+	static constexpr uint32 INVALID_INDEX = 0xFFFFFFFF;
+
+	// Builds the graph from all outer trees of the volume
+	void Build(ACPathVolume* Volume);
+
+	// Rebuilds leafs of given outer trees, and neighbour lists of leafs in outer trees next to them
+	void UpdateOuterTrees(ACPathVolume* Volume, const std::set<uint32>& OuterIndexes);
+
+	void Empty();
+
+	// Returns INVALID_INDEX if TreeID is not a free leaf
+	inline uint32 FindLeafIndex(CPathTreeID TreeID) const
+	{
+		auto Found = LeafIndexByTreeID.find(TreeID);
+		return Found == LeafIndexByTreeID.end() ? INVALID_INDEX : Found->second;
+	}
+
+	// Same as FindLeafIndex, except when the octree was regenerated after this graph was published and the leaf isn't in it yet.
+	// The leaf of the same outer tree closest to Location is returned then, INVALID_INDEX if it has none.
+	uint32 FindLeafIndexOrClosest(CPathTreeID TreeID, FVector Location) const;
+
+	inline CPathNeighbourSpan GetNeighbours(uint32 LeafIndex) const
+	{
+		CPathNeighbourSpan Span;
+		Span.First = Neighbours.data() + NeighbourOffsets[LeafIndex];
+		Span.Num = NeighbourCounts[LeafIndex];
+		return Span;
+	}
+
+	// Every valid leaf index is lower than this
+	inline uint32 GetLeafCapacity() const
+	{
+		return (uint32)LeafTreeIDs.size();
+	}
+
+	inline uint32 GetLeafCount() const
+	{
+		return (uint32)LeafIndexByTreeID.size();
+	}
+
+	// Indexes of all free leafs of the outer tree
+	inline const std::vector<uint32>& GetOuterTreeLeafs(uint32 OuterIndex) const
+	{
+		return LeafsByOuterIndex[OuterIndex];
+	}
+
+	// In bytes
+	uint64 GetMemoryUsage() const;
+
+	// Cached leaf data, indexed by leaf index. TreeID of a removed leaf is INVALID_TREEID.
+	std::vector<CPathTreeID> LeafTreeIDs;
+	std::vector<FVector> LeafLocations;
+	std::vector<uint32> LeafData;
+
+private:
+	// Neighbours of a leaf are Neighbours[NeighbourOffsets[Leaf]] to Neighbours[NeighbourOffsets[Leaf] + NeighbourCounts[Leaf] - 1]
+	std::vector<uint32> NeighbourOffsets;
+	std::vector<uint32> NeighbourCounts;
+	std::vector<uint32> Neighbours;
+
+	// Entries in Neighbours that are no longer referenced after patching
+	uint32 GarbageNeighbours = 0;
+
+	std::vector<std::vector<uint32>> LeafsByOuterIndex;
+	std::vector<uint32> FreeLeafIndexes;
+	std::unordered_map<CPathTreeID, uint32> LeafIndexByTreeID;
+
+	void AddLeafsRec(ACPathVolume* Volume, uint32 OuterIndex, CPathTreeID TreeID, CPathOctree* Tree, uint32 Depth);
+
+	void RemoveOuterTreeLeafs(uint32 OuterIndex);
+
+	// Appends a new neighbour list for the leaf, old one becomes garbage
+	void BuildNeighbourList(ACPathVolume* Volume, uint32 LeafIndex);
+
+	// Removes garbage from Neighbours
+	void Compact();
+};
@@ -0,0 +1,139 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <vector>
+#include <set>
+#include <unordered_map>
+
+class ACPathVolume;
+
+
+// Abstract graph over outer trees (cells) for hierarchical search, built on top of CPathGraph.
+// Free leafs of a cell are split into components connected inside the cell. Every pair of components of two
+// neighbouring cells that touch each other gets a portal - a pair of adjacent leafs, one on each side.
+// Portals of the same cell component are connected by edges with the cached distance between them inside the cell,
+// so a search over portals is a coarse route, and each leg of it can be refined with A* limited to one cell.
+class CPATHFINDING_API CPathHierarchy
+{
+public:
+	static constexpr uint32 INVALID_INDEX = 0xFFFFFFFF;
+
+	struct FPortal
+	{
+		// Outer indexes of both sides, Cells[0] < Cells[1]. Cells[0] is INVALID_INDEX for removed portals.
+		uint32 Cells[2] = { INVALID_INDEX, INVALID_INDEX };
+
+		// Adjacent leafs, Leafs[i] is in Cells[i]
+		uint32 Leafs[2] = { INVALID_INDEX, INVALID_INDEX };
+
+		// Middle of the two leafs
+		FVector Location;
+	};
+
+	struct FEdge
+	{
+		uint32 Portal;
+		float Cost;
+
+		// Cell the edge goes through
+		uint32 Cell;
+	};
+
+	// Buffers of a Dijkstra over one cell, kept by the caller so that queries don't allocate once they've grown
+	struct FCellSearch
+	{
+		// Leafs of the cell, sorted so a leaf's position can be found with a binary search
+		std::vector<uint32> Leafs;
+
+		// Indexed like Leafs, FLT_MAX if not reached
+		std::vector<float> Distances;
+
+		std::vector<std::pair<float, uint32>> Heap;
+
+		// FLT_MAX if the leaf wasn't reached or isn't in the cell
+		float GetDistance(uint32 LeafIndex) const;
+	};
+
+	// Builds portals and edges for all outer trees. Graph must be built.
+	void Build(const ACPathVolume* Volume);
+
+	// Rebuilds portals of given outer trees and edges of them and their neighbours. Graph must be updated first.
+	void UpdateOuterTrees(const ACPathVolume* Volume, const std::set<uint32>& OuterIndexes);
+
+	void Empty();
+
+	inline bool IsBuilt() const
+	{
+		return bBuilt;
+	}
+
+	inline const FPortal& GetPortal(uint32 PortalIndex) const
+	{
+		return Portals[PortalIndex];
+	}
+
+	// Leaf of the portal that lies in the cell
+	static inline uint32 GetPortalLeafInCell(const FPortal& Portal, uint32 Cell)
+	{
+		return Portal.Leafs[Portal.Cells[0] == Cell ? 0 : 1];
+	}
+
+	// Every valid portal index is lower than this
+	inline uint32 GetPortalCapacity() const
+	{
+		return (uint32)Portals.size();
+	}
+
+	inline const std::vector<FEdge>& GetEdges(uint32 PortalIndex) const
+	{
+		return Edges[PortalIndex];
+	}
+
+	// Component of a leaf inside its cell
+	inline uint32 GetComponent(uint32 LeafIndex) const
+	{
+		return ComponentByLeaf[LeafIndex];
+	}
+
+	// Finds distances inside the cell from a leaf to every portal of its component, appends them to OutEdges.
+	// Thread safe, as long as the hierarchy isn't modified and every thread has its own Search.
+	void FindPortalDistances(const ACPathVolume* Volume, uint32 LeafIndex, std::vector<FEdge>& OutEdges, FCellSearch& Search) const;
+
+	// In bytes
+	uint64 GetMemoryUsage() const;
+
+private:
+	bool bBuilt = false;
+
+	std::vector<FPortal> Portals;
+	std::vector<uint32> FreePortals;
+
+	// Indexed by portal
+	std::vector<std::vector<FEdge>> Edges;
+
+	// Only cells that have portals
+	std::unordered_map<uint32, std::vector<uint32>> PortalsByCell;
+
+	// Indexed by leaf index of the graph
+	std::vector<uint32> ComponentByLeaf;
+
+	// Labels leafs of the cell by components connected inside of it
+	void BuildComponents(const ACPathVolume* Volume, uint32 Cell);
+
+	// Creates portals for every pair of touching components of two neighbouring cells
+	void BuildPortalsBetween(const ACPathVolume* Volume, uint32 CellA, uint32 CellB);
+
+	// Removes all portals that have this cell on one side
+	void RemoveCellPortals(uint32 Cell);
+
+	// Replaces edges going through the cell with the current distances between its portals
+	void BuildCellEdges(const ACPathVolume* Volume, uint32 Cell);
+
+	// Dijkstra from SourceLeaf over leafs of its cell, distances of reached leafs are in Search
+	static void CellDijkstra(const ACPathVolume* Volume, uint32 Cell, uint32 SourceLeaf, FCellSearch& Search);
+
+	// Outer indexes of up to 6 neighbouring cells
+	static void GetNeighbourCells(const ACPathVolume* Volume, uint32 Cell, std::vector<uint32>& OutCells);
+};
@@ -0,0 +1,149 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CPathNode.h"
+#include "CPathFindPath.h"
+#include <vector>
+
+class ACPathVolume;
+
+
+/**
+Persistent planner for one agent that keeps re-planning to a moving target, like a monster chasing the player.
+It's a forward LPA* over graph leafs (the moving target variant of D* Lite), the search tree is kept between Replan calls:
+- If the target moves, only the part of the tree between the old and the new target is searched
+- If the agent moved along its last path, the subtree under its new leaf is kept and the rest is dropped
+- Leafs of outer trees regenerated by dynamic obstacles are repaired, see ACPathVolume::GetGraphChangeLog
+Falls back to a full search if the agent left the tree, the volume changed or the graph was rebuilt.
+Game thread only, one instance per agent. Edge costs come from CalcFitness, so an override should only depend on the two leafs.
+*/
+class CPATHFINDING_API CPathIncrementalPlanner
+{
+public:
+	// Finds a path from Start to End, reusing the previous search if possible. Same results as CPathAStar::FindPath.
+	// If it times out, the search is kept and the next call continues it.
+	ECPathfindingFailReason Replan(ACPathVolume* VolumeRef, FCPathResult* Result, FVector Start, FVector End, uint32 SmoothingPasses = 2, int32 UserData = 0, float TimeLimit = 0.002f, bool RequestRawPath = false, bool RequestUserPath = true);
+
+	// Drops the search tree, the next Replan starts from scratch
+	void Reset();
+
+	// Weight of the distance to the target in the priority of leafs. Higher is faster after big changes, but paths are less optimal.
+	float HeuristicWeight = 1.5f;
+
+	// Leafs expanded by the last Replan call
+	uint32 GetLastExpansionCount() const
+	{
+		return LastExpansionCount;
+	}
+
+private:
+	static constexpr uint32 INVALID_INDEX = 0xFFFFFFFF;
+
+	struct FKey
+	{
+		float First = FLT_MAX;
+		float Second = FLT_MAX;
+
+		inline bool operator<(const FKey& Other) const
+		{
+			return First < Other.First || (First == Other.First && Second < Other.Second);
+		}
+	};
+
+	struct FOpenEntry
+	{
+		FKey Key;
+		uint32 Leaf;
+		uint32 Version;
+	};
+
+	// Min heap by key
+	static inline bool OpenEntryGreater(const FOpenEntry& A, const FOpenEntry& B)
+	{
+		return B.Key < A.Key;
+	}
+
+	// Per leaf state, only valid if Stamp == Iteration
+	struct FLeafState
+	{
+		float G = FLT_MAX;
+		float Rhs = FLT_MAX;
+		uint32 Parent = INVALID_INDEX;
+		uint32 Stamp = 0;
+
+		// Matches Version of the valid heap entry while the leaf is open
+		uint32 OpenVersion = 0;
+		bool bOpen = false;
+
+		// TreeID of the leaf when it was first reached, to notice reused leaf indexes
+		CPathTreeID TreeID = INVALID_TREEID;
+	};
+
+	ACPathVolume* CurrentVolumeRef = nullptr;
+	int32 CurrentUserData = 0;
+	uint32 GraphVersion = 0;
+	uint32 Iteration = 0;
+
+	uint32 StartLeaf = INVALID_INDEX;
+	uint32 GoalLeaf = INVALID_INDEX;
+	FVector GoalLocation;
+
+	std::vector<FLeafState> States;
+	std::vector<uint32> TouchedLeafs;
+	std::vector<FOpenEntry> OpenHeap;
+	uint32 LastExpansionCount = 0;
+
+	// Temporary containers
+	TArray<CPathAStarNode> PathNodes;
+	std::vector<uint32> Affected;
+	std::vector<uint32> WalkStack;
+	std::vector<uint8> InSubtree;
+
+	// Smoothing and conversion to the user path are shared with A*
+	CPathAStar PostProcess;
+
+	// Starts a new search tree from StartLeaf
+	void Initialize();
+
+	// Repairs leafs of outer trees regenerated since the last call. Returns false if that's not possible.
+	bool ApplyGraphChanges();
+
+	// Keeps the subtree of the new start leaf. Returns false if the new start is not in the tree.
+	bool MoveStart(uint32 NewStartLeaf);
+
+	// Recomputes keys of all open leafs, after the start or the target moved
+	void RebuildOpenHeap();
+
+	// Returns false on timeout
+	bool ComputeShortestPath(double TimeLimitMS, decltype(TIMENOW) SearchStart);
+
+	void UpdateLeaf(uint32 Leaf);
+
+	float EdgeCost(uint32 From, uint32 To) const;
+
+	FKey CalcKey(uint32 Leaf) const;
+
+	inline bool IsTouched(uint32 Leaf) const
+	{
+		return States[Leaf].Stamp == Iteration;
+	}
+
+	// Makes the state of the leaf valid for this iteration
+	FLeafState& Touch(uint32 Leaf);
+
+	void PushOpen(uint32 Leaf);
+
+	inline void RemoveOpen(uint32 Leaf)
+	{
+		// Heap entry becomes stale and is skipped when popped
+		States[Leaf].bOpen = false;
+	}
+
+	// Pops stale entries, returns false if there are no open leafs
+	bool PeekOpen(FOpenEntry& OutEntry);
+
+	// Leaf index of the closest free leaf, INVALID_INDEX if there is none or it's in an unloaded chunk
+	static uint32 FindLeaf(ACPathVolume* VolumeRef, FVector Location);
+};
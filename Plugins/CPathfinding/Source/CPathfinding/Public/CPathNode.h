@@ -4,6 +4,8 @@
 
 #include "CoreMinimal.h"
 #include "CPathDefines.h"
+#include <memory>
+#include <atomic>
 #include "CPathNode.generated.h"
 
 /**
@@ -16,17 +18,20 @@ class CPATHFINDING_API CPathAStarNode
 {
 public:
 	CPathAStarNode();
-	CPathAStarNode(uint32 ID)
+	CPathAStarNode(CPathTreeID ID)
 		:
 		TreeID(ID)
 	{}
-	CPathAStarNode(uint32 ID, uint32 Data)
+	CPathAStarNode(CPathTreeID ID, uint32 Data)
 		:
 		TreeID(ID),
 		TreeUserData(Data)
 	{}
 
-	uint32 TreeID = 0xFFFFFFFF;
+	CPathTreeID TreeID = INVALID_TREEID;
+
+	// Index of this leaf in the volume's CPathGraph
+	uint32 LeafIndex = 0xFFFFFFFF;
 
 	// Data from Octree that you may modify by overriding `RecheckOctreeAtDepth`
 	// and access from `CalcFitness`
@@ -59,9 +64,15 @@ public:
 
 	struct Hash
 	{
+		// Leafs of one outer tree differ only in the high bits of TreeID, so they are mixed down
+		// to keep them from landing in the same bucket of power of 2 sized tables
 		size_t operator()(const CPathAStarNode& Node) const
 		{
-			return Node.TreeID;
+			uint64 Key = (uint64)Node.TreeID;
+			Key ^= Key >> 33;
+			Key *= 0xff51afd7ed558ccdull;
+			Key ^= Key >> 33;
+			return (size_t)Key;
 		}
 	};
 
@@ -110,25 +121,181 @@ struct CPATHFINDING_API FCPathResult
 	// To get this data, set RequestRawPath to true in the FindPath call
 	TArray<CPathAStarNode> RawPathNodes;
 	float RawPathLength = 0;
+
+	// True for the route over portals delivered to OnCoarsePathFound, UserPath goes through portal locations then
+	bool bCoarsePath = false;
+
+	// Clears the result for reuse, arrays keep their memory
+	void Reset()
+	{
+		FailReason = Unknown;
+		bCoarsePath = false;
+		SearchDuration = 0;
+		UserPath.Reset();
+		UserPathLength = 0;
+		RawPathNodes.Reset();
+		RawPathLength = 0;
+	}
+
+	// Moves the first and last node of UserPath to new locations, for results shared by requests between the same leafs.
+	// An endpoint that can't reach the next node is put before the old one instead, returns false if it can't reach that either.
+	bool ReplaceEndpoints(FVector Start, FVector End, TFunctionRef<bool(FVector, FVector)> IsSegmentFree)
+	{
+		const int32 Count = UserPath.Num();
+		if (Count < 2)
+			return false;
+
+		// With 2 nodes both new endpoints connect to each other
+		bool bMoveStart, bMoveEnd;
+		if (Count == 2)
+		{
+			bMoveStart = bMoveEnd = IsSegmentFree(Start, End);
+		}
+		else
+		{
+			bMoveStart = IsSegmentFree(Start, UserPath[1].WorldLocation);
+			bMoveEnd = IsSegmentFree(UserPath[Count - 2].WorldLocation, End);
+		}
+		if ((!bMoveStart && !IsSegmentFree(Start, UserPath[0].WorldLocation)) || (!bMoveEnd && !IsSegmentFree(UserPath.Last().WorldLocation, End)))
+			return false;
+
+		if (bMoveStart)
+			UserPath[0].WorldLocation = Start;
+		else
+			UserPath.Insert(FCPathNode(Start), 0);
+
+		if (bMoveEnd)
+			UserPath.Last().WorldLocation = End;
+		else
+			UserPath.Add(FCPathNode(End));
+
+		for (int32 i = 0; i < UserPath.Num() - 1; i++)
+		{
+			UserPath[i].Normal = (UserPath[i + 1].WorldLocation - UserPath[i].WorldLocation).GetSafeNormal();
+		}
+		UserPath.Last().Normal = FVector::ZeroVector;
+		return true;
+	}
 };
 
 
 DECLARE_DELEGATE_OneParam(PathResultDelegate, FCPathResult&);
+DECLARE_DELEGATE_OneParam(PathBatchDelegate, TArray<FCPathResult>&);
+
+// Shared by a request and its handles
+struct FCPathRequestState
+{
+	std::atomic_bool bCancelled = false;
+};
+
+// Returned by ACPathVolume::FindPathAsync, copies refer to the same request
+struct CPATHFINDING_API FCPathRequestHandle
+{
+	FCPathRequestHandle() {}
+	explicit FCPathRequestHandle(std::shared_ptr<FCPathRequestState> InState)
+		: State(InState) {}
+
+	// Stops the search if it's running, or skips it if it hasn't started. OnPathFound is never called after this,
+	// as long as it's called on the game thread.
+	inline void Cancel()
+	{
+		if (State)
+			State->bCancelled.store(true);
+	}
+
+	inline bool IsCancelled() const
+	{
+		return State && State->bCancelled.load();
+	}
+
+	// False if the request wasn't made
+	inline bool IsValid() const
+	{
+		return (bool)State;
+	}
+
+	explicit operator bool() const
+	{
+		return IsValid();
+	}
 
+private:
+	std::shared_ptr<FCPathRequestState> State;
+};
+
+struct FCPathBatch;
 
 // Struct used to save parameters for a FindPath call
 struct CPATHFINDING_API FCPathRequest
 {
 	PathResultDelegate OnPathFound;
+
+	// Optional, only called with ACPathVolume::UseHierarchicalSearch for paths crossing outer trees.
+	// Gets a rough path before OnPathFound, so the agent can start moving while the path is refined.
+	PathResultDelegate OnCoarsePathFound;
+
 	class ACPathVolume* VolumeRef;
 	FVector Start;
 	FVector End;
 	uint32 SmoothingPasses;
+	bool UseJumpPointSearch = false;
 	int32 UserData;
 	float TimeLimit;
 	//FCPathResult* Result;
 	bool RequestRawPath;
 	bool RequestUserPath;
+
+	// Pathfinding threads serve higher priority first, searches of lower priority wait while higher ones are running
+	int32 Priority = 0;
+
+	// Seconds after FindPathAsync after which the path is of no use, 0 - none. Past it the search fails with Timeout.
+	// Requests of the same priority are served earliest deadline first.
+	float Deadline = 0;
+
+	// Set by FindPathAsync, FPlatformTime::Seconds of the deadline
+	double DeadlineTime = 0;
+
+	// Set by FindPathAsync, shared with the returned handle
+	std::shared_ptr<FCPathRequestState> State;
+
+	// Set by ACPathCore when the request runs as two halves of a bidirectional search, see ACPathVolume::BidirectionalSearchMinDistance.
+	// The backward half searches from End to Start and doesn't submit a result.
+	std::shared_ptr<class CPathBidirectionalSearch> Bidirectional;
+	bool bBackwardHalf = false;
+
+	// Set by CPathFlowField::Update, the thread builds the field toward End instead of finding a path
+	std::shared_ptr<class CPathFlowField> FlowField;
+
+	// Set for requests of FindPathBatchAsync, the result goes to Batch->Results[BatchIndex] instead of OnPathFound.
+	// INDEX_NONE for the request that prepares the batch, see ACPathVolume::PrepareBatch.
+	std::shared_ptr<FCPathBatch> Batch;
+	int32 BatchIndex = 0;
+};
+
+// Shared by all requests of one ACPathVolume::FindPathBatchAsync call
+struct CPATHFINDING_API FCPathBatch
+{
+	PathBatchDelegate OnBatchFinished;
+
+	// One per request of the batch, in the same order. Pathfinding threads write only to the ones they search for
+	// and to the ones sharing these searches.
+	TArray<FCPathResult> Results;
+
+	// Index of the request each request shares the search with, its own index if it was searched
+	TArray<int32> SearchIndexes;
+
+	// All requests until the batch is prepared, then only the ones that share another one's search. Kept to search them
+	// on their own if the shared path doesn't connect to their locations. Without Batch set, so they don't keep the batch alive.
+	TArray<FCPathRequest> SharedRequests;
+
+	// Searches that haven't finished yet, the thread finishing the last one submits the batch
+	std::atomic_int Remaining = 0;
+
+	// Game thread
+	void Finish()
+	{
+		OnBatchFinished.ExecuteIfBound(Results);
+	}
 };
 
 UENUM(BlueprintType)
@@ -0,0 +1,115 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CPathDefines.h"
+#include "HAL/CriticalSection.h"
+#include <vector>
+
+class ACPathVolume;
+class CPathOctree;
+
+
+// Bit-packed occupancy of the volume at the finest depth, kept next to the octree.
+// Every outer tree that has children gets a mask of its finest voxels (set bit = free),
+// 64 bits for OctreeDepth 2 (4x4x4) and 512 bits for OctreeDepth 3 (8x8x8).
+// Outer trees without children don't need a mask, their own free bit is used instead.
+// Bits are in Morton order made of child indexes from depth 1 down, so every subtree is a contiguous range of bits
+// and occupancy queries become word wide bit operations instead of walking the octree.
+class CPATHFINDING_API CPathOccupancy
+{
+public:
+	CPathOccupancy();
+	~CPathOccupancy();
+
+	// Deeper octrees would need 4096+ bits per outer tree, so the layer is disabled for them and queries walk the octree
+	static constexpr uint32 MAX_OCCUPANCY_DEPTH = 3;
+
+	// 8^MAX_OCCUPANCY_DEPTH bits
+	static constexpr uint32 MAX_WORDS_PER_TREE = 8;
+
+	// Must be called after the volume set its NodeCount and voxel sizes
+	void Init(const ACPathVolume* Volume);
+
+	// Deletes all masks. Not thread safe.
+	void Empty();
+
+	inline bool IsEnabled() const
+	{
+		return WordsPerTree > 0;
+	}
+
+	// Rasterizes the outer tree into its mask, or releases the mask if the tree has no children.
+	// Thread safe as long as every thread updates different outer trees.
+	void UpdateOuterTree(const ACPathVolume* Volume, uint32 OuterIndex);
+
+	// If set, a mask is rasterized into a new slot and the old one is released through this, so searches never see it half written
+	FCPathDeferRelease DeferRelease;
+
+	// Null if the outer tree has no children
+	inline const uint64* GetMask(uint32 OuterIndex) const
+	{
+		uint32 Slot = SlotByOuterIndex[OuterIndex];
+		return Slot ? GetSlot(Slot) : nullptr;
+	}
+
+	// First bit of a subtree in its outer tree's mask
+	uint32 GetSubtreeStart(const ACPathVolume* Volume, CPathTreeID TreeID) const;
+
+	// True if any finest voxel on the Side of a subtree is free, or if its outer tree has no mask.
+	// Subtree is given by its outer index, GetSubtreeStart and Depth.
+	bool AnyFreeOnSide(uint32 OuterIndex, uint32 Start, uint32 Depth, ENeighbourDirection Side) const;
+
+	// True if every finest voxel overlapping the box is free. False if the box is not fully inside the volume.
+	bool IsBoxFree(const ACPathVolume* Volume, FVector WorldMin, FVector WorldMax) const;
+
+	// In bytes
+	uint64 GetMemoryUsage() const;
+
+private:
+	static constexpr uint32 SLOTS_PER_BLOCK_BITS = 10;
+	static constexpr uint32 SLOTS_PER_BLOCK = 1 << SLOTS_PER_BLOCK_BITS;
+	static constexpr uint32 SLOT_MASK = SLOTS_PER_BLOCK - 1;
+
+	uint32 OctreeDepth = 0;
+	uint32 WordsPerTree = 0;
+	uint32 NodeCount[3] = { 0, 0, 0 };
+	FVector VolumeMin;
+	float FinestVoxelSize = 1.f;
+
+	// 0 means no mask
+	std::vector<uint32> SlotByOuterIndex;
+
+	// Fixed size table so that it never reallocates while generators write masks
+	std::vector<uint64*> Blocks;
+	uint32 BlocksCreated = 0;
+	uint32 NextFreshSlot = 1;
+	std::vector<uint32> FreeSlots;
+	FCriticalSection Mutex;
+
+	// [Height][Side], masks of voxels on the side of a subtree with given height (OctreeDepth - Depth)
+	uint64 FaceMasks[MAX_OCCUPANCY_DEPTH + 1][6][MAX_WORDS_PER_TREE];
+
+	// Spreads bits of a local finest coordinate to its place in the Morton code, [Axis][Coord]
+	uint32 MortonByAxis[3][1 << MAX_OCCUPANCY_DEPTH];
+
+	inline uint64* GetSlot(uint32 Slot) const
+	{
+		return Blocks[Slot >> SLOTS_PER_BLOCK_BITS] + (Slot & SLOT_MASK) * WordsPerTree;
+	}
+
+	uint32 AllocateSlot();
+	void FreeSlot(uint32 Slot);
+
+	// Frees the slot now or through DeferRelease
+	void ReleaseSlot(uint32 Slot);
+
+	void RasterizeRec(const ACPathVolume* Volume, const CPathOctree* Tree, uint64* Mask, uint32 Prefix, uint32 Depth);
+
+	// Sets Count bits starting from Start. Ranges of 64+ bits are always word aligned.
+	static void SetBits(uint64* Mask, uint32 Start, uint32 Count);
+
+	// Is every voxel in local box [Min, Max] of this outer tree free
+	bool IsLocalBoxFree(const ACPathVolume* Volume, uint32 OuterIndex, const FIntVector& Min, const FIntVector& Max) const;
+};
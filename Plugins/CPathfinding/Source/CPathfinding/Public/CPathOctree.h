@@ -3,6 +3,10 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "CPathDefines.h"
+#include "HAL/CriticalSection.h"
+#include <atomic>
+#include <vector>
 
 /**
  *
@@ -16,8 +20,9 @@ class CPATHFINDING_API CPathOctree
 public:
 	CPathOctree();
 
-
-	CPathOctree* Children = nullptr;
+	// Index of the first of 8 children in the volume's CPathOctreePool, 0 if this tree is a leaf.
+	// Use ACPathVolume::GetChild or CPathOctreePool::Get to access them.
+	uint32 Children = 0;
 
 	uint32 Data = 0;
 
@@ -32,11 +37,209 @@ public:
 	{
 		return Data << 31;
 	}
+};
+
+
+// Contiguous storage for octree children, one per volume.
+// Children are always allocated in groups of 8 (octets), addressed by a 32 bit index instead of a pointer.
+// Octets live in fixed size blocks that never move, so a CPathOctree* stays valid as long as its octet is allocated.
+// Freed octets are reused through a free list, so dynamic obstacles don't fragment the memory.
+class CPATHFINDING_API CPathOctreePool
+{
+public:
+	CPathOctreePool();
+	~CPathOctreePool();
+
+	// 2^OCTETS_PER_BLOCK_BITS octets per block, 256KB
+	static constexpr uint32 OCTETS_PER_BLOCK_BITS = 12;
+	static constexpr uint32 OCTETS_PER_BLOCK = 1 << OCTETS_PER_BLOCK_BITS;
+	static constexpr uint32 OCTET_MASK = OCTETS_PER_BLOCK - 1;
+
+	// Blocks addressable with 32 bit octet indexes
+	static constexpr uint64 MAX_BLOCK_COUNT = ((uint64)MAX_uint32 >> OCTETS_PER_BLOCK_BITS) + 1;
+
+	// Must be called before the first Allocate. MaxOctets is the upper bound of octets that can exist at once,
+	// it only sizes the block table, which is capped to MAX_BLOCK_COUNT. Blocks themselves are created on demand.
+	// Optionally, the pool can start with MappedOctetCount octets (including the reserved octet 0) from read only memory, 
+	// for example a memory mapped bake. Mapped octets are never written to or freed, use CloneToWritable before modifying them.
+	void Init(uint64 MaxOctets, const CPathOctree* MappedOctets = nullptr, uint32 MappedOctetCount = 0);
+
+	// Returns index of 8 zeroed children. Thread safe.
+	uint32 Allocate();
+
+	// Returns the octet and all of its descendants to the free list. Mapped octets are ignored. Thread safe.
+	void Free(uint32 OctetIndex);
+
+	// If set, Free hands the release over to it, so that octets searches may still be walking stay valid until then
+	FCPathDeferRelease DeferRelease;
+
+	inline bool IsMapped(uint32 OctetIndex) const
+	{
+		return (OctetIndex >> OCTETS_PER_BLOCK_BITS) < MappedBlockCount;
+	}
+
+	// Copies the octet and all of its descendants into writable octets, returns the index of the copy. Thread safe.
+	uint32 CloneToWritable(uint32 OctetIndex);
+
+	// Returns the first of 8 children. Index must come from Allocate.
+	// Blocks never move, so the pointer stays valid while more octets are allocated, e.g. by recursion into deeper levels.
+	inline CPathOctree* Get(uint32 OctetIndex) const
+	{
+		return Blocks[OctetIndex >> OCTETS_PER_BLOCK_BITS] + (OctetIndex & OCTET_MASK) * 8;
+	}
+
+	// Deletes all blocks. Not thread safe.
+	void Empty();
+
+	// Number of octets currently in use
+	inline uint32 GetAllocatedOctetCount() const
+	{
+		return AllocatedOctets;
+	}
+
+	// Memory reserved by blocks, in bytes
+	uint64 GetMemoryUsage() const;
+
+private:
+	// Fixed size table so that it never reallocates while other threads read from it
+	std::vector<CPathOctree*> Blocks;
+
+	uint32 BlocksCreated = 0;
+
+	// First blocks point to read only memory passed to Init
+	uint32 MappedBlockCount = 0;
+
+	// Index of the next never used octet
+	uint32 NextFreshOctet = 1;
+
+	// Head of the free list, 0 if empty. Next free octet is stored in the Children field of the first child.
+	uint32 FreeListHead = 0;
+
+	uint32 AllocatedOctets = 0;
+
+	FCriticalSection Mutex;
+
+	void FreeRec(uint32 OctetIndex);
+};
+
+// Sparse storage of outer trees (depth 0), one per volume.
+// Outer trees are grouped in bricks of 4x4x4. Only bricks with mixed content are materialized,
+// uniformly free or occupied bricks point to one of two shared read only bricks instead.
+// Outer indexes are the same as with a dense array, the grid only changes where the trees are stored.
+// A published brick is never written to. Changes copy the brick and publish the copy with one atomic store,
+// so searches reading concurrently see every tree either whole before or whole after the change.
+class CPATHFINDING_API CPathOuterGrid
+{
+public:
+	CPathOuterGrid();
+	~CPathOuterGrid();
+
+	static constexpr uint32 BRICK_BITS = 2;
+	static constexpr uint32 BRICK_SIZE = 1 << BRICK_BITS;
+	static constexpr uint32 BRICK_MASK = BRICK_SIZE - 1;
+	static constexpr uint32 TREES_PER_BRICK = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+	// Every brick starts as uniformly occupied
+	void Init(const uint32 InNodeCount[3]);
+
+	// Returns outer tree for reading, never write to it - use ReplaceTree instead
+	inline CPathOctree* Get(uint32 OuterIndex) const
+	{
+		uint32 LocalIndex;
+		uint32 BrickIndex = GetBrickIndex(OuterIndex, LocalIndex);
+		return Bricks[BrickIndex].load(std::memory_order_acquire) + LocalIndex;
+	}
+
+	// Publishes a copy of the tree's brick with the tree replaced, materializing the brick if it was uniform.
+	// Returns Children of the old tree, free them through the pool once the new tree is in. Thread safe.
+	uint32 ReplaceTree(uint32 OuterIndex, const CPathOctree& Tree);
+
+	inline uint32 GetBrickIndex(uint32 OuterIndex, uint32& LocalIndex) const
+	{
+		uint32 X = OuterIndex / NodeCountYZ;
+		uint32 YZ = OuterIndex - X * NodeCountYZ;
+		uint32 Y = YZ / NodeCount[2];
+		uint32 Z = YZ - Y * NodeCount[2];
+
+		LocalIndex = ((X & BRICK_MASK) << (2 * BRICK_BITS)) | ((Y & BRICK_MASK) << BRICK_BITS) | (Z & BRICK_MASK);
+		return ((X >> BRICK_BITS) * BrickCount[1] + (Y >> BRICK_BITS)) * BrickCount[2] + (Z >> BRICK_BITS);
+	}
+
+	inline uint32 GetBrickCount() const
+	{
+		return (uint32)Bricks.size();
+	}
+
+	// Coordinates of the brick's first outer tree, in outer tree units
+	FIntVector GetBrickOrigin(uint32 BrickIndex) const;
+
+	// Morton code of the brick's coordinates. Bricks sorted by it form compact blocks, unlike with the X major index.
+	uint64 GetBrickMortonCode(uint32 BrickIndex) const;
+
+	// Fills OutIndexes with outer indexes of trees in this brick that are inside the volume
+	void GetOuterIndexesInBrick(uint32 BrickIndex, std::vector<uint32>& OutIndexes) const;
+
+	// Trees of the brick, shared with other bricks if it's uniform
+	inline const CPathOctree* GetBrick(uint32 BrickIndex) const
+	{
+		return Bricks[BrickIndex].load(std::memory_order_acquire);
+	}
+
+	// Copies TREES_PER_BRICK trees into a new brick, which replaces the old one. Thread safe.
+	void LoadBrick(uint32 BrickIndex, const CPathOctree* Trees);
+
+	inline bool IsBrickMaterialized(uint32 BrickIndex) const
+	{
+		return IsMaterialized(Bricks[BrickIndex].load(std::memory_order_acquire));
+	}
+
+	// Sets all trees of the brick as childless free or occupied leafs, releasing its storage.
+	// Children of its trees are not freed, the caller does that after this. Thread safe.
+	void SetBrickUniform(uint32 BrickIndex, bool IsFree);
+
+	// If all trees in the brick are childless and have Data of exactly 0 or exactly 1, the brick becomes uniform again.
+	// Returns true if the brick is uniform afterwards. Not thread safe for this brick.
+	bool TryCollapseBrick(uint32 BrickIndex);
+
+	// Deletes all bricks. Not thread safe.
+	void Empty();
 
-	~CPathOctree()
+	// If set, bricks that are replaced or become uniform are deleted through it, so that searches can finish reading them
+	FCPathDeferRelease DeferRelease;
+
+	inline uint32 GetMaterializedBrickCount() const
 	{
-		delete[] Children;
-	};
+		return MaterializedBricks;
+	}
+
+	// In bytes
+	uint64 GetMemoryUsage() const;
+
+private:
+	uint32 NodeCount[3] = { 0, 0, 0 };
+	uint32 NodeCountYZ = 1;
+	uint32 BrickCount[3] = { 0, 0, 0 };
+
+	// Materialized bricks are owned, uniform ones point to UniformBricks. Stored with release, so a brick is filled before searches can see it.
+	std::vector<std::atomic<CPathOctree*>> Bricks;
+
+	// [0] - occupied, [1] - free
+	CPathOctree* UniformBricks[2];
+
+	uint32 MaterializedBricks = 0;
+
+	// Serializes changes of bricks, readers don't lock
+	FCriticalSection Mutex;
+
+	inline bool IsMaterialized(const CPathOctree* Brick) const
+	{
+		return Brick != UniformBricks[0] && Brick != UniformBricks[1];
+	}
+
+	// Replaces the brick and releases the old one, Mutex must be locked
+	void PublishBrick(uint32 BrickIndex, CPathOctree* Brick);
+
+	void ReleaseBrick(CPathOctree* Brick);
 };
 
 // Class used to remember data needed to draw a debug voxel 
@@ -60,4 +263,3 @@ public:
 	bool Free = false;
 
 };
-
@@ -0,0 +1,110 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CPathGraph.h"
+#include "CPathHierarchy.h"
+#include "HAL/CriticalSection.h"
+#include "Templates/Function.h"
+#include <atomic>
+#include <deque>
+#include <vector>
+
+
+// Everything searches read besides the octree, as of one graph version
+struct CPATHFINDING_API FCPathSnapshot
+{
+	// Adjacency of free leafs used by A*
+	CPathGraph Graph;
+
+	// Portals between outer trees for UseHierarchicalSearch
+	CPathHierarchy Hierarchy;
+
+	// Incremented every time the graph changes, so paused searches know their leaf indexes are stale
+	uint32 Version = 0;
+
+	// Outer trees of the graph updates since the last full build, each with Version after it, oldest first.
+	// Lets CPathIncrementalPlanner repair its search instead of starting over.
+	std::deque<std::pair<uint32, std::vector<uint32>>> ChangeLog;
+};
+
+
+/**
+Two copies of FCPathSnapshot, so that regeneration doesn't wait for searches and searches don't wait for regeneration.
+Searches pin the published copy with FCPathSnapshotScope. An update is applied to the other copy, which is published then,
+and applied again to the first copy once searches that pinned it are done. Both copies are the same after an update,
+so leaf indexes only depend on Version.
+Octree memory replaced during an update is retired instead of freed, and released by Reclaim after the update.
+Before Enable there is only one copy, updated in place while nothing searches - during the initial generation.
+*/
+class CPATHFINDING_API CPathSnapshots
+{
+public:
+	// Snapshot of this thread - the pinned one, or the published one if none is pinned
+	const FCPathSnapshot& GetCurrent() const;
+
+	// Copies the published snapshot to the other one, updates are applied to both from now on. Not thread safe.
+	void Enable();
+
+	inline bool IsEnabled() const
+	{
+		return bEnabled;
+	}
+
+	// Applies the update as described above, Version of the snapshot is already the new one. One update at a time.
+	// Volume functions called by Apply read the snapshot that is being updated.
+	void Update(TFunctionRef<void(FCPathSnapshot& Snapshot)> Apply);
+
+	// Release runs in Reclaim, or right away if snapshots aren't enabled. Thread safe.
+	void Retire(TFunction<void()>&& Release);
+
+	// Runs releases retired by finished updates. Must not run while an update is in progress.
+	void Reclaim();
+
+	// Releases everything and goes back to one copy. Not thread safe.
+	void Empty();
+
+private:
+	friend class FCPathSnapshotScope;
+
+	FCPathSnapshot Snapshots[2];
+
+	std::atomic<uint32> Published = 0;
+
+	// Searches that pinned each copy
+	mutable std::atomic_int Readers[2] = { 0, 0 };
+
+	bool bEnabled = false;
+	uint32 LastVersion = 0;
+
+	std::vector<TFunction<void()>> Retired;
+	FCriticalSection RetiredMutex;
+
+	// Returns index of the pinned copy
+	uint32 Pin() const;
+	void Unpin(uint32 Index) const;
+
+	// Waits until no search reads the copy
+	void WaitForReaders(uint32 Index) const;
+};
+
+
+// Pins the published snapshot for the lifetime of the scope, so a search sees one graph even if a new one is published meanwhile.
+// Keep it short, an update waits for searches of the old copy before applying itself to it.
+// Nested scopes keep the pin of the outer one.
+class CPATHFINDING_API FCPathSnapshotScope
+{
+public:
+	explicit FCPathSnapshotScope(const CPathSnapshots& InSnapshots);
+	~FCPathSnapshotScope();
+
+private:
+	const CPathSnapshots& Snapshots;
+
+	// -1 if an outer scope pinned already
+	int32 Index = -1;
+
+	const CPathSnapshots* PreviousSnapshots = nullptr;
+	uint32 PreviousIndex = 0;
+};
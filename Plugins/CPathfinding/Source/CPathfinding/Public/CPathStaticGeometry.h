@@ -0,0 +1,120 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CPathDefines.h"
+#include <vector>
+
+class ACPathVolume;
+class UPrimitiveComponent;
+class UStaticMesh;
+struct FKAggregateGeom;
+
+
+// Static collision around the volume as triangles, gathered once so the initial generation can test trees
+// without physics queries. Triangles are binned into cells the size of outer trees they touch, every cell keeps its own copy
+// of them in batches of 4, which are tested against a box at once (separating axis test).
+// Simple collision elements are solid, so they are also kept as planes to find boxes entirely inside them.
+// Complex collision is only a surface for physics overlaps too, so its triangles are enough.
+// Primitives are gathered the way physics overlaps would find them during generation, movable ones at their current location.
+class CPATHFINDING_API CPathStaticGeometry
+{
+public:
+
+	// Collects collision of the primitives that block or overlap the volume's TraceChannel. Must be called on the game thread
+	// after the volume set its NodeCount and voxel sizes. Returns false and stays empty if some collision can't be
+	// turned into triangles, e.g. landscapes or complex collision without CPU access, physics has to be used then.
+	bool Gather(const ACPathVolume* Volume);
+
+	// Not thread safe
+	void Empty();
+
+	inline bool IsGathered() const
+	{
+		return bGathered;
+	}
+
+	inline uint32 GetTriangleCount() const
+	{
+		return TriangleCount;
+	}
+
+	// True if no triangle touches the box and it isn't inside a simple collision element. Thread safe.
+	bool IsBoxFree(FVector Center, FVector Extent) const;
+
+	// True if no triangle touches the sphere and it isn't inside a simple collision element. Thread safe.
+	bool IsSphereFree(FVector Center, float Radius) const;
+
+private:
+
+	// Structure of arrays, Coords[Vertex * 3 + Axis][Lane]. Unused lanes repeat lane 0.
+	struct FTriangleBatch
+	{
+		alignas(16) float Coords[9][4];
+	};
+
+	// Consecutive batches of a cell start at CellFirstBatch[Cell], the last entry is the batch count
+	std::vector<FTriangleBatch> Batches;
+	std::vector<uint32> CellFirstBatch;
+
+	// 3 vertices per triangle, only kept until the batches are built
+	std::vector<FVector3f> Vertices;
+
+	// Convex simple collision element, the inside is behind all of its planes
+	struct FSolid
+	{
+		FBox Box;
+		uint32 FirstPlane;
+		uint32 PlaneCount;
+	};
+	std::vector<FSolid> Solids;
+	std::vector<FPlane> SolidPlanes;
+
+	// Solids whose bounding box overlaps a cell start at CellFirstSolid[Cell] in CellSolids, the last entry is their count
+	std::vector<uint32> CellSolids;
+	std::vector<uint32> CellFirstSolid;
+
+	FVector GridMin;
+	float CellSize = 1;
+	int32 CellCount[3] = {};
+
+	// Triangles outside of this can't touch any tree of the volume
+	FBox Bounds;
+
+	uint32 TriangleCount = 0;
+	bool bGathered = false;
+
+	bool AddPrimitive(UPrimitiveComponent* Primitive);
+
+	// Complex collision, returns false if the render data isn't available on CPU
+	bool AddStaticMesh(const UStaticMesh* Mesh, const FTransform& Transform);
+
+	// Simple collision. Spheres and capsules are added as their bounding boxes.
+	void AddAggregateGeometry(const FKAggregateGeom& Geometry, const FTransform& Transform);
+
+	// Box with the given extent, centered in Transform's origin
+	void AddBox(const FTransform& Transform, FVector Extent);
+
+	void AddTriangle(FVector A, FVector B, FVector C);
+
+	// Convex hull given by its triangles, planes face away from the average of Points
+	void AddSolid(const TArray<FVector>& Points, const int32* Indices, int32 IndexCount);
+
+	// A location that doesn't touch any triangle is either inside a solid or outside of all of them
+	bool IsInsideSolid(FVector Location) const;
+
+	// Bins Vertices into cells whose box they touch, and Solids into cells their bounding box overlaps
+	void Build();
+
+	// Cells overlapping the box, boxes outside of the grid are clamped to the cells on its edge
+	void GetCellRange(FVector Min, FVector Max, FIntVector& OutMin, FIntVector& OutMax) const;
+
+	// Space that GetCellRange maps to the cell, cells on the edge of the grid reach to Bounds
+	FBox GetCellBox(int32 X, int32 Y, int32 Z) const;
+
+	inline uint32 GetCellIndex(int32 X, int32 Y, int32 Z) const
+	{
+		return (X * CellCount[1] + Y) * CellCount[2] + Z;
+	}
+};
@@ -11,14 +11,26 @@
 #include <atomic>
 #include <set>
 #include <list>
+#include <deque>
+#include <unordered_map>
 #include "PhysicsInterfaceTypesCore.h"
+#include "Async/MappedFileHandle.h"
 #include "CPathDefines.h"
 #include "CPathOctree.h"
 #include "CPathNode.h"
+#include "CPathGraph.h"
+#include "CPathHierarchy.h"
+#include "CPathSnapshot.h"
+#include "CPathCache.h"
+#include "CPathOccupancy.h"
+#include "CPathDeltaLog.h"
+#include "CPathChunks.h"
+#include "CPathStaticGeometry.h"
 #include "CPathAsyncVolumeGeneration.h"
 #include "CPathVolume.generated.h"
 
 class ACPathCore;
+class CPathAStar;
 
 UCLASS()
 class CPATHFINDING_API ACPathVolume : public AActor
@@ -27,6 +39,10 @@ class CPATHFINDING_API ACPathVolume : public AActor
 
 	friend class FCPathAsyncVolumeGenerator;
 	friend class UCPathDynamicObstacle;
+	friend class CPathGraph;
+	friend class CPathHierarchy;
+	friend class CPathOccupancy;
+	friend class CPathDeltaLog;
 public:
 	ACPathVolume();
 
@@ -35,24 +51,51 @@ public:
 	// This is the method to find get a path in c++, asynchronously. 
 	// Example function you can provide: void OnPathFound(FCPathResult& PathResult);
 	// You can get the function name via macro: GET_FUNCTION_NAME_CHECKED(YourUObjectType, OnPathFound);
-	// Returns false if FindPath request wasn't made (happens if somehow called before begin play or if one of the volumes has been destroyed)
-	bool FindPathAsync(UObject* CallingObject, const FName& InFunctionName,
+	// UseJumpPointSearch makes searches through large open spaces faster, see CPathAStar::FindPath.
+	// The returned handle can cancel the request, it's invalid if FindPath request wasn't made (happens if somehow called before begin play or if one of the volumes has been destroyed)
+	FCPathRequestHandle FindPathAsync(UObject* CallingObject, const FName& InFunctionName,
 		FVector Start, FVector End,
 		uint32 SmoothingPasses = 2, int32 UserData = 0, float TimeLimit = 0.15f,
-		bool RequestRawPath = false, bool RequestUserPath = true);
+		bool RequestRawPath = false, bool RequestUserPath = true, bool UseJumpPointSearch = false);
 
-	// Same as above, just using the FCPathRequest structure to pass parameters
-	bool FindPathAsync(FCPathRequest& Request);
+	// Same as above, just using the FCPathRequest structure to pass parameters, which also has Priority and Deadline
+	FCPathRequestHandle FindPathAsync(FCPathRequest& Request);
+
+	// Many requests at once, for example a whole squad moving. They are spread over pathfinding threads with one wake up each,
+	// and OnBatchFinished is called once on the game thread with results in the same order as Requests.
+	// Requests that start and end in the same leafs as an earlier one of the batch, with the same options, share its search.
+	// Leafs are looked up by the pathfinding thread that picks up the batch, the game thread only moves the requests.
+	// OnPathFound of the requests isn't called and they can't be cancelled. Requests are moved from the array.
+	bool FindPathBatchAsync(TArray<FCPathRequest>& Requests, PathBatchDelegate OnBatchFinished);
+
+	// Called by the pathfinding thread that picked up a batch while the volume can be searched. Sets SearchIndexes
+	// and moves the requests that get their own search from SharedRequests to OutSearches, with Batch set.
+	void PrepareBatch(const std::shared_ptr<FCPathBatch>& Batch, std::vector<FCPathRequest>& OutSearches);
 
 	// This searches for a path on this thread, so the result is available here and now.
 	// Increase TimeLimit at your own risk. 
 	// Default time of 2ms means that in the worst case scenatio, this call will increse your frametime by 2ms!
 	// Use this only for small graphs or very short paths (for example, <=1000 node graph)
 	// Whenever possible, use FindPathAsync instead
-	// IMPORTANT: When using with dynamic obstacles, this might fail with reason GraphNotGenerated while the graph is being updated!
+	// Fails with VolumeNotGenerated until the initial generation is done, regeneration by dynamic obstacles doesn't block it.
 	FCPathResult FindPathSynchronous(FVector Start, FVector End,
 		uint32 SmoothingPasses = 2, int32 UserData = 0, float TimeLimit = 0.002f,
-		bool RequestRawPath = false, bool RequestUserPath = true);
+		bool RequestRawPath = false, bool RequestUserPath = true, bool UseJumpPointSearch = false);
+
+	// For agents that keep re-planning to a moving target, CPathIncrementalPlanner reuses the previous search on this thread.
+	// For many agents going to the same target, CPathFlowField gives each of them the next waypoint without a search.
+
+	// Time sliced version of FindPathSynchronous for longer paths, without the hard Timeout of a single frame budget.
+	// Call BeginSynchronousSearch once, then ContinueSynchronousSearch every frame until it returns true, Result is final then.
+	// Search and Result are yours and must stay alive until then, a Search can be reused for the next path.
+	// TimeLimit is the total time spent in slices. A slice after a graph update starts the search over.
+	// Returns false if the search is over right away, Result.FailReason says if it failed.
+	bool BeginSynchronousSearch(CPathAStar& Search, FCPathResult& Result, FVector Start, FVector End,
+		uint32 SmoothingPasses = 2, int32 UserData = 0, float TimeLimit = 0.15f,
+		bool RequestRawPath = false, bool RequestUserPath = true, bool UseJumpPointSearch = false);
+
+	// Runs the search for at most SliceTime seconds
+	bool ContinueSynchronousSearch(CPathAStar& Search, float SliceTime = 0.002f);
 
 
 	// Blueprint exposed version
@@ -61,11 +104,11 @@ public:
 	// Default time of 2ms means that in the worst case scenatio, this call will increse your frametime by 2ms!
 	// Use this only for small graphs or very short paths (for example, <=1000 node graph)
 	// Whenever possible, use FindPathAsync instead
-	// IMPORTANT: When using with dynamic obstacles, this might fail with reason GraphNotGenerated while the graph is being updated!
+	// Fails with VolumeNotGenerated until the initial generation is done, regeneration by dynamic obstacles doesn't block it.
 	UFUNCTION(BlueprintCallable, Category = "CPath", Meta = (ExpandEnumAsExecs = "Branches"))
 		void FindPathSynchronous(TEnumAsByte<BranchFailSuccessEnum>& Branches, TArray<FCPathNode>& Path, TEnumAsByte<ECPathfindingFailReason>& FailReason,
 			 FVector Start, FVector End, int SmoothingPasses = 2,
-			int UserData = 0, float TimeLimit = 0.002f);
+			int UserData = 0, float TimeLimit = 0.002f, bool UseJumpPointSearch = false);
 
 
 	// ------- EXTENDABLE ------
@@ -77,8 +120,14 @@ public:
 	// Overwrite this function to change the default conditions of a tree being free/ocupied.
 	// You may also save other information in the Data field of an Octree, as only the least significant bit is used.
 	// This is called during graph generation, for every subtree including leafs, so potentially millions of times. 
+	// With VoxelizeStaticGeometry, the default implementation tests gathered triangles instead of physics during the initial generation.
 	virtual bool RecheckOctreeAtDepth(CPathOctree* OctreeRef, FVector TreeLocation, uint32 Depth);
 
+	// Called during initial generation for every brick of 4x4x4 outer trees, before checking them one by one.
+	// If it returns true, all of them become free leafs with Data = 1 and RecheckOctreeAtDepth is not called for them.
+	// Override it if your RecheckOctreeAtDepth stores more data, return false to always check every tree.
+	virtual bool RecheckBrickIsFree(FVector BrickLocation, FVector BrickExtent);
+
 
 	// -------- BP EXPOSED ----------
 
@@ -119,8 +168,9 @@ public:
 
 	// 2 Is optimal in most cases. If you have very large open speces with small amount of obstacles, then 3 will be better.
 	// For dense labirynths with little to no open space, 1 or even 0 will be faster.
+	// Depths above 3 require CPATH_64BIT_TREEID (see CPathDefines.h), without it higher values are clamped to 3.
 	// Check documentation for detailed performance guidance.
-	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false", ClampMin = "0", ClampMax = "3", UIMin = "0", UIMax = "3"))
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false", ClampMin = "0", ClampMax = "7", UIMin = "0", UIMax = "7"))
 		int OctreeDepth = 2;
 
 
@@ -135,10 +185,118 @@ public:
 
 	// How many threads can graph generation split into. 
 	// If left <=0 (RECOMMENDED), it uses system's Physical Core count - 1. 
-	// Generation threads are allocated dynamically, so it only uses more than 1 thread when necessary.
+	// Generation threads are created once and sleep between updates, more than 1 of them only work when necessary.
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false && OverwriteMaxGenerationThreads==true", ClampMin = "0", ClampMax = "31", UIMin = "0", UIMax = "31"))
 		int MaxGenerationThreads = 0;
 
+	// Initial generation tests trees against triangles of static collision gathered once, instead of physics overlap tests.
+	// Sees the same primitives as the overlap tests, including overlapping and movable ones where they are. Capsules and spheres in simple collision
+	// become their bounding boxes, and so does the agent capsule, so the result is slightly more conservative than with physics.
+	// Falls back to physics if some collision can't be gathered, e.g. landscapes. Obstacles and streamed chunks always use physics.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool VoxelizeStaticGeometry = false;
+
+	// Size of the pathfinding thread pool shared by all volumes. If left <=0, it uses system's Physical Core count - 1.
+	// The pool is created by the first volume that begins play, so only its value is used.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (ClampMin = "0", UIMin = "0", UIMax = "63"))
+		int PathfindingThreadCount = 0;
+
+	// Long paths are first planned over portals between outer trees, then refined one outer tree at a time.
+	// Paths are slightly longer than with plain A*, but time grows with the number of outer trees crossed instead of leafs.
+	// Costs memory and generation time for portals and cached distances between them, set it for large open volumes.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseHierarchicalSearch = false;
+
+	// Async requests with Start and End further apart than this run as a bidirectional search on two idle pathfinding threads,
+	// which lowers the latency of long paths when threads are free. 0 disables it. Not used with jump point or hierarchical search.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "CPath", meta = (ClampMin = "0", UIMin = "0"))
+		float BidirectionalSearchMinDistance = 0;
+
+	// Number of found paths kept for requests between the same start and end leafs with the same UserData and SmoothingPasses.
+	// Paths are evicted when outer trees they cross are regenerated. 0 disables the cache. Requests for raw paths bypass it.
+	// Only use it if your CalcFitness depends on nothing but the leafs.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "CPath", meta = (ClampMin = "0", UIMin = "0"))
+		int PathCacheSize = 0;
+
+	// Counters of PathCache since the start or the last call with Reset = true, to tune PathCacheSize
+	UFUNCTION(BlueprintCallable, Category = "CPath")
+		void GetPathCacheStats(int64& Hits, int64& Misses, int64& Evictions, int64& Invalidations, int& EntryCount, bool Reset = false);
+
+	// Pathfinding threads run async searches and flow field builds in slices of this many seconds and switch between them,
+	// so a long search doesn't hold back short ones queued after it. 0 runs every search to the end at once.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "CPath", meta = (ClampMin = "0", UIMin = "0"))
+		float AsyncSearchSliceTime = 0.005f;
+
+	// If a bake made with BakeOctree exists for this volume and matches its settings and collision, the octree is loaded from it
+	// instead of being generated. Bakes are loose files in ProjectContentDir/CPathBakes, add that directory to 
+	// "Additional Non-Asset Directories to Copy" in packaging settings to ship them.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Bake", meta = (EditCondition = "GenerationStarted==false"))
+		bool LoadBakedOctree = true;
+
+	// Initial generation starts around PointsOfInterest and player starts, and the volume can be searched once the first
+	// ProgressiveBricksPerWave bricks are done. The rest is generated in waves of the same size, by distance from those points.
+	// Space that isn't generated yet is impassable. Dynamic obstacles and streaming wait until the last wave is done.
+	// Not used when the octree is loaded from a bake, which is fast already.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Progressive", meta = (EditCondition = "GenerationStarted==false"))
+		bool ProgressiveGeneration = false;
+
+	// Bricks are 4x4x4 outer trees. The smaller this is, the sooner the first wave is searchable, but the more graph updates it takes.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Progressive", meta = (EditCondition = "GenerationStarted==false && ProgressiveGeneration==true", ClampMin = "1", UIMin = "1"))
+		int ProgressiveBricksPerWave = 128;
+
+	// Where agents are needed first, e.g. AI spawns. Player starts are added automatically.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "CPath|Progressive", meta = (EditCondition = "ProgressiveGeneration==true"))
+		TArray<FVector> PointsOfInterest;
+
+	// Only has an effect before the generation starts
+	UFUNCTION(BlueprintCallable, Category = "CPath|Progressive")
+		void AddPointOfInterest(FVector WorldLocation);
+
+#if WITH_EDITOR
+	// Generates the octree on the game thread and saves it to GetBakeFilePath. Rebake after changing the level or the volume.
+	UFUNCTION(CallInEditor, Category = "CPath|Bake")
+		void BakeOctree();
+#endif
+
+	// Splits the volume into chunks that are only generated (or loaded from the bake) while a streamed level overlaps them,
+	// or while they are requested with LoadChunksInBox. Everything else is impassable and takes no memory.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Streaming", meta = (EditCondition = "GenerationStarted==false"))
+		bool StreamChunks = false;
+
+	// Edge of a chunk in bricks of 4x4x4 outer trees, rounded up to a power of 2
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Streaming", meta = (EditCondition = "GenerationStarted==false && StreamChunks==true", ClampMin = "1", ClampMax = "64", UIMin = "1", UIMax = "64"))
+		int ChunkSizeInBricks = 4;
+
+	// Keeps chunks overlapping the box loaded until a matching UnloadChunksInBox. Streamed levels do this automatically.
+	UFUNCTION(BlueprintCallable, Category = "CPath|Streaming")
+		void LoadChunksInBox(FBox WorldBox);
+
+	UFUNCTION(BlueprintCallable, Category = "CPath|Streaming")
+		void UnloadChunksInBox(FBox WorldBox);
+
+	// Always true if StreamChunks is false
+	UFUNCTION(BlueprintCallable, Category = "CPath|Streaming")
+		bool IsLocationResident(FVector WorldLocation) const;
+
+	// Keeps the last state of every outer tree changed by dynamic obstacles, so that it can be saved with SaveObstacleDeltas.
+	// Costs memory proportional to the area obstacles have moved through.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|SaveGame", meta = (EditCondition = "GenerationStarted==false"))
+		bool RecordObstacleDeltas = true;
+
+	// Writes outer trees changed by dynamic obstacles so far, store it in your save game.
+	UFUNCTION(BlueprintCallable, Category = "CPath|SaveGame")
+		void SaveObstacleDeltas(TArray<uint8>& OutData) const;
+
+	// Restores outer trees saved with SaveObstacleDeltas, without any physics queries. Call any time after the generation started, 
+	// they are applied as soon as the volume is free. Obstacles that were at rest when saving don't need to be tracked anymore.
+	// Returns false if the data was saved with different volume settings.
+	UFUNCTION(BlueprintCallable, Category = "CPath|SaveGame")
+		bool LoadObstacleDeltas(const TArray<uint8>& Data);
+
+	// Forgets recorded changes, the octree stays as it is
+	UFUNCTION(BlueprintCallable, Category = "CPath|SaveGame")
+		void ClearObstacleDeltas();
+
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Render")
 		bool DrawFree = true;
 
@@ -161,7 +319,7 @@ public:
 
 	// This is a read only info about initially generated graph
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "CPath|Info")
-		TArray<int> OctreeCountAtDepth = { 0, 0, 0, 0 };
+		TArray<int> OctreeCountAtDepth;
 
 	// This is a read only info about initially generated graph
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "CPath|Info")
@@ -181,7 +339,7 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "CPath|Render")
 		void DrawDebugPath(const TArray<FCPathNode>& Path, float Duration, bool DrawPoints = true, FColor Color = FColor::Magenta);
 
-	// Before this is true, the graph is inoperable
+	// Before this is true, the graph is inoperable. With ProgressiveGeneration, it can be searched before, see CanSearch.
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "CPath|Info")
 		bool InitialGenerationFinished = false;
 
@@ -209,9 +367,14 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Benchmark", meta = (EditCondition = "SaveBenchmarkResultToFile==true"))
 		bool SaveBenchmarksWithUnreliableResults = false;
 
-	// Not used for now, async benchmark does not provide reliable results
-	//UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Benchmark")
-	bool IsAsyncBenchmark = false;
+	// Measures throughput and latency of pathfinding threads instead of a single search, by sending bursts of requests
+	// and waiting for each burst to finish. Latency is from FindPathAsync until the result is ready on the game thread.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Benchmark")
+		bool IsAsyncBenchmark = false;
+
+	// Requests sent at once by the async benchmark
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Benchmark", meta = (EditCondition = "IsAsyncBenchmark==true", ClampMin = "1"))
+		int BenchmarkBurstSize = 256;
 
 
 	// Shapes to use when checking if voxel is free or not
@@ -220,18 +383,76 @@ public:
 	// Returns false if graph couldnt start generating
 	bool GenerateGraph();
 
+	// Where BakeOctree saves and GenerateGraph looks for the bake of this volume
+	FString GetBakeFilePath() const;
+
+	// Hash of everything in the volume's settings that changes the generated octree
+	uint64 ComputeSettingsHash() const;
+
+	// Hash of static collision overlapping the volume. Doesn't see changes in RecheckOctreeAtDepth overrides, rebake after those.
+	uint64 ComputeCollisionHash() const;
+
 	// These are called by UE in this order
 	virtual void EndPlay(EEndPlayReason::Type EndPlayReason) override;
 	virtual void BeginDestroy() override;
 	virtual bool IsReadyForFinishDestroy() override;
 	virtual void FinishDestroy() override;
 
+#if WITH_EDITOR
+	// Clamps OctreeDepth to MAX_DEPTH, its property limits are the ones of CPATH_64BIT_TREEID
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
 protected:
 
 	virtual void BeginPlay() override;
 
-	// The Octree data
-	CPathOctree* Octrees = nullptr;
+	// The Octree data. Sparse, so outer trees in uniform regions don't take any memory.
+	CPathOuterGrid Octrees;
+
+	// Storage for all children of Octrees
+	CPathOctreePool OctreePool;
+
+	// Used by RecheckOctreeAtDepth and RecheckBrickIsFree while gathered, released once the initial generation is finished
+	CPathStaticGeometry StaticGeometry;
+
+	// True if the trace shape doesn't touch any static triangle, capsules are tested as their bounding boxes
+	bool IsShapeFreeInStaticGeometry(FVector Location, const FCollisionShape& Shape) const;
+
+	// Sets NodeCount, lookup tables and trace shapes, and prepares empty octree storage
+	void InitGenerationData();
+
+	// Frees everything InitGenerationData and generation created
+	void ReleaseGenerationData();
+
+	// Upper bound of octets in OctreePool for the current NodeCount and OctreeDepth
+	uint64 GetMaxOctetCount() const;
+
+	// ---------- BAKE ----------
+
+	// Writes the current octree to Path. Octree must not be modified while saving.
+	bool SaveBake(const FString& Path, const uint32* CountAtDepth);
+
+	// Replaces the empty octree created by InitGenerationData with the one from the bake, returns false if there is no valid bake.
+	bool LoadBake(const FString& Path);
+
+	// Copies the brick from the bake, returns false if nothing was loaded from a bake. Not thread safe for this brick.
+	bool LoadBrickFromBake(uint32 BrickIndex);
+
+	// Closes the bake file, OctreePool must not point to it anymore
+	void ReleaseBake();
+
+	// Helper for SaveBake, copies the octet and its descendants to Octets depth first and returns its new index
+	uint32 BakeOctetRec(uint32 OctetIndex, TArray<CPathOctree>& Octets) const;
+
+	// Bake is either memory mapped, or read into BakeFileData if mapping isn't supported
+	TUniquePtr<IMappedFileHandle> BakeFileHandle;
+	TUniquePtr<IMappedFileRegion> BakeFileRegion;
+	TArray<uint8> BakeFileData;
+
+	// Sections of the loaded bake, kept for chunks that stream in later
+	const uint32* BakeBrickStates = nullptr;
+	const CPathOctree* BakeBricks = nullptr;
 
 	// This is for find path requests, shouldn't be accessed directly unless you know what you're doing
 	// UPROPERTY() is here so that UE's garabge collector doesn't randomly
@@ -248,69 +469,145 @@ public:
 
 	//----------- TreeID ------------------------------------------------------------------------
 
+	// Returns a child of Tree at ChildIndex. Tree must have children.
+	inline CPathOctree* GetChild(const CPathOctree* Tree, uint32 ChildIndex) const
+	{
+		return OctreePool.Get(Tree->Children) + ChildIndex;
+	}
+
 	// Returns the child with this tree id, or his parent at DepthReached in case the child doesnt exist
-	CPathOctree* FindTreeByID(uint32 TreeID, uint32& DepthReached);
+	CPathOctree* FindTreeByID(CPathTreeID TreeID, uint32& DepthReached);
 
-	inline CPathOctree* FindTreeByID(uint32 TreeID);
+	inline CPathOctree* FindTreeByID(CPathTreeID TreeID);
 
 	// Returns a tree and its TreeID by world location, returns null if location outside of volume. Only for Outer index
-	CPathOctree* FindTreeByWorldLocation(FVector WorldLocation, uint32& TreeID);
+	CPathOctree* FindTreeByWorldLocation(FVector WorldLocation, CPathTreeID& TreeID);
 
 	// Returns a leaf and its TreeID by world location, returns null if location outside of volume. 
-	inline CPathOctree* FindLeafByWorldLocation(FVector WorldLocation, uint32& TreeID, bool MustBeFree = 1);
+	inline CPathOctree* FindLeafByWorldLocation(FVector WorldLocation, CPathTreeID& TreeID, bool MustBeFree = 1);
 
 	// Returns a free leaf and its TreeID by world location, as long as it exists in provided search range and WorldLocation is in this Volume
 	// If SearchRange <= 0, it uses a default dynamic search range
 	// If SearchRange is too large, you might get a free node that is inaccessible from provided WorldLocation
-	CPathOctree* FindClosestFreeLeaf(FVector WorldLocation, uint32& TreeID, float SearchRange = -1);
+	CPathOctree* FindClosestFreeLeaf(FVector WorldLocation, CPathTreeID& TreeID, float SearchRange = -1);
+
+	// Returns true if the agent can move along the segment without leaving free voxels, checked only against the occupancy layer.
+	// False means "don't know", not "blocked", so use a physics sweep after it.
+	bool IsSweepFreeInOccupancy(FVector Start, FVector End) const;
+
+	// Returns true if the agent can move along the segment, asks the occupancy layer first and physics if it doesn't know. Thread safe.
+	bool IsSegmentFree(FVector Start, FVector End) const;
+
+	// Appends outer indexes of every outer tree the agent can touch while moving along the segment. May contain duplicates.
+	void GetOuterTreesAlongSegment(FVector Start, FVector End, std::vector<uint32>& OutOuterIndexes) const;
 
 	// Returns a neighbour of the tree with TreeID in given direction, also returns  TreeID if the neighbour if found
-	CPathOctree* FindNeighbourByID(uint32 TreeID, ENeighbourDirection Direction, uint32& NeighbourID);
+	CPathOctree* FindNeighbourByID(CPathTreeID TreeID, ENeighbourDirection Direction, CPathTreeID& NeighbourID);
 
 	// Returns a list of adjecent leafs as TreeIDs
-	std::vector<uint32> FindNeighbourLeafs(uint32 TreeID, bool MustBeFree = true);
+	std::vector<CPathTreeID> FindNeighbourLeafs(CPathTreeID TreeID, bool MustBeFree = true);
 
 	// Returns a list of adjecent free leafs as CPathAStarNode
+	// Walks the octree, so prefer Graph.GetNeighbours when the node is a free leaf
 	std::vector<CPathAStarNode> FindFreeNeighbourLeafs(CPathAStarNode& Node);
 
 	// Returns a parent of tree with given TreeID or null if TreeID has depth of 0
-	inline CPathOctree* GetParentTree(uint32 TreeId);
+	inline CPathOctree* GetParentTree(CPathTreeID TreeId);
 
 	// Returns world location of a voxel at this TreeID. This returns CENTER of the voxel
-	inline FVector WorldLocationFromTreeID(uint32 TreeID) const;
+	inline FVector WorldLocationFromTreeID(CPathTreeID TreeID) const;
+
+	// Center of a brick of outer trees, see CPathOuterGrid
+	FVector GetBrickWorldLocation(uint32 BrickIndex) const;
 
 	inline FVector LocalCoordsInt3FromOuterIndex(uint32 OuterIndex) const;
 
 	// Creates TreeID for AsyncOverlapByChannel
-	inline uint32 CreateTreeID(uint32 Index, uint32 Depth) const;
+	inline CPathTreeID CreateTreeID(uint32 Index, uint32 Depth) const;
 
 	// Extracts Octrees array index from TreeID
-	inline uint32 ExtractOuterIndex(uint32 TreeID) const;
+	inline uint32 ExtractOuterIndex(CPathTreeID TreeID) const;
 
 	// Replaces Depth in the TreeID with NewDepth
-	inline void ReplaceDepth(uint32& TreeID, uint32 NewDepth);
+	inline void ReplaceDepth(CPathTreeID& TreeID, uint32 NewDepth);
 
 	// Extracts depth from TreeID
-	inline uint32 ExtractDepth(uint32 TreeID) const;
+	inline uint32 ExtractDepth(CPathTreeID TreeID) const;
 
 	// Returns a number from  0 to 7 - a child index at requested Depth
-	inline uint32 ExtractChildIndex(uint32 TreeID, uint32 Depth) const;
+	inline uint32 ExtractChildIndex(CPathTreeID TreeID, uint32 Depth) const;
 
 	// This assumes that child index at Depth is 000, if its not use ReplaceChildIndex
-	inline void AddChildIndex(uint32& TreeID, uint32 Depth, uint32 ChildIndex);
+	inline void AddChildIndex(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex);
 
 	// Replaces child index at given depth
-	inline void ReplaceChildIndex(uint32& TreeID, uint32 Depth, uint32 ChildIndex);
+	inline void ReplaceChildIndex(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex);
 
 	// Replaces child index at given depth and also replaces depth to the same one
-	inline void ReplaceChildIndexAndDepth(uint32& TreeID, uint32 Depth, uint32 ChildIndex);
+	inline void ReplaceChildIndexAndDepth(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex);
 
 	// Traverses the tree downwards and adds every tree to the container
-	void GetAllSubtrees(uint32 TreeID, std::vector<uint32>& Container);
+	void GetAllSubtrees(CPathTreeID TreeID, std::vector<CPathTreeID>& Container);
 
-	// Volume is not safe to access as long as this is not 0, pathfinders should wait till this is 0
+	// Until the initial generation is done, volume is not safe to access as long as this is not 0 and pathfinders wait till it is.
+	// After that regeneration doesn't block searches, see Snapshots.
 	std::atomic_int GeneratorsRunning = 0;
 
+	// Graph and hierarchy, published by generators while searches keep reading the previous ones.
+	// Searches pin one with FCPathSnapshotScope, GetGraph and the functions below then return the pinned one on that thread.
+	CPathSnapshots Snapshots;
+
+	// Adjacency of free leafs used by A*
+	inline const CPathGraph& GetGraph() const
+	{
+		return Snapshots.GetCurrent().Graph;
+	}
+
+	// Portals between outer trees for UseHierarchicalSearch
+	inline const CPathHierarchy& GetHierarchy() const
+	{
+		return Snapshots.GetCurrent().Hierarchy;
+	}
+
+	// Changes every time the graph changes, so paused searches know their leaf indexes are stale
+	inline uint32 GetGraphVersion() const
+	{
+		return Snapshots.GetCurrent().Version;
+	}
+
+	// Outer trees of the graph updates since the last full build, each with the graph version after it, oldest first.
+	// Lets CPathIncrementalPlanner repair its search instead of starting over.
+	inline const std::deque<std::pair<uint32, std::vector<uint32>>>& GetGraphChangeLog() const
+	{
+		return Snapshots.GetCurrent().ChangeLog;
+	}
+	static constexpr size_t GRAPH_CHANGE_LOG_SIZE = 32;
+
+	// True if searches can read the graph. After the initial generation it's always true, regeneration doesn't block them.
+	inline bool CanSearch() const
+	{
+		return InitialGenerationCompleteAtom.load() && (Snapshots.IsEnabled() || GeneratorsRunning.load() == 0);
+	}
+
+	// Called by the generator that built the graph, searches stop waiting for regeneration from now on
+	void EnableSnapshots();
+
+	// Finest depth occupancy bit masks. Masks and octree memory replaced by regeneration are released through Snapshots.
+	CPathOccupancy Occupancy;
+
+	// See PathCacheSize
+	CPathCache PathCache;
+
+	// Outer trees changed by dynamic obstacles, see RecordObstacleDeltas
+	CPathDeltaLog DeltaLog;
+
+	// Residency of chunks, see StreamChunks
+	CPathChunkMap Chunks;
+
+	// Generators started by the current generation that haven't finished refreshing trees yet.
+	// The last one to finish updates the graph snapshots, before it decrements GeneratorsRunning.
+	std::atomic_int GeneratorsPendingGraphUpdate = 0;
+
 	// Wake up call for pathfinding threads waiting for generation to finish
 	FEvent* GenerationFinishedSemaphore = nullptr;
 
@@ -328,53 +625,84 @@ public:
 
 	inline float GetVoxelSizeByDepth(int Depth) const;
 
+	// Memory used by the octree, in bytes
+	uint64 GetOctreeMemoryUsage() const;
+
 	// Draws the voxel, this takes all the drawing options into condition. If Duraiton is below 0, it never disappears. 
 	// If Color = green, free trees are green and occupied are red.
 	// Returns true if drawn, false otherwise
-	bool DrawDebugVoxel(uint32 TreeID, bool DrawIfNotLeaf = true, float Duration = 0, FColor Color = FColor::Green, CPathVoxelDrawData* OutDrawData = nullptr);
+	bool DrawDebugVoxel(CPathTreeID TreeID, bool DrawIfNotLeaf = true, float Duration = 0, FColor Color = FColor::Green, CPathVoxelDrawData* OutDrawData = nullptr);
 	void DrawDebugVoxel(const CPathVoxelDrawData& DrawData, float Duration) const;
 
 protected:
 
 	// Returns an index in the Octree array from world position. NO BOUNDS CHECK
-	inline int WorldLocationToIndex(FVector WorldLocation) const;
+	inline uint32 WorldLocationToIndex(FVector WorldLocation) const;
 
-	// Multiplies local integer coordinates into index
-	inline float LocalCoordsInt3ToIndex(FVector V) const;
+	// Multiplies local integer coordinates into index, in integers so it's exact for every outer index
+	inline uint32 LocalCoordsInt3ToIndex(FVector V) const;
 
 	// Returns the X Y and Z relative to StartPosition and divided by VoxelSize. Multiply them to get the index. NO BOUNDS CHECK
 	inline FVector WorldLocationToLocalCoordsInt3(FVector WorldLocation) const;
 
 	// Returns world location of a tree at depth 0. Extracts only outer index from TreeID
-	inline FVector GetOuterTreeWorldLocation(uint32 TreeID) const;
+	inline FVector GetOuterTreeWorldLocation(CPathTreeID TreeID) const;
 
 	// takes in what `WorldLocationToLocalCoordsInt3` returns and performs a bounds check
 	inline bool IsInBounds(FVector LocalCoordsInt3) const;
 
 	// Helper function for 'FindLeafByWorldLocation'. Relative location is location relative to the middle of CurrentTree
-	CPathOctree* FindLeafRecursive(FVector RelativeLocation, uint32& TreeID, uint32 CurrentDepth, CPathOctree* CurrentTree);
+	CPathOctree* FindLeafRecursive(FVector RelativeLocation, CPathTreeID& TreeID, uint32 CurrentDepth, CPathOctree* CurrentTree);
 
 	// Returns IDs of all free leafs on chosen side of a tree. Sides are indexed in the same way as neighbours, and adds them to passed Vector.
 	// ASSUMES THAT PASSED TREE HAS CHILDREN
-	void FindLeafsOnSide(uint32 TreeID, ENeighbourDirection Side, std::vector<uint32>* Vector, bool MustBeFree = true);
+	void FindLeafsOnSide(CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathTreeID>* Vector, bool MustBeFree = true);
 
 	// Same as above, but skips the part of getting a tree by TreeID so its faster
-	void FindLeafsOnSide(CPathOctree* Tree, uint32 TreeID, ENeighbourDirection Side, std::vector<uint32>* Vector, bool MustBeFree = true);
+	void FindLeafsOnSide(CPathOctree* Tree, CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathTreeID>* Vector, bool MustBeFree = true);
 
 	// Same as above, but wrapped in CPathAStarNode
-	void FindLeafsOnSide(CPathOctree* Tree, uint32 TreeID, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector, bool MustBeFree = true);
+	void FindLeafsOnSide(CPathOctree* Tree, CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector, bool MustBeFree = true);
+
+	// Occupancy test used by FindLeafsOnSide to skip subtrees with nothing free on that side. True if occupancy is disabled.
+	inline bool MayHaveFreeLeafsOnSide(CPathTreeID TreeID, ENeighbourDirection Side) const;
 
 	// Internal function used in GetAllSubtrees
-	void GetAllSubtreesRec(uint32 TreeID, CPathOctree* Tree, std::vector<uint32>& Container, uint32 Depth);
+	void GetAllSubtreesRec(CPathTreeID TreeID, CPathOctree* Tree, std::vector<CPathTreeID>& Container, uint32 Depth);
 
 
 	// -------- GENERATION -----
 	FTimerHandle GenerationTimerHandle;
 
-	std::list<std::unique_ptr<FCPathAsyncVolumeGenerator>> GeneratorThreads;
+	// One per generation thread, created with the first generation and kept until EndPlay
+	std::vector<std::unique_ptr<FCPathAsyncVolumeGenerator>> Generators;
+
+	void CreateGenerators();
 
-	// Garbage collection
-	void CleanFinishedGenerators();
+	// Starts the first ThreadCount generators on WorkCount items, they take chunks of them from NextGenerationItem.
+	// SetWork sets the generator's flags, every generator starts from ResetWork. No generator may be running.
+	void StartGenerators(uint32 WorkCount, uint32 ThreadCount, TFunctionRef<void(FCPathAsyncVolumeGenerator& Generator)> SetWork);
+
+	// Shared work counter of the running generation round
+	std::atomic<uint32> NextGenerationItem = 0;
+
+	// All bricks sorted by SortByBrickMortonCode, items of the initial generation.
+	// Nearby bricks tend to cost the same, so this keeps each chunk compact while neighbouring chunks go to different generators.
+	std::vector<uint32> BrickOrder;
+
+	void SortByBrickMortonCode(std::vector<uint32>& Bricks) const;
+
+	// Closest bricks to PointsOfInterest first
+	void SortByDistanceToPointsOfInterest(std::vector<uint32>& Bricks) const;
+
+	// Bricks of BrickOrder before this one were generated, the progressive generation is done once it reaches the end
+	uint32 NextProgressiveBrick = 0;
+
+	// Generates the next ProgressiveBricksPerWave bricks of BrickOrder like chunks that streamed in
+	void StartNextProgressiveWave();
+
+	// Same for outer trees, by the code of their brick
+	void SortOuterIndexesByBrickMortonCode(std::vector<uint32>& OuterIndexes) const;
 
 	// Checking if initial generation has finished
 	void InitialGenerationUpdate();
@@ -382,20 +710,59 @@ protected:
 	// Checking if there are any trees to regenerate from dynamic obstacles
 	void GenerationUpdate();
 
-	std::set<int32> TreesToRegenerate;
+	std::set<uint32> TreesToRegenerate;
 
-	// This is so that when an actor moves, the previous space it was in needs to be regenerated as well
-	std::set<int32> TreesToRegeneratePreviousUpdate;
+	// TreesToRegenerate as an array, generators of obstacles and deltas take contiguous ranges of it
+	std::vector<uint32> TreesToRegenerateList;
 
-	// This is set in GenerateGraph() using a formula that estimates total voxel count
-	int OuterIndexesPerThread;
+	// World boxes dynamic obstacles moved out of or into since the last update, filled by UCPathDynamicObstacle
+	std::vector<FBox> ObstacleRegions;
+
+	// Parts of trees in TreesToRegenerate that obstacles changed, grown by the agent's size. Trees without an entry are regenerated whole.
+	std::unordered_map<uint32, std::vector<FBox>> RegionsToRegenerate;
+
+	// Moves ObstacleRegions to TreesToRegenerate and RegionsToRegenerate
+	void AddObstacleRegionsToRegenerate();
+
+	// Set by LoadObstacleDeltas, deltas are applied by a generator once no other generator runs
+	bool DeltasPendingApply = false;
+
+	void StartApplyingDeltas();
+
+	// -------- STREAMING -----
+
+	// Chunks whose residency changed since they were last refreshed
+	std::set<uint32> ChunksPendingRefresh;
+
+	// Bricks refreshed by the running chunk generators
+	std::vector<uint32> ChunkBricksToRefresh;
 
-	bool ThreadIDs[64];
+	// Bounds of streamed levels that hold references to chunks
+	TMap<const ULevel*, FBox> StreamedLevelBounds;
 
-	inline uint32 GetFreeThreadID() const;
+	FDelegateHandle LevelAddedHandle;
+	FDelegateHandle LevelRemovedHandle;
+
+	void OnLevelAddedToWorld(ULevel* Level, UWorld* World);
+	void OnLevelRemovedFromWorld(ULevel* Level, UWorld* World);
+
+	// Adds or releases references to chunks overlapping the box
+	void ChangeChunkRefsInBox(const FBox& WorldBox, bool Add);
+
+	// Regenerates bricks of ChunksPendingRefresh, unloads them if they are no longer resident
+	void StartRefreshingChunks();
+
+	// Regenerates or unloads ChunkBricksToRefresh and updates the graph for their trees
+	void StartRefreshingBricks();
+
+	// This is set in GenerateGraph() using a formula that estimates total voxel count
+	int OuterIndexesPerThread;
 
 	void PerformRandomBenchmark(uint32 UserData = 0, float TimeLimit = 0.2);
 
+	// Called by PerformRandomBenchmark if IsAsyncBenchmark is set
+	void PerformAsyncBenchmark(uint32 UserData, float TimeLimit);
+
 	// ----- Lookup tables-------
 	static const FVector LookupTable_ChildPositionOffsetMaskByIndex[8];
 	static const FVector LookupTable_NeighbourOffsetByDirection[6];
@@ -18,6 +18,8 @@ public:
 
 	virtual bool RecheckOctreeAtDepth(CPathOctree* OctreeRef, FVector TreeLocation, uint32 Depth);
 
+	virtual bool RecheckBrickIsFree(FVector BrickLocation, FVector BrickExtent) override;
+
 	inline bool ExtractIsGroundFromData(uint32 TreeUserData)
 	{
 		return TreeUserData & 0x00000002;
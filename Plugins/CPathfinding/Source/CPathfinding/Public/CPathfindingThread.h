@@ -8,6 +8,7 @@
 #include "Containers/Queue.h"
 #include "CPathNode.h"
 #include <atomic>
+#include <vector>
 #include "HAL/Event.h"
 
 
@@ -42,8 +43,30 @@ public:
 	// Includes the one that it's currently working on.
 	int GetTaskCount();
 
+	// Requests that didn't start yet, other threads can steal these
+	inline int GetPendingCount() const
+	{
+		return PendingCount.load();
+	}
+
+	// Requests this thread took from others
+	inline int GetStolenCount() const
+	{
+		return StolenCount.load();
+	}
+
+	// Wakes the thread only if it's waiting for work, so requests assigned while it's busy don't trigger the event each
 	void AssignTask(FCPathRequest& FindPathRequest);
 
+	// Enqueues requests with a single wake up, they are moved from the array
+	void AssignTasks(FCPathRequest* Requests, int Count);
+
+	// Returns true if the thread was waiting for work
+	bool WakeUpIfSleeping();
+
+	// Called by other threads, hands over the pending request this thread would start next. Bidirectional halves are never given away.
+	bool GiveRequest(FCPathRequest& OutRequest);
+
 	void PrintThreadMessage(FString Message);
 	
 	int ThreadIndex;
@@ -51,8 +74,6 @@ public:
 	// -----------------------------------------------------------------
 
 private:
-	TQueue<FCPathRequest, EQueueMode::Spsc> InputQueue;
-
 	std::atomic_bool KillRequested = false;
 	std::atomic_bool IsDoingWork = false;
 	std::atomic_int CurrentTaskCount = 0;
@@ -61,7 +82,50 @@ private:
 	
 	class ACPathCore* CoreRef = nullptr;
 	FRunnableThread* Thread = nullptr;
-	class CPathAStar* AStar = nullptr;
+
+	// Requests that didn't start yet, a heap ordered by IsServedAfter. Guarded by Mutex, as other threads steal from it.
+	struct FPendingRequest
+	{
+		FCPathRequest Request;
+
+		// Requests with the same priority and deadline start in the order they came
+		uint64 Order = 0;
+	};
+	std::vector<FPendingRequest> Pending;
+	uint64 NextPendingOrder = 0;
+	std::atomic_int PendingCount = 0;
+	std::atomic_int StolenCount = 0;
+
+	// Set while waiting on Semaphore
+	std::atomic_bool bSleeping = false;
+
+	// Heap order of Pending, higher priority first, then earlier deadline
+	static bool IsServedAfter(const FPendingRequest& A, const FPendingRequest& B);
+
+	// Adds to Pending, Mutex must be locked
+	void PushPending(FCPathRequest&& Request);
+
+	// Takes the next pending request if its priority is at least MinPriority
+	bool TakeRequest(FCPathRequest& OutRequest, int32 MinPriority);
+
+	// Searches paused after their slice ran out, see ACPathVolume::AsyncSearchSliceTime.
+	// They take turns with each other and with new requests, each one has its own CPathAStar.
+	struct FActiveSearch
+	{
+		FCPathRequest Request;
+		class CPathAStar* AStar = nullptr;
+		FCPathResult* Result = nullptr;
+	};
+	static constexpr int MAX_ACTIVE_SEARCHES = 8;
+	std::vector<FActiveSearch> ActiveSearches;
+	size_t NextActiveSearch = 0;
+
+	// All CPathAStar instances of this thread and the ones not used by any active search
+	std::vector<class CPathAStar*> AStarPool;
+	std::vector<class CPathAStar*> FreeAStars;
+
+	// The one inside of a slice right now, so Stop can interrupt it
+	std::atomic<class CPathAStar*> RunningAStar = nullptr;
 
 	FCriticalSection Mutex;
 	FEvent* Semaphore = nullptr;
@@ -70,6 +134,39 @@ private:
 
 	void SubmitResult(FCPathResult* Result, PathResultDelegate Delegate);
 
+	// Result is already in the batch, the last request of the batch submits it as a whole
+	void SubmitBatchResult(FCPathRequest& Request);
+
+	// Hands the finished batch to the game thread as one output
+	void SubmitBatch(const std::shared_ptr<FCPathBatch>& Batch);
+
+	// Copies the result of the request to the ones sharing its search. Those whose locations don't connect to the path are searched on their own.
+	void ShareBatchResult(FCPathRequest& Request);
+
+	// Wraps the delegate so it does nothing if the request is cancelled before the game thread runs it
+	static PathResultDelegate GuardCancelled(const FCPathRequest& Request, const PathResultDelegate& Delegate);
+
+	// Doesn't finish the task, the full result is submitted later
+	void SubmitCoarseResult(const TArray<FCPathNode>& CoarsePath, PathResultDelegate Delegate);
+
+	// Makes sure the other half of a bidirectional search doesn't wait for this one, then drops the shared state
+	void EndBidirectionalHalf(FCPathRequest& Request);
+
+	// Runs one slice of the search, the first one also starts it. Returns true if the search is over and can be removed.
+	bool RunSlice(FActiveSearch& Search, bool bFirstSlice);
+
+	// Ends the search without a result, like requests for volumes that became invalid. Batches and flow fields still get a failed one.
+	void DropSearch(FActiveSearch& Search);
+
+	// Submits the final result of the search
+	void FinishSearch(FActiveSearch& Search);
+
+	// The search to run a slice of, the next one in turn among those with the highest priority
+	size_t PickActiveSearch();
+
+	// Returns the AStar of a finished search to FreeAStars and removes it
+	void RemoveActiveSearch(size_t Index);
+
 	// Returns false if volume is not valid before/after waiting
 	bool WaitForVolume(class ACPathVolume* Volume);
 